@@ -31,7 +31,7 @@ wait_until_server_ready(){
 client_start(){
   echo "[starting the clien with numbe of images-> $NUMBER_OF_IMAGES ]"
 
-	  ../../serving_1.4/serving/bazel-bin/tensorflow_serving/example/inception_client --number_of_images=$NUMBER_OF_IMAGES --server=localhost:9000 --inter_arrival=0.0 >> $CLIENT_FILE 
+	  bazel-bin/tensorflow_serving/example/load_generator --server_port=localhost:9000 --image_file=$IMAGE_FILE --num_requests=$NUMBER_OF_IMAGES --arrival=trace --trace_file=$ARRIVAL_TRACE >> $CLIENT_FILE
 	echo "[Test Finished- BS->$batch_size, BT->$batch_threads, INTER_OP->$inter_op, INTRA_OP->$intra_op "	
 #echo "Client is running"
 }
@@ -92,6 +92,13 @@ done
 
 }
 
+usage(){
+	echo "Usage: $0 {inter|intra|bt} IMAGE_FILE"
+	echo "  IMAGE_FILE: the image the load generator sends in every request"
+	echo "  (ARRIVAL_TRACE may name the inter-arrival trace; default interarrival_time_generated.txt)"
+	exit 1
+}
+
 HOME=$(pwd)
 TIME=$(date +'%d-%m-%y-%H-%M')
 #$MAIN_FOLDER='Test'$TIME
@@ -99,6 +106,15 @@ inter_op=1
 intra_op=1
 batch_threads=1
 NUMBER_OF_IMAGES=0
+IMAGE_FILE="$2"
+if [ -z "$IMAGE_FILE" ]; then
+     usage
+fi
+if [ ! -f "$IMAGE_FILE" ]; then
+     echo "Image file $IMAGE_FILE does not exist"
+     usage
+fi
+ARRIVAL_TRACE=${ARRIVAL_TRACE:-interarrival_time_generated.txt}
 TEST_FOLDER="$1"
 a="inter"
 echo $TIME
@@ -115,7 +131,7 @@ elif [ "$TEST_FOLDER" == "bt" ]; then
 #elif [$# -eq 0]; then
  #    TEST_FOLDER='test_bs_'
 else
-     echo "Argunments are not correct"
+     usage
 fi
 
 
@@ -21,6 +21,7 @@ limitations under the License.
 #include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "tensorflow/contrib/batching/shared_batch_scheduler.h"
 
@@ -176,6 +177,15 @@ class BasicBatchScheduler : public BatchScheduler<TaskType> {
     // parameter.
     int max_enqueued_batches = 999999;
 
+    // If true, tasks that don't fit in the open batch are split across it and
+    // new batches, using 'split_input_task_func'. See the same-named fields of
+    // SharedBatchScheduler::QueueOptions.
+    bool enable_large_batch_splitting = false;
+    std::function<Status(std::unique_ptr<TaskType>* input_task,
+                         int open_batch_remaining_slot, int max_batch_size,
+                         std::vector<std::unique_ptr<TaskType>>* output_tasks)>
+        split_input_task_func;
+
     // The following options are typically only overridden by test code.
 
     // The environment to use.
@@ -231,6 +241,10 @@ Status BasicBatchScheduler<TaskType>::Create(
       options.batch_timeout_micros;
   shared_scheduler_queue_options.max_enqueued_batches =
       options.max_enqueued_batches;
+  shared_scheduler_queue_options.enable_large_batch_splitting =
+      options.enable_large_batch_splitting;
+  shared_scheduler_queue_options.split_input_task_func =
+      options.split_input_task_func;
   std::unique_ptr<BatchScheduler<TaskType>> shared_scheduler_queue;
   TF_RETURN_IF_ERROR(shared_scheduler->AddQueue(shared_scheduler_queue_options,
                                                 process_batch_callback,
@@ -44,6 +44,9 @@ limitations under the License.
 namespace tensorflow {
 namespace serving {
 
+// The deadline of a task that has none. (See BatchTask::deadline_micros().)
+constexpr uint64 kNoDeadlineMicros = ~uint64{0};
+
 // The abstract superclass for a unit of work to be done as part of a batch.
 //
 // An implementing subclass typically contains (or points to):
@@ -62,6 +65,15 @@ class BatchTask {
   // Returns the size of the task, in terms of how much it contributes to the
   // size of a batch. (A batch's size is the sum of its task sizes.)
   virtual size_t size() const = 0;
+
+  // Returns the time, in microseconds of the scheduler's Env::NowMicros(),
+  // after which the task's outcome is no longer of use. Schedulers may reject
+  // or set apart tasks whose deadline has passed instead of batching them.
+  virtual uint64 deadline_micros() const { return kNoDeadlineMicros; }
+
+  // Returns the priority class of the task. When tasks are backed up,
+  // schedulers may form batches from tasks of higher priority first.
+  virtual int priority() const { return 0; }
 };
 
 // A thread-safe collection of BatchTasks, to be executed together in some
@@ -78,7 +90,9 @@ template <typename TaskType>
 class Batch {
  public:
   Batch() = default;
-  virtual ~Batch();  // Blocks until the batch is closed.
+  // Blocks until the batch is closed, then runs the callback set by
+  // SetDestructionCallback(), if any.
+  virtual ~Batch();
 
   // Appends 'task' to the batch. After calling AddTask(), the newly-added task
   // can be accessed via task(num_tasks()-1) or mutable_task(num_tasks()-1).
@@ -110,9 +124,20 @@ class Batch {
   // Blocks until the batch is closed.
   void WaitUntilClosed() const;
 
+  // Blocks until the batch holds more than 'num_tasks' tasks or is closed, and
+  // returns the number of tasks it holds. Lets a consumer of an open batch
+  // process tasks as they are added.
+  int WaitForMoreTasks(int num_tasks) const;
+
   // Marks the batch as closed. Dies if called more than once.
   void Close();
 
+  // Sets 'callback' to run when the batch is destroyed, i.e. once whoever
+  // processes the batch is done with it. Lets a scheduler that hands the batch
+  // to a callback, which may pass it on to later stages, learn when processing
+  // has finished. Must not be called concurrently with the destructor.
+  void SetDestructionCallback(std::function<void()> callback);
+
  private:
   mutable mutex mu_;
 
@@ -125,6 +150,12 @@ class Batch {
   // Whether the batch has been closed.
   Notification closed_;
 
+  // Signaled when a task is added or the batch is closed.
+  mutable condition_variable tasks_changed_cv_;
+
+  // Run by the destructor, if set.
+  std::function<void()> destruction_callback_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(Batch);
 };
 
@@ -190,6 +221,9 @@ class BatchScheduler {
 template <typename TaskType>
 Batch<TaskType>::~Batch() {
   WaitUntilClosed();
+  if (destruction_callback_) {
+    destruction_callback_();
+  }
 }
 
 template <typename TaskType>
@@ -200,6 +234,7 @@ void Batch<TaskType>::AddTask(std::unique_ptr<TaskType> task) {
     size_ += task->size();
     tasks_.push_back(std::move(task));
   }
+  tasks_changed_cv_.notify_all();
 }
 
 template <typename TaskType>
@@ -210,6 +245,7 @@ std::unique_ptr<TaskType> Batch<TaskType>::RemoveTask() {
       return nullptr;
     }
     std::unique_ptr<TaskType> task = std::move(tasks_.back());
+    size_ -= task->size();
     tasks_.pop_back();
     return task;
   }
@@ -269,9 +305,29 @@ void Batch<TaskType>::WaitUntilClosed() const {
   const_cast<Notification*>(&closed_)->WaitForNotification();
 }
 
+template <typename TaskType>
+int Batch<TaskType>::WaitForMoreTasks(int num_tasks) const {
+  mutex_lock l(mu_);
+  while (tasks_.size() <= num_tasks &&
+         !const_cast<Notification*>(&closed_)->HasBeenNotified()) {
+    tasks_changed_cv_.wait(l);
+  }
+  return tasks_.size();
+}
+
 template <typename TaskType>
 void Batch<TaskType>::Close() {
-  closed_.Notify();
+  {
+    // Notify under 'mu_' so WaitForMoreTasks() can't miss the closing.
+    mutex_lock l(mu_);
+    closed_.Notify();
+  }
+  tasks_changed_cv_.notify_all();
+}
+
+template <typename TaskType>
+void Batch<TaskType>::SetDestructionCallback(std::function<void()> callback) {
+  destruction_callback_ = std::move(callback);
 }
 
 }  // namespace serving
@@ -76,6 +76,7 @@ TEST(BatchTest, Basic) {
   EXPECT_EQ(7, batch.RemoveTask()->size());
   EXPECT_EQ(3, batch.RemoveTask()->size());
   EXPECT_TRUE(batch.empty());
+  EXPECT_EQ(0, batch.size());
 }
 
 TEST(BatchTest, WaitUntilClosed) {
@@ -92,6 +93,26 @@ TEST(BatchTest, WaitUntilClosed) {
   EXPECT_TRUE(batch.IsClosed());
 }
 
+TEST(BatchTest, WaitForMoreTasks) {
+  Batch<FakeTask> batch;
+  batch.AddTask(std::unique_ptr<FakeTask>(new FakeTask(3)));
+  EXPECT_EQ(1, batch.WaitForMoreTasks(0));
+
+  Notification add_task;
+  std::unique_ptr<Thread> add_thread(Env::Default()->StartThread(
+      ThreadOptions(), "test", [&batch, &add_task]() {
+        add_task.WaitForNotification();
+        batch.AddTask(std::unique_ptr<FakeTask>(new FakeTask(5)));
+        Env::Default()->SleepForMicroseconds(100);
+        batch.Close();
+      }));
+  add_task.Notify();
+  EXPECT_EQ(2, batch.WaitForMoreTasks(1));
+  // Once the batch closes, no more tasks can arrive.
+  EXPECT_EQ(2, batch.WaitForMoreTasks(2));
+  EXPECT_TRUE(batch.IsClosed());
+}
+
 TEST(BatchTest, DeletionBlocksUntilClosed) {
   Batch<FakeTask>* batch = new Batch<FakeTask>;
   batch->AddTask(std::unique_ptr<FakeTask>(new FakeTask(3)));
@@ -111,6 +132,18 @@ TEST(BatchTest, DeletionBlocksUntilClosed) {
   deleted.WaitForNotification();
 }
 
+TEST(BatchTest, DestructionCallback) {
+  bool callback_called = false;
+  {
+    Batch<FakeTask> batch;
+    batch.SetDestructionCallback(
+        [&callback_called]() { callback_called = true; });
+    batch.Close();
+    EXPECT_FALSE(callback_called);
+  }
+  EXPECT_TRUE(callback_called);
+}
+
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
@@ -0,0 +1,288 @@
+/* Copyright 2016 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+
+#include "tensorflow/contrib/batching/batching_auto_tuner.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+// Returns 'value' grown by one multiplicative step (and by at least one),
+// capped at 'upper'.
+int64 Grow(int64 value, double step, int64 upper) {
+  const int64 grown = std::max<int64>(value + 1, std::llround(value * step));
+  return std::min(grown, upper);
+}
+
+// Returns 'value' shrunk by one multiplicative step (and by at least one),
+// floored at 'lower'.
+int64 Shrink(int64 value, double step, int64 lower) {
+  const int64 shrunk = std::min<int64>(value - 1, std::llround(value / step));
+  return std::max(shrunk, lower);
+}
+
+int64 Clamp(int64 value, int64 lower, int64 upper) {
+  return std::max(lower, std::min(value, upper));
+}
+
+// Returns the value at quantile 'q' of 'samples', which is reordered.
+int64 Percentile(double q, std::vector<int64>* samples) {
+  if (samples->empty()) return 0;
+  const size_t index = std::min(
+      samples->size() - 1, static_cast<size_t>(q * samples->size()));
+  std::nth_element(samples->begin(), samples->begin() + index, samples->end());
+  return (*samples)[index];
+}
+
+}  // namespace
+
+LatencyTargetTuningPolicy::LatencyTargetTuningPolicy(const Options& options)
+    : options_(options) {}
+
+BatchingKnobs LatencyTargetTuningPolicy::Adjust(
+    const BatchingObservations& observations, const BatchingKnobs& current) {
+  BatchingKnobs next = current;
+  if (observations.num_tasks > 0 && observations.num_batches > 0) {
+    const double target = options_.target_latency_micros;
+    // Estimated fraction of the batch threads' time spent processing batches.
+    const double utilization =
+        observations.num_batches * observations.mean_batch_compute_micros /
+        (std::max<int64>(current.num_batch_threads, 1) *
+         static_cast<double>(std::max<int64>(observations.interval_micros, 1)));
+
+    if (observations.p99_latency_micros > target) {
+      if (observations.mean_queue_micros >
+          observations.mean_batch_compute_micros) {
+        if (utilization >= options_.saturation_utilization) {
+          // Tasks queue up behind busy threads: add capacity.
+          if (current.num_batch_threads < options_.max_num_batch_threads) {
+            next.num_batch_threads = current.num_batch_threads + 1;
+          } else {
+            next.max_batch_size = Grow(current.max_batch_size, options_.step,
+                                       options_.max_max_batch_size);
+          }
+        } else {
+          // Tasks wait for batches to fill up: stop waiting as long. The
+          // timeout alone must leave room for processing within the target.
+          const int64 budget = std::llround(
+              target - observations.mean_batch_compute_micros);
+          next.batch_timeout_micros = std::min(
+              Shrink(current.batch_timeout_micros, options_.step,
+                     options_.min_batch_timeout_micros),
+              std::max(budget, options_.min_batch_timeout_micros));
+        }
+      } else {
+        // Processing dominates: use smaller batches.
+        next.max_batch_size = Shrink(current.max_batch_size, options_.step,
+                                     options_.min_max_batch_size);
+      }
+    } else if (observations.p99_latency_micros < options_.headroom * target) {
+      // Batch size is the binding constraint; allow larger batches for
+      // throughput.
+      const bool batches_full =
+          observations.mean_batch_size >= 0.9 * current.max_batch_size;
+      if (batches_full) {
+        next.max_batch_size = Grow(current.max_batch_size, options_.step,
+                                   options_.max_max_batch_size);
+      }
+    }
+  }
+
+  next.max_batch_size =
+      Clamp(next.max_batch_size, options_.min_max_batch_size,
+            options_.max_max_batch_size);
+  next.batch_timeout_micros =
+      Clamp(next.batch_timeout_micros, options_.min_batch_timeout_micros,
+            options_.max_batch_timeout_micros);
+  next.num_batch_threads =
+      Clamp(next.num_batch_threads, options_.min_num_batch_threads,
+            options_.max_num_batch_threads);
+  return next;
+}
+
+Status BatchingAutoTuner::Create(const Options& options,
+                                 const BatchingKnobs& initial_knobs,
+                                 std::unique_ptr<BatchingTuningPolicy> policy,
+                                 ApplyFn apply_fn,
+                                 std::unique_ptr<BatchingAutoTuner>* tuner) {
+  if (options.tuning_interval_micros < 0) {
+    return errors::InvalidArgument(
+        "tuning_interval_micros must be non-negative; was ",
+        options.tuning_interval_micros);
+  }
+  if (options.max_samples_per_interval <= 0) {
+    return errors::InvalidArgument(
+        "max_samples_per_interval must be positive; was ",
+        options.max_samples_per_interval);
+  }
+  if (initial_knobs.max_batch_size <= 0 ||
+      initial_knobs.batch_timeout_micros < 0 ||
+      initial_knobs.num_batch_threads <= 0) {
+    return errors::InvalidArgument(
+        "Invalid initial batching parameters: max_batch_size=",
+        initial_knobs.max_batch_size,
+        " batch_timeout_micros=", initial_knobs.batch_timeout_micros,
+        " num_batch_threads=", initial_knobs.num_batch_threads);
+  }
+  if (policy == nullptr) {
+    return errors::InvalidArgument("policy must be set");
+  }
+  if (apply_fn == nullptr) {
+    return errors::InvalidArgument("apply_fn must be set");
+  }
+  tuner->reset(new BatchingAutoTuner(options, initial_knobs, std::move(policy),
+                                     std::move(apply_fn)));
+  return Status::OK();
+}
+
+BatchingAutoTuner::BatchingAutoTuner(
+    const Options& options, const BatchingKnobs& initial_knobs,
+    std::unique_ptr<BatchingTuningPolicy> policy, ApplyFn apply_fn)
+    : options_(options),
+      apply_fn_(std::move(apply_fn)),
+      policy_(std::move(policy)),
+      knobs_(initial_knobs),
+      interval_start_micros_(options.env->NowMicros()) {
+  if (options_.tuning_interval_micros > 0) {
+    PeriodicFunction::Options periodic_fn_options;
+    periodic_fn_options.thread_name_prefix = "batching_auto_tuner";
+    periodic_fn_options.env = options_.env;
+    periodic_fn_options.startup_delay_micros = options_.tuning_interval_micros;
+    tuning_thread_.reset(new PeriodicFunction([this] { Tune(); },
+                                              options_.tuning_interval_micros,
+                                              periodic_fn_options));
+  }
+}
+
+BatchingAutoTuner::~BatchingAutoTuner() {
+  // Stop tuning before the state it reads goes away.
+  tuning_thread_.reset();
+}
+
+void BatchingAutoTuner::RecordTask(int64 queue_micros, int64 compute_micros) {
+  const int64 latency_micros = queue_micros + compute_micros;
+  mutex_lock l(mu_);
+  ++num_tasks_;
+  sum_queue_micros_ += queue_micros;
+  // Reservoir sampling keeps a uniform sample of the interval's latencies.
+  if (latency_samples_.size() < options_.max_samples_per_interval) {
+    latency_samples_.push_back(latency_micros);
+  } else {
+    sample_rng_state_ ^= sample_rng_state_ << 13;
+    sample_rng_state_ ^= sample_rng_state_ >> 7;
+    sample_rng_state_ ^= sample_rng_state_ << 17;
+    const uint64 slot = sample_rng_state_ % num_tasks_;
+    if (slot < latency_samples_.size()) {
+      latency_samples_[slot] = latency_micros;
+    }
+  }
+}
+
+void BatchingAutoTuner::RecordBatch(int64 batch_size, int64 compute_micros) {
+  mutex_lock l(mu_);
+  ++num_batches_;
+  sum_batch_size_ += batch_size;
+  sum_batch_compute_micros_ += compute_micros;
+}
+
+void BatchingAutoTuner::Tune() {
+  mutex_lock tune_lock(tune_mu_);
+  if (options_.read_fn != nullptr) {
+    BatchingKnobs in_effect;
+    const Status read_status = options_.read_fn(&in_effect);
+    if (read_status.ok()) {
+      mutex_lock l(mu_);
+      knobs_ = in_effect;
+    } else {
+      LOG(WARNING) << "Failed to read the batching parameters in effect: "
+                   << read_status;
+    }
+  }
+  BatchingObservations observations;
+  BatchingKnobs current;
+  {
+    mutex_lock l(mu_);
+    if (num_tasks_ == 0 || num_tasks_ < options_.min_tasks_per_interval) {
+      return;
+    }
+    const uint64 now_micros = options_.env->NowMicros();
+    observations.interval_micros =
+        std::max<int64>(now_micros - interval_start_micros_, 1);
+    observations.num_tasks = num_tasks_;
+    observations.num_batches = num_batches_;
+    observations.tasks_per_second =
+        num_tasks_ * 1e6 / observations.interval_micros;
+    observations.p50_latency_micros = Percentile(0.5, &latency_samples_);
+    observations.p99_latency_micros = Percentile(0.99, &latency_samples_);
+    observations.mean_queue_micros =
+        static_cast<double>(sum_queue_micros_) / num_tasks_;
+    if (num_batches_ > 0) {
+      observations.mean_batch_compute_micros =
+          static_cast<double>(sum_batch_compute_micros_) / num_batches_;
+      observations.mean_batch_size =
+          static_cast<double>(sum_batch_size_) / num_batches_;
+    }
+
+    interval_start_micros_ = now_micros;
+    num_tasks_ = 0;
+    num_batches_ = 0;
+    sum_queue_micros_ = 0;
+    sum_batch_compute_micros_ = 0;
+    sum_batch_size_ = 0;
+    latency_samples_.clear();
+    last_observations_ = observations;
+    current = knobs_;
+  }
+
+  const BatchingKnobs next = policy_->Adjust(observations, current);
+  if (next == current) {
+    return;
+  }
+  const Status status = apply_fn_(next);
+  if (!status.ok()) {
+    LOG(WARNING) << "Failed to apply tuned batching parameters: " << status;
+    return;
+  }
+  VLOG(1) << "Batching auto-tuner (p99=" << observations.p99_latency_micros
+          << "us, " << observations.tasks_per_second << " tasks/s): "
+          << "max_batch_size " << current.max_batch_size << " -> "
+          << next.max_batch_size << ", batch_timeout_micros "
+          << current.batch_timeout_micros << " -> "
+          << next.batch_timeout_micros << ", num_batch_threads "
+          << current.num_batch_threads << " -> " << next.num_batch_threads;
+  mutex_lock l(mu_);
+  knobs_ = next;
+}
+
+BatchingKnobs BatchingAutoTuner::knobs() const {
+  mutex_lock l(mu_);
+  return knobs_;
+}
+
+BatchingObservations BatchingAutoTuner::last_observations() const {
+  mutex_lock l(mu_);
+  return last_observations_;
+}
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,265 @@
+/* Copyright 2016 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+
+#ifndef THIRD_PARTY_TENSORFLOW_CONTRIB_BATCHING_BATCHING_AUTO_TUNER_H_
+#define THIRD_PARTY_TENSORFLOW_CONTRIB_BATCHING_BATCHING_AUTO_TUNER_H_
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "tensorflow/contrib/batching/util/periodic_function.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// The batching parameters a tuner controls.
+struct BatchingKnobs {
+  int64 max_batch_size = 0;
+  int64 batch_timeout_micros = 0;
+  int64 num_batch_threads = 0;
+
+  bool operator==(const BatchingKnobs& other) const {
+    return max_batch_size == other.max_batch_size &&
+           batch_timeout_micros == other.batch_timeout_micros &&
+           num_batch_threads == other.num_batch_threads;
+  }
+  bool operator!=(const BatchingKnobs& other) const {
+    return !(*this == other);
+  }
+};
+
+// What the batching layer observed during one tuning interval.
+struct BatchingObservations {
+  // Length of the interval.
+  int64 interval_micros = 0;
+  // Number of tasks and batches that finished processing in the interval.
+  int64 num_tasks = 0;
+  int64 num_batches = 0;
+  // Tasks per second that finished processing in the interval; equal to the
+  // arrival rate in steady state.
+  double tasks_per_second = 0;
+  // Latency of a task from enqueueing to the end of its batch's processing.
+  // Percentiles are computed over a sample of at most
+  // BatchingAutoTuner::Options::max_samples_per_interval tasks.
+  int64 p50_latency_micros = 0;
+  int64 p99_latency_micros = 0;
+  // Mean time tasks spent waiting for their batch to be scheduled.
+  double mean_queue_micros = 0;
+  // Mean processing time of a batch, and mean batch size.
+  double mean_batch_compute_micros = 0;
+  double mean_batch_size = 0;
+};
+
+// Decides how to change the batching parameters given what happened during the
+// last tuning interval. Implementations need not be thread-safe: the tuner
+// calls Adjust() from one thread at a time.
+class BatchingTuningPolicy {
+ public:
+  virtual ~BatchingTuningPolicy() = default;
+
+  // Returns the parameters to use for the next interval. Returning 'current'
+  // leaves them unchanged.
+  virtual BatchingKnobs Adjust(const BatchingObservations& observations,
+                               const BatchingKnobs& current) = 0;
+};
+
+// A policy that keeps the tail latency of tasks below a target while batching
+// as much as that target allows.
+//
+// When p99 latency is above the target it first removes whatever dominates the
+// latency: if tasks mostly wait in the queue while the batch threads are
+// saturated, it adds a batch thread (or, once at the thread limit, grows the
+// batch size to raise throughput); if they mostly wait for a batch to fill up,
+// it shortens the batch timeout; if batch processing itself dominates, it
+// shrinks the batch size. When p99 latency is comfortably below the target and
+// batches are consistently full, it grows the batch size to improve
+// throughput. Every change is a multiplicative step, clamped to the configured
+// bounds.
+class LatencyTargetTuningPolicy : public BatchingTuningPolicy {
+ public:
+  struct Options {
+    // The p99 task latency to stay below. Must be positive.
+    int64 target_latency_micros = 0;
+
+    // Latency below 'headroom * target_latency_micros' is considered
+    // comfortably below the target. Must be in (0, 1].
+    double headroom = 0.7;
+
+    // Multiplicative step by which parameters are changed. Must be > 1.
+    double step = 1.25;
+
+    // Estimated fraction of batch-thread capacity in use above which the
+    // threads are considered saturated.
+    double saturation_utilization = 0.8;
+
+    // Bounds on the parameters.
+    int64 min_max_batch_size = 1;
+    int64 max_max_batch_size = 512;
+    int64 min_batch_timeout_micros = 0;
+    int64 max_batch_timeout_micros = 100 * 1000;
+    int64 min_num_batch_threads = 1;
+    int64 max_num_batch_threads = 64;
+  };
+
+  explicit LatencyTargetTuningPolicy(const Options& options);
+  ~LatencyTargetTuningPolicy() override = default;
+
+  BatchingKnobs Adjust(const BatchingObservations& observations,
+                       const BatchingKnobs& current) override;
+
+ private:
+  const Options options_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(LatencyTargetTuningPolicy);
+};
+
+// EXPERIMENTAL: API MAY BE SUBJECTED TO SUDDEN CHANGES.
+//
+// An online controller for the parameters of a batch scheduler (e.g.
+// SharedBatchScheduler or AdaptiveSharedBatchScheduler).
+//
+// The batching layer reports every task and every batch it processes to a
+// BatchingAutoTuner. At a fixed interval the tuner summarizes the reports
+// received since the previous interval -- arrival rate, queueing delay,
+// per-batch compute time and tail latency -- and hands the summary to a
+// pluggable BatchingTuningPolicy, which picks new parameters. If they differ
+// from the current ones, the tuner passes them to a caller-supplied function
+// that applies them to the scheduler(s), e.g. via
+// SharedBatchScheduler::UpdateQueueOptions() and SetNumBatchThreads().
+//
+// Example:
+//
+//   LatencyTargetTuningPolicy::Options policy_options;
+//   policy_options.target_latency_micros = 50 * 1000;
+//   BatchingAutoTuner::Options options;
+//   std::unique_ptr<BatchingAutoTuner> tuner;
+//   TF_CHECK_OK(BatchingAutoTuner::Create(
+//       options, initial_knobs,
+//       std::unique_ptr<BatchingTuningPolicy>(
+//           new LatencyTargetTuningPolicy(policy_options)),
+//       [scheduler](const BatchingKnobs& knobs) { ... apply ... },
+//       &tuner));
+//   ...
+//   // On every processed batch:
+//   tuner->RecordBatch(batch_size, compute_micros);
+//   tuner->RecordTask(queue_micros, compute_micros);
+//
+// This object is thread-safe.
+class BatchingAutoTuner {
+ public:
+  // Reads the parameters currently in effect in the batch scheduler(s).
+  using ReadFn = std::function<Status(BatchingKnobs*)>;
+
+  struct Options {
+    // How often to consult the policy. If 0, no background thread is started
+    // and the caller drives tuning by calling Tune() (e.g. from tests).
+    int64 tuning_interval_micros = 1000 * 1000;
+
+    // Intervals in which fewer tasks than this finished are skipped, since
+    // their percentiles are too noisy to act on. Their reports carry over to
+    // the next interval.
+    int64 min_tasks_per_interval = 100;
+
+    // Upper bound on the task latencies kept per interval for computing
+    // percentiles. Once reached, further tasks replace random earlier ones.
+    int64 max_samples_per_interval = 10000;
+
+    // If set, called at the start of every tuning step, so that the policy
+    // starts from the parameters actually in effect rather than from the
+    // last ones the tuner applied: others (e.g. an operator) may have changed
+    // them since, or an apply may have changed less than asked. If it returns
+    // an error, the tuner keeps its own idea of the parameters.
+    ReadFn read_fn;
+
+    // The environment to use.
+    Env* env = Env::Default();
+  };
+
+  // Applies new parameters to the batch scheduler(s). If it returns an error,
+  // the tuner keeps the previous parameters. It may leave alone parameters
+  // that cannot be changed; with 'read_fn' set, the next step then starts from
+  // what actually took effect.
+  using ApplyFn = std::function<Status(const BatchingKnobs&)>;
+
+  static Status Create(const Options& options,
+                       const BatchingKnobs& initial_knobs,
+                       std::unique_ptr<BatchingTuningPolicy> policy,
+                       ApplyFn apply_fn,
+                       std::unique_ptr<BatchingAutoTuner>* tuner);
+
+  ~BatchingAutoTuner();
+
+  // Reports that a task spent 'queue_micros' waiting for its batch to be
+  // scheduled, then 'compute_micros' while the batch was processed.
+  void RecordTask(int64 queue_micros, int64 compute_micros);
+
+  // Reports that a batch of 'batch_size' units was processed in
+  // 'compute_micros'.
+  void RecordBatch(int64 batch_size, int64 compute_micros);
+
+  // Summarizes the reports since the last tuning step, consults the policy
+  // and applies its decision. Called periodically by the background thread,
+  // if any.
+  void Tune();
+
+  // Returns the parameters currently in effect.
+  BatchingKnobs knobs() const;
+
+  // Returns the observations the policy was last consulted with.
+  BatchingObservations last_observations() const;
+
+ private:
+  BatchingAutoTuner(const Options& options, const BatchingKnobs& initial_knobs,
+                    std::unique_ptr<BatchingTuningPolicy> policy,
+                    ApplyFn apply_fn);
+
+  const Options options_;
+  const ApplyFn apply_fn_;
+
+  // Serializes Tune(). Acquired before 'mu_'.
+  mutex tune_mu_;
+  std::unique_ptr<BatchingTuningPolicy> policy_ GUARDED_BY(tune_mu_);
+
+  // Guards the reports accumulated during the current interval.
+  mutable mutex mu_;
+  BatchingKnobs knobs_ GUARDED_BY(mu_);
+  BatchingObservations last_observations_ GUARDED_BY(mu_);
+  uint64 interval_start_micros_ GUARDED_BY(mu_);
+  int64 num_tasks_ GUARDED_BY(mu_) = 0;
+  int64 num_batches_ GUARDED_BY(mu_) = 0;
+  int64 sum_queue_micros_ GUARDED_BY(mu_) = 0;
+  int64 sum_batch_compute_micros_ GUARDED_BY(mu_) = 0;
+  int64 sum_batch_size_ GUARDED_BY(mu_) = 0;
+  std::vector<int64> latency_samples_ GUARDED_BY(mu_);
+  uint64 sample_rng_state_ GUARDED_BY(mu_) = 0x9E3779B97F4A7C15ull;
+
+  // Runs Tune() every 'options_.tuning_interval_micros', if positive.
+  std::unique_ptr<PeriodicFunction> tuning_thread_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(BatchingAutoTuner);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // THIRD_PARTY_TENSORFLOW_CONTRIB_BATCHING_BATCHING_AUTO_TUNER_H_
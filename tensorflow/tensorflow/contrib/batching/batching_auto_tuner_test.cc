@@ -0,0 +1,286 @@
+/* Copyright 2016 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+
+#include "tensorflow/contrib/batching/batching_auto_tuner.h"
+
+#include "tensorflow/contrib/batching/test_util/fake_clock_env.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+BatchingKnobs MakeKnobs(int64 max_batch_size, int64 batch_timeout_micros,
+                        int64 num_batch_threads) {
+  BatchingKnobs knobs;
+  knobs.max_batch_size = max_batch_size;
+  knobs.batch_timeout_micros = batch_timeout_micros;
+  knobs.num_batch_threads = num_batch_threads;
+  return knobs;
+}
+
+LatencyTargetTuningPolicy::Options PolicyOptions() {
+  LatencyTargetTuningPolicy::Options options;
+  options.target_latency_micros = 10 * 1000;
+  options.max_num_batch_threads = 4;
+  return options;
+}
+
+// One second during which 'num_batches' batches of 'batch_size' tasks each
+// took 'compute_micros' to process, after their tasks queued for
+// 'queue_micros'.
+BatchingObservations MakeObservations(int64 num_batches, int64 batch_size,
+                                      int64 compute_micros,
+                                      int64 queue_micros) {
+  BatchingObservations observations;
+  observations.interval_micros = 1000 * 1000;
+  observations.num_batches = num_batches;
+  observations.num_tasks = num_batches * batch_size;
+  observations.tasks_per_second = observations.num_tasks;
+  observations.mean_batch_size = batch_size;
+  observations.mean_batch_compute_micros = compute_micros;
+  observations.mean_queue_micros = queue_micros;
+  observations.p50_latency_micros = queue_micros + compute_micros;
+  observations.p99_latency_micros = queue_micros + compute_micros;
+  return observations;
+}
+
+TEST(LatencyTargetTuningPolicyTest, NoTrafficKeepsKnobs) {
+  LatencyTargetTuningPolicy policy(PolicyOptions());
+  const BatchingKnobs current = MakeKnobs(32, 1000, 2);
+  EXPECT_EQ(current, policy.Adjust(BatchingObservations(), current));
+}
+
+TEST(LatencyTargetTuningPolicyTest, ShrinksBatchesWhenComputeDominates) {
+  LatencyTargetTuningPolicy policy(PolicyOptions());
+  const BatchingKnobs next = policy.Adjust(
+      MakeObservations(10, 32, 15 * 1000, 1000), MakeKnobs(32, 1000, 2));
+  EXPECT_LT(next.max_batch_size, 32);
+  EXPECT_EQ(1000, next.batch_timeout_micros);
+  EXPECT_EQ(2, next.num_batch_threads);
+}
+
+TEST(LatencyTargetTuningPolicyTest, ShortensTimeoutWhenWaitingForBatches) {
+  LatencyTargetTuningPolicy policy(PolicyOptions());
+  // Threads are mostly idle, tasks wait 50ms for the batch to fill.
+  const BatchingKnobs next =
+      policy.Adjust(MakeObservations(10, 4, 2000, 50 * 1000),
+                    MakeKnobs(32, 100 * 1000, 2));
+  EXPECT_EQ(32, next.max_batch_size);
+  // Leaves room for the 2ms of processing within the 10ms target.
+  EXPECT_LE(next.batch_timeout_micros, 8000);
+  EXPECT_EQ(2, next.num_batch_threads);
+}
+
+TEST(LatencyTargetTuningPolicyTest, AddsThreadsWhenSaturated) {
+  LatencyTargetTuningPolicy policy(PolicyOptions());
+  // Two threads each busy 90% of the second; tasks queue behind them.
+  const BatchingObservations observations =
+      MakeObservations(180, 8, 10 * 1000, 20 * 1000);
+  BatchingKnobs next = policy.Adjust(observations, MakeKnobs(8, 0, 2));
+  EXPECT_EQ(3, next.num_batch_threads);
+  EXPECT_EQ(8, next.max_batch_size);
+
+  // At the thread limit, batches grow instead.
+  next = policy.Adjust(MakeObservations(360, 8, 10 * 1000, 20 * 1000),
+                       MakeKnobs(8, 0, 4));
+  EXPECT_EQ(4, next.num_batch_threads);
+  EXPECT_GT(next.max_batch_size, 8);
+}
+
+TEST(LatencyTargetTuningPolicyTest, GrowsFullBatchesUnderTarget) {
+  LatencyTargetTuningPolicy policy(PolicyOptions());
+  BatchingKnobs next = policy.Adjust(MakeObservations(100, 16, 2000, 1000),
+                                     MakeKnobs(16, 1000, 2));
+  EXPECT_GT(next.max_batch_size, 16);
+
+  // Partially filled batches are left alone.
+  next = policy.Adjust(MakeObservations(100, 4, 2000, 1000),
+                       MakeKnobs(16, 1000, 2));
+  EXPECT_EQ(16, next.max_batch_size);
+}
+
+TEST(LatencyTargetTuningPolicyTest, ClampsToBounds) {
+  LatencyTargetTuningPolicy::Options options = PolicyOptions();
+  options.min_max_batch_size = 4;
+  options.max_batch_timeout_micros = 5000;
+  LatencyTargetTuningPolicy policy(options);
+  const BatchingKnobs next = policy.Adjust(
+      MakeObservations(10, 4, 50 * 1000, 0), MakeKnobs(4, 1000 * 1000, 8));
+  EXPECT_EQ(4, next.max_batch_size);
+  EXPECT_EQ(5000, next.batch_timeout_micros);
+  EXPECT_EQ(4, next.num_batch_threads);
+}
+
+// A policy that records what it saw and always asks for one more thread.
+class AddThreadPolicy : public BatchingTuningPolicy {
+ public:
+  explicit AddThreadPolicy(BatchingObservations* seen) : seen_(seen) {}
+
+  BatchingKnobs Adjust(const BatchingObservations& observations,
+                       const BatchingKnobs& current) override {
+    *seen_ = observations;
+    BatchingKnobs next = current;
+    ++next.num_batch_threads;
+    return next;
+  }
+
+ private:
+  BatchingObservations* seen_;
+};
+
+TEST(BatchingAutoTunerTest, InvalidOptions) {
+  BatchingObservations seen;
+  auto apply_fn = [](const BatchingKnobs& knobs) { return Status::OK(); };
+  std::unique_ptr<BatchingAutoTuner> tuner;
+  BatchingAutoTuner::Options options;
+  EXPECT_FALSE(BatchingAutoTuner::Create(
+                   options, MakeKnobs(0, 0, 1),
+                   std::unique_ptr<BatchingTuningPolicy>(
+                       new AddThreadPolicy(&seen)),
+                   apply_fn, &tuner)
+                   .ok());
+  EXPECT_FALSE(BatchingAutoTuner::Create(options, MakeKnobs(8, 0, 1), nullptr,
+                                         apply_fn, &tuner)
+                   .ok());
+  options.tuning_interval_micros = -1;
+  EXPECT_FALSE(BatchingAutoTuner::Create(
+                   options, MakeKnobs(8, 0, 1),
+                   std::unique_ptr<BatchingTuningPolicy>(
+                       new AddThreadPolicy(&seen)),
+                   apply_fn, &tuner)
+                   .ok());
+}
+
+TEST(BatchingAutoTunerTest, SummarizesAndApplies) {
+  test_util::FakeClockEnv env(Env::Default());
+  BatchingObservations seen;
+  std::vector<BatchingKnobs> applied;
+  bool fail_apply = false;
+  auto apply_fn = [&applied, &fail_apply](const BatchingKnobs& knobs) {
+    if (fail_apply) return errors::Internal("apply failed");
+    applied.push_back(knobs);
+    return Status::OK();
+  };
+
+  BatchingAutoTuner::Options options;
+  options.tuning_interval_micros = 0;
+  options.min_tasks_per_interval = 4;
+  options.env = &env;
+  std::unique_ptr<BatchingAutoTuner> tuner;
+  TF_ASSERT_OK(BatchingAutoTuner::Create(
+      options, MakeKnobs(8, 100, 1),
+      std::unique_ptr<BatchingTuningPolicy>(new AddThreadPolicy(&seen)),
+      apply_fn, &tuner));
+
+  // Too few tasks: nothing happens, and the reports carry over.
+  tuner->RecordBatch(3, 500);
+  for (int i = 0; i < 3; ++i) {
+    tuner->RecordTask(100 * i, 500);
+  }
+  env.AdvanceByMicroseconds(500 * 1000);
+  tuner->Tune();
+  EXPECT_TRUE(applied.empty());
+
+  tuner->RecordBatch(1, 1500);
+  tuner->RecordTask(2500, 1500);
+  env.AdvanceByMicroseconds(500 * 1000);
+  tuner->Tune();
+
+  EXPECT_EQ(1000 * 1000, seen.interval_micros);
+  EXPECT_EQ(4, seen.num_tasks);
+  EXPECT_EQ(2, seen.num_batches);
+  EXPECT_DOUBLE_EQ(4.0, seen.tasks_per_second);
+  EXPECT_DOUBLE_EQ(700.0, seen.mean_queue_micros);
+  EXPECT_DOUBLE_EQ(1000.0, seen.mean_batch_compute_micros);
+  EXPECT_DOUBLE_EQ(2.0, seen.mean_batch_size);
+  EXPECT_EQ(4000, seen.p99_latency_micros);
+  ASSERT_EQ(1, applied.size());
+  EXPECT_EQ(MakeKnobs(8, 100, 2), applied[0]);
+  EXPECT_EQ(MakeKnobs(8, 100, 2), tuner->knobs());
+
+  // A failed apply keeps the current knobs.
+  fail_apply = true;
+  for (int i = 0; i < 4; ++i) {
+    tuner->RecordTask(0, 100);
+  }
+  tuner->Tune();
+  EXPECT_EQ(MakeKnobs(8, 100, 2), tuner->knobs());
+
+  // The next step tries again from the same knobs.
+  fail_apply = false;
+  for (int i = 0; i < 4; ++i) {
+    tuner->RecordTask(0, 100);
+  }
+  tuner->Tune();
+  ASSERT_EQ(2, applied.size());
+  EXPECT_EQ(MakeKnobs(8, 100, 3), applied[1]);
+}
+
+TEST(BatchingAutoTunerTest, StartsFromKnobsReadBeforeEachStep) {
+  BatchingObservations seen;
+  std::vector<BatchingKnobs> applied;
+  auto apply_fn = [&applied](const BatchingKnobs& knobs) {
+    applied.push_back(knobs);
+    return Status::OK();
+  };
+  // Stands in for the scheduler, whose parameters are also changed from
+  // outside the tuner.
+  BatchingKnobs in_effect = MakeKnobs(8, 100, 1);
+  bool fail_read = false;
+
+  BatchingAutoTuner::Options options;
+  options.tuning_interval_micros = 0;
+  options.min_tasks_per_interval = 1;
+  options.read_fn = [&in_effect, &fail_read](BatchingKnobs* knobs) {
+    if (fail_read) return errors::Internal("read failed");
+    *knobs = in_effect;
+    return Status::OK();
+  };
+  std::unique_ptr<BatchingAutoTuner> tuner;
+  TF_ASSERT_OK(BatchingAutoTuner::Create(
+      options, MakeKnobs(8, 100, 1),
+      std::unique_ptr<BatchingTuningPolicy>(new AddThreadPolicy(&seen)),
+      apply_fn, &tuner));
+
+  in_effect = MakeKnobs(16, 200, 4);
+  tuner->RecordTask(0, 100);
+  tuner->Tune();
+  ASSERT_EQ(1, applied.size());
+  EXPECT_EQ(MakeKnobs(16, 200, 5), applied[0]);
+  EXPECT_EQ(MakeKnobs(16, 200, 5), tuner->knobs());
+
+  // The apply only took partly effect.
+  in_effect = MakeKnobs(16, 200, 4);
+  tuner->RecordTask(0, 100);
+  tuner->Tune();
+  ASSERT_EQ(2, applied.size());
+  EXPECT_EQ(MakeKnobs(16, 200, 5), applied[1]);
+
+  // Without a reading, the tuner goes on from the knobs it applied last.
+  fail_read = true;
+  tuner->RecordTask(0, 100);
+  tuner->Tune();
+  ASSERT_EQ(3, applied.size());
+  EXPECT_EQ(MakeKnobs(16, 200, 6), applied[2]);
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,108 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/contrib/batching/core_budget.h"
+
+#include <algorithm>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/cpu_info.h"
+
+namespace tensorflow {
+namespace serving {
+
+Status CoreBudget::Create(const Options& options,
+                          std::unique_ptr<CoreBudget>* budget) {
+  if (options.num_cores < 0) {
+    return errors::InvalidArgument("num_cores must be non-negative; was ",
+                                   options.num_cores);
+  }
+  const int num_cores = options.num_cores == 0 ? port::NumSchedulableCPUs()
+                                               : options.num_cores;
+  if (options.max_concurrent_batches < 1 ||
+      options.max_concurrent_batches > num_cores) {
+    return errors::InvalidArgument(
+        "max_concurrent_batches must be between 1 and the number of cores (",
+        num_cores, "); was ", options.max_concurrent_batches);
+  }
+  if (options.inter_op_pool_name.empty()) {
+    return errors::InvalidArgument("inter_op_pool_name must be non-empty");
+  }
+  budget->reset(new CoreBudget(num_cores, options.max_concurrent_batches,
+                               options.inter_op_pool_name));
+  return Status::OK();
+}
+
+CoreBudget::CoreBudget(const int num_cores, const int max_concurrent_batches,
+                       const string& inter_op_pool_name)
+    : num_cores_(num_cores),
+      max_concurrent_batches_(max_concurrent_batches),
+      inter_op_pool_name_(inter_op_pool_name),
+      pool_holders_(max_concurrent_batches, 0) {}
+
+void CoreBudget::ConfigureSession(ConfigProto* config) const {
+  config->clear_session_inter_op_thread_pool();
+  const int threads_per_pool = CoresPerBatch(max_concurrent_batches_);
+  for (int i = 0; i < max_concurrent_batches_; ++i) {
+    ThreadPoolOptionProto* pool = config->add_session_inter_op_thread_pool();
+    pool->set_num_threads(threads_per_pool);
+    // Global, so that the sessions of all servables share the same pools.
+    pool->set_global_name(strings::StrCat(inter_op_pool_name_, "_", i));
+  }
+  // The per-batch intra-op limit can only lower parallelism below the size of
+  // the pool.
+  config->set_intra_op_parallelism_threads(
+      std::max(config->intra_op_parallelism_threads(), num_cores_));
+}
+
+CoreBudget::Grant::Grant(CoreBudget* budget, const int inter_op_thread_pool,
+                         const int num_cores)
+    : budget_(budget),
+      inter_op_thread_pool_(inter_op_thread_pool),
+      num_cores_(num_cores) {}
+
+CoreBudget::Grant::~Grant() { budget_->Release(inter_op_thread_pool_); }
+
+std::unique_ptr<CoreBudget::Grant> CoreBudget::Acquire() {
+  mutex_lock l(mu_);
+  // Take the least shared pool; with at most 'max_concurrent_batches_'
+  // batches in flight, that is a free one.
+  const int pool = std::min_element(pool_holders_.begin(),
+                                    pool_holders_.end()) -
+                   pool_holders_.begin();
+  ++pool_holders_[pool];
+  ++num_batches_in_flight_;
+  return std::unique_ptr<Grant>(
+      new Grant(this, pool, CoresPerBatch(num_batches_in_flight_)));
+}
+
+void CoreBudget::Release(const int inter_op_thread_pool) {
+  mutex_lock l(mu_);
+  --pool_holders_[inter_op_thread_pool];
+  --num_batches_in_flight_;
+}
+
+int CoreBudget::num_batches_in_flight() const {
+  mutex_lock l(mu_);
+  return num_batches_in_flight_;
+}
+
+int CoreBudget::CoresPerBatch(const int num_batches) const {
+  return std::max(1, num_cores_ / num_batches);
+}
+
+}  // namespace serving
+}  // namespace tensorflow
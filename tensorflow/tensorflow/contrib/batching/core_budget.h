@@ -0,0 +1,170 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef THIRD_PARTY_TENSORFLOW_CONTRIB_BATCHING_CORE_BUDGET_H_
+#define THIRD_PARTY_TENSORFLOW_CONTRIB_BATCHING_CORE_BUDGET_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow/core/protobuf/config.pb.h"
+
+namespace tensorflow {
+namespace serving {
+
+// EXPERIMENTAL: API MAY BE SUBJECTED TO SUDDEN CHANGES.
+//
+// Divides a fixed number of CPU cores between the batches that are processed
+// concurrently, so that batch-level and op-level parallelism are sized
+// together. Sizing num_batch_threads, inter_op_parallelism and
+// intra_op_parallelism independently makes it easy to run, say, 8 batches
+// each fanning out to 16 intra-op threads on a 16-core host.
+//
+// The budget owns two things:
+//
+//  - Inter-op pools. ConfigureSession() gives sessions one inter-op pool per
+//    concurrent batch, shared process-wide and sized to that batch's even share
+//    of the cores. Every batch in flight holds a distinct pool slot, which it
+//    passes to Session::Run() in RunOptions::inter_op_thread_pool, so the
+//    nodes of concurrent batches never queue behind each other.
+//
+//  - Intra-op parallelism. Each batch is granted num_cores divided by the
+//    number of batches in flight when it starts, which it passes to
+//    Session::Run() in RunOptions::intra_op_parallelism_limit. A lone batch
+//    gets every core; under load, every new batch gets a smaller share. The
+//    limit is fixed for the lifetime of the grant and applies to that batch
+//    only, so batches already running are not resized, and the process-wide
+//    limit (SetIntraOpParallelismLimit(), e.g. set by ServerTuningService)
+//    still applies on top: the lower of the two wins.
+//
+// The budget bounds the threads of each kind, not their sum: with B concurrent
+// batches on N cores there are B inter-op pools of N/B threads and an intra-op
+// pool of N threads, so up to 2N threads can be runnable at once. That peak is
+// only reached when every inter-op thread runs a kernel of its own while the
+// intra-op pool is busy; a kernel that fans out to intra-op threads mostly
+// leaves its inter-op thread waiting, so in practice the load stays near N.
+//
+// Example:
+//
+//   CoreBudget::Options options;
+//   options.num_cores = 16;
+//   options.max_concurrent_batches = 4;
+//   std::unique_ptr<CoreBudget> budget;
+//   TF_CHECK_OK(CoreBudget::Create(options, &budget));
+//   budget->ConfigureSession(&session_config);
+//   ...
+//   // On a batch thread:
+//   std::unique_ptr<CoreBudget::Grant> grant = budget->Acquire();
+//   run_options.set_inter_op_thread_pool(grant->inter_op_thread_pool());
+//   run_options.set_intra_op_parallelism_limit(grant->num_cores());
+//   session->Run(run_options, ...);
+//
+// This object is thread-safe.
+class CoreBudget {
+ public:
+  struct Options {
+    // The number of cores to divide. 0 means port::NumSchedulableCPUs().
+    int num_cores = 0;
+
+    // The number of batches expected to be processed at once, i.e. the number
+    // of batch threads. Must be between 1 and 'num_cores'. If more batches
+    // than this are in flight (e.g. after the number of batch threads was
+    // raised at runtime), the extra ones share inter-op pools.
+    int max_concurrent_batches = 1;
+
+    // Prefix of the global names of the inter-op pools.
+    string inter_op_pool_name = "core_budget_inter_op";
+  };
+
+  static Status Create(const Options& options,
+                       std::unique_ptr<CoreBudget>* budget);
+
+  ~CoreBudget() = default;
+
+  int num_cores() const { return num_cores_; }
+  int max_concurrent_batches() const { return max_concurrent_batches_; }
+
+  // Sets up 'config' so that sessions created from it draw their threads from
+  // the budget: one global inter-op pool per concurrent batch, and an intra-op
+  // pool of at least 'num_cores' threads. Any existing
+  // session_inter_op_thread_pool entries are replaced; RunOptions that select
+  // pool 0 (the default) keep working.
+  void ConfigureSession(ConfigProto* config) const;
+
+  // A share of the budget held by one batch while it is processed. Returned
+  // to the budget on destruction.
+  class Grant {
+   public:
+    ~Grant();
+
+    // The index of the inter-op pool reserved for this batch, for
+    // RunOptions::inter_op_thread_pool.
+    int inter_op_thread_pool() const { return inter_op_thread_pool_; }
+
+    // The number of cores the batch was given when it started, for
+    // RunOptions::intra_op_parallelism_limit.
+    int num_cores() const { return num_cores_; }
+
+   private:
+    friend class CoreBudget;
+    Grant(CoreBudget* budget, int inter_op_thread_pool, int num_cores);
+
+    CoreBudget* const budget_;
+    const int inter_op_thread_pool_;
+    const int num_cores_;
+
+    TF_DISALLOW_COPY_AND_ASSIGN(Grant);
+  };
+
+  // Starts processing a batch. The grant must not outlive the budget.
+  std::unique_ptr<Grant> Acquire();
+
+  // The number of batches currently holding a grant.
+  int num_batches_in_flight() const;
+
+ private:
+  CoreBudget(int num_cores, int max_concurrent_batches,
+             const string& inter_op_pool_name);
+
+  // Called by ~Grant().
+  void Release(int inter_op_thread_pool);
+
+  // The share of the cores of each batch when 'num_batches' are in flight.
+  int CoresPerBatch(int num_batches) const;
+
+  const int num_cores_;
+  const int max_concurrent_batches_;
+  const string inter_op_pool_name_;
+
+  mutable mutex mu_;
+
+  // The number of grants holding each inter-op pool.
+  std::vector<int> pool_holders_ GUARDED_BY(mu_);
+
+  int num_batches_in_flight_ GUARDED_BY(mu_) = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(CoreBudget);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // THIRD_PARTY_TENSORFLOW_CONTRIB_BATCHING_CORE_BUDGET_H_
@@ -0,0 +1,133 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/contrib/batching/core_budget.h"
+
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/util/parallelism_limits.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+std::unique_ptr<CoreBudget> CreateBudget(int num_cores,
+                                         int max_concurrent_batches) {
+  CoreBudget::Options options;
+  options.num_cores = num_cores;
+  options.max_concurrent_batches = max_concurrent_batches;
+  std::unique_ptr<CoreBudget> budget;
+  TF_CHECK_OK(CoreBudget::Create(options, &budget));
+  return budget;
+}
+
+TEST(CoreBudgetTest, ValidatesOptions) {
+  std::unique_ptr<CoreBudget> budget;
+  CoreBudget::Options options;
+  options.num_cores = 4;
+  options.max_concurrent_batches = 0;
+  EXPECT_FALSE(CoreBudget::Create(options, &budget).ok());
+  options.max_concurrent_batches = 5;
+  EXPECT_FALSE(CoreBudget::Create(options, &budget).ok());
+  options.max_concurrent_batches = 4;
+  options.num_cores = -1;
+  EXPECT_FALSE(CoreBudget::Create(options, &budget).ok());
+  options.num_cores = 0;
+  options.max_concurrent_batches = 1;
+  TF_ASSERT_OK(CoreBudget::Create(options, &budget));
+  EXPECT_LT(0, budget->num_cores());
+}
+
+TEST(CoreBudgetTest, ConfigureSession) {
+  std::unique_ptr<CoreBudget> budget = CreateBudget(8, 3);
+  ConfigProto config;
+  config.add_session_inter_op_thread_pool()->set_num_threads(100);
+  config.set_intra_op_parallelism_threads(2);
+  budget->ConfigureSession(&config);
+  ASSERT_EQ(3, config.session_inter_op_thread_pool_size());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(2, config.session_inter_op_thread_pool(i).num_threads());
+    EXPECT_EQ(strings::StrCat("core_budget_inter_op_", i),
+              config.session_inter_op_thread_pool(i).global_name());
+  }
+  EXPECT_EQ(8, config.intra_op_parallelism_threads());
+
+  config.set_intra_op_parallelism_threads(32);
+  budget->ConfigureSession(&config);
+  EXPECT_EQ(32, config.intra_op_parallelism_threads());
+}
+
+TEST(CoreBudgetTest, DividesCoresBetweenBatchesInFlight) {
+  std::unique_ptr<CoreBudget> budget = CreateBudget(12, 3);
+
+  std::unique_ptr<CoreBudget::Grant> first = budget->Acquire();
+  EXPECT_EQ(12, first->num_cores());
+
+  std::unique_ptr<CoreBudget::Grant> second = budget->Acquire();
+  EXPECT_EQ(6, second->num_cores());
+
+  std::unique_ptr<CoreBudget::Grant> third = budget->Acquire();
+  EXPECT_EQ(4, third->num_cores());
+  EXPECT_EQ(3, budget->num_batches_in_flight());
+
+  // Grants keep the share they started with.
+  EXPECT_EQ(12, first->num_cores());
+
+  // Concurrent batches hold distinct inter-op pools.
+  EXPECT_NE(first->inter_op_thread_pool(), second->inter_op_thread_pool());
+  EXPECT_NE(first->inter_op_thread_pool(), third->inter_op_thread_pool());
+  EXPECT_NE(second->inter_op_thread_pool(), third->inter_op_thread_pool());
+
+  // A freed pool is handed to the next batch.
+  const int second_pool = second->inter_op_thread_pool();
+  second.reset();
+  std::unique_ptr<CoreBudget::Grant> fourth = budget->Acquire();
+  EXPECT_EQ(second_pool, fourth->inter_op_thread_pool());
+  EXPECT_EQ(4, fourth->num_cores());
+
+  // Batches beyond 'max_concurrent_batches' share pools, and still get at
+  // least one core each.
+  std::vector<std::unique_ptr<CoreBudget::Grant>> extra;
+  for (int i = 0; i < 20; ++i) {
+    extra.push_back(budget->Acquire());
+    EXPECT_LE(0, extra.back()->inter_op_thread_pool());
+    EXPECT_GT(3, extra.back()->inter_op_thread_pool());
+  }
+  EXPECT_EQ(1, extra.back()->num_cores());
+
+  extra.clear();
+  first.reset();
+  third.reset();
+  fourth.reset();
+  EXPECT_EQ(0, budget->num_batches_in_flight());
+  EXPECT_EQ(12, budget->Acquire()->num_cores());
+}
+
+TEST(CoreBudgetTest, LeavesProcessWideIntraOpLimitAlone) {
+  std::unique_ptr<CoreBudget> budget = CreateBudget(8, 2);
+  SetIntraOpParallelismLimit(3);
+  {
+    std::unique_ptr<CoreBudget::Grant> first = budget->Acquire();
+    std::unique_ptr<CoreBudget::Grant> second = budget->Acquire();
+    EXPECT_EQ(3, GetIntraOpParallelismLimit());
+  }
+  EXPECT_EQ(3, GetIntraOpParallelismLimit());
+  SetIntraOpParallelismLimit(0);
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -17,6 +17,9 @@ limitations under the License.
 #define THIRD_PARTY_TENSORFLOW_CONTRIB_BATCHING_SHARED_BATCH_SCHEDULER_H_
 
 #include <stddef.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <deque>
 #include <functional>
 #include <list>
@@ -26,9 +29,9 @@ limitations under the License.
 #include <vector>
 
 #include "tensorflow/contrib/batching/batch_scheduler.h"
-#include "tensorflow/contrib/batching/util/periodic_function.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/monitoring/counter.h"
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/platform/cpu_info.h"
 #include "tensorflow/core/platform/env.h"
@@ -69,10 +72,13 @@ namespace serving {
 // dynamically, to accommodate e.g. versions of a model being brought up and
 // down over the lifetime of a server.
 //
-// The batch thread pool round-robins through the queues, running one batch
-// from a queue and then moving to the next queue. Each queue behaves like a
-// BasicBatchScheduler instance, in the sense that it has maximum batch size and
-// timeout parameters, which govern when a batch is eligible to be processed.
+// Each queue behaves like a BasicBatchScheduler instance, in the sense that it
+// has maximum batch size and timeout parameters, which govern when a batch is
+// eligible to be processed. Whenever a batch thread becomes available, it takes
+// the eligible batch with the earliest deadline (the time its first task was
+// enqueued plus its queue's timeout) across all queues, breaking ties among
+// queues round-robin. Idle threads sleep until the next deadline of a batch
+// that is not yet eligible, or until a batch becomes eligible.
 //
 // Each queue is independently configured with a maximum size (in terms of the
 // maximum number of batches worth of enqueued tasks). For online serving, it is
@@ -90,9 +96,27 @@ namespace serving {
 // For bulk processing jobs and throughput-oriented benchmarks, you may want to
 // set the maximum queue size to a large value.
 //
-// TODO(b/26539183): Support queue servicing policies other than round-robin.
-// E.g. let each queue specify a "share" (an int >= 1), so e.g. with queues A
-// and B having shares 1 and 2 respectively, the servicing pattern is ABBABB...
+// A long timeout holds the tasks of a lightly loaded queue for the full timeout
+// even when the batch has no chance of filling up. With speculative dispatch
+// enabled (see QueueOptions::enable_speculative_dispatch), each queue keeps
+// online estimates of its task arrival rate and batch processing time, and
+// dispatches its open batch early when waiting for it to fill would take longer
+// than the processing time the fuller batch would save. Each dispatch of an
+// open batch is counted by reason in the
+// /tensorflow/serving/batching/open_batch_dispatches metric.
+//
+// Tasks may carry a deadline and a priority class (see BatchTask). A task whose
+// deadline has passed is rejected by Schedule(). When tasks back up in a queue,
+// batches are formed from the tasks of the highest priority first and, among
+// those, from the tasks with the earliest deadlines; tasks whose deadline has
+// passed in the meantime are set apart in batches of their own, for the
+// process-batch callback to fail without processing them. Under overload,
+// tasks of low priority are thus the ones that wait, and eventually expire.
+//
+// TODO(b/26539183): Support queue servicing policies other than earliest
+// deadline first. E.g. let each queue specify a "share" (an int >= 1), so e.g.
+// with queues A and B having shares 1 and 2 respectively, the servicing pattern
+// is ABBABB...
 //
 //
 // PERFORMANCE TUNING: See README.md.
@@ -110,6 +134,13 @@ class SharedBatchScheduler
     // Must be >= 1, and should be tuned carefully.
     int num_batch_threads = port::NumSchedulableCPUs();
 
+    // If true, the batch threads are bound round-robin to the NUMA nodes of
+    // the host (see port::NUMASetThreadNodeAffinity()), so that each node
+    // processes an even share of the batches against memory local to it. All
+    // threads still draw from the same queues, which balances the load across
+    // nodes. Has no effect on hosts with a single node.
+    bool numa_aware = false;
+
     // The environment to use.
     // (Typically only overridden by test code.)
     Env* env = Env::Default();
@@ -151,26 +182,98 @@ class SharedBatchScheduler
     // avoid latency spikes.
     int64 batch_timeout_micros = 0;
 
+    // If true, the open batch may be dispatched before 'batch_timeout_micros'
+    // when the queue is predicted to stay underfilled: i.e. when, at the
+    // task arrival rate observed so far, filling the rest of the batch would
+    // take longer than processing a batch, which is roughly what processing
+    // the remaining tasks together with this batch rather than in a later one
+    // saves. Both rates are exponentially weighted moving averages, updated as
+    // tasks arrive and batches are processed. A batch is timed from when it is
+    // handed to the process-batch callback until it is destroyed, so a
+    // callback that passes batches on to later stages is timed until those are
+    // done. Under low traffic tasks then see close to unbatched latency, and
+    // under high traffic batches fill as usual.
+    bool enable_speculative_dispatch = false;
+
     // The maximum allowable number of enqueued (accepted by Schedule() but
     // not yet being processed on a batch thread) tasks in terms of batches.
     // If this limit is reached, Schedule() will return an UNAVAILABLE error.
     // See the class documentation above for guidelines on how to tune this
     // parameter.
     int max_enqueued_batches = 10;
+
+    // If true, a task that doesn't fit in the remaining room of the open batch
+    // is split via 'split_input_task_func': the first piece tops up the open
+    // batch, and the rest fill new batches of up to 'max_batch_size' each.
+    // Tasks larger than 'max_batch_size' are then accepted, as long as the
+    // queue has room for all of their pieces. If false, such a task starts a
+    // new batch, and tasks larger than 'max_batch_size' are rejected.
+    bool enable_large_batch_splitting = false;
+
+    // Splits '*input_task' into 'output_tasks', the first of which has size
+    // 'open_batch_remaining_slot' (if that is positive) and the others at most
+    // 'max_batch_size'. The pieces are responsible for completing the original
+    // task once all of them have been processed. Must be set if
+    // 'enable_large_batch_splitting' is true.
+    std::function<Status(std::unique_ptr<TaskType>* input_task,
+                         int open_batch_remaining_slot, int max_batch_size,
+                         std::vector<std::unique_ptr<TaskType>>* output_tasks)>
+        split_input_task_func;
   };
   Status AddQueue(const QueueOptions& options,
                   std::function<void(std::unique_ptr<Batch<TaskType>>)>
                       process_batch_callback,
                   std::unique_ptr<BatchScheduler<TaskType>>* queue);
 
+  // Changes the number of batch threads while the scheduler is running. When
+  // shrinking, each thread that is removed finishes the batch it is currently
+  // processing (if any) before exiting; this method blocks until that
+  // happens. Returns an error if 'num_batch_threads' is not positive.
+  Status SetNumBatchThreads(int num_batch_threads);
+
+  // Returns the current number of batch threads.
+  int num_batch_threads() const;
+
+  // Replaces the options of every queue currently attached to this scheduler
+  // (queues added later use the options passed to AddQueue()). Tasks that are
+  // already enqueued are not re-batched: if the open batch of a queue exceeds
+  // the new 'max_batch_size' it is closed as-is, and only subsequent tasks are
+  // subject to the new limits. Returns an error, and changes nothing, if
+  // 'options' is invalid.
+  Status UpdateQueueOptions(const QueueOptions& options);
+
  private:
   explicit SharedBatchScheduler(const Options& options);
 
-  // The code executed in 'batch_threads_'. Obtains a batch to process from the
-  // queue pointed to by 'next_queue_to_schedule_', and processes it. If that
-  // queue declines to provide a batch to process, moves onto the next queue. If
-  // no queues provide a batch to process, just sleeps briefly and exits.
-  void ThreadLogic();
+  // Checks that the fields of 'options' are within their allowed ranges.
+  static Status ValidateQueueOptions(const QueueOptions& options);
+
+  // A thread that processes batches obtained from the queues.
+  struct BatchThread {
+    // Set, under 'mu_', to ask the thread to exit once it is done with the
+    // batch it is processing (if any).
+    bool stop_requested = false;
+
+    std::unique_ptr<Thread> thread;
+  };
+
+  // Starts one more batch thread.
+  void AddBatchThread() EXCLUSIVE_LOCKS_REQUIRED(batch_threads_mu_);
+
+  // Asks 'batch_threads' to exit, and joins them.
+  void StopBatchThreads(
+      std::vector<std::unique_ptr<BatchThread>> batch_threads);
+
+  // The code executed repeatedly by 'batch_thread'. Obtains the eligible batch
+  // with the earliest deadline across 'queues_', and processes it. If there is
+  // no such batch, sleeps until the earliest deadline of a batch that is not
+  // yet eligible, or until woken up by a queue, and returns. Returns false iff
+  // the thread has been asked to exit.
+  bool ThreadLogic(const BatchThread* batch_thread);
+
+  // Wakes up an idle batch thread. Called by the queues when they get an
+  // eligible batch or a new deadline, or are closed.
+  void WakeUpBatchThread();
 
   const Options options_;
 
@@ -186,16 +289,22 @@ class SharedBatchScheduler
   //  - have been removed but are not yet empty.
   QueueList queues_ GUARDED_BY(mu_);
 
-  // An iterator over 'queues_', pointing to the queue from which the next
-  // available batch thread should grab work.
+  // An iterator over 'queues_', pointing to the queue that wins the next tie
+  // between queues whose eligible batches have the same deadline.
   typename QueueList::iterator next_queue_to_schedule_ GUARDED_BY(mu_);
 
   // Used by idle batch threads to wait for work to enter the system. Notified
-  // whenever a batch becomes schedulable.
+  // whenever a batch becomes schedulable, a queue gets a new deadline or is
+  // closed, or a batch thread is asked to exit.
   condition_variable schedulable_batch_cv_;
 
+  // Guards 'batch_threads_'. Never held while acquiring 'mu_', or while a
+  // batch thread is being joined.
+  mutable mutex batch_threads_mu_;
+
   // Threads that process batches obtained from the queues.
-  std::vector<std::unique_ptr<PeriodicFunction>> batch_threads_;
+  std::vector<std::unique_ptr<BatchThread>> batch_threads_
+      GUARDED_BY(batch_threads_mu_);
 
   TF_DISALLOW_COPY_AND_ASSIGN(SharedBatchScheduler);
 };
@@ -205,6 +314,27 @@ class SharedBatchScheduler
 
 namespace internal {
 
+// The weight of the newest sample in the moving averages behind speculative
+// dispatch.
+constexpr double kSpeculativeDispatchSmoothing = 0.2;
+
+// A queue's moving average of the time to process a batch, negative until its
+// first sample. Shared with the batches the queue hands out, which add their
+// sample when they are destroyed, possibly after the queue itself.
+struct BatchProcessingTime {
+  mutex mu;
+  double average_micros GUARDED_BY(mu) = -1;
+};
+
+// Counts the dispatches of open batches, by why they were dispatched: "closed"
+// (the queue was closed), "full", "timeout" or "speculative".
+inline monitoring::Counter<1>* OpenBatchDispatches() {
+  static monitoring::Counter<1>* counter = monitoring::Counter<1>::New(
+      "/tensorflow/serving/batching/open_batch_dispatches",
+      "The number of open batches dispatched, by reason.", "reason");
+  return counter;
+}
+
 // A task queue for SharedBatchScheduler. Accepts tasks and accumulates them
 // into batches, and dispenses those batches to be processed via a "pull"
 // interface. The queue's behavior is governed by maximum batch size, timeout
@@ -220,15 +350,22 @@ namespace internal {
 // started.
 //
 // Batch pull requests are handled by dequeuing the front-most batch if it is
-// closed. If the front-most batch is open (i.e. the queue contains only one
+// closed. Before that, if the closed batches hold tasks out of priority and
+// deadline order, or tasks whose deadline has passed, the closed batches are
+// formed anew (see FormClosedBatches()). If the front-most batch is open (i.e. the queue contains only one
 // batch) and has reached the timeout, it is immediately closed and returned;
 // otherwise no batch is returned for the request.
+//
+// The deadline of the front-most batch, and whether it is eligible regardless
+// of the time, are published so that the scheduler can pick a queue without
+// taking every queue's lock.
 template <typename TaskType>
 class Queue {
  public:
   using ProcessBatchCallback =
       std::function<void(std::unique_ptr<Batch<TaskType>>)>;
   using SchedulableBatchCallback = std::function<void()>;
+
   Queue(const typename SharedBatchScheduler<TaskType>::QueueOptions& options,
         Env* env, ProcessBatchCallback process_batch_callback,
         SchedulableBatchCallback schdulable_batch_callback);
@@ -249,7 +386,25 @@ class Queue {
   size_t SchedulingCapacity() const;
 
   // Returns the maximum allowed size of tasks submitted to the queue.
-  size_t max_task_size() const { return options_.max_batch_size; }
+  size_t max_task_size() const {
+    mutex_lock l(mu_);
+    return options_.max_batch_size;
+  }
+
+  // Replaces the queue's options. See SharedBatchScheduler::
+  // UpdateQueueOptions(). Returns true iff the queue went from having no
+  // schedulable batch to having one. Unlike Schedule(), does not invoke
+  // 'schedulable_batch_callback_', since the caller holds the scheduler's lock.
+  bool SetOptions(
+      const typename SharedBatchScheduler<TaskType>::QueueOptions& options);
+
+  // Returns the deadline of the front-most batch, i.e. the time at which its
+  // first task will have been enqueued for 'batch_timeout_micros', or
+  // kNoDeadlineMicros if the queue has no enqueued tasks. Sets '*eligible' to
+  // whether that batch can be scheduled before its deadline (because it is
+  // closed or full, or the queue is closed). Does not take the queue's lock, so
+  // the result may be slightly stale; ScheduleBatch() has the final say.
+  uint64 NextBatchDeadlineMicros(bool* eligible) const;
 
   // Called by a thread that is ready to process a batch, to request one from
   // this queue. Either returns a batch that is ready to be processed, or
@@ -280,11 +435,40 @@ class Queue {
   // fresh open batch behind it.
   void StartNewBatch() EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
+  // Why the open batch residing at the back of 'batches_' can be scheduled
+  // now, if it can.
+  enum class OpenBatchDispatchReason {
+    kNotSchedulable,
+    kClosed,
+    kFull,
+    kTimeout,
+    kSpeculative,
+  };
+  OpenBatchDispatchReason GetOpenBatchDispatchReason() const
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
   // Determines whether the open batch residing at the back of 'batches_' is
   // currently schedulable.
   bool IsOpenBatchSchedulable() const EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
-  const typename SharedBatchScheduler<TaskType>::QueueOptions options_;
+  // Whether speculative dispatch is enabled, and the estimates predict that
+  // the non-empty open batch would take longer to fill than to process.
+  bool ShouldDispatchOpenBatchEarly() const EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Folds 'sample' into the moving average '*average', which is negative until
+  // its first sample.
+  static void UpdateMovingAverage(double sample, double* average);
+
+  // Updates the state read by NextBatchDeadlineMicros().
+  void PublishNextBatchDeadline() EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Re-forms the closed batches in 'batches_' if needed, so that the tasks
+  // whose deadline has passed come first, in batches of their own, followed by
+  // the other tasks in decreasing priority and then increasing deadline order.
+  // Tasks are packed into batches in that order, each batch being closed when
+  // the next task doesn't fit in it. Leaves the batches as they are if they are
+  // already in that order.
+  void FormClosedBatches() EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
   // The environment to use.
   Env* env_;
@@ -294,11 +478,15 @@ class Queue {
   ProcessBatchCallback process_batch_callback_;
 
   // A callback invoked to notify the scheduler that a new batch has become
-  // schedulable.
+  // schedulable, that the queue has a new deadline, or that it was closed.
   SchedulableBatchCallback schedulable_batch_callback_;
 
   mutable mutex mu_;
 
+  // The queue's options. May be replaced via SetOptions().
+  typename SharedBatchScheduler<TaskType>::QueueOptions options_
+      GUARDED_BY(mu_);
+
   // Whether this queue can accept new tasks. This variable is monotonic: it
   // starts as false, and then at some point gets set to true and remains true
   // for the duration of this object's life.
@@ -311,8 +499,28 @@ class Queue {
   // in 'batches_'. Valid iff that batch contains at least one task.
   uint64 open_batch_start_time_micros_ GUARDED_BY(mu_);
 
-  // Whether this queue contains a batch that is eligible to be scheduled. Used
-  // to keep track of when to call 'schedulable_batch_callback_'.
+  // The times at which the first task was added to each closed batch in
+  // 'batches_', front-most first.
+  std::deque<uint64> closed_batch_start_times_micros_ GUARDED_BY(mu_);
+
+  // The estimates behind speculative dispatch: moving averages of the time
+  // between task arrivals per unit of task size, and of the time to process a
+  // batch. The former is negative until its first sample.
+  double micros_per_arriving_task_unit_ GUARDED_BY(mu_) = -1;
+  const std::shared_ptr<BatchProcessingTime> batch_processing_time_ =
+      std::make_shared<BatchProcessingTime>();
+
+  // The time at which the last task was submitted. Valid iff 'has_arrival_'.
+  uint64 last_arrival_time_micros_ GUARDED_BY(mu_) = 0;
+  bool has_arrival_ GUARDED_BY(mu_) = false;
+
+  // Published by PublishNextBatchDeadline(), for NextBatchDeadlineMicros().
+  std::atomic<uint64> next_batch_deadline_micros_{kNoDeadlineMicros};
+  std::atomic<bool> next_batch_eligible_{false};
+
+  // Whether this queue contains a batch that is eligible to be scheduled, as of
+  // the last Schedule(), ScheduleBatch() or SetOptions(). Lets SetOptions()
+  // tell whether the new options made a batch eligible.
   bool schedulable_batch_ GUARDED_BY(mu_) = false;
 
   // The number of batches currently being processed by batch threads.
@@ -384,7 +592,12 @@ SharedBatchScheduler<TaskType>::~SharedBatchScheduler() {
   }
   // Delete the batch threads before allowing state the threads may access (e.g.
   // 'mu_') to be deleted.
-  batch_threads_.clear();
+  std::vector<std::unique_ptr<BatchThread>> batch_threads;
+  {
+    mutex_lock l(batch_threads_mu_);
+    batch_threads.swap(batch_threads_);
+  }
+  StopBatchThreads(std::move(batch_threads));
 }
 
 template <typename TaskType>
@@ -393,25 +606,9 @@ Status SharedBatchScheduler<TaskType>::AddQueue(
     std::function<void(std::unique_ptr<Batch<TaskType>>)>
         process_batch_callback,
     std::unique_ptr<BatchScheduler<TaskType>>* queue) {
-  if (options.max_batch_size <= 0) {
-    return errors::InvalidArgument("max_batch_size must be positive; was ",
-                                   options.max_batch_size);
-  }
-  if (options.batch_timeout_micros < 0) {
-    return errors::InvalidArgument(
-        "batch_timeout_micros must be non-negative; was ",
-        options.batch_timeout_micros);
-  }
-  if (options.max_enqueued_batches < 0) {
-    return errors::InvalidArgument(
-        "max_enqueued_batches must be non-negative; was ",
-        options.max_enqueued_batches);
-  }
+  TF_RETURN_IF_ERROR(ValidateQueueOptions(options));
 
-  auto schedulable_batch_callback = [this] {
-    mutex_lock l(mu_);
-    schedulable_batch_cv_.notify_one();
-  };
+  auto schedulable_batch_callback = [this] { WakeUpBatchThread(); };
   auto internal_queue =
       std::unique_ptr<internal::Queue<TaskType>>(new internal::Queue<TaskType>(
           options, options_.env, process_batch_callback,
@@ -430,73 +627,230 @@ Status SharedBatchScheduler<TaskType>::AddQueue(
   return Status::OK();
 }
 
+template <typename TaskType>
+Status SharedBatchScheduler<TaskType>::SetNumBatchThreads(
+    int num_batch_threads) {
+  if (num_batch_threads < 1) {
+    return errors::InvalidArgument("num_batch_threads must be positive; was ",
+                                   num_batch_threads);
+  }
+  // Threads being removed. Stopped and joined outside 'batch_threads_mu_',
+  // since each may first have to finish processing a batch.
+  std::vector<std::unique_ptr<BatchThread>> removed_threads;
+  {
+    mutex_lock l(batch_threads_mu_);
+    while (batch_threads_.size() < num_batch_threads) {
+      AddBatchThread();
+    }
+    while (batch_threads_.size() > num_batch_threads) {
+      removed_threads.push_back(std::move(batch_threads_.back()));
+      batch_threads_.pop_back();
+    }
+  }
+  StopBatchThreads(std::move(removed_threads));
+  return Status::OK();
+}
+
+template <typename TaskType>
+int SharedBatchScheduler<TaskType>::num_batch_threads() const {
+  mutex_lock l(batch_threads_mu_);
+  return batch_threads_.size();
+}
+
+template <typename TaskType>
+Status SharedBatchScheduler<TaskType>::UpdateQueueOptions(
+    const QueueOptions& options) {
+  TF_RETURN_IF_ERROR(ValidateQueueOptions(options));
+  {
+    mutex_lock l(mu_);
+    for (const auto& queue : queues_) {
+      queue->SetOptions(options);
+    }
+    // The deadlines changed along with the timeouts, so let idle threads
+    // re-compute how long to wait.
+    schedulable_batch_cv_.notify_all();
+  }
+  return Status::OK();
+}
+
+template <typename TaskType>
+Status SharedBatchScheduler<TaskType>::ValidateQueueOptions(
+    const QueueOptions& options) {
+  if (options.max_batch_size <= 0) {
+    return errors::InvalidArgument("max_batch_size must be positive; was ",
+                                   options.max_batch_size);
+  }
+  if (options.batch_timeout_micros < 0) {
+    return errors::InvalidArgument(
+        "batch_timeout_micros must be non-negative; was ",
+        options.batch_timeout_micros);
+  }
+  if (options.max_enqueued_batches < 0) {
+    return errors::InvalidArgument(
+        "max_enqueued_batches must be non-negative; was ",
+        options.max_enqueued_batches);
+  }
+  if (options.enable_large_batch_splitting &&
+      options.split_input_task_func == nullptr) {
+    return errors::InvalidArgument(
+        "split_input_task_func must be set when enable_large_batch_splitting "
+        "is true");
+  }
+  return Status::OK();
+}
+
 template <typename TaskType>
 SharedBatchScheduler<TaskType>::SharedBatchScheduler(const Options& options)
     : options_(options), next_queue_to_schedule_(queues_.end()) {
   // Kick off the batch threads.
-  PeriodicFunction::Options periodic_fn_options;
-  periodic_fn_options.thread_name_prefix =
-      strings::StrCat(options.thread_pool_name, "_");
+  mutex_lock l(batch_threads_mu_);
   for (int i = 0; i < options.num_batch_threads; ++i) {
-    std::unique_ptr<PeriodicFunction> thread(new PeriodicFunction(
-        [this] { this->ThreadLogic(); },
-        0 /* function invocation interval time */, periodic_fn_options));
-    batch_threads_.push_back(std::move(thread));
+    AddBatchThread();
   }
 }
 
 template <typename TaskType>
-void SharedBatchScheduler<TaskType>::ThreadLogic() {
+void SharedBatchScheduler<TaskType>::AddBatchThread() {
+  std::unique_ptr<BatchThread> batch_thread(new BatchThread);
+  const BatchThread* thread_state = batch_thread.get();
+  ThreadOptions thread_options;
+  if (options_.numa_aware && port::NUMANumNodes() > 1) {
+    thread_options.numa_node = batch_threads_.size() % port::NUMANumNodes();
+  }
+  batch_thread->thread.reset(options_.env->StartThread(
+      thread_options,
+      strings::StrCat(options_.thread_pool_name, "_", batch_threads_.size()),
+      [this, thread_state] {
+        while (this->ThreadLogic(thread_state)) {
+        }
+      }));
+  batch_threads_.push_back(std::move(batch_thread));
+}
+
+template <typename TaskType>
+void SharedBatchScheduler<TaskType>::StopBatchThreads(
+    std::vector<std::unique_ptr<BatchThread>> batch_threads) {
+  if (batch_threads.empty()) {
+    return;
+  }
+  {
+    mutex_lock l(mu_);
+    for (const auto& batch_thread : batch_threads) {
+      batch_thread->stop_requested = true;
+    }
+    schedulable_batch_cv_.notify_all();
+  }
+  // Join the threads.
+  for (auto& batch_thread : batch_threads) {
+    batch_thread->thread.reset();
+  }
+}
+
+template <typename TaskType>
+void SharedBatchScheduler<TaskType>::WakeUpBatchThread() {
+  mutex_lock l(mu_);
+  schedulable_batch_cv_.notify_one();
+}
+
+template <typename TaskType>
+bool SharedBatchScheduler<TaskType>::ThreadLogic(
+    const BatchThread* batch_thread) {
   // A batch to process next (or nullptr if no work to do).
   std::unique_ptr<Batch<TaskType>> batch_to_process;
   // The queue with which 'batch_to_process' is associated.
   internal::Queue<TaskType>* queue_for_batch = nullptr;
   {
     mutex_lock l(mu_);
+    if (batch_thread->stop_requested) {
+      return false;
+    }
+
+    const uint64 now_micros = options_.env->NowMicros();
+
+    // The queue whose eligible batch has the earliest deadline. Among equal
+    // deadlines, the first queue starting from 'next_queue_to_schedule_' wins.
+    auto earliest_queue = queues_.end();
+    uint64 earliest_deadline_micros = kNoDeadlineMicros;
+    // The earliest deadline of a batch that is not eligible yet.
+    uint64 wake_up_time_micros = kNoDeadlineMicros;
 
     const int num_queues = queues_.size();
-    for (int num_queues_tried = 0;
-         batch_to_process == nullptr && num_queues_tried < num_queues;
+    auto queue_it = next_queue_to_schedule_;
+    for (int num_queues_tried = 0; num_queues_tried < num_queues;
          ++num_queues_tried) {
-      DCHECK(next_queue_to_schedule_ != queues_.end());
-
-      // If a closed queue responds to ScheduleBatch() with nullptr, the queue
-      // will never yield any further batches so we can drop it. To avoid a
-      // race, we take a snapshot of the queue's closedness state *before*
-      // calling ScheduleBatch().
-      const bool queue_closed = (*next_queue_to_schedule_)->closed();
-
-      // Ask '*next_queue_to_schedule_' if it wants us to process a batch.
-      batch_to_process = (*next_queue_to_schedule_)->ScheduleBatch();
-      if (batch_to_process != nullptr) {
-        queue_for_batch = next_queue_to_schedule_->get();
+      if (queue_it == queues_.end()) {
+        // We've hit the end. Wrap to the first queue.
+        queue_it = queues_.begin();
       }
-
-      // Advance 'next_queue_to_schedule_'.
-      if (queue_closed && (*next_queue_to_schedule_)->IsEmpty() &&
-          batch_to_process == nullptr) {
-        // We've encountered a closed queue with no work to do. Drop it.
-        DCHECK_NE(queue_for_batch, next_queue_to_schedule_->get());
-        next_queue_to_schedule_ = queues_.erase(next_queue_to_schedule_);
+      bool eligible;
+      const uint64 deadline_micros =
+          (*queue_it)->NextBatchDeadlineMicros(&eligible);
+      if (deadline_micros == kNoDeadlineMicros) {
+        // Take a snapshot of the queue's closedness state *before* checking
+        // that it is empty, since an open queue may still be given tasks.
+        if ((*queue_it)->closed() && (*queue_it)->IsEmpty()) {
+          // We've encountered a closed queue with no work to do. It will never
+          // yield any further batches, so drop it.
+          const bool is_next_queue = queue_it == next_queue_to_schedule_;
+          queue_it = queues_.erase(queue_it);
+          if (is_next_queue) {
+            next_queue_to_schedule_ = queue_it;
+          }
+          continue;
+        }
+      } else if (eligible || deadline_micros <= now_micros) {
+        if (deadline_micros < earliest_deadline_micros) {
+          earliest_queue = queue_it;
+          earliest_deadline_micros = deadline_micros;
+        }
       } else {
-        ++next_queue_to_schedule_;
-      }
-      if (next_queue_to_schedule_ == queues_.end() && !queues_.empty()) {
-        // We've hit the end. Wrap to the first queue.
-        next_queue_to_schedule_ = queues_.begin();
+        wake_up_time_micros = std::min(wake_up_time_micros, deadline_micros);
       }
+      ++queue_it;
+    }
+    if (next_queue_to_schedule_ == queues_.end()) {
+      next_queue_to_schedule_ = queues_.begin();
     }
 
-    if (batch_to_process == nullptr) {
-      // We couldn't find any work to do. Wait until a new batch becomes
-      // schedulable, or some time has elapsed, before checking again.
-      const int64 kTimeoutMillis = 1;  // The smallest accepted granule of time.
-      WaitForMilliseconds(&l, &schedulable_batch_cv_, kTimeoutMillis);
-      return;
+    if (earliest_queue != queues_.end()) {
+      batch_to_process = (*earliest_queue)->ScheduleBatch();
+      if (batch_to_process == nullptr) {
+        // The queue's published deadline was stale. It is up to date now, so
+        // just look again.
+        return true;
+      }
+      queue_for_batch = earliest_queue->get();
+      // If the queue has another eligible batch (e.g. one that filled while
+      // this one waited), hand it to an idle thread rather than leaving it to
+      // the next notification or deadline.
+      bool more_eligible = false;
+      if ((*earliest_queue)->NextBatchDeadlineMicros(&more_eligible) !=
+              kNoDeadlineMicros &&
+          more_eligible) {
+        schedulable_batch_cv_.notify_one();
+      }
+      // Let the following queue win the next tie.
+      next_queue_to_schedule_ = std::next(earliest_queue);
+      if (next_queue_to_schedule_ == queues_.end()) {
+        next_queue_to_schedule_ = queues_.begin();
+      }
+    } else {
+      // We couldn't find any work to do. Wait until a batch becomes eligible,
+      // either by reaching its deadline or by being woken up by its queue.
+      // (The wait is measured on the real clock, so under a fake clock this
+      // re-checks the time periodically.)
+      if (wake_up_time_micros == kNoDeadlineMicros) {
+        schedulable_batch_cv_.wait(l);
+      } else {
+        schedulable_batch_cv_.wait_for(
+            l, std::chrono::microseconds(wake_up_time_micros - now_micros));
+      }
+      return true;
     }
   }
 
   queue_for_batch->ProcessBatch(std::move(batch_to_process));
+  return true;
 }
 
 namespace internal {
@@ -506,10 +860,10 @@ Queue<TaskType>::Queue(
     const typename SharedBatchScheduler<TaskType>::QueueOptions& options,
     Env* env, ProcessBatchCallback process_batch_callback,
     SchedulableBatchCallback schedulable_batch_callback)
-    : options_(options),
-      env_(env),
+    : env_(env),
       process_batch_callback_(process_batch_callback),
-      schedulable_batch_callback_(schedulable_batch_callback) {
+      schedulable_batch_callback_(schedulable_batch_callback),
+      options_(options) {
   // Create an initial, open batch.
   batches_.emplace_back(new Batch<TaskType>);
 }
@@ -525,37 +879,94 @@ Queue<TaskType>::~Queue() {
 
 template <typename TaskType>
 Status Queue<TaskType>::Schedule(std::unique_ptr<TaskType>* task) {
-  if ((*task)->size() > options_.max_batch_size) {
-    return errors::InvalidArgument("Task size ", (*task)->size(),
-                                   " is larger than maximum batch size ",
-                                   options_.max_batch_size);
-  }
-
   bool notify_of_schedulable_batch = false;
   {
     mutex_lock l(mu_);
 
+    if ((*task)->size() > options_.max_batch_size &&
+        !options_.enable_large_batch_splitting) {
+      return errors::InvalidArgument("Task size ", (*task)->size(),
+                                     " is larger than maximum batch size ",
+                                     options_.max_batch_size);
+    }
+
     DCHECK(!closed_);
 
-    if (batches_.back()->size() + (*task)->size() > options_.max_batch_size) {
-      if (batches_.size() >= options_.max_enqueued_batches) {
+    const uint64 task_deadline_micros = (*task)->deadline_micros();
+    if (task_deadline_micros != kNoDeadlineMicros &&
+        task_deadline_micros <= env_->NowMicros()) {
+      return errors::DeadlineExceeded(
+          "The deadline of the task has passed before it was batched");
+    }
+
+    const uint64 now_micros = env_->NowMicros();
+    if (has_arrival_ && (*task)->size() > 0) {
+      UpdateMovingAverage(
+          static_cast<double>(now_micros - last_arrival_time_micros_) /
+              (*task)->size(),
+          &micros_per_arriving_task_unit_);
+    }
+    last_arrival_time_micros_ = now_micros;
+    has_arrival_ = true;
+
+    // Any batch that this task closes, or makes eligible, needs a batch thread.
+    const size_t num_batches_before = batches_.size();
+    const bool open_batch_was_schedulable = IsOpenBatchSchedulable();
+
+    // The tasks to add, which are the pieces of '*task' if it gets split.
+    std::vector<std::unique_ptr<TaskType>> tasks_to_add;
+    const int open_batch_remaining_slot =
+        std::max<int>(0, options_.max_batch_size -
+                             static_cast<int>(batches_.back()->size()));
+    if ((*task)->size() > open_batch_remaining_slot &&
+        options_.enable_large_batch_splitting) {
+      const int num_new_batches =
+          ((*task)->size() - open_batch_remaining_slot +
+           options_.max_batch_size - 1) /
+          options_.max_batch_size;
+      if (batches_.size() + num_new_batches > options_.max_enqueued_batches) {
         return errors::Unavailable(
             "The batch scheduling queue to which this task was submitted is "
             "full");
       }
-      StartNewBatch();
-    }
-    if (batches_.back()->empty()) {
-      open_batch_start_time_micros_ = env_->NowMicros();
+      TF_RETURN_IF_ERROR(options_.split_input_task_func(
+          task, open_batch_remaining_slot, options_.max_batch_size,
+          &tasks_to_add));
+    } else {
+      if ((*task)->size() > open_batch_remaining_slot &&
+          batches_.size() >= options_.max_enqueued_batches) {
+        return errors::Unavailable(
+            "The batch scheduling queue to which this task was submitted is "
+            "full");
+      }
+      tasks_to_add.push_back(std::move(*task));
     }
-    batches_.back()->AddTask(std::move(*task));
 
-    if (!schedulable_batch_) {
-      if (batches_.size() > 1 || IsOpenBatchSchedulable()) {
-        schedulable_batch_ = true;
-        notify_of_schedulable_batch = true;
+    for (std::unique_ptr<TaskType>& task_to_add : tasks_to_add) {
+      if (batches_.back()->size() + task_to_add->size() >
+          options_.max_batch_size) {
+        StartNewBatch();
+      }
+      if (batches_.back()->empty()) {
+        open_batch_start_time_micros_ = env_->NowMicros();
+        if (batches_.size() == 1) {
+          // The queue has a deadline again, which idle batch threads must
+          // learn about.
+          notify_of_schedulable_batch = true;
+        }
       }
+      batches_.back()->AddTask(std::move(task_to_add));
     }
+
+    // Notify on every batch that becomes eligible, not just the first one: the
+    // batch threads may all be busy with (or past) the earlier ones.
+    const bool open_batch_is_schedulable = IsOpenBatchSchedulable();
+    if (batches_.size() > num_batches_before ||
+        (open_batch_is_schedulable && !open_batch_was_schedulable)) {
+      notify_of_schedulable_batch = true;
+    }
+    schedulable_batch_ = batches_.size() > 1 || open_batch_is_schedulable;
+    PublishNextBatchDeadline();
   }
 
   if (notify_of_schedulable_batch) {
@@ -578,10 +989,11 @@ size_t Queue<TaskType>::NumEnqueuedTasks() const {
 template <typename TaskType>
 size_t Queue<TaskType>::SchedulingCapacity() const {
   mutex_lock l(mu_);
-  const int num_new_batches_schedulable =
-      options_.max_enqueued_batches - batches_.size();
-  const int open_batch_capacity =
-      options_.max_batch_size - batches_.back()->size();
+  // Either term can be negative right after SetOptions() lowered the limits.
+  const int num_new_batches_schedulable = std::max<int>(
+      0, options_.max_enqueued_batches - static_cast<int>(batches_.size()));
+  const int open_batch_capacity = std::max<int>(
+      0, options_.max_batch_size - static_cast<int>(batches_.back()->size()));
   return (num_new_batches_schedulable * options_.max_batch_size) +
          open_batch_capacity;
 }
@@ -596,18 +1008,29 @@ std::unique_ptr<Batch<TaskType>> Queue<TaskType>::ScheduleBatch() {
     mutex_lock l(mu_);
 
     // Consider closing the open batch at this time, to schedule it.
-    if (batches_.size() == 1 && IsOpenBatchSchedulable()) {
-      StartNewBatch();
+    if (batches_.size() == 1) {
+      const OpenBatchDispatchReason reason = GetOpenBatchDispatchReason();
+      if (reason != OpenBatchDispatchReason::kNotSchedulable) {
+        static monitoring::CounterCell* const cells[] = {
+            nullptr, OpenBatchDispatches()->GetCell("closed"),
+            OpenBatchDispatches()->GetCell("full"),
+            OpenBatchDispatches()->GetCell("timeout"),
+            OpenBatchDispatches()->GetCell("speculative")};
+        cells[static_cast<int>(reason)]->IncrementBy(1);
+        StartNewBatch();
+      }
     }
 
     if (batches_.size() >= 2) {
       // There is at least one closed batch that is ready to be scheduled.
+      FormClosedBatches();
       ++num_batches_being_processed_;
       batch_to_schedule = std::move(batches_.front());
       batches_.pop_front();
-    } else {
-      schedulable_batch_ = false;
+      closed_batch_start_times_micros_.pop_front();
     }
+    schedulable_batch_ = batches_.size() > 1 || IsOpenBatchSchedulable();
+    PublishNextBatchDeadline();
   }
 
   return batch_to_schedule;
@@ -615,10 +1038,24 @@ std::unique_ptr<Batch<TaskType>> Queue<TaskType>::ScheduleBatch() {
 
 template <typename TaskType>
 void Queue<TaskType>::ProcessBatch(std::unique_ptr<Batch<TaskType>> batch) {
+  // The batch is processed until it is destroyed, which may be after the
+  // callback returns if the callback hands it on to later stages (e.g. those of
+  // a pipeline).
+  Env* const env = env_;
+  const uint64 start_time_micros = env->NowMicros();
+  std::shared_ptr<BatchProcessingTime> processing_time = batch_processing_time_;
+  batch->SetDestructionCallback([env, start_time_micros, processing_time]() {
+    const uint64 end_time_micros = env->NowMicros();
+    mutex_lock l(processing_time->mu);
+    UpdateMovingAverage(end_time_micros - start_time_micros,
+                        &processing_time->average_micros);
+  });
   process_batch_callback_(std::move(batch));
 
   {
     mutex_lock l(mu_);
+    // A new estimate may make the open batch eligible.
+    PublishNextBatchDeadline();
     --num_batches_being_processed_;
     if (empty_notification_ != nullptr && IsEmptyInternal()) {
       empty_notification_->Notify();
@@ -626,6 +1063,25 @@ void Queue<TaskType>::ProcessBatch(std::unique_ptr<Batch<TaskType>> batch) {
   }
 }
 
+template <typename TaskType>
+bool Queue<TaskType>::SetOptions(
+    const typename SharedBatchScheduler<TaskType>::QueueOptions& options) {
+  mutex_lock l(mu_);
+  options_ = options;
+  if (batches_.back()->size() > options_.max_batch_size) {
+    // Don't let the open batch grow any further under the new limit.
+    StartNewBatch();
+  }
+  PublishNextBatchDeadline();
+  // A smaller size or timeout may have made a batch schedulable right away.
+  if (!schedulable_batch_ &&
+      (batches_.size() > 1 || IsOpenBatchSchedulable())) {
+    schedulable_batch_ = true;
+    return true;
+  }
+  return false;
+}
+
 template <typename TaskType>
 bool Queue<TaskType>::IsEmpty() const {
   mutex_lock l(mu_);
@@ -644,7 +1100,11 @@ void Queue<TaskType>::CloseAndWaitUntilEmpty() {
       // Arrange for ProcessBatch() to notify when the queue becomes empty.
       empty_notification_ = &empty;
     }
+    PublishNextBatchDeadline();
   }
+  // The open batch, if any, is schedulable now; and if the queue is empty, a
+  // batch thread has to come and drop it.
+  schedulable_batch_callback_();
   empty.WaitForNotification();
 }
 
@@ -657,18 +1117,164 @@ bool Queue<TaskType>::IsEmptyInternal() const {
 template <typename TaskType>
 void Queue<TaskType>::StartNewBatch() {
   batches_.back()->Close();
+  closed_batch_start_times_micros_.push_back(open_batch_start_time_micros_);
   batches_.emplace_back(new Batch<TaskType>);
 }
 
 template <typename TaskType>
-bool Queue<TaskType>::IsOpenBatchSchedulable() const {
+typename Queue<TaskType>::OpenBatchDispatchReason
+Queue<TaskType>::GetOpenBatchDispatchReason() const {
   Batch<TaskType>* open_batch = batches_.back().get();
   if (open_batch->empty()) {
+    return OpenBatchDispatchReason::kNotSchedulable;
+  }
+  if (closed_) {
+    return OpenBatchDispatchReason::kClosed;
+  }
+  if (open_batch->size() >= options_.max_batch_size) {
+    return OpenBatchDispatchReason::kFull;
+  }
+  if (env_->NowMicros() >=
+      open_batch_start_time_micros_ + options_.batch_timeout_micros) {
+    return OpenBatchDispatchReason::kTimeout;
+  }
+  if (ShouldDispatchOpenBatchEarly()) {
+    return OpenBatchDispatchReason::kSpeculative;
+  }
+  return OpenBatchDispatchReason::kNotSchedulable;
+}
+
+template <typename TaskType>
+bool Queue<TaskType>::IsOpenBatchSchedulable() const {
+  return GetOpenBatchDispatchReason() !=
+         OpenBatchDispatchReason::kNotSchedulable;
+}
+
+template <typename TaskType>
+bool Queue<TaskType>::ShouldDispatchOpenBatchEarly() const {
+  if (!options_.enable_speculative_dispatch || batches_.back()->empty()) {
     return false;
   }
-  return closed_ || open_batch->size() >= options_.max_batch_size ||
-         env_->NowMicros() >=
-             open_batch_start_time_micros_ + options_.batch_timeout_micros;
+  // Without an observed arrival rate, there is no sign of more tasks coming.
+  if (micros_per_arriving_task_unit_ < 0) {
+    return true;
+  }
+  const int remaining_slots =
+      options_.max_batch_size - static_cast<int>(batches_.back()->size());
+  const double fill_micros = remaining_slots * micros_per_arriving_task_unit_;
+  mutex_lock l(batch_processing_time_->mu);
+  return fill_micros > std::max(batch_processing_time_->average_micros, 0.0);
+}
+
+template <typename TaskType>
+void Queue<TaskType>::UpdateMovingAverage(const double sample,
+                                          double* average) {
+  *average = *average < 0 ? sample
+                          : kSpeculativeDispatchSmoothing * sample +
+                                (1 - kSpeculativeDispatchSmoothing) * *average;
+}
+
+template <typename TaskType>
+void Queue<TaskType>::FormClosedBatches() {
+  const int num_closed_batches = batches_.size() - 1;
+  const uint64 now_micros = env_->NowMicros();
+  auto is_expired = [now_micros](const TaskType& task) {
+    return task.deadline_micros() <= now_micros;
+  };
+  // Whether 'a' goes into a batch before 'b', among unexpired tasks.
+  auto ranks_before = [](const TaskType& a, const TaskType& b) {
+    if (a.priority() != b.priority()) {
+      return a.priority() > b.priority();
+    }
+    return a.deadline_micros() < b.deadline_micros();
+  };
+
+  // Nothing to do unless a task has expired or is out of order, which is rare
+  // as long as tasks arrive with a uniform priority and timeout.
+  bool formed = true;
+  const TaskType* previous_task = nullptr;
+  for (int i = 0; formed && i < num_closed_batches; ++i) {
+    const Batch<TaskType>& batch = *batches_[i];
+    for (int j = 0; formed && j < batch.num_tasks(); ++j) {
+      const TaskType& task = batch.task(j);
+      if (is_expired(task) ||
+          (previous_task != nullptr && ranks_before(task, *previous_task))) {
+        formed = false;
+      }
+      previous_task = &task;
+    }
+  }
+  if (formed) {
+    return;
+  }
+
+  std::vector<std::unique_ptr<TaskType>> tasks;
+  for (int i = 0; i < num_closed_batches; ++i) {
+    const size_t first_task = tasks.size();
+    while (!batches_[i]->empty()) {
+      tasks.push_back(batches_[i]->RemoveTask());
+    }
+    std::reverse(tasks.begin() + first_task, tasks.end());
+  }
+  const auto first_unexpired_task = std::stable_partition(
+      tasks.begin(), tasks.end(),
+      [&is_expired](const std::unique_ptr<TaskType>& task) {
+        return is_expired(*task);
+      });
+  std::stable_sort(first_unexpired_task, tasks.end(),
+                   [&ranks_before](const std::unique_ptr<TaskType>& a,
+                                   const std::unique_ptr<TaskType>& b) {
+                     return ranks_before(*a, *b);
+                   });
+
+  std::deque<std::unique_ptr<Batch<TaskType>>> closed_batches;
+  for (auto it = tasks.begin(); it != tasks.end(); ++it) {
+    if (closed_batches.empty() || it == first_unexpired_task ||
+        closed_batches.back()->size() + (*it)->size() >
+            options_.max_batch_size) {
+      if (!closed_batches.empty()) {
+        closed_batches.back()->Close();
+      }
+      closed_batches.emplace_back(new Batch<TaskType>);
+    }
+    closed_batches.back()->AddTask(std::move(*it));
+  }
+  closed_batches.back()->Close();
+
+  // The re-formed batches are all due by the deadline of the front-most one.
+  const uint64 front_batch_start_time_micros =
+      closed_batch_start_times_micros_.front();
+  closed_batch_start_times_micros_.assign(closed_batches.size(),
+                                          front_batch_start_time_micros);
+  std::unique_ptr<Batch<TaskType>> open_batch = std::move(batches_.back());
+  batches_ = std::move(closed_batches);
+  batches_.push_back(std::move(open_batch));
+}
+
+template <typename TaskType>
+uint64 Queue<TaskType>::NextBatchDeadlineMicros(bool* eligible) const {
+  *eligible = next_batch_eligible_.load(std::memory_order_acquire);
+  return next_batch_deadline_micros_.load(std::memory_order_acquire);
+}
+
+template <typename TaskType>
+void Queue<TaskType>::PublishNextBatchDeadline() {
+  uint64 deadline_micros = kNoDeadlineMicros;
+  bool eligible = false;
+  if (batches_.size() > 1) {
+    deadline_micros = closed_batch_start_times_micros_.front() +
+                      options_.batch_timeout_micros;
+    eligible = true;
+  } else if (!batches_.back()->empty()) {
+    deadline_micros =
+        open_batch_start_time_micros_ + options_.batch_timeout_micros;
+    eligible = closed_ ||
+               batches_.back()->size() >= options_.max_batch_size ||
+               ShouldDispatchOpenBatchEarly();
+  }
+  next_batch_eligible_.store(eligible, std::memory_order_release);
+  next_batch_deadline_micros_.store(deadline_micros,
+                                    std::memory_order_release);
 }
 
 template <typename TaskType>
@@ -0,0 +1,223 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Benchmarks for the dispatch latency of SharedBatchScheduler, i.e. how long
+// batches wait for a batch thread after becoming eligible, with several queues
+// sharing the batch threads, under low and high rates of task injection.
+//
+// Run with:
+// bazel run -c opt \
+// tensorflow/contrib/batching:shared_batch_scheduler_benchmark
+
+#include <limits.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "tensorflow/contrib/batching/shared_batch_scheduler.h"
+#include "tensorflow/core/lib/histogram/histogram.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/init_main.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+using ::tensorflow::histogram::Histogram;
+
+constexpr int kMaxBatchSize = 100;
+
+class BenchmarkBatchTask : public BatchTask {
+ public:
+  BenchmarkBatchTask();
+
+  BenchmarkBatchTask(const BenchmarkBatchTask&) = delete;
+  BenchmarkBatchTask& operator=(const BenchmarkBatchTask&) = delete;
+
+  ~BenchmarkBatchTask() override = default;
+
+  size_t size() const override { return 1; }
+
+  uint64 start_time_micros() const { return start_time_micros_; }
+
+ private:
+  // The time at which the task was created, in microseconds.
+  const uint64 start_time_micros_;
+};
+
+BenchmarkBatchTask::BenchmarkBatchTask()
+    : start_time_micros_(Env::Default()->NowMicros()) {}
+
+// The state and logic associated with a latency benchmark, which injects tasks
+// round-robin into several queues of a SharedBatchScheduler at a controlled
+// rate, and measures how late batches start relative to their deadline, as
+// well as the task queueing latencies.
+//
+// Reports the measurements to std::cout (not LOG(INFO)).
+class DispatchLatencyBenchmark {
+ public:
+  DispatchLatencyBenchmark(int num_queues,
+                           int64 task_injection_interval_micros,
+                           int64 batch_timeout_micros);
+
+  DispatchLatencyBenchmark(const DispatchLatencyBenchmark&) = delete;
+  DispatchLatencyBenchmark& operator=(const DispatchLatencyBenchmark&) =
+      delete;
+
+  // Perform the benchmark run, based on the parameters supplied to the ctor.
+  void RunBenchmark();
+
+ private:
+  // Processes a batch of tasks. (Invoked by the scheduler on one of its batch
+  // threads.)
+  void ProcessBatch(std::unique_ptr<Batch<BenchmarkBatchTask>> batch);
+
+  const int num_queues_;
+  const int64 task_injection_interval_micros_;
+  const int64 batch_timeout_micros_;
+
+  mutable mutex mu_;
+
+  // A histogram of how long after its deadline each batch that was closed by
+  // its timeout started being processed, in milliseconds.
+  Histogram dispatch_delay_millis_histogram_ GUARDED_BY(mu_);
+
+  // A histogram of the task queueing latencies, i.e. the time from a task's
+  // creation until its batch starts being processed, in milliseconds.
+  Histogram task_latency_millis_histogram_ GUARDED_BY(mu_);
+};
+
+DispatchLatencyBenchmark::DispatchLatencyBenchmark(
+    int num_queues, int64 task_injection_interval_micros,
+    int64 batch_timeout_micros)
+    : num_queues_(num_queues),
+      task_injection_interval_micros_(task_injection_interval_micros),
+      batch_timeout_micros_(batch_timeout_micros) {}
+
+void DispatchLatencyBenchmark::RunBenchmark() {
+  SharedBatchScheduler<BenchmarkBatchTask>::Options options;
+  options.num_batch_threads = 2;
+  std::shared_ptr<SharedBatchScheduler<BenchmarkBatchTask>> scheduler;
+  TF_CHECK_OK(
+      SharedBatchScheduler<BenchmarkBatchTask>::Create(options, &scheduler));
+
+  SharedBatchScheduler<BenchmarkBatchTask>::QueueOptions queue_options;
+  queue_options.max_batch_size = kMaxBatchSize;
+  queue_options.batch_timeout_micros = batch_timeout_micros_;
+  queue_options.max_enqueued_batches = INT_MAX;  // Unbounded queue.
+  std::vector<std::unique_ptr<BatchScheduler<BenchmarkBatchTask>>> queues(
+      num_queues_);
+  for (auto& queue : queues) {
+    TF_CHECK_OK(scheduler->AddQueue(
+        queue_options,
+        [this](std::unique_ptr<Batch<BenchmarkBatchTask>> batch) {
+          ProcessBatch(std::move(batch));
+        },
+        &queue));
+  }
+
+  // Inject tasks at the specified rate, for a fixed total time duration.
+  const int64 kTimeDurationMicros = 10 * 1000 * 1000 /* 10 seconds */;
+  const int64 num_tasks = kTimeDurationMicros / task_injection_interval_micros_;
+  const int64 start_time_micros = Env::Default()->NowMicros();
+  for (int64 i = 0; i < num_tasks; ++i) {
+    auto task = std::unique_ptr<BenchmarkBatchTask>(new BenchmarkBatchTask);
+    TF_CHECK_OK(queues[i % num_queues_]->Schedule(&task));
+
+    const int64 next_injection_time_micros =
+        start_time_micros + (i + 1) * task_injection_interval_micros_;
+    int64 now_micros = Env::Default()->NowMicros();
+    while (now_micros < next_injection_time_micros) {
+      const int64 kSleepThresholdMicros = 1000;
+      if (next_injection_time_micros - now_micros >= kSleepThresholdMicros) {
+        Env::Default()->SleepForMicroseconds(1 /* minimum time */);
+      }
+      now_micros = Env::Default()->NowMicros();
+    }
+  }
+
+  // Wait for the scheduler to process all injected tasks.
+  queues.clear();
+  scheduler.reset();
+
+  // Report benchmark measurements.
+  mutex_lock l(mu_);
+  std::cout << "\t"
+            << "50% dispatch delay: "
+            << dispatch_delay_millis_histogram_.Percentile(50) << "ms"
+            << "\t"
+            << "99% dispatch delay: "
+            << dispatch_delay_millis_histogram_.Percentile(99) << "ms"
+            << "\t"
+            << "99.9% queueing latency: "
+            << task_latency_millis_histogram_.Percentile(99.9) << "ms"
+            << std::endl;
+}
+
+void DispatchLatencyBenchmark::ProcessBatch(
+    std::unique_ptr<Batch<BenchmarkBatchTask>> batch) {
+  const uint64 batch_start_time_micros = Env::Default()->NowMicros();
+
+  mutex_lock l(mu_);
+  if (batch->size() < kMaxBatchSize) {
+    // The batch was closed by its timeout.
+    const uint64 deadline_micros =
+        batch->task(0).start_time_micros() + batch_timeout_micros_;
+    const uint64 delay_micros = batch_start_time_micros > deadline_micros
+                                    ? batch_start_time_micros - deadline_micros
+                                    : 0;
+    dispatch_delay_millis_histogram_.Add(delay_micros / 1000.0);
+  }
+  for (int i = 0; i < batch->num_tasks(); ++i) {
+    task_latency_millis_histogram_.Add(
+        (batch_start_time_micros - batch->task(i).start_time_micros()) /
+        1000.0);
+  }
+}
+
+static void RunLatencyBenchmarks() {
+  const int kNumQueues = 4;
+  for (const int64 batch_timeout_micros : {1 * 1000, 5 * 1000}) {
+    // Low load: batches are closed by their timeout, and batch threads are
+    // mostly idle. High load: batches are mostly full.
+    for (const int64 task_injection_interval_micros : {5000, 500, 20}) {
+      std::cout << "Dispatch latency benchmark w/ " << kNumQueues
+                << " queues; batch timeout " << batch_timeout_micros / 1000.0
+                << "ms"
+                << "; "
+                << "task injection rate "
+                << 1000000.0 / task_injection_interval_micros << "/sec"
+                << "\t...";
+      DispatchLatencyBenchmark benchmark(
+          kNumQueues, task_injection_interval_micros, batch_timeout_micros);
+      benchmark.RunBenchmark();
+    }
+    std::cout << std::endl;
+  }
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
+
+int main(int argc, char** argv) {
+  tensorflow::port::InitMain(argv[0], &argc, &argv);
+  std::cout << std::setprecision(5);
+  tensorflow::serving::RunLatencyBenchmarks();
+  return 0;
+}
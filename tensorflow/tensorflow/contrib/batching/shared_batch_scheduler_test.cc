@@ -15,10 +15,13 @@ limitations under the License.
 
 #include "tensorflow/contrib/batching/shared_batch_scheduler.h"
 
+#include <set>
+
 #include "tensorflow/contrib/batching/test_util/fake_clock_env.h"
 #include "tensorflow/core/lib/core/error_codes.pb.h"
 #include "tensorflow/core/lib/core/notification.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/cpu_info.h"
 #include "tensorflow/core/platform/macros.h"
 #include "tensorflow/core/platform/test.h"
 
@@ -28,14 +31,22 @@ namespace {
 
 class FakeTask : public BatchTask {
  public:
-  explicit FakeTask(size_t size) : size_(size) {}
+  explicit FakeTask(size_t size, int priority = 0,
+                    uint64 deadline_micros = kNoDeadlineMicros)
+      : size_(size), priority_(priority), deadline_micros_(deadline_micros) {}
 
   ~FakeTask() override = default;
 
   size_t size() const override { return size_; }
 
+  int priority() const override { return priority_; }
+
+  uint64 deadline_micros() const override { return deadline_micros_; }
+
  private:
   const size_t size_;
+  const int priority_;
+  const uint64 deadline_micros_;
 
   TF_DISALLOW_COPY_AND_ASSIGN(FakeTask);
 };
@@ -187,6 +198,67 @@ TEST(SharedBatchSchedulerTest, ObeyBatchSizeConstraint) {
   EXPECT_EQ((std::vector<size_t>{3, 1, 6}), callback_data_b);
 }
 
+TEST(SharedBatchSchedulerTest, SplitsLargeTasks) {
+  // Set up a callback that captures the batches' task sizes.
+  mutex mu;
+  std::vector<std::vector<size_t>> callback_data;
+  auto callback = [&mu,
+                   &callback_data](std::unique_ptr<Batch<FakeTask>> batch) {
+    ASSERT_TRUE(batch->IsClosed());
+    std::vector<size_t> batch_data;
+    for (int i = 0; i < batch->num_tasks(); ++i) {
+      batch_data.push_back(batch->task(i).size());
+    }
+    mutex_lock l(mu);
+    callback_data.push_back(batch_data);
+  };
+  auto split_input_task_func =
+      [](std::unique_ptr<FakeTask>* input_task, int open_batch_remaining_slot,
+         int max_batch_size,
+         std::vector<std::unique_ptr<FakeTask>>* output_tasks) {
+        size_t remaining_size = (*input_task)->size();
+        size_t piece_size = open_batch_remaining_slot > 0
+                                ? open_batch_remaining_slot
+                                : max_batch_size;
+        while (remaining_size > 0) {
+          piece_size = std::min(piece_size, remaining_size);
+          output_tasks->emplace_back(new FakeTask(piece_size));
+          remaining_size -= piece_size;
+          piece_size = max_batch_size;
+        }
+        input_task->reset();
+        return Status::OK();
+      };
+
+  {
+    SharedBatchScheduler<FakeTask>::Options options;
+    options.num_batch_threads = 1;
+    std::shared_ptr<SharedBatchScheduler<FakeTask>> scheduler;
+    TF_ASSERT_OK(SharedBatchScheduler<FakeTask>::Create(options, &scheduler));
+    SharedBatchScheduler<FakeTask>::QueueOptions queue_options;
+    queue_options.max_batch_size = 10;
+    queue_options.batch_timeout_micros = 10 * 1000 * 1000;  // 10 seconds
+    queue_options.max_enqueued_batches = 3;
+    queue_options.enable_large_batch_splitting = true;
+    std::unique_ptr<BatchScheduler<FakeTask>> queue;
+    EXPECT_FALSE(scheduler->AddQueue(queue_options, callback, &queue).ok());
+    queue_options.split_input_task_func = split_input_task_func;
+    TF_ASSERT_OK(scheduler->AddQueue(queue_options, callback, &queue));
+
+    TF_ASSERT_OK(ScheduleTask(3, queue.get()));
+    // Would need a fourth batch.
+    EXPECT_EQ(error::UNAVAILABLE, ScheduleTask(28, queue.get()).code());
+    // Tops up the first batch, fills the second, and opens the third.
+    TF_ASSERT_OK(ScheduleTask(21, queue.get()));
+    EXPECT_EQ(4, queue->NumEnqueuedTasks());
+  }
+
+  ASSERT_EQ(3, callback_data.size());
+  EXPECT_EQ((std::vector<size_t>{3, 7}), callback_data[0]);
+  EXPECT_EQ((std::vector<size_t>{10}), callback_data[1]);
+  EXPECT_EQ((std::vector<size_t>{4}), callback_data[2]);
+}
+
 TEST(SharedBatchSchedulerTest, ObeysTimeout) {
   // Set up a fake clock, which only advances when we explicitly tell it to.
   test_util::FakeClockEnv env(Env::Default());
@@ -255,6 +327,141 @@ TEST(SharedBatchSchedulerTest, ObeysTimeout) {
   stop_teardown.Notify();
 }
 
+TEST(SharedBatchSchedulerTest, SpeculativeDispatch) {
+  test_util::FakeClockEnv env(Env::Default());
+  Notification start_teardown, stop_teardown;
+  std::unique_ptr<Thread> teardown_thread =
+      CreateFakeClockAdvancerThread(&env, &start_teardown, &stop_teardown);
+  auto num_dispatches = [](const string& reason) {
+    return internal::OpenBatchDispatches()->GetCell(reason)->value();
+  };
+  const int64 initial_speculative_dispatches = num_dispatches("speculative");
+  const int64 initial_timeout_dispatches = num_dispatches("timeout");
+
+  {
+    mutex mu;
+    std::vector<size_t> batch_sizes;
+    auto callback = [&mu,
+                     &batch_sizes](std::unique_ptr<Batch<FakeTask>> batch) {
+      mutex_lock l(mu);
+      batch_sizes.push_back(batch->size());
+    };
+    auto wait_for_num_batches = [&mu, &batch_sizes](int num_batches) {
+      for (;;) {
+        {
+          mutex_lock l(mu);
+          if (batch_sizes.size() >= num_batches) return;
+        }
+        Env::Default()->SleepForMicroseconds(1000);
+      }
+    };
+
+    SharedBatchScheduler<FakeTask>::Options options;
+    options.num_batch_threads = 1;
+    options.env = &env;
+    std::shared_ptr<SharedBatchScheduler<FakeTask>> scheduler;
+    TF_ASSERT_OK(SharedBatchScheduler<FakeTask>::Create(options, &scheduler));
+    SharedBatchScheduler<FakeTask>::QueueOptions queue_options;
+    queue_options.max_batch_size = 4;
+    queue_options.batch_timeout_micros = 1000;
+    queue_options.enable_speculative_dispatch = true;
+    std::unique_ptr<BatchScheduler<FakeTask>> queue;
+    TF_ASSERT_OK(scheduler->AddQueue(queue_options, callback, &queue));
+
+    // With no arrival rate observed yet, the first task goes out right away.
+    TF_ASSERT_OK(ScheduleTask(1, queue.get()));
+    wait_for_num_batches(1);
+
+    // Tasks arriving back to back fill batches faster than they are processed,
+    // so the batch waits for the timeout.
+    TF_ASSERT_OK(ScheduleTask(1, queue.get()));
+    TF_ASSERT_OK(ScheduleTask(1, queue.get()));
+    Env::Default()->SleepForMicroseconds(10 * 1000 /* 10 milliseconds */);
+    {
+      mutex_lock l(mu);
+      EXPECT_EQ(1, batch_sizes.size());
+    }
+    env.AdvanceByMicroseconds(1000);
+    wait_for_num_batches(2);
+
+    // After a long lull, the batch is not expected to fill up in time.
+    env.AdvanceByMicroseconds(1000 * 1000);
+    TF_ASSERT_OK(ScheduleTask(1, queue.get()));
+    wait_for_num_batches(3);
+    {
+      mutex_lock l(mu);
+      EXPECT_EQ((std::vector<size_t>{1, 2, 1}), batch_sizes);
+    }
+
+    start_teardown.Notify();
+  }
+  stop_teardown.Notify();
+
+  EXPECT_EQ(2, num_dispatches("speculative") - initial_speculative_dispatches);
+  EXPECT_EQ(1, num_dispatches("timeout") - initial_timeout_dispatches);
+}
+
+TEST(SharedBatchSchedulerTest, SpeculativeDispatchTimesBatchesUntilDestroyed) {
+  test_util::FakeClockEnv env(Env::Default());
+  Notification start_teardown, stop_teardown;
+  std::unique_ptr<Thread> teardown_thread =
+      CreateFakeClockAdvancerThread(&env, &start_teardown, &stop_teardown);
+
+  // The callback hands every batch on, like the first stage of a pipeline.
+  mutex mu;
+  std::vector<std::unique_ptr<Batch<FakeTask>>> batches;
+  auto callback = [&mu, &batches](std::unique_ptr<Batch<FakeTask>> batch) {
+    mutex_lock l(mu);
+    batches.push_back(std::move(batch));
+  };
+  auto num_batches = [&mu, &batches]() {
+    mutex_lock l(mu);
+    return batches.size();
+  };
+  auto wait_for_num_batches = [&num_batches](int num) {
+    while (num_batches() < num) {
+      Env::Default()->SleepForMicroseconds(1000);
+    }
+  };
+  {
+    SharedBatchScheduler<FakeTask>::Options options;
+    options.num_batch_threads = 1;
+    options.env = &env;
+    std::shared_ptr<SharedBatchScheduler<FakeTask>> scheduler;
+    TF_ASSERT_OK(SharedBatchScheduler<FakeTask>::Create(options, &scheduler));
+    SharedBatchScheduler<FakeTask>::QueueOptions queue_options;
+    queue_options.max_batch_size = 4;
+    queue_options.batch_timeout_micros = 1000;
+    queue_options.enable_speculative_dispatch = true;
+    std::unique_ptr<BatchScheduler<FakeTask>> queue;
+    TF_ASSERT_OK(scheduler->AddQueue(queue_options, callback, &queue));
+
+    // The first task goes out right away. Its batch is processed, i.e. held,
+    // for 500 microseconds after the callback has returned.
+    TF_ASSERT_OK(ScheduleTask(1, queue.get()));
+    wait_for_num_batches(1);
+    env.AdvanceByMicroseconds(500);
+    {
+      mutex_lock l(mu);
+      batches.front().reset();
+    }
+
+    // The last slot is expected to fill in under 200 microseconds, sooner than
+    // a batch is processed, so the batch waits for the timeout.
+    TF_ASSERT_OK(ScheduleTask(3, queue.get()));
+    Env::Default()->SleepForMicroseconds(10 * 1000 /* 10 milliseconds */);
+    EXPECT_EQ(1, num_batches());
+    env.AdvanceByMicroseconds(1000);
+    wait_for_num_batches(2);
+
+    start_teardown.Notify();
+  }
+  stop_teardown.Notify();
+  // Batches may outlive their queue.
+  mutex_lock l(mu);
+  batches.clear();
+}
+
 TEST(SharedBatchSchedulerTest, ObeysTimeoutWithRealClock) {
   Notification first_batch_processed, second_batch_processed;
   auto callback = [&first_batch_processed, &second_batch_processed](
@@ -290,6 +497,45 @@ TEST(SharedBatchSchedulerTest, ObeysTimeoutWithRealClock) {
   second_batch_processed.WaitForNotification();
 }
 
+TEST(SharedBatchSchedulerTest, FullBatchWakesIdleThreadWhileOtherIsBusy) {
+  Notification first_batch_started, second_batch_processed;
+  auto callback = [&first_batch_started, &second_batch_processed](
+      std::unique_ptr<Batch<FakeTask>> batch) {
+    ASSERT_TRUE(batch->IsClosed());
+    if (!first_batch_started.HasBeenNotified()) {
+      first_batch_started.Notify();
+      // Keep this thread busy until the other one has run the second batch.
+      second_batch_processed.WaitForNotification();
+    } else {
+      second_batch_processed.Notify();
+    }
+  };
+
+  SharedBatchScheduler<FakeTask>::Options options;
+  options.num_batch_threads = 2;
+  std::shared_ptr<SharedBatchScheduler<FakeTask>> scheduler;
+  TF_ASSERT_OK(SharedBatchScheduler<FakeTask>::Create(options, &scheduler));
+  SharedBatchScheduler<FakeTask>::QueueOptions queue_options;
+  queue_options.max_batch_size = 10;
+  queue_options.batch_timeout_micros = 10 * 1000 * 1000;  // 10 seconds
+  queue_options.max_enqueued_batches = 2;
+  std::unique_ptr<BatchScheduler<FakeTask>> queue;
+  TF_ASSERT_OK(scheduler->AddQueue(queue_options, callback, &queue));
+
+  TF_ASSERT_OK(ScheduleTask(10, queue.get()));
+  first_batch_started.WaitForNotification();
+
+  // The second batch fills while the first is still being processed, in two
+  // tasks: the first gives the idle thread a deadline to sleep until, and the
+  // second must wake it up right away.
+  const uint64 start_micros = Env::Default()->NowMicros();
+  TF_ASSERT_OK(ScheduleTask(5, queue.get()));
+  Env::Default()->SleepForMicroseconds(10 * 1000);
+  TF_ASSERT_OK(ScheduleTask(5, queue.get()));
+  second_batch_processed.WaitForNotification();
+  EXPECT_LT(Env::Default()->NowMicros() - start_micros, 1000 * 1000);
+}
+
 TEST(SharedBatchSchedulerTest,
      WithZeroTimeoutBatchesScheduledAsSoonAsThreadIsAvailable) {
   // Set up a fake clock, and never advance the time.
@@ -408,6 +654,216 @@ TEST(SharedBatchSchedulerTest, Fairness) {
   stop_teardown.Notify();
 }
 
+TEST(SharedBatchSchedulerTest, EarliestDeadlineFirst) {
+  test_util::FakeClockEnv env(Env::Default());
+  Notification start_teardown, stop_teardown;
+  std::unique_ptr<Thread> teardown_thread =
+      CreateFakeClockAdvancerThread(&env, &start_teardown, &stop_teardown);
+
+  {
+    Notification blocking_batch_scheduled, blocking_batch_proceed;
+    auto blocking_callback = [&blocking_batch_scheduled,
+                              &blocking_batch_proceed](
+        std::unique_ptr<Batch<FakeTask>> batch) {
+      blocking_batch_scheduled.Notify();
+      blocking_batch_proceed.WaitForNotification();
+    };
+
+    mutex mu;
+    std::vector<string> processed_queues;
+    Notification both_batches_processed;
+    auto callback_for = [&mu, &processed_queues,
+                         &both_batches_processed](const string& name) {
+      return [&mu, &processed_queues, &both_batches_processed,
+              name](std::unique_ptr<Batch<FakeTask>> batch) {
+        mutex_lock l(mu);
+        processed_queues.push_back(name);
+        if (processed_queues.size() == 2) {
+          both_batches_processed.Notify();
+        }
+      };
+    };
+
+    SharedBatchScheduler<FakeTask>::Options options;
+    options.num_batch_threads = 1;
+    options.env = &env;
+    std::shared_ptr<SharedBatchScheduler<FakeTask>> scheduler;
+    TF_ASSERT_OK(SharedBatchScheduler<FakeTask>::Create(options, &scheduler));
+    SharedBatchScheduler<FakeTask>::QueueOptions queue_options;
+    queue_options.max_batch_size = 10;
+    queue_options.batch_timeout_micros = 0;
+    std::unique_ptr<BatchScheduler<FakeTask>> blocking_queue;
+    TF_ASSERT_OK(scheduler->AddQueue(queue_options, blocking_callback,
+                                     &blocking_queue));
+    queue_options.batch_timeout_micros = 100;
+    std::unique_ptr<BatchScheduler<FakeTask>> slow_queue;
+    TF_ASSERT_OK(
+        scheduler->AddQueue(queue_options, callback_for("slow"), &slow_queue));
+    queue_options.batch_timeout_micros = 10;
+    std::unique_ptr<BatchScheduler<FakeTask>> fast_queue;
+    TF_ASSERT_OK(
+        scheduler->AddQueue(queue_options, callback_for("fast"), &fast_queue));
+
+    // Occupy the only batch thread.
+    TF_ASSERT_OK(ScheduleTask(1, blocking_queue.get()));
+    blocking_batch_scheduled.WaitForNotification();
+
+    // A full batch in the slow queue is eligible right away, but its deadline
+    // is later than that of the fast queue's batch once the latter times out.
+    // Round-robin would pick the slow queue, which follows the blocking one.
+    TF_ASSERT_OK(ScheduleTask(10, slow_queue.get()));
+    TF_ASSERT_OK(ScheduleTask(1, fast_queue.get()));
+    env.AdvanceByMicroseconds(10);
+    blocking_batch_proceed.Notify();
+    both_batches_processed.WaitForNotification();
+    {
+      mutex_lock l(mu);
+      EXPECT_EQ((std::vector<string>{"fast", "slow"}), processed_queues);
+    }
+
+    start_teardown.Notify();
+  }
+  stop_teardown.Notify();
+}
+
+TEST(SharedBatchSchedulerTest, RejectsExpiredTasks) {
+  SharedBatchScheduler<FakeTask>::Options options;
+  options.num_batch_threads = 1;
+  std::shared_ptr<SharedBatchScheduler<FakeTask>> scheduler;
+  TF_ASSERT_OK(SharedBatchScheduler<FakeTask>::Create(options, &scheduler));
+  SharedBatchScheduler<FakeTask>::QueueOptions queue_options;
+  queue_options.max_batch_size = 10;
+  queue_options.batch_timeout_micros = 0;
+  std::unique_ptr<BatchScheduler<FakeTask>> queue;
+  TF_ASSERT_OK(scheduler->AddQueue(
+      queue_options, [](std::unique_ptr<Batch<FakeTask>> batch) {}, &queue));
+
+  std::unique_ptr<FakeTask> task(
+      new FakeTask(1, 0, Env::Default()->NowMicros() - 1));
+  Status status = queue->Schedule(&task);
+  EXPECT_EQ(error::DEADLINE_EXCEEDED, status.code());
+  EXPECT_NE(nullptr, task);
+  EXPECT_EQ(0, queue->NumEnqueuedTasks());
+}
+
+// Occupies the only batch thread of a scheduler with a batch of a separate
+// queue, while tasks back up in another queue.
+class BackloggedQueueTest : public ::testing::Test {
+ protected:
+  BackloggedQueueTest()
+      : env_(Env::Default()),
+        teardown_thread_(CreateFakeClockAdvancerThread(&env_, &start_teardown_,
+                                                       &stop_teardown_)) {}
+
+  ~BackloggedQueueTest() override {
+    start_teardown_.Notify();
+    queue_.reset();
+    blocking_queue_.reset();
+    scheduler_.reset();
+    stop_teardown_.Notify();
+  }
+
+  // Creates the scheduler and queues, and blocks the batch thread.
+  void BlockBatchThread(int max_batch_size) {
+    SharedBatchScheduler<FakeTask>::Options options;
+    options.num_batch_threads = 1;
+    options.env = &env_;
+    TF_ASSERT_OK(SharedBatchScheduler<FakeTask>::Create(options, &scheduler_));
+    SharedBatchScheduler<FakeTask>::QueueOptions queue_options;
+    queue_options.max_batch_size = max_batch_size;
+    queue_options.batch_timeout_micros = 0;
+    TF_ASSERT_OK(scheduler_->AddQueue(
+        queue_options,
+        [this](std::unique_ptr<Batch<FakeTask>> batch) {
+          blocking_batch_scheduled_.Notify();
+          blocking_batch_proceed_.WaitForNotification();
+        },
+        &blocking_queue_));
+    queue_options.batch_timeout_micros = 1000 * 1000;
+    TF_ASSERT_OK(scheduler_->AddQueue(
+        queue_options,
+        [this](std::unique_ptr<Batch<FakeTask>> batch) {
+          mutex_lock l(mu_);
+          processed_batches_.push_back(std::move(batch));
+          if (processed_batches_.size() == 2) {
+            two_batches_processed_.Notify();
+          }
+        },
+        &queue_));
+
+    TF_ASSERT_OK(ScheduleTask(1, blocking_queue_.get()));
+    blocking_batch_scheduled_.WaitForNotification();
+  }
+
+  // Schedules a task in the backlogged queue.
+  void Schedule(size_t size, int priority, uint64 deadline_micros) {
+    std::unique_ptr<FakeTask> task(
+        new FakeTask(size, priority, deadline_micros));
+    TF_ASSERT_OK(queue_->Schedule(&task));
+  }
+
+  // Unblocks the batch thread, and waits for it to process the first two
+  // batches of the backlogged queue.
+  void ProcessTwoBatches() {
+    blocking_batch_proceed_.Notify();
+    two_batches_processed_.WaitForNotification();
+  }
+
+  test_util::FakeClockEnv env_;
+  Notification start_teardown_, stop_teardown_;
+  std::unique_ptr<Thread> teardown_thread_;
+
+  Notification blocking_batch_scheduled_, blocking_batch_proceed_;
+  Notification two_batches_processed_;
+  mutex mu_;
+  std::vector<std::unique_ptr<Batch<FakeTask>>> processed_batches_
+      GUARDED_BY(mu_);
+
+  std::shared_ptr<SharedBatchScheduler<FakeTask>> scheduler_;
+  std::unique_ptr<BatchScheduler<FakeTask>> blocking_queue_;
+  std::unique_ptr<BatchScheduler<FakeTask>> queue_;
+};
+
+TEST_F(BackloggedQueueTest, HighPriorityTasksAreBatchedFirst) {
+  BlockBatchThread(2);
+  Schedule(1, 0, kNoDeadlineMicros);
+  Schedule(1, 0, kNoDeadlineMicros);
+  Schedule(1, 1, kNoDeadlineMicros);
+  Schedule(1, 1, kNoDeadlineMicros);
+  // Keeps the batches above closed, while this one stays open.
+  Schedule(1, 0, kNoDeadlineMicros);
+  ProcessTwoBatches();
+
+  mutex_lock l(mu_);
+  ASSERT_EQ(2, processed_batches_.size());
+  for (int i = 0; i < 2; ++i) {
+    const Batch<FakeTask>& batch = *processed_batches_[i];
+    ASSERT_EQ(2, batch.num_tasks());
+    EXPECT_EQ(i == 0 ? 1 : 0, batch.task(0).priority());
+    EXPECT_EQ(i == 0 ? 1 : 0, batch.task(1).priority());
+  }
+}
+
+TEST_F(BackloggedQueueTest, ExpiredTasksAreSetApart) {
+  BlockBatchThread(3);
+  env_.AdvanceByMicroseconds(100);
+  Schedule(1, 0, kNoDeadlineMicros);
+  Schedule(1, 0, 200);
+  Schedule(1, 0, kNoDeadlineMicros);
+  // Keeps the batch above closed, while this one stays open.
+  Schedule(1, 0, kNoDeadlineMicros);
+  env_.AdvanceByMicroseconds(100);
+  ProcessTwoBatches();
+
+  mutex_lock l(mu_);
+  ASSERT_EQ(2, processed_batches_.size());
+  ASSERT_EQ(1, processed_batches_[0]->num_tasks());
+  EXPECT_EQ(200, processed_batches_[0]->task(0).deadline_micros());
+  ASSERT_EQ(2, processed_batches_[1]->num_tasks());
+  EXPECT_EQ(kNoDeadlineMicros, processed_batches_[1]->task(0).deadline_micros());
+  EXPECT_EQ(kNoDeadlineMicros, processed_batches_[1]->task(1).deadline_micros());
+}
+
 TEST(SharedBatchSchedulerTest, ConstMethods) {
   for (const int max_enqueued_batches : {1, 2, 5}) {
     Notification processing, proceed;
@@ -592,6 +1048,160 @@ TEST(SharedBatchSchedulerTest, QueueDestructorBlocksUntilAllTasksProcessed) {
   stop_teardown.Notify();
 }
 
+TEST(SharedBatchSchedulerTest, SetNumBatchThreads) {
+  mutex mu;
+  int num_concurrent_batches = 0;
+  int max_concurrent_batches = 0;
+  Notification release_batches;
+  auto callback = [&mu, &num_concurrent_batches, &max_concurrent_batches,
+                   &release_batches](std::unique_ptr<Batch<FakeTask>> batch) {
+    {
+      mutex_lock l(mu);
+      ++num_concurrent_batches;
+      max_concurrent_batches =
+          std::max(max_concurrent_batches, num_concurrent_batches);
+    }
+    release_batches.WaitForNotification();
+    {
+      mutex_lock l(mu);
+      --num_concurrent_batches;
+    }
+  };
+  auto get_num_concurrent_batches = [&mu, &num_concurrent_batches]() {
+    mutex_lock l(mu);
+    return num_concurrent_batches;
+  };
+
+  SharedBatchScheduler<FakeTask>::Options options;
+  options.num_batch_threads = 1;
+  std::shared_ptr<SharedBatchScheduler<FakeTask>> scheduler;
+  TF_ASSERT_OK(SharedBatchScheduler<FakeTask>::Create(options, &scheduler));
+  EXPECT_EQ(1, scheduler->num_batch_threads());
+  EXPECT_FALSE(scheduler->SetNumBatchThreads(0).ok());
+
+  SharedBatchScheduler<FakeTask>::QueueOptions queue_options;
+  queue_options.max_batch_size = 1;
+  queue_options.batch_timeout_micros = 0;
+  queue_options.max_enqueued_batches = 10;
+  std::unique_ptr<BatchScheduler<FakeTask>> queue;
+  TF_ASSERT_OK(scheduler->AddQueue(queue_options, callback, &queue));
+
+  // Only one batch at a time can be in flight with a single thread.
+  for (int i = 0; i < 3; ++i) {
+    TF_ASSERT_OK(ScheduleTask(1, queue.get()));
+  }
+  while (get_num_concurrent_batches() < 1) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  Env::Default()->SleepForMicroseconds(10 * 1000 /* 10 milliseconds */);
+  EXPECT_EQ(1, get_num_concurrent_batches());
+
+  // Adding threads lets the remaining batches start right away.
+  TF_ASSERT_OK(scheduler->SetNumBatchThreads(3));
+  EXPECT_EQ(3, scheduler->num_batch_threads());
+  while (get_num_concurrent_batches() < 3) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  release_batches.Notify();
+
+  // Shrinking waits for the removed threads' batches to finish.
+  TF_ASSERT_OK(scheduler->SetNumBatchThreads(1));
+  EXPECT_EQ(1, scheduler->num_batch_threads());
+  queue = nullptr;
+  EXPECT_EQ(3, max_concurrent_batches);
+}
+
+TEST(SharedBatchSchedulerTest, NumaAwareBatchThreads) {
+  mutex mu;
+  int num_concurrent_batches = 0;
+  std::set<int> batch_numa_nodes;
+  auto callback = [&mu, &num_concurrent_batches, &batch_numa_nodes](
+                      std::unique_ptr<Batch<FakeTask>> batch) {
+    {
+      mutex_lock l(mu);
+      ++num_concurrent_batches;
+      batch_numa_nodes.insert(port::NUMAGetThreadNodeAffinity());
+    }
+    // Hold the thread until both threads have a batch, so that each processes
+    // one.
+    for (;;) {
+      {
+        mutex_lock l(mu);
+        if (num_concurrent_batches == 2) break;
+      }
+      Env::Default()->SleepForMicroseconds(1000);
+    }
+  };
+
+  SharedBatchScheduler<FakeTask>::Options options;
+  options.num_batch_threads = 2;
+  options.numa_aware = true;
+  std::shared_ptr<SharedBatchScheduler<FakeTask>> scheduler;
+  TF_ASSERT_OK(SharedBatchScheduler<FakeTask>::Create(options, &scheduler));
+  SharedBatchScheduler<FakeTask>::QueueOptions queue_options;
+  queue_options.max_batch_size = 1;
+  queue_options.batch_timeout_micros = 0;
+  std::unique_ptr<BatchScheduler<FakeTask>> queue;
+  TF_ASSERT_OK(scheduler->AddQueue(queue_options, callback, &queue));
+  TF_ASSERT_OK(ScheduleTask(1, queue.get()));
+  TF_ASSERT_OK(ScheduleTask(1, queue.get()));
+  queue = nullptr;
+
+  // The threads are spread over the nodes of NUMA hosts, and left unbound on
+  // others.
+  if (port::NUMANumNodes() > 1) {
+    EXPECT_EQ(std::set<int>({0, 1}), batch_numa_nodes);
+  } else {
+    EXPECT_EQ(std::set<int>({port::kNUMANoAffinity}), batch_numa_nodes);
+  }
+}
+
+TEST(SharedBatchSchedulerTest, UpdateQueueOptions) {
+  mutex mu;
+  std::vector<size_t> batch_sizes;
+  auto callback = [&mu, &batch_sizes](std::unique_ptr<Batch<FakeTask>> batch) {
+    ASSERT_TRUE(batch->IsClosed());
+    mutex_lock l(mu);
+    batch_sizes.push_back(batch->size());
+  };
+
+  {
+    SharedBatchScheduler<FakeTask>::Options options;
+    options.num_batch_threads = 1;
+    std::shared_ptr<SharedBatchScheduler<FakeTask>> scheduler;
+    TF_ASSERT_OK(SharedBatchScheduler<FakeTask>::Create(options, &scheduler));
+    SharedBatchScheduler<FakeTask>::QueueOptions queue_options;
+    queue_options.max_batch_size = 10;
+    queue_options.batch_timeout_micros = 10 * 1000 * 1000;  // 10 seconds
+    queue_options.max_enqueued_batches = 2;
+    std::unique_ptr<BatchScheduler<FakeTask>> queue;
+    TF_ASSERT_OK(scheduler->AddQueue(queue_options, callback, &queue));
+    EXPECT_EQ(10, queue->max_task_size());
+
+    // Invalid options are rejected as a whole.
+    SharedBatchScheduler<FakeTask>::QueueOptions invalid_options =
+        queue_options;
+    invalid_options.max_batch_size = 0;
+    EXPECT_FALSE(scheduler->UpdateQueueOptions(invalid_options).ok());
+    EXPECT_EQ(10, queue->max_task_size());
+
+    // Fill the open batch past the new size limit. Shrinking closes it as-is,
+    // and later tasks are batched under the new limit.
+    TF_ASSERT_OK(ScheduleTask(3, queue.get()));
+    TF_ASSERT_OK(ScheduleTask(3, queue.get()));
+    queue_options.max_batch_size = 4;
+    TF_ASSERT_OK(scheduler->UpdateQueueOptions(queue_options));
+    EXPECT_EQ(4, queue->max_task_size());
+    EXPECT_EQ(error::INVALID_ARGUMENT, ScheduleTask(5, queue.get()).code());
+    TF_ASSERT_OK(ScheduleTask(2, queue.get()));
+    TF_ASSERT_OK(ScheduleTask(2, queue.get()));
+  }
+
+  ASSERT_EQ(2, batch_sizes.size());
+  EXPECT_EQ(6, batch_sizes[0]);
+  EXPECT_EQ(4, batch_sizes[1]);
+}
+
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
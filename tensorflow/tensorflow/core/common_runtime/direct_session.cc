@@ -13,12 +13,9 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
-//For BENCHMARKING
-#include <iostream>
-#include <chrono>
-#include <fstream>
 #include "tensorflow/core/common_runtime/direct_session.h"
 
+#include <algorithm>
 #include <atomic>
 #include <string>
 #include <vector>
@@ -32,6 +29,7 @@ limitations under the License.
 #include "tensorflow/core/common_runtime/memory_types.h"
 #include "tensorflow/core/common_runtime/optimization_registry.h"
 #include "tensorflow/core/common_runtime/step_stats_collector.h"
+#include "tensorflow/core/common_runtime/work_stealing_scheduler.h"
 #include "tensorflow/core/framework/function.h"
 #include "tensorflow/core/framework/graph.pb_text.h"
 #include "tensorflow/core/framework/graph.pb.h"
@@ -53,6 +51,7 @@ limitations under the License.
 #include "tensorflow/core/lib/core/threadpool.h"
 #include "tensorflow/core/lib/gtl/array_slice.h"
 #include "tensorflow/core/lib/gtl/stl_util.h"
+#include "tensorflow/core/lib/hash/hash.h"
 #include "tensorflow/core/lib/monitoring/counter.h"
 #include "tensorflow/core/lib/strings/numbers.h"
 #include "tensorflow/core/lib/strings/str_util.h"
@@ -64,7 +63,8 @@ limitations under the License.
 #include "tensorflow/core/platform/types.h"
 #include "tensorflow/core/util/device_name_utils.h"
 #include "tensorflow/core/util/env_var.h"
-
+#include "tensorflow/core/util/latency_trace.h"
+#include "tensorflow/core/util/parallelism_limits.h"
 
 namespace tensorflow {
 
@@ -96,13 +96,25 @@ Status NewThreadPoolFromThreadPoolOptions(
   if (num_threads == 0) {
     num_threads = NumInterOpThreadsFromSessionOptions(options);
   }
+  ThreadOptions thread_options;
+  if (thread_pool_options.bind_to_numa_node()) {
+    if (thread_pool_options.numa_node() < 0) {
+      return errors::InvalidArgument("Invalid NUMA node ",
+                                     thread_pool_options.numa_node(),
+                                     " for inter-op pool ", pool_number);
+    }
+    if (thread_pool_options.numa_node() < port::NUMANumNodes()) {
+      thread_options.numa_node = thread_pool_options.numa_node();
+    }
+  }
   const string& name = thread_pool_options.global_name();
   if (name.empty()) {
     // Session-local threadpool.
     VLOG(1) << "Direct session inter op parallelism threads for pool "
             << pool_number << ": " << num_threads;
-    *pool = new thread::ThreadPool(
-        options.env, strings::StrCat("Compute", pool_number), num_threads);
+    *pool = new thread::ThreadPool(options.env, thread_options,
+                                   strings::StrCat("Compute", pool_number),
+                                   num_threads);
     *owned = true;
     return Status::OK();
   }
@@ -117,7 +129,8 @@ Status NewThreadPoolFromThreadPoolOptions(
   if (mvalue->second == nullptr) {
     mvalue->first = thread_pool_options.num_threads();
     mvalue->second = new thread::ThreadPool(
-        options.env, strings::StrCat("Compute", pool_number), num_threads);
+        options.env, thread_options, strings::StrCat("Compute", pool_number),
+        num_threads);
   } else {
     if (mvalue->first != thread_pool_options.num_threads()) {
       return errors::InvalidArgument(
@@ -132,10 +145,57 @@ Status NewThreadPoolFromThreadPoolOptions(
   return Status::OK();
 }
 
-thread::ThreadPool* GlobalThreadPool(const SessionOptions& options) {
-  static thread::ThreadPool* const thread_pool =
-      NewThreadPoolFromSessionOptions(options);
-  return thread_pool;
+// Returns the inter-op pool shared by sessions that use neither per-session
+// nor explicitly configured pools. The pool is sized from the options of the
+// first session that asks for it, unless SetInterOpParallelismOverride() asks
+// for another size, in which case a new pool replaces it. Callers keep the
+// returned pool alive for as long as they schedule work on it.
+std::shared_ptr<thread::ThreadPool> GlobalThreadPool(
+    const SessionOptions& options) {
+  static mutex* mu = new mutex;
+  static std::shared_ptr<thread::ThreadPool>* thread_pool =
+      new std::shared_ptr<thread::ThreadPool>;
+  static int32 default_num_threads = 0;
+  static int32 num_threads = 0;
+
+  mutex_lock l(*mu);
+  if (default_num_threads == 0) {
+    default_num_threads = NumInterOpThreadsFromSessionOptions(options);
+  }
+  const int32 override_num_threads = GetInterOpParallelismOverride();
+  const int32 wanted_num_threads =
+      override_num_threads > 0 ? override_num_threads : default_num_threads;
+  if (*thread_pool == nullptr || num_threads != wanted_num_threads) {
+    VLOG(1) << "Direct session inter op parallelism threads: "
+            << wanted_num_threads;
+    // The last reference to a replaced pool may be dropped by one of its own
+    // threads (e.g. when an executor finishes a step), which must not join
+    // itself; delete the pool from a fresh thread instead.
+    thread_pool->reset(new thread::ThreadPool(options.env, "Compute",
+                                              wanted_num_threads),
+                       [](thread::ThreadPool* pool) {
+                         Env::Default()->SchedClosure([pool]() { delete pool; });
+                       });
+    num_threads = wanted_num_threads;
+  }
+  return *thread_pool;
+}
+
+// Returns the scheduler shared by sessions that set
+// use_work_stealing_inter_op_scheduler, sized from the options of the first
+// of them. Never deleted.
+WorkStealingScheduler* GlobalWorkStealingScheduler(
+    const SessionOptions& options) {
+  const int32 num_threads = NumInterOpThreadsFromSessionOptions(options);
+  static WorkStealingScheduler* scheduler =
+      new WorkStealingScheduler(options.env, "Compute", num_threads);
+  if (scheduler->NumThreads() != num_threads) {
+    LOG(WARNING) << "The work-stealing inter-op scheduler was created with "
+                 << scheduler->NumThreads()
+                 << " threads; ignoring this session's request for "
+                 << num_threads;
+  }
+  return scheduler;
 }
 
 // TODO(vrv): Figure out how to unify the many different functions
@@ -150,6 +210,26 @@ string GetRendezvousKey(const string& tensor_name,
                          frame_iter.frame_id, ":", frame_iter.iter_id);
 }
 
+// Hashes the names of a Run() call's feeds, fetches and targets, in order.
+uint64 HashRunSignature(gtl::ArraySlice<string> inputs,
+                        gtl::ArraySlice<string> outputs,
+                        gtl::ArraySlice<string> target_nodes) {
+  uint64 hash = 0;
+  for (gtl::ArraySlice<string> names : {inputs, outputs, target_nodes}) {
+    hash = Hash64Combine(hash, names.size());
+    for (const string& name : names) {
+      hash = Hash64Combine(hash, Hash64(name));
+    }
+  }
+  return hash;
+}
+
+bool NamesEqual(gtl::ArraySlice<string> names,
+                const std::vector<string>& other) {
+  return names.size() == other.size() &&
+         std::equal(names.begin(), names.end(), other.begin());
+}
+
 }  // namespace
 
 class DirectSessionFactory : public SessionFactory {
@@ -255,6 +335,14 @@ void DirectSession::SchedClosure(thread::ThreadPool* pool,
 #endif  // __ANDROID__
 }
 
+thread::ThreadPool* DirectSession::GetThreadPool(
+    int index, std::shared_ptr<thread::ThreadPool>* global_pool) {
+  thread::ThreadPool* pool = thread_pools_[index].first;
+  if (pool != nullptr) return pool;
+  *global_pool = GlobalThreadPool(options_);
+  return global_pool->get();
+}
+
 DirectSession::DirectSession(const SessionOptions& options,
                              const DeviceMgr* device_mgr,
                              DirectSessionFactory* const factory)
@@ -277,7 +365,19 @@ DirectSession::DirectSession(const SessionOptions& options,
     thread_pools_.emplace_back(NewThreadPoolFromSessionOptions(options_),
                                true /* owned */);
   } else {
-    thread_pools_.emplace_back(GlobalThreadPool(options), false /* owned */);
+    // The global pool may be replaced between steps, so it is looked up on
+    // each Run(); see GetThreadPool().
+    thread_pools_.emplace_back(nullptr, false /* owned */);
+  }
+  if (options_.config.use_work_stealing_inter_op_scheduler()) {
+    if (options_.config.session_inter_op_thread_pool_size() > 0) {
+      // RunOptions.inter_op_thread_pool picks one of these pools per Run(),
+      // which the shared scheduler would silently override.
+      LOG(WARNING) << "Ignoring use_work_stealing_inter_op_scheduler, since "
+                      "session_inter_op_thread_pool is set";
+    } else {
+      inter_op_scheduler_ = GlobalWorkStealingScheduler(options_);
+    }
   }
   // The default value of sync_on_finish will be flipped soon and this
   // environment variable will be removed as well.
@@ -461,8 +561,9 @@ Status DirectSession::Run(const RunOptions& run_options,
     return errors::InvalidArgument("Invalid inter_op_thread_pool: ",
                                    run_options.inter_op_thread_pool());
   }
+  std::shared_ptr<thread::ThreadPool> global_pool;
   thread::ThreadPool* pool =
-      thread_pools_[run_options.inter_op_thread_pool()].first;
+      GetThreadPool(run_options.inter_op_thread_pool(), &global_pool);
 
   // Check if we already have an executor for these arguments.
   ExecutorsAndKeys* executors_and_keys;
@@ -533,6 +634,7 @@ Status DirectSession::Run(const RunOptions& run_options,
     LogMemory::RecordStep(args.step_id, run_state_args.handle);
   }
   args.sync_on_finish = sync_on_finish_;
+  args.intra_op_parallelism_limit = run_options.intra_op_parallelism_limit();
 
   const bool do_trace = (run_options.trace_level() > RunOptions::NO_TRACE);
 
@@ -586,28 +688,20 @@ Status DirectSession::Run(const RunOptions& run_options,
     return errors::Cancelled("Run call was cancelled");
   }
 
-  Executor::Args::Runner default_runner = [this,
-                                           pool](Executor::Args::Closure c) {
-    SchedClosure(pool, std::move(c));
-  };
+  Executor::Args::Runner default_runner = [this, pool, global_pool](
+      Executor::Args::Closure c) { SchedClosure(pool, std::move(c)); };
+  if (inter_op_scheduler_ != nullptr) {
+    WorkStealingScheduler* scheduler = inter_op_scheduler_;
+    const int64 step = scheduler->StartStep();
+    default_runner = [scheduler, step](Executor::Args::Closure c) {
+      scheduler->Schedule(step, std::move(c));
+    };
+  }
+
+  const bool trace_latency = latency_trace::IsEnabled();
+  const int64 trace_start_micros =
+      trace_latency ? latency_trace::NowMicros() : 0;
 
-  //start here
-//int64_t start_time1 = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
- //std::cout<<"cashe start"<<std::endl;
-  /*(const int size = 1020*1024*20; // Allocate 20M. Set much larger then L2
-     char *c = (char *)malloc(size);
-     for (int i = 0; i < 500; i++)
-       for (int j = 0; j < size; j++)
-         c[j] = i*j;*/
-	//sleep (3);
- //int64_t end_time1 = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();  
-  /*Tensor::tensor_m.lock();
-  std::cout << "caching_session.cc," << (end_time1 - start_time1) << "," << start_time1 << "," << end_time1 << std::endl;
-  Tensor::tensor_m.unlock();*/
-   //START TIME
-  int64_t start_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
-  //std::cout<<"request arrived"<<std::endl;
-  
   for (const auto& item : executors_and_keys->items) {
     // TODO(zhengxq): support partial run.
     // TODO(zhengxq): if the device picks its own threadpool, we need to assign
@@ -630,34 +724,13 @@ Status DirectSession::Run(const RunOptions& run_options,
                       run_options.timeout_in_ms() > 0
                           ? run_options.timeout_in_ms()
                           : operation_timeout_in_ms_);
-     //end time
-
-  //END TIME
-  int64_t end_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();  
-  //PRINT TIME
-  Tensor::tensor_m.lock();
-  std::cout << "direct_session.cc," << (end_time - start_time) << "," << start_time << "," << end_time << std::endl;
-  Tensor::tensor_m.unlock();
-  qy_request_count++;
-  if(qy_request_count>3){
-  std::ofstream outfile;
-  outfile.open("direct_session.txt", std::ios_base::app);
-  if (outfile.fail())
-    std::cout << errno;
-  outfile << end_time - start_time<<std::endl;
-  outfile.close();
-      outfile.open("direct_session_start.txt", std::ios_base::app);
-  if (outfile.fail())
-    std::cout << errno;
-  outfile << start_time<<std::endl;
-  outfile.close();
-    outfile.open("direct_session_end.txt", std::ios_base::app);
-  if (outfile.fail())
-    std::cout << errno;
-  outfile << end_time<<std::endl;
-  outfile.close();
-  }
-  
+  if (trace_latency) {
+    const int64 trace_end_micros = latency_trace::NowMicros();
+    latency_trace::Record({latency_trace::Source::kSessionRun,
+                           trace_start_micros, trace_end_micros, 0,
+                           trace_end_micros - trace_start_micros});
+  }
+
   if (!cancellation_manager_->DeregisterCallback(cancellation_token)) {
     // The step has been cancelled: make sure we don't attempt to receive the
     // outputs as this would make it block forever.
@@ -770,7 +843,8 @@ Status DirectSession::PRunSetup(const std::vector<string>& input_names,
   }
 
   // RunOptions is not available in PRunSetup, so use thread pool 0.
-  thread::ThreadPool* pool = thread_pools_[0].first;
+  std::shared_ptr<thread::ThreadPool> global_pool;
+  thread::ThreadPool* pool = GetThreadPool(0, &global_pool);
 
   // Check if we already have an executor for these arguments.
   ExecutorsAndKeys* executors_and_keys;
@@ -812,7 +886,7 @@ Status DirectSession::PRunSetup(const std::vector<string>& input_names,
 
   args.rendezvous = run_state->rendez;
   args.cancellation_manager = cancellation_manager_;
-  args.runner = [this, pool](Executor::Args::Closure c) {
+  args.runner = [this, pool, global_pool](Executor::Args::Closure c) {
     SchedClosure(pool, std::move(c));
   };
   args.session_state = &session_state_;
@@ -1123,6 +1197,21 @@ Status DirectSession::GetOrCreateExecutors(
         run_state_args->debug_options.debug_tensor_watch_opts());
   }
 
+  // Fastest path: a plain Run() with names we have seen before, in the same
+  // order, needs no key string.
+  const bool use_run_signatures =
+      handle_name_counter_value < 0 && debug_tensor_watches_summary.empty();
+  const uint64 run_signature_hash =
+      use_run_signatures ? HashRunSignature(inputs, outputs, target_nodes) : 0;
+  if (use_run_signatures) {
+    mutex_lock l(executor_lock_);
+    *executors_and_keys = FindRunSignatureLocked(run_signature_hash, inputs,
+                                                 outputs, target_nodes);
+    if (*executors_and_keys != nullptr) {
+      return Status::OK();
+    }
+  }
+
   // Fast lookup path, no sorting.
   const string key = strings::StrCat(
       str_util::Join(inputs, ","), "->", str_util::Join(outputs, ","), "/",
@@ -1140,6 +1229,10 @@ Status DirectSession::GetOrCreateExecutors(
     auto it = executors_.find(key);
     if (it != executors_.end()) {
       *executors_and_keys = it->second.get();
+      if (use_run_signatures) {
+        AddRunSignatureLocked(run_signature_hash, inputs, outputs, target_nodes,
+                              *executors_and_keys);
+      }
       return Status::OK();
     }
   }
@@ -1175,6 +1268,10 @@ Status DirectSession::GetOrCreateExecutors(
       *executors_and_keys = it->second.get();
       // Insert this under the original key.
       executors_.emplace(key, it->second);
+      if (use_run_signatures) {
+        AddRunSignatureLocked(run_signature_hash, inputs, outputs, target_nodes,
+                              *executors_and_keys);
+      }
       return Status::OK();
     }
   }
@@ -1277,6 +1374,7 @@ Status DirectSession::GetOrCreateExecutors(
       }
     };
     params.node_outputs_cb = node_outputs_callback_;
+    params.plan_memory = options_.config.graph_options().plan_step_memory();
 
     optimizer.Optimize(lib, options_.env, device, &iter->second,
                        /*shape_map=*/nullptr);
@@ -1343,10 +1441,48 @@ Status DirectSession::GetOrCreateExecutors(
   // if the user uses the same order of inputs, outputs, and targets again.
   executors_.emplace(key, insert_result.first->second);
   *executors_and_keys = insert_result.first->second.get();
+  if (use_run_signatures) {
+    AddRunSignatureLocked(run_signature_hash, inputs, outputs, target_nodes,
+                          *executors_and_keys);
+  }
 
   return Status::OK();
 }
 
+DirectSession::ExecutorsAndKeys* DirectSession::FindRunSignatureLocked(
+    uint64 hash, gtl::ArraySlice<string> inputs,
+    gtl::ArraySlice<string> outputs, gtl::ArraySlice<string> target_nodes) {
+  auto it = run_signatures_.find(hash);
+  if (it == run_signatures_.end()) {
+    return nullptr;
+  }
+  for (const RunSignature& signature : it->second) {
+    if (NamesEqual(inputs, signature.inputs) &&
+        NamesEqual(outputs, signature.outputs) &&
+        NamesEqual(target_nodes, signature.target_nodes)) {
+      return signature.executors_and_keys;
+    }
+  }
+  return nullptr;
+}
+
+void DirectSession::AddRunSignatureLocked(uint64 hash,
+                                          gtl::ArraySlice<string> inputs,
+                                          gtl::ArraySlice<string> outputs,
+                                          gtl::ArraySlice<string> target_nodes,
+                                          ExecutorsAndKeys* executors_and_keys) {
+  // Another thread may have added the same signature since we looked.
+  if (FindRunSignatureLocked(hash, inputs, outputs, target_nodes) != nullptr) {
+    return;
+  }
+  RunSignature signature;
+  signature.inputs.assign(inputs.begin(), inputs.end());
+  signature.outputs.assign(outputs.begin(), outputs.end());
+  signature.target_nodes.assign(target_nodes.begin(), target_nodes.end());
+  signature.executors_and_keys = executors_and_keys;
+  run_signatures_[hash].push_back(std::move(signature));
+}
+
 Status DirectSession::CreateGraphs(
     const BuildGraphOptions& subgraph_options,
     std::unordered_map<string, std::unique_ptr<Graph>>* outputs,
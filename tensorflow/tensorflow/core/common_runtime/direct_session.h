@@ -50,11 +50,11 @@ class CostModel;
 class DebugGateway;
 class Device;
 class DirectSessionFactory;
+class WorkStealingScheduler;
 
 class DirectSession : public Session {
  public:
   typedef std::function<void(Session*)> CloseCallback;
-  int qy_request_count = 0;
   // Takes ownership of 'device_mgr'.
   // 'factory' is used to unregister the DirectSession with 'factory' when its
   // closed. This ensures that Reset requests from the 'factory' don't get sent
@@ -198,6 +198,21 @@ class DirectSession : public Session {
       gtl::ArraySlice<string> target_nodes,
       ExecutorsAndKeys** executors_and_keys, RunStateArgs* run_state_args);
 
+  // Returns the executors cached in 'run_signatures_' for exactly 'inputs',
+  // 'outputs' and 'target_nodes' (in that order), or nullptr.
+  ExecutorsAndKeys* FindRunSignatureLocked(uint64 hash,
+                                           gtl::ArraySlice<string> inputs,
+                                           gtl::ArraySlice<string> outputs,
+                                           gtl::ArraySlice<string> target_nodes)
+      EXCLUSIVE_LOCKS_REQUIRED(executor_lock_);
+
+  // Caches 'executors_and_keys' in 'run_signatures_'.
+  void AddRunSignatureLocked(uint64 hash, gtl::ArraySlice<string> inputs,
+                             gtl::ArraySlice<string> outputs,
+                             gtl::ArraySlice<string> target_nodes,
+                             ExecutorsAndKeys* executors_and_keys)
+      EXCLUSIVE_LOCKS_REQUIRED(executor_lock_);
+
   // Creates several graphs given the existing graph_def_ and the
   // input feeds and fetches, given 'devices'. The graphs share a common
   // function library 'flib_def'.
@@ -273,9 +288,15 @@ class DirectSession : public Session {
   GraphDef graph_def_ GUARDED_BY(graph_def_lock_);
 
   // The thread-pools to use for running ops, with a bool indicating if the pool
-  // is owned.
+  // is owned. A null entry stands for the global pool, which may be resized
+  // between steps (see SetInterOpParallelismOverride()).
   std::vector<std::pair<thread::ThreadPool*, bool>> thread_pools_;
 
+  // If ConfigProto.use_work_stealing_inter_op_scheduler is set (and
+  // session_inter_op_thread_pool is not), the scheduler that replaces
+  // 'thread_pools_' in Run(). Not owned.
+  WorkStealingScheduler* inter_op_scheduler_ = nullptr;
+
   Status init_error_;  // Set to an error if construction failed.
 
   // If true, blocks until device has finished all queued operations in a step.
@@ -283,6 +304,12 @@ class DirectSession : public Session {
   // Schedules 'c' for execution on pool.
   void SchedClosure(thread::ThreadPool* pool, std::function<void()> c);
 
+  // Returns the inter-op pool at 'index' in 'thread_pools_'. If that is the
+  // global pool, also stores a reference in '*global_pool', which the caller
+  // must hold while it schedules work on the returned pool.
+  thread::ThreadPool* GetThreadPool(
+      int index, std::shared_ptr<thread::ThreadPool>* global_pool);
+
   mutex executor_lock_;  // protects executors_
   // Holds mappings from signature to the executors that process
   // it. The reason for a level of indirection around mapped_type is
@@ -292,6 +319,19 @@ class DirectSession : public Session {
   std::unordered_map<string, std::shared_ptr<ExecutorsAndKeys>> executors_
       GUARDED_BY(executor_lock_);
 
+  // A cache in front of 'executors_' for plain Run() calls (no partial run,
+  // debug watches or memory logging). It is keyed by a hash of the feed, fetch
+  // and target names, so a hit builds no key string; the names are kept for an
+  // exact comparison.
+  struct RunSignature {
+    std::vector<string> inputs;
+    std::vector<string> outputs;
+    std::vector<string> target_nodes;
+    ExecutorsAndKeys* executors_and_keys;  // Owned by 'executors_'.
+  };
+  std::unordered_map<uint64, std::vector<RunSignature>> run_signatures_
+      GUARDED_BY(executor_lock_);
+
   // Holds mappings from handle to partial run state.
   std::unordered_map<string, std::unique_ptr<RunState>> partial_runs_
       GUARDED_BY(executor_lock_);
@@ -44,6 +44,7 @@ limitations under the License.
 #include "tensorflow/core/public/session.h"
 #include "tensorflow/core/public/session_options.h"
 #include "tensorflow/core/util/device_name_utils.h"
+#include "tensorflow/core/util/parallelism_limits.h"
 
 namespace tensorflow {
 namespace {
@@ -208,6 +209,29 @@ TEST_F(DirectSessionMinusAXTest, TestPerSessionThreads) {
   delete tp;
 }
 
+TEST_F(DirectSessionMinusAXTest, ResizeGlobalPoolsBetweenRuns) {
+  Initialize({3, 2, -1, 0});
+  auto session = CreateSession();
+  ASSERT_TRUE(session != nullptr);
+  TF_ASSERT_OK(session->Create(def_));
+  std::vector<std::pair<string, Tensor>> inputs;
+  std::vector<string> output_names = {y_ + ":0"};
+  std::vector<string> target_nodes = {y_neg_};
+
+  // Each step runs on the pools in effect when it starts; sizes may change
+  // freely in between.
+  for (int num_threads : {1, 3, 0}) {
+    SetInterOpParallelismOverride(num_threads);
+    SetIntraOpParallelismLimit(num_threads);
+    std::vector<Tensor> outputs;
+    TF_ASSERT_OK(session->Run(inputs, output_names, target_nodes, &outputs));
+    ASSERT_EQ(1, outputs.size());
+    EXPECT_FLOAT_EQ(5.0, outputs[0].matrix<float>()(0, 0));
+  }
+  EXPECT_EQ(0, GetInterOpParallelismOverride());
+  EXPECT_EQ(0, GetIntraOpParallelismLimit());
+}
+
 TEST_F(DirectSessionMinusAXTest, TwoCreateCallsFails) {
   Initialize({1, 2, 3, 4});
   auto session = CreateSession();
@@ -913,7 +937,8 @@ REGISTER_KERNEL_BUILDER(Name("BlockingOp").Device(DEVICE_CPU), BlockingOp);
 REGISTER_OP("BlockingOp").Input("x: float").Output("y: float").Doc("");
 
 static void TestSessionInterOpThreadsImpl(bool use_function_lib,
-                                          bool use_global_pools) {
+                                          bool use_global_pools,
+                                          bool use_work_stealing = false) {
   FunctionDefLibrary library_graph_def;
   if (use_function_lib) {
     const string lib = R"proto(
@@ -954,6 +979,8 @@ static void TestSessionInterOpThreadsImpl(bool use_function_lib,
   (*options.config.mutable_device_count())["CPU"] = 2;
   (*options.config.mutable_device_count())["GPU"] = 0;
   (*options.config.mutable_device_count())["SYCL"] = 0;
+  // The per-Run() choice of pool must win over the work-stealing scheduler.
+  options.config.set_use_work_stealing_inter_op_scheduler(use_work_stealing);
 
   auto* p = options.config.add_session_inter_op_thread_pool();
   if (use_global_pools) p->set_global_name("large pool");
@@ -1073,6 +1100,12 @@ TEST(DirectSessionTest, TestSessionInterOpGlobalPoolsWithFunctions) {
                                 true /*use_global_pools */);
 }
 
+TEST(DirectSessionTest, TestSessionInterOpThreadsWithWorkStealing) {
+  TestSessionInterOpThreadsImpl(false /* use_function_lib */,
+                                false /*use_global_pools */,
+                                true /* use_work_stealing */);
+}
+
 TEST(DirectSessionTest, TestSessionInterOpThreadsInvalidOptions) {
   Graph g(OpRegistry::Global());
   Tensor t(DT_FLOAT, TensorShape({}));
@@ -1107,6 +1140,17 @@ TEST(DirectSessionTest, TestSessionInterOpThreadsInvalidOptions) {
     }
   }
 
+  // Negative NUMA node.
+  {
+    SessionOptions numa_options = options;
+    ThreadPoolOptionProto* numa_pool =
+        numa_options.config.mutable_session_inter_op_thread_pool(0);
+    numa_pool->set_bind_to_numa_node(true);
+    numa_pool->set_numa_node(-1);
+    std::unique_ptr<Session> session(NewSession(numa_options));
+    EXPECT_FALSE(session->Create(def).ok());
+  }
+
   // Global name changes thread count.
   std::vector<std::unique_ptr<Session>> sessions;
   auto* pool_config = options.config.mutable_session_inter_op_thread_pool(0);
@@ -1129,6 +1173,36 @@ TEST(DirectSessionTest, TestSessionInterOpThreadsInvalidOptions) {
   }
 }
 
+TEST(DirectSessionTest, TestSessionInterOpThreadsBoundToNUMANode) {
+  Graph g(OpRegistry::Global());
+  Tensor t(DT_FLOAT, TensorShape({}));
+  t.scalar<float>()() = {1.2f};
+  Node* x = test::graph::Constant(&g, t);
+  GraphDef def;
+  test::graph::ToGraphDef(&g, &def);
+
+  // Every host has node 0; nodes beyond the last one are left unbound.
+  SessionOptions options;
+  for (int node : {0, 1 << 20}) {
+    ThreadPoolOptionProto* pool =
+        options.config.add_session_inter_op_thread_pool();
+    pool->set_num_threads(1);
+    pool->set_bind_to_numa_node(true);
+    pool->set_numa_node(node);
+  }
+  std::unique_ptr<Session> session(NewSession(options));
+  TF_ASSERT_OK(session->Create(def));
+  for (int pool = 0; pool < 2; ++pool) {
+    RunOptions run_options;
+    run_options.set_inter_op_thread_pool(pool);
+    std::vector<Tensor> outputs;
+    TF_ASSERT_OK(session->Run(run_options, {} /* inputs */,
+                              {x->name() + ":0"} /* output_names */, {},
+                              &outputs, nullptr /* run_metadata */));
+    test::ExpectTensorEqual<float>(t, outputs[0]);
+  }
+}
+
 TEST(DirectSessionTest, TestDirectSessionRunClose) {
   // Construct a graph with a variable and a single assign.
   Graph g(OpRegistry::Global());
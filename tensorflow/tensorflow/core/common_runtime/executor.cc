@@ -25,6 +25,7 @@ limitations under the License.
 
 #include "tensorflow/core/common_runtime/costmodel_manager.h"
 #include "tensorflow/core/common_runtime/pending_counts.h"
+#include "tensorflow/core/common_runtime/step_memory_planner.h"
 #include "tensorflow/core/common_runtime/step_stats_collector.h"
 #include "tensorflow/core/framework/allocation_description.pb.h"
 #include "tensorflow/core/framework/allocator.h"
@@ -56,9 +57,11 @@ limitations under the License.
 #include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/platform/macros.h"
 #include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/profile_utils/cpu_utils.h"
 #include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow/core/platform/tracing.h"
 #include "tensorflow/core/platform/types.h"
+#include "tensorflow/core/util/parallelism_limits.h"
 #include "tensorflow/core/util/tensor_slice_reader_cache.h"
 
 namespace tensorflow {
@@ -337,6 +340,59 @@ class GraphView {
   TF_DISALLOW_COPY_AND_ASSIGN(GraphView);
 };
 
+// Online estimates of the compute cost of each node's kernel, kept across
+// the steps of an executor. ExecutorState runs nodes whose kernels turn out
+// to be cheap inline, instead of paying for a handoff to the thread pool,
+// and dispatches the ones that turn out to be expensive, whatever
+// OpKernel::IsExpensive() says.
+class KernelStats {
+ public:
+  KernelStats() {}
+
+  void Initialize(const GraphView& gview, const Graph* g) {
+    const int num_nodes = g->num_node_ids();
+    cost_estimates_.reset(new std::atomic<uint64>[num_nodes]);
+    for (int i = 0; i < num_nodes; ++i) {
+      const NodeItem* item = gview.node(i);
+      // Until measured, trust the kernel.
+      uint64 cost_estimate = 0;
+      if (item != nullptr && item->kernel_is_expensive) {
+        cost_estimate = kInitialCostEstimateCycles;
+      }
+      cost_estimates_[i] = cost_estimate;
+    }
+  }
+
+  // Returns true iff 'item' is worth running on a thread of its own.
+  bool IsExpensive(const NodeItem& item) const {
+    return cost_estimates_[item.node->id()].load(std::memory_order_relaxed) >
+           kOpIsExpensiveThresholdCycles;
+  }
+
+  // Folds the cycles one run of 'item' took into its estimate. Concurrent
+  // updates may be lost, which only delays convergence.
+  void UpdateCostEstimate(const NodeItem& item,
+                          uint64 elapsed_cycles) const {
+    std::atomic<uint64>& cost_estimate = cost_estimates_[item.node->id()];
+    const uint64 old_estimate = cost_estimate.load(std::memory_order_relaxed);
+    cost_estimate.store(
+        (old_estimate * (kCostDecay - 1) + elapsed_cycles) / kCostDecay,
+        std::memory_order_relaxed);
+  }
+
+ private:
+  // Roughly the cost of handing a closure to the inter-op thread pool and
+  // waking a thread for it.
+  static constexpr uint64 kOpIsExpensiveThresholdCycles = 8000;
+  static constexpr uint64 kInitialCostEstimateCycles = 100 * 1000 * 1000;
+  // The weight of the last run in an estimate is 1 / kCostDecay.
+  static constexpr uint64 kCostDecay = 8;
+
+  std::unique_ptr<std::atomic<uint64>[]> cost_estimates_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(KernelStats);
+};
+
 class ExecutorImpl : public Executor {
  public:
   ExecutorImpl(const LocalExecutorParams& p, const Graph* g)
@@ -433,6 +489,21 @@ class ExecutorImpl : public Executor {
   // the overhead of constructing it for each executor instance.
   gtl::FlatMap<string, FrameInfo*> frame_info_;
 
+  // Plans the memory of node outputs, if params_.plan_memory is set and the
+  // graph allows it.
+  std::unique_ptr<StepMemoryPlanner> memory_planner_;
+
+  KernelStats kernel_stats_;
+
+  // True iff the graph has no control flow nodes. Its nodes then all run
+  // once per step in the root frame, and ExecutorState propagates outputs
+  // with atomic pending counts instead of under the frame's lock.
+  bool is_control_flow_free_ = false;
+
+  // Per node id, if is_control_flow_free_: the initial value of the node's
+  // atomic pending count in ExecutorState.
+  std::vector<int32> initial_atomic_pending_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(ExecutorImpl);
 };
 
@@ -629,6 +700,7 @@ Status ExecutorImpl::Initialize() {
 
   // Preprocess every node in the graph to create an instance of op
   // kernel for each node.
+  is_control_flow_free_ = true;
   for (const Node* n : graph_->nodes()) {
     const int id = n->id();
     const string& frame_name = cf_info.frame_names[id];
@@ -662,6 +734,9 @@ Status ExecutorImpl::Initialize() {
     item->is_sink = IsSink(n);
     item->is_enter_exit_or_next_iter =
         (IsEnter(n) || IsExit(n) || IsNextIteration(n));
+    if (IsControlFlow(n)) {
+      is_control_flow_free_ = false;
+    }
 
     // Compute the maximum values we'll store for this node in the
     // pending counts data structure, and allocate a handle in
@@ -684,6 +759,12 @@ Status ExecutorImpl::Initialize() {
   // Initialize PendingCounts only after item->pending_id is initialized for
   // all nodes.
   InitializePending(graph_, cf_info);
+  kernel_stats_.Initialize(gview_, graph_);
+
+  if (params_.plan_memory && params_.device->device_type() == DEVICE_CPU) {
+    memory_planner_ = StepMemoryPlanner::Create(
+        *graph_, params_.device->GetAllocator(AllocatorAttributes()));
+  }
 
   return gview_.SetAllocAttrs(graph_, params_.device);
 }
@@ -1194,6 +1275,11 @@ class ExecutorState {
   CancellationManager* cancellation_manager_;
   Executor::Args::Runner runner_;
   bool sync_on_finish_;
+  const int32 intra_op_parallelism_limit_;
+
+  // The arena holding the outputs of this step's nodes, or null if the
+  // executor doesn't plan memory. Handed back to the planner on destruction.
+  StepArena* step_arena_ = nullptr;
 
   // Owned.
 
@@ -1204,6 +1290,12 @@ class ExecutorState {
   // The root frame in which the execution of this step is started.
   FrameState* root_frame_;
 
+  // Per node id, for graphs without control flow: the number of inputs
+  // yet to arrive times two, plus one once a dead input arrived. Replaces
+  // the root frame's PendingCounts, so that propagating outputs takes no
+  // lock. Null otherwise.
+  std::unique_ptr<std::atomic<int32>[]> atomic_pending_;
+
   // Invoked when the execution finishes.
   Executor::DoneCallback done_cb_;
 
@@ -1258,6 +1350,11 @@ class ExecutorState {
   void PropagateOutputs(const TaggedNode& tagged_node, const NodeItem* item,
                         EntryVector* outputs, TaggedNodeSeq* ready);
 
+  // PropagateOutputs() for graphs without control flow, using
+  // atomic_pending_ instead of the root frame's state.
+  void ActivateNodesLockFree(const NodeItem* item, const bool is_dead,
+                             EntryVector* outputs, TaggedNodeSeq* ready);
+
   // "node" just finishes. Takes ownership of "stats". Returns true if
   // execution has completed.
   bool NodeDone(const Status& s, const Node* node, const TaggedNodeSeq& ready,
@@ -1313,6 +1410,7 @@ ExecutorState::ExecutorState(const Executor::Args& args, ExecutorImpl* impl)
       cancellation_manager_(args.cancellation_manager),
       runner_(args.runner),
       sync_on_finish_(args.sync_on_finish),
+      intra_op_parallelism_limit_(args.intra_op_parallelism_limit),
       num_outstanding_ops_(0) {
   // We start the entire execution in iteration 0 of the root frame
   // so let us create the root frame and the state for iteration 0.
@@ -1327,9 +1425,25 @@ ExecutorState::ExecutorState(const Executor::Args& args, ExecutorImpl* impl)
       root_frame_->pending_counts, root_frame_->total_input_tensors);
 
   outstanding_frames_.insert({root_frame_->frame_name, root_frame_});
+
+  // The per-node debugging state is kept in the PendingCounts only.
+  if (impl_->is_control_flow_free_ && !vlog_) {
+    const std::vector<int32>& initial = impl_->initial_atomic_pending_;
+    atomic_pending_.reset(new std::atomic<int32>[initial.size()]);
+    for (size_t i = 0; i < initial.size(); ++i) {
+      atomic_pending_[i].store(initial[i], std::memory_order_relaxed);
+    }
+  }
+
+  if (impl_->memory_planner_ != nullptr) {
+    step_arena_ = impl_->memory_planner_->AcquireArena();
+  }
 }
 
 ExecutorState::~ExecutorState() {
+  if (step_arena_ != nullptr) {
+    impl_->memory_planner_->ReleaseArena(step_arena_);
+  }
   for (auto name_frame : outstanding_frames_) {
     delete name_frame.second;
   }
@@ -1419,6 +1533,15 @@ void ExecutorImpl::InitializePending(const Graph* graph,
     PendingCounts* counts = EnsureFrameInfo(name)->pending_counts;
     counts->set_initial_count(item->pending_id, max_pending);
   }
+
+  if (is_control_flow_free_) {
+    initial_atomic_pending_.assign(graph->num_node_ids(), 0);
+    for (const Node* n : graph->nodes()) {
+      // The count of inputs yet to arrive, shifted left to leave bit 0 for
+      // whether a dead one arrived.
+      initial_atomic_pending_[n->id()] = n->in_edges().size() << 1;
+    }
+  }
 }
 
 void ExecutorState::RunAsync(Executor::DoneCallback done) {
@@ -1498,6 +1621,10 @@ struct ExecutorState::AsyncState {
 
 void ExecutorState::Process(TaggedNode tagged_node, int64 scheduled_usec) {
   const GraphView& gview = impl_->gview_;
+  // Applies to the kernels this thread runs for the step. Touches only the
+  // thread's state, so it may outlive this one, which Finish() deletes.
+  ScopedIntraOpParallelismLimit intra_op_parallelism_limit(
+      intra_op_parallelism_limit_);
   TaggedNodeSeq ready;
   TaggedNodeReadyQueue inline_ready;
 
@@ -1526,6 +1653,7 @@ void ExecutorState::Process(TaggedNode tagged_node, int64 scheduled_usec) {
   params.input_alloc_attrs = &input_alloc_attrs;
   params.runner = &runner_;
   params.stats_collector = stats_collector_;
+  params.planned_output_allocator = step_arena_;
   //Tensor::tensor_m;
   //pthread_mutex_t lock;
   Status s;
@@ -1620,6 +1748,9 @@ void ExecutorState::Process(TaggedNode tagged_node, int64 scheduled_usec) {
       params.frame_iter = FrameAndIter(input_frame->frame_id, input_iter);
       params.is_input_dead = is_input_dead;
       params.output_attr_array = item.output_attrs();
+      if (step_arena_ != nullptr) {
+        params.planned_output_start = impl_->memory_planner_->output_start(id);
+      }
 
       if (item.kernel_is_async) {
         // Asynchronous computes.
@@ -1679,7 +1810,16 @@ void ExecutorState::Process(TaggedNode tagged_node, int64 scheduled_usec) {
         // Synchronous computes.
         OpKernelContext ctx(&params, item.num_outputs);
         nodestats::SetOpStart(stats);
+        const uint64 start_cycles =
+            profile_utils::CpuUtils::GetCurrentClockCycle();
         device->Compute(CHECK_NOTNULL(op_kernel), &ctx);
+        const uint64 end_cycles =
+            profile_utils::CpuUtils::GetCurrentClockCycle();
+        // Without a cycle counter the estimates keep their initial values.
+        if (end_cycles > start_cycles) {
+          impl_->kernel_stats_.UpdateCostEstimate(item,
+                                                  end_cycles - start_cycles);
+        }
         nodestats::SetOpEnd(stats);
         s = ProcessOutputs(item, &ctx, &outputs, stats);
         if (s.ok() && impl_->device_record_tensor_accesses_) {
@@ -1957,6 +2097,12 @@ void ExecutorState::PropagateOutputs(const TaggedNode& tagged_node,
   // Propagates outputs along out edges, and puts newly ready nodes
   // into the ready queue.
   ready->clear();
+  if (atomic_pending_ != nullptr) {
+    // The root frame is the only one, and it is deleted with this state
+    // rather than when its last node is done.
+    ActivateNodesLockFree(item, is_dead, outputs, ready);
+    return;
+  }
   bool is_frame_done = false;
   FrameState* output_frame = input_frame;
   int64 output_iter = input_iter;
@@ -2051,6 +2197,50 @@ void ExecutorState::PropagateOutputs(const TaggedNode& tagged_node,
   }
 }
 
+void ExecutorState::ActivateNodesLockFree(const NodeItem* item,
+                                          const bool is_dead,
+                                          EntryVector* outputs,
+                                          TaggedNodeSeq* ready) {
+  const GraphView& gview = impl_->gview_;
+  Entry* input_tensors = GetInputTensors(root_frame_, 0);
+  const size_t num_output_edges = item->num_output_edges;
+  const EdgeInfo* edges = item->output_edge_list();
+  for (size_t out_index = 0; out_index < num_output_edges; out_index++) {
+    const EdgeInfo& e = edges[out_index];
+    const int dst_id = e.dst_id;
+    const NodeItem* dst_item = gview.node(dst_id);
+    const int src_slot = e.output_slot;
+
+    if (dst_item->is_sink) continue;
+
+    const bool is_control_edge = (src_slot == Graph::kControlSlot);
+    const bool increment_dead =
+        (is_dead || (!is_control_edge && !(*outputs)[src_slot].has_value));
+    if (!is_control_edge) {
+      // Published to the thread that runs dst by the decrement below.
+      const int dst_loc = dst_item->input_start + e.input_slot;
+      if (e.is_last) {
+        input_tensors[dst_loc] = std::move((*outputs)[src_slot]);
+      } else {
+        input_tensors[dst_loc] = (*outputs)[src_slot];
+      }
+    }
+
+    std::atomic<int32>* pending = &atomic_pending_[dst_id];
+    if (increment_dead) {
+      pending->fetch_or(1, std::memory_order_relaxed);
+    }
+    const int32 old_pending = pending->fetch_sub(2, std::memory_order_acq_rel);
+    if ((old_pending >> 1) == 1) {
+      // This was the last input of dst. Every dead input set bit 0 before
+      // its own decrement, so all of them show in 'old_pending'.
+      const bool dst_dead =
+          (old_pending & 1) != 0 && !dst_item->is_control_trigger;
+      ready->push_back(TaggedNode(dst_item->node, root_frame_, 0, dst_dead));
+    }
+  }
+}
+
 bool ExecutorState::NodeDone(const Status& s, const Node* node,
                              const TaggedNodeSeq& ready,
                              NodeExecStatsWrapper* stats,
@@ -2106,18 +2296,37 @@ void ExecutorState::ScheduleReady(const TaggedNodeSeq& ready,
   if (stats_collector_) {
     scheduled_usec = nodestats::NowInUsec();
   }
+  const GraphView& gview = impl_->gview_;
+  const KernelStats& kernel_stats = impl_->kernel_stats_;
   if (inline_ready == nullptr) {
-    // Schedule to run all the ready ops in thread pool.
+    // Schedule to run all the ready ops in thread pool: the expensive ones
+    // each on its own, and the inexpensive ones together.
+    TaggedNodeSeq inexpensive_nodes;
     for (auto& tagged_node : ready) {
-      runner_([=]() { Process(tagged_node, scheduled_usec); });
+      const NodeItem& item = *gview.node(tagged_node.node->id());
+      if (tagged_node.is_dead || !kernel_stats.IsExpensive(item)) {
+        inexpensive_nodes.push_back(tagged_node);
+      } else {
+        runner_([=]() { Process(tagged_node, scheduled_usec); });
+      }
+    }
+    if (inexpensive_nodes.size() == 1) {
+      runner_([=]() { Process(inexpensive_nodes[0], scheduled_usec); });
+    } else if (!inexpensive_nodes.empty()) {
+      // Each node counts as outstanding until processed, so only the last
+      // Process() call may finish, and delete, this state.
+      runner_([=]() {
+        for (const TaggedNode& tagged_node : inexpensive_nodes) {
+          Process(tagged_node, scheduled_usec);
+        }
+      });
     }
     return;
   }
-  const GraphView& gview = impl_->gview_;
   const TaggedNode* curr_expensive_node = nullptr;
   for (auto& tagged_node : ready) {
     const NodeItem& item = *gview.node(tagged_node.node->id());
-    if (tagged_node.is_dead || !item.kernel_is_expensive) {
+    if (tagged_node.is_dead || !kernel_stats.IsExpensive(item)) {
       // Inline this inexpensive node.
       inline_ready->push_back(tagged_node);
     } else {
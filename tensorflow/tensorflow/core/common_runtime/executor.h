@@ -93,6 +93,10 @@ class Executor {
     // If true, calls Sync() on the device.
     bool sync_on_finish = false;
 
+    // If positive, caps the number of intra-op threads each kernel of the
+    // step may use (see ScopedIntraOpParallelismLimit).
+    int32 intra_op_parallelism_limit = 0;
+
     typedef std::function<void()> Closure;
     typedef std::function<void(Closure)> Runner;
     Runner runner = nullptr;
@@ -141,6 +145,11 @@ struct LocalExecutorParams {
   std::function<void(OpKernel*)> delete_kernel;
 
   Executor::Args::NodeOutputsCallback node_outputs_cb;
+
+  // If true, and the device is a CPU and the graph has no control flow, the
+  // outputs of the nodes of each step are placed in one arena laid out by a
+  // StepMemoryPlanner.
+  bool plan_memory = false;
 };
 ::tensorflow::Status NewLocalExecutor(const LocalExecutorParams& params,
                                       const Graph* graph, Executor** executor);
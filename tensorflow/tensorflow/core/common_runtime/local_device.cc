@@ -16,6 +16,9 @@ limitations under the License.
 #define EIGEN_USE_THREADS
 
 #include "tensorflow/core/common_runtime/local_device.h"
+
+#include <vector>
+
 #include "third_party/eigen3/unsupported/Eigen/CXX11/Tensor"
 #include "tensorflow/core/common_runtime/eigen_thread_pool.h"
 #include "tensorflow/core/lib/core/threadpool.h"
@@ -24,6 +27,7 @@ limitations under the License.
 #include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/platform/types.h"
 #include "tensorflow/core/public/session_options.h"
+#include "tensorflow/core/util/parallelism_limits.h"
 
 namespace tensorflow {
 
@@ -46,17 +50,38 @@ struct LocalDevice::EigenThreadPoolInfo {
         new EigenThreadPoolWrapper(eigen_worker_threads_.workers));
     eigen_device_.reset(new Eigen::ThreadPoolDevice(
         eigen_threadpool_wrapper_.get(), eigen_worker_threads_.num_threads));
+
+    // Views of the same pool that let a kernel use fewer threads, for
+    // GetEffectiveIntraOpParallelismLimit(). Entry i allows i + 1 threads.
+    limited_worker_threads_.resize(intra_op_parallelism_threads - 1);
+    for (int i = 0; i < limited_worker_threads_.size(); ++i) {
+      limited_worker_threads_[i].num_threads = i + 1;
+      limited_worker_threads_[i].workers = eigen_worker_threads_.workers;
+      limited_eigen_devices_.emplace_back(new Eigen::ThreadPoolDevice(
+          eigen_threadpool_wrapper_.get(), i + 1));
+    }
   }
 
   ~EigenThreadPoolInfo() {
+    limited_eigen_devices_.clear();
     eigen_threadpool_wrapper_.reset();
     eigen_device_.reset();
     delete eigen_worker_threads_.workers;
   }
 
+  // Returns the index into the limited_* vectors to use under the current
+  // intra-op parallelism limit, or -1 if the whole pool may be used.
+  int LimitedIndex() const {
+    const int32 limit = GetEffectiveIntraOpParallelismLimit();
+    if (limit <= 0 || limit >= eigen_worker_threads_.num_threads) return -1;
+    return limit - 1;
+  }
+
   DeviceBase::CpuWorkerThreads eigen_worker_threads_;
   std::unique_ptr<Eigen::ThreadPoolInterface> eigen_threadpool_wrapper_;
   std::unique_ptr<Eigen::ThreadPoolDevice> eigen_device_;
+  std::vector<DeviceBase::CpuWorkerThreads> limited_worker_threads_;
+  std::vector<std::unique_ptr<Eigen::ThreadPoolDevice>> limited_eigen_devices_;
 };
 
 LocalDevice::LocalDevice(const SessionOptions& options,
@@ -78,10 +103,24 @@ LocalDevice::LocalDevice(const SessionOptions& options,
     owned_tp_info_.reset(new LocalDevice::EigenThreadPoolInfo(options));
     tp_info = owned_tp_info_.get();
   }
+  tp_info_ = tp_info;
   set_tensorflow_cpu_worker_threads(&tp_info->eigen_worker_threads_);
   set_eigen_cpu_device(tp_info->eigen_device_.get());
 }
 
 LocalDevice::~LocalDevice() {}
 
+const DeviceBase::CpuWorkerThreads*
+LocalDevice::tensorflow_cpu_worker_threads() const {
+  const int index = tp_info_->LimitedIndex();
+  if (index < 0) return Device::tensorflow_cpu_worker_threads();
+  return &tp_info_->limited_worker_threads_[index];
+}
+
+const Eigen::ThreadPoolDevice* LocalDevice::eigen_cpu_device() {
+  const int index = tp_info_->LimitedIndex();
+  if (index < 0) return Device::eigen_cpu_device();
+  return tp_info_->limited_eigen_devices_[index].get();
+}
+
 }  // namespace tensorflow
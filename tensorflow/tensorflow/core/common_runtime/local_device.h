@@ -37,6 +37,11 @@ class LocalDevice : public Device {
               const DeviceAttributes& attributes);
   ~LocalDevice() override;
 
+  // Honor SetIntraOpParallelismLimit() and ScopedIntraOpParallelismLimit by
+  // handing out views of the intra-op pool that use fewer threads.
+  const CpuWorkerThreads* tensorflow_cpu_worker_threads() const override;
+  const Eigen::ThreadPoolDevice* eigen_cpu_device() override;
+
  private:
   static bool use_global_threadpool_;
 
@@ -46,6 +51,8 @@ class LocalDevice : public Device {
 
   struct EigenThreadPoolInfo;
   std::unique_ptr<EigenThreadPoolInfo> owned_tp_info_;
+  // Either 'owned_tp_info_' or the process-wide one. Not owned.
+  EigenThreadPoolInfo* tp_info_ = nullptr;
 
   friend class test::Benchmark;
 
@@ -0,0 +1,319 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/step_memory_planner.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "tensorflow/core/graph/algorithm.h"
+#include "tensorflow/core/platform/mem.h"
+
+namespace tensorflow {
+
+namespace {
+
+// The number of times the plan may be built. Bounds the cost of planning for
+// graphs whose output sizes keep growing, e.g. with the batch size.
+constexpr int kMaxNumPlans = 4;
+
+int64 RoundUpToAlignment(const int64 num_bytes) {
+  const int64 alignment = Allocator::kAllocatorAlignment;
+  return (num_bytes + alignment - 1) / alignment * alignment;
+}
+
+}  // namespace
+
+StepArena::StepArena(std::shared_ptr<const StepMemoryPlan> plan,
+                     Allocator* base_allocator)
+    : plan_(std::move(plan)),
+      base_allocator_(base_allocator),
+      base_(plan_->total_bytes > 0
+                ? static_cast<char*>(port::AlignedMalloc(
+                      plan_->total_bytes, Allocator::kAllocatorAlignment))
+                : nullptr),
+      states_(new std::atomic<int>[plan_->offsets.size()]),
+      outgrown_sizes_(new std::atomic<int64>[plan_->offsets.size()]) {
+  for (size_t i = 0; i < plan_->offsets.size(); ++i) {
+    states_[i].store(kFree, std::memory_order_relaxed);
+    outgrown_sizes_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+StepArena::~StepArena() {
+  if (base_ != nullptr) {
+    port::AlignedFree(base_);
+  }
+}
+
+void* StepArena::AllocateRaw(size_t alignment, size_t num_bytes) {
+  return AllocateRaw(alignment, num_bytes, AllocationAttributes());
+}
+
+void* StepArena::AllocateRaw(size_t alignment, size_t num_bytes,
+                             const AllocationAttributes& allocation_attr) {
+  const int buffer = allocation_attr.planned_buffer;
+  if (buffer >= 0 && buffer < plan_->offsets.size() && num_bytes > 0) {
+    void* ptr = AllocatePlanned(buffer, alignment, num_bytes);
+    if (ptr != nullptr) {
+      num_planned_allocations_.fetch_add(1, std::memory_order_relaxed);
+      Ref();
+      return ptr;
+    }
+  }
+  void* ptr = base_allocator_->AllocateRaw(alignment, num_bytes,
+                                           allocation_attr);
+  if (ptr != nullptr) {
+    Ref();
+  }
+  return ptr;
+}
+
+void* StepArena::AllocatePlanned(const int buffer, const size_t alignment,
+                                 const size_t num_bytes) {
+  const int64 offset = plan_->offsets[buffer];
+  if (offset < 0 || num_bytes > plan_->sizes[buffer]) {
+    std::atomic<int64>& outgrown_size = outgrown_sizes_[buffer];
+    int64 seen = outgrown_size.load(std::memory_order_relaxed);
+    while (seen < static_cast<int64>(num_bytes) &&
+           !outgrown_size.compare_exchange_weak(seen, num_bytes,
+                                                std::memory_order_relaxed)) {
+    }
+    return nullptr;
+  }
+  if (base_ == nullptr || alignment > Allocator::kAllocatorAlignment) {
+    return nullptr;
+  }
+  int expected = kFree;
+  if (!states_[buffer].compare_exchange_strong(expected, kClaiming)) {
+    return nullptr;
+  }
+  for (const int other : plan_->overlapping[buffer]) {
+    if (states_[other].load() != kFree) {
+      states_[buffer].store(kFree);
+      return nullptr;
+    }
+  }
+  states_[buffer].store(kLive, std::memory_order_release);
+  return base_ + offset;
+}
+
+void StepArena::DeallocateRaw(void* ptr) {
+  if (base_ != nullptr && ptr >= base_ && ptr < base_ + plan_->total_bytes) {
+    // Of the buffers placed at this offset, which all overlap each other, the
+    // live one is the one being freed. One being claimed is never live.
+    const int64 offset = static_cast<char*>(ptr) - base_;
+    auto it = std::lower_bound(plan_->buffers_by_offset.begin(),
+                               plan_->buffers_by_offset.end(),
+                               std::make_pair(offset, -1));
+    bool freed = false;
+    for (; it != plan_->buffers_by_offset.end() && it->first == offset;
+         ++it) {
+      int expected = kLive;
+      if (states_[it->second].compare_exchange_strong(
+              expected, kFree, std::memory_order_acq_rel)) {
+        freed = true;
+        break;
+      }
+    }
+    DCHECK(freed) << "No live buffer at offset " << offset;
+  } else {
+    base_allocator_->DeallocateRaw(ptr);
+  }
+  // May delete the arena.
+  Unref();
+}
+
+int64 StepArena::num_planned_allocations() const {
+  return num_planned_allocations_.load(std::memory_order_relaxed);
+}
+
+std::vector<int64> StepArena::TakeOutgrownSizes() {
+  std::vector<int64> outgrown_sizes(plan_->offsets.size());
+  for (size_t i = 0; i < outgrown_sizes.size(); ++i) {
+    outgrown_sizes[i] =
+        outgrown_sizes_[i].exchange(0, std::memory_order_relaxed);
+  }
+  return outgrown_sizes;
+}
+
+std::unique_ptr<StepMemoryPlanner> StepMemoryPlanner::Create(
+    const Graph& graph, Allocator* base_allocator) {
+  for (const Node* n : graph.nodes()) {
+    if (n->IsControlFlow()) {
+      return nullptr;
+    }
+  }
+
+  std::unique_ptr<StepMemoryPlanner> planner(
+      new StepMemoryPlanner(base_allocator));
+  planner->output_starts_.resize(graph.num_node_ids());
+  int num_buffers = 0;
+  for (const Node* n : graph.nodes()) {
+    planner->output_starts_[n->id()] = num_buffers;
+    num_buffers += n->num_outputs();
+  }
+  planner->plannable_.resize(num_buffers);
+  planner->first_use_.resize(num_buffers);
+  planner->last_use_.resize(num_buffers);
+
+  std::vector<Node*> order;
+  GetReversePostOrder(graph, &order);
+  std::vector<int> positions(graph.num_node_ids());
+  for (int i = 0; i < order.size(); ++i) {
+    positions[order[i]->id()] = i;
+  }
+  for (const Node* n : order) {
+    const int start = planner->output_starts_[n->id()];
+    for (int i = 0; i < n->num_outputs(); ++i) {
+      planner->plannable_[start + i] = !IsRefType(n->output_type(i));
+      planner->first_use_[start + i] = positions[n->id()];
+      planner->last_use_[start + i] = positions[n->id()];
+    }
+    for (const Edge* e : n->out_edges()) {
+      if (e->IsControlEdge()) {
+        continue;
+      }
+      const int buffer = start + e->src_output();
+      planner->last_use_[buffer] =
+          std::max(planner->last_use_[buffer], positions[e->dst()->id()]);
+      if (e->dst()->op_def().is_stateful()) {
+        planner->plannable_[buffer] = false;
+      }
+    }
+  }
+
+  mutex_lock l(planner->mu_);
+  planner->sizes_.resize(num_buffers, 0);
+  planner->plan_ = planner->BuildPlan();
+  return planner;
+}
+
+StepMemoryPlanner::StepMemoryPlanner(Allocator* base_allocator)
+    : base_allocator_(base_allocator) {}
+
+StepMemoryPlanner::~StepMemoryPlanner() {
+  mutex_lock l(mu_);
+  for (StepArena* arena : idle_arenas_) {
+    arena->Unref();
+  }
+}
+
+StepArena* StepMemoryPlanner::AcquireArena() {
+  mutex_lock l(mu_);
+  if (idle_arenas_.empty()) {
+    return new StepArena(plan_, base_allocator_);
+  }
+  StepArena* arena = idle_arenas_.back();
+  idle_arenas_.pop_back();
+  return arena;
+}
+
+void StepMemoryPlanner::ReleaseArena(StepArena* arena) {
+  std::vector<StepArena*> stale_arenas;
+  {
+    mutex_lock l(mu_);
+    const std::vector<int64> outgrown_sizes = arena->TakeOutgrownSizes();
+    bool grew = false;
+    for (int i = 0; i < outgrown_sizes.size(); ++i) {
+      if (plannable_[i] && outgrown_sizes[i] > sizes_[i]) {
+        sizes_[i] = outgrown_sizes[i];
+        grew = true;
+      }
+    }
+    if (grew && num_plans_ < kMaxNumPlans) {
+      plan_ = BuildPlan();
+      ++num_plans_;
+      stale_arenas.swap(idle_arenas_);
+    }
+    if (&arena->plan() == plan_.get()) {
+      idle_arenas_.push_back(arena);
+    } else {
+      stale_arenas.push_back(arena);
+    }
+  }
+  // Arenas holding tensors live on until those are released.
+  for (StepArena* stale_arena : stale_arenas) {
+    stale_arena->Unref();
+  }
+}
+
+int64 StepMemoryPlanner::planned_bytes() const {
+  mutex_lock l(mu_);
+  return plan_->total_bytes;
+}
+
+int StepMemoryPlanner::num_plans() const {
+  mutex_lock l(mu_);
+  return num_plans_;
+}
+
+std::shared_ptr<const StepMemoryPlan> StepMemoryPlanner::BuildPlan() const {
+  const int num_buffers = sizes_.size();
+  std::shared_ptr<StepMemoryPlan> plan(new StepMemoryPlan);
+  plan->offsets.assign(num_buffers, -1);
+  plan->sizes.assign(num_buffers, 0);
+  plan->overlapping.resize(num_buffers);
+
+  // Place the largest buffers first, each at the lowest offset that doesn't
+  // overlap a buffer placed earlier whose lifetime intersects its own.
+  std::vector<int> buffers;
+  for (int i = 0; i < num_buffers; ++i) {
+    if (plannable_[i] && sizes_[i] > 0) {
+      buffers.push_back(i);
+    }
+  }
+  std::sort(buffers.begin(), buffers.end(), [this](const int a, const int b) {
+    return sizes_[a] != sizes_[b] ? sizes_[a] > sizes_[b] : a < b;
+  });
+  std::vector<int> placed;
+  std::vector<std::pair<int64, int64>> taken;
+  for (const int buffer : buffers) {
+    const int64 size = RoundUpToAlignment(sizes_[buffer]);
+    taken.clear();
+    for (const int other : placed) {
+      if (first_use_[other] <= last_use_[buffer] &&
+          first_use_[buffer] <= last_use_[other]) {
+        taken.emplace_back(plan->offsets[other],
+                           plan->offsets[other] + plan->sizes[other]);
+      }
+    }
+    std::sort(taken.begin(), taken.end());
+    int64 offset = 0;
+    for (const auto& range : taken) {
+      if (range.first >= offset + size) {
+        break;
+      }
+      offset = std::max(offset, range.second);
+    }
+    plan->offsets[buffer] = offset;
+    plan->sizes[buffer] = size;
+    plan->total_bytes = std::max(plan->total_bytes, offset + size);
+
+    for (const int other : placed) {
+      if (plan->offsets[other] < offset + size &&
+          offset < plan->offsets[other] + plan->sizes[other]) {
+        plan->overlapping[buffer].push_back(other);
+        plan->overlapping[other].push_back(buffer);
+      }
+    }
+    placed.push_back(buffer);
+    plan->buffers_by_offset.emplace_back(offset, buffer);
+  }
+  std::sort(plan->buffers_by_offset.begin(), plan->buffers_by_offset.end());
+  return plan;
+}
+
+}  // namespace tensorflow
@@ -0,0 +1,177 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef THIRD_PARTY_TENSORFLOW_CORE_COMMON_RUNTIME_STEP_MEMORY_PLANNER_H_
+#define THIRD_PARTY_TENSORFLOW_CORE_COMMON_RUNTIME_STEP_MEMORY_PLANNER_H_
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "tensorflow/core/framework/allocator.h"
+#include "tensorflow/core/graph/graph.h"
+#include "tensorflow/core/lib/core/refcount.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+
+// Where each buffer of a StepMemoryPlanner lives in a step's arena.
+struct StepMemoryPlan {
+  // Per buffer: the offset in the arena, or -1 if the buffer is not planned,
+  // and the number of bytes reserved there.
+  std::vector<int64> offsets;
+  std::vector<int64> sizes;
+
+  // Per buffer: the other buffers whose memory overlaps its own.
+  std::vector<std::vector<int>> overlapping;
+
+  // The placed buffers as (offset, buffer), ordered by offset, so that a
+  // pointer into the arena can be traced back to its buffer.
+  std::vector<std::pair<int64, int>> buffers_by_offset;
+
+  int64 total_bytes = 0;
+};
+
+// The memory of one step, laid out by a StepMemoryPlan. Allocations that name
+// a planned buffer (AllocationAttributes::planned_buffer) are placed at the
+// buffer's offset if they fit and no overlapping buffer is live. All other
+// allocations go to the base allocator.
+//
+// Every allocation, planned or not, holds a reference on the arena, so the
+// arena outlives tensors that outlive their step.
+//
+// Allocation and deallocation take no lock: each buffer has an atomic state,
+// and the plan maps buffers to offsets and back.
+class StepArena : public Allocator, public core::RefCounted {
+ public:
+  StepArena(std::shared_ptr<const StepMemoryPlan> plan,
+            Allocator* base_allocator);
+
+  string Name() override { return "step_arena"; }
+  void* AllocateRaw(size_t alignment, size_t num_bytes) override;
+  void* AllocateRaw(size_t alignment, size_t num_bytes,
+                    const AllocationAttributes& allocation_attr) override;
+  void DeallocateRaw(void* ptr) override;
+
+  const StepMemoryPlan& plan() const { return *plan_; }
+
+  // The number of allocations placed in the arena so far.
+  int64 num_planned_allocations() const;
+
+  // Returns, per buffer, the size of the largest allocation for the buffer
+  // that didn't fit the plan, or 0, and starts over.
+  std::vector<int64> TakeOutgrownSizes();
+
+ private:
+  ~StepArena() override;
+
+  const std::shared_ptr<const StepMemoryPlan> plan_;
+  Allocator* const base_allocator_;
+  char* const base_;
+
+  // Buffer states. A buffer is claimed before the buffers overlapping it are
+  // checked, so that of two overlapping buffers claimed at once, at least one
+  // sees the other and backs off.
+  enum BufferState { kFree = 0, kClaiming = 1, kLive = 2 };
+
+  // Places an allocation of 'num_bytes' in 'buffer', or returns null if it
+  // doesn't fit or the memory is taken.
+  void* AllocatePlanned(int buffer, size_t alignment, size_t num_bytes);
+
+  // Per buffer: its BufferState.
+  std::unique_ptr<std::atomic<int>[]> states_;
+  // Per buffer: the largest allocation that didn't fit it, or 0.
+  std::unique_ptr<std::atomic<int64>[]> outgrown_sizes_;
+  std::atomic<int64> num_planned_allocations_{0};
+
+  TF_DISALLOW_COPY_AND_ASSIGN(StepArena);
+};
+
+// Plans the memory of the outputs of a graph's nodes, so that an executor can
+// place them in one arena per step instead of allocating and freeing every
+// output on its own. Buffer output_start(n) + i of the plan holds output i of
+// the node with id n.
+//
+// The lifetime of an output spans the positions of its producer and its last
+// consumer in a topological order of the graph, and outputs with disjoint
+// lifetimes share memory. Shapes aren't known up front, so the sizes come
+// from earlier steps: the first step only records them, and the plan is
+// rebuilt, a bounded number of times, after a step whose outputs outgrew it.
+//
+// The executor runs nodes in any order the dataflow allows, and a tensor may
+// be kept past its last consumer (e.g. when fetched), so a planned lifetime is
+// only a guess; StepArena checks at runtime that buffers sharing memory are
+// never live at once. Outputs consumed by stateful ops, which may keep them
+// across steps and so pin the arena, are not planned.
+//
+// This class is thread-safe.
+class StepMemoryPlanner {
+ public:
+  // Returns null if 'graph' has control flow, whose nodes may run more than
+  // once per step.
+  static std::unique_ptr<StepMemoryPlanner> Create(const Graph& graph,
+                                                   Allocator* base_allocator);
+
+  ~StepMemoryPlanner();
+
+  // The buffer of the first output of the node with id 'node_id'.
+  int output_start(int node_id) const { return output_starts_[node_id]; }
+
+  // Returns the arena for a new step. Must be handed back to ReleaseArena()
+  // once the step is done.
+  StepArena* AcquireArena();
+  void ReleaseArena(StepArena* arena);
+
+  // The size of the arena of each step under the current plan.
+  int64 planned_bytes() const;
+
+  // The number of times the plan was built.
+  int num_plans() const;
+
+ private:
+  explicit StepMemoryPlanner(Allocator* base_allocator);
+
+  // Lays the buffers of the sizes in 'sizes_' out in a new plan.
+  std::shared_ptr<const StepMemoryPlan> BuildPlan() const
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  Allocator* const base_allocator_;
+
+  // Per node id.
+  std::vector<int> output_starts_;
+  // Per buffer: whether it may be planned, and the positions of its producer
+  // and last consumer in the topological order.
+  std::vector<bool> plannable_;
+  std::vector<int> first_use_;
+  std::vector<int> last_use_;
+
+  mutable mutex mu_;
+  // Per buffer: the largest size seen so far.
+  std::vector<int64> sizes_ GUARDED_BY(mu_);
+  std::shared_ptr<const StepMemoryPlan> plan_ GUARDED_BY(mu_);
+  int num_plans_ GUARDED_BY(mu_) = 0;
+  // Arenas of the current plan not in use by any step.
+  std::vector<StepArena*> idle_arenas_ GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(StepMemoryPlanner);
+};
+
+}  // namespace tensorflow
+
+#endif  // THIRD_PARTY_TENSORFLOW_CORE_COMMON_RUNTIME_STEP_MEMORY_PLANNER_H_
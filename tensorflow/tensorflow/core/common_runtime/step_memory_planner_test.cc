@@ -0,0 +1,254 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/step_memory_planner.h"
+
+#include <atomic>
+#include <cstring>
+
+#include "tensorflow/core/framework/op.h"
+#include "tensorflow/core/graph/graph_def_builder.h"
+#include "tensorflow/core/graph/node_builder.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace tensorflow {
+namespace {
+
+REGISTER_OP("StepMemoryPlannerTestSource").Output("o: float");
+REGISTER_OP("StepMemoryPlannerTestUnary").Input("i: float").Output("o: float");
+REGISTER_OP("StepMemoryPlannerTestStateful")
+    .Input("i: float")
+    .Output("o: float")
+    .SetIsStateful();
+
+// Builds the chain a -> b -> c, with c consumed by 'sink_op'.
+std::unique_ptr<Graph> CreateChain(const string& sink_op) {
+  GraphDefBuilder b(GraphDefBuilder::kFailImmediately);
+  Node* a =
+      ops::SourceOp("StepMemoryPlannerTestSource", b.opts().WithName("a"));
+  Node* bb =
+      ops::UnaryOp("StepMemoryPlannerTestUnary", a, b.opts().WithName("b"));
+  Node* c =
+      ops::UnaryOp("StepMemoryPlannerTestUnary", bb, b.opts().WithName("c"));
+  ops::UnaryOp(sink_op, c, b.opts().WithName("d"));
+  std::unique_ptr<Graph> graph(new Graph(OpRegistry::Global()));
+  TF_CHECK_OK(b.ToGraph(graph.get()));
+  return graph;
+}
+
+int FindNode(const Graph& graph, const string& name) {
+  for (const Node* n : graph.nodes()) {
+    if (n->name() == name) {
+      return n->id();
+    }
+  }
+  return -1;
+}
+
+AllocationAttributes PlannedBuffer(const int buffer) {
+  AllocationAttributes attr;
+  attr.planned_buffer = buffer;
+  return attr;
+}
+
+// Allocates and frees 'num_bytes' for each of 'buffers', in order, each
+// buffer being freed before the next one after it is allocated.
+void RunStep(const std::vector<int>& buffers, const size_t num_bytes,
+             StepArena* arena) {
+  void* previous = nullptr;
+  for (const int buffer : buffers) {
+    void* ptr = arena->AllocateRaw(Allocator::kAllocatorAlignment, num_bytes,
+                                   PlannedBuffer(buffer));
+    ASSERT_NE(nullptr, ptr);
+    if (previous != nullptr) {
+      arena->DeallocateRaw(previous);
+    }
+    previous = ptr;
+  }
+  arena->DeallocateRaw(previous);
+}
+
+TEST(StepMemoryPlannerTest, SharesMemoryBetweenDisjointLifetimes) {
+  std::unique_ptr<Graph> graph = CreateChain("StepMemoryPlannerTestUnary");
+  std::unique_ptr<StepMemoryPlanner> planner =
+      StepMemoryPlanner::Create(*graph, cpu_allocator());
+  ASSERT_NE(nullptr, planner);
+  const std::vector<int> buffers = {
+      planner->output_start(FindNode(*graph, "a")),
+      planner->output_start(FindNode(*graph, "b")),
+      planner->output_start(FindNode(*graph, "c")),
+      planner->output_start(FindNode(*graph, "d"))};
+
+  // The first step only records the sizes.
+  StepArena* arena = planner->AcquireArena();
+  RunStep(buffers, 100, arena);
+  EXPECT_EQ(0, arena->num_planned_allocations());
+  planner->ReleaseArena(arena);
+  EXPECT_EQ(1, planner->num_plans());
+
+  // a and c, and b and d, never live at once.
+  const int64 alignment = Allocator::kAllocatorAlignment;
+  const int64 rounded_bytes = (100 + alignment - 1) / alignment * alignment;
+  EXPECT_EQ(2 * rounded_bytes, planner->planned_bytes());
+
+  arena = planner->AcquireArena();
+  RunStep(buffers, 100, arena);
+  EXPECT_EQ(4, arena->num_planned_allocations());
+  // Smaller outputs fit the plan too.
+  RunStep(buffers, 10, arena);
+  EXPECT_EQ(8, arena->num_planned_allocations());
+  planner->ReleaseArena(arena);
+  EXPECT_EQ(1, planner->num_plans());
+
+  // Larger outputs fall back to the base allocator, and grow the plan. The
+  // idle arena is reused, so its count carries over.
+  arena = planner->AcquireArena();
+  RunStep(buffers, 1000, arena);
+  EXPECT_EQ(8, arena->num_planned_allocations());
+  planner->ReleaseArena(arena);
+  EXPECT_EQ(2, planner->num_plans());
+  EXPECT_LE(2000, planner->planned_bytes());
+}
+
+TEST(StepMemoryPlannerTest, FallsBackWhileOverlappingBufferIsLive) {
+  std::unique_ptr<Graph> graph = CreateChain("StepMemoryPlannerTestUnary");
+  std::unique_ptr<StepMemoryPlanner> planner =
+      StepMemoryPlanner::Create(*graph, cpu_allocator());
+  ASSERT_NE(nullptr, planner);
+  const int a = planner->output_start(FindNode(*graph, "a"));
+  const int c = planner->output_start(FindNode(*graph, "c"));
+  StepArena* arena = planner->AcquireArena();
+  RunStep({a, c}, 100, arena);
+  planner->ReleaseArena(arena);
+
+  // A tensor of a that outlives its step (e.g. a fetched one) keeps c, which
+  // shares its memory, out of the arena.
+  arena = planner->AcquireArena();
+  void* a_ptr = arena->AllocateRaw(Allocator::kAllocatorAlignment, 100,
+                                   PlannedBuffer(a));
+  void* c_ptr = arena->AllocateRaw(Allocator::kAllocatorAlignment, 100,
+                                   PlannedBuffer(c));
+  EXPECT_EQ(1, arena->num_planned_allocations());
+  EXPECT_NE(a_ptr, c_ptr);
+  arena->DeallocateRaw(c_ptr);
+  planner->ReleaseArena(arena);
+  planner.reset();
+  // The arena outlives the planner until its last buffer is freed.
+  arena->DeallocateRaw(a_ptr);
+}
+
+TEST(StepMemoryPlannerTest, ConcurrentAllocationsNeverShareMemory) {
+  std::unique_ptr<Graph> graph = CreateChain("StepMemoryPlannerTestUnary");
+  std::unique_ptr<StepMemoryPlanner> planner =
+      StepMemoryPlanner::Create(*graph, cpu_allocator());
+  ASSERT_NE(nullptr, planner);
+  const std::vector<int> buffers = {
+      planner->output_start(FindNode(*graph, "a")),
+      planner->output_start(FindNode(*graph, "b")),
+      planner->output_start(FindNode(*graph, "c")),
+      planner->output_start(FindNode(*graph, "d"))};
+  constexpr size_t kNumBytes = 256;
+  StepArena* arena = planner->AcquireArena();
+  RunStep(buffers, kNumBytes, arena);
+  planner->ReleaseArena(arena);
+
+  // Every thread fills the memory it gets with its own byte, and checks that
+  // nobody overwrote it before freeing it.
+  arena = planner->AcquireArena();
+  std::atomic<int> num_overwritten(0);
+  {
+    thread::ThreadPool pool(Env::Default(), "test", 4);
+    for (int t = 0; t < 4; ++t) {
+      pool.Schedule([&buffers, arena, t, &num_overwritten]() {
+        for (int i = 0; i < 2000; ++i) {
+          char* ptr = static_cast<char*>(arena->AllocateRaw(
+              Allocator::kAllocatorAlignment, kNumBytes,
+              PlannedBuffer(buffers[(t + i) % buffers.size()])));
+          memset(ptr, t, kNumBytes);
+          for (size_t j = 0; j < kNumBytes; j += 64) {
+            if (ptr[j] != t) ++num_overwritten;
+          }
+          arena->DeallocateRaw(ptr);
+        }
+      });
+    }
+  }
+  EXPECT_EQ(0, num_overwritten);
+  EXPECT_LT(0, arena->num_planned_allocations());
+  planner->ReleaseArena(arena);
+}
+
+TEST(StepMemoryPlannerTest, SkipsOutputsOfStatefulConsumers) {
+  std::unique_ptr<Graph> graph = CreateChain("StepMemoryPlannerTestStateful");
+  std::unique_ptr<StepMemoryPlanner> planner =
+      StepMemoryPlanner::Create(*graph, cpu_allocator());
+  ASSERT_NE(nullptr, planner);
+  const int c = planner->output_start(FindNode(*graph, "c"));
+  StepArena* arena = planner->AcquireArena();
+  RunStep({c}, 100, arena);
+  planner->ReleaseArena(arena);
+  EXPECT_EQ(0, planner->num_plans());
+  EXPECT_EQ(0, planner->planned_bytes());
+}
+
+TEST(StepMemoryPlannerTest, NoPlannerForControlFlow) {
+  std::unique_ptr<Graph> graph = CreateChain("StepMemoryPlannerTestUnary");
+  Node* enter;
+  TF_ASSERT_OK(NodeBuilder("enter", "Enter")
+                   .Input(graph->FindNodeId(FindNode(*graph, "d")))
+                   .Attr("frame_name", "frame")
+                   .Finalize(graph.get(), &enter));
+  EXPECT_EQ(nullptr, StepMemoryPlanner::Create(*graph, cpu_allocator()));
+}
+
+// Allocates and frees the outputs of a chain of nodes, one step after the
+// other, from a step arena ('arg' 1) or the arena's base allocator ('arg' 0).
+static void BM_StepArena(int iters, int arg) {
+  testing::StopTiming();
+  std::unique_ptr<Graph> graph = CreateChain("StepMemoryPlannerTestUnary");
+  std::unique_ptr<StepMemoryPlanner> planner =
+      StepMemoryPlanner::Create(*graph, cpu_allocator());
+  std::vector<int> buffers;
+  for (const Node* n : graph->nodes()) {
+    if (n->IsOp()) buffers.push_back(planner->output_start(n->id()));
+  }
+  constexpr size_t kNumBytes = 4096;
+  StepArena* arena = planner->AcquireArena();
+  RunStep(buffers, kNumBytes, arena);
+  planner->ReleaseArena(arena);
+  arena = planner->AcquireArena();
+  Allocator* allocator = arg ? static_cast<Allocator*>(arena) : cpu_allocator();
+  testing::StartTiming();
+  while (--iters > 0) {
+    void* previous = nullptr;
+    for (const int buffer : buffers) {
+      void* ptr = allocator->AllocateRaw(Allocator::kAllocatorAlignment,
+                                         kNumBytes, PlannedBuffer(buffer));
+      if (previous != nullptr) allocator->DeallocateRaw(previous);
+      previous = ptr;
+    }
+    allocator->DeallocateRaw(previous);
+  }
+  testing::StopTiming();
+  planner->ReleaseArena(arena);
+}
+BENCHMARK(BM_StepArena)->Arg(0)->Arg(1);
+
+}  // namespace
+}  // namespace tensorflow
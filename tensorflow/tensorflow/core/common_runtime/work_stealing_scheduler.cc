@@ -0,0 +1,181 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/work_stealing_scheduler.h"
+
+#include <utility>
+
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+
+namespace {
+
+// The scheduler, if any, whose worker is the current thread, and its index.
+struct CurrentWorker {
+  const WorkStealingScheduler* scheduler = nullptr;
+  int index = -1;
+};
+
+thread_local CurrentWorker current_worker;
+
+}  // namespace
+
+WorkStealingScheduler::WorkStealingScheduler(Env* env, const string& name,
+                                             int num_threads)
+    : oldest_shared_step_(kint64max) {
+  CHECK_GE(num_threads, 1);
+  for (int i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(new Worker);
+  }
+  // Workers steal from each other, so all of them exist before any starts.
+  for (int i = 0; i < num_threads; ++i) {
+    workers_[i]->thread.reset(
+        env->StartThread(ThreadOptions(), strings::StrCat(name, "_", i),
+                         [this, i]() { WorkerLoop(i); }));
+  }
+}
+
+WorkStealingScheduler::~WorkStealingScheduler() {
+  {
+    mutex_lock l(mu_);
+    stopping_ = true;
+    wake_.notify_all();
+  }
+  // Joins the workers, which run what is left first.
+  for (auto& worker : workers_) {
+    worker->thread.reset();
+  }
+}
+
+int64 WorkStealingScheduler::StartStep() { return next_step_.fetch_add(1); }
+
+int WorkStealingScheduler::CurrentThreadId() const {
+  return current_worker.scheduler == this ? current_worker.index : -1;
+}
+
+void WorkStealingScheduler::Schedule(int64 step, std::function<void()> fn) {
+  const int index = CurrentThreadId();
+  if (index >= 0) {
+    Worker* worker = workers_[index].get();
+    mutex_lock l(worker->mu);
+    worker->tasks.push_front({step, std::move(fn)});
+  } else {
+    mutex_lock l(mu_);
+    shared_tasks_[step].push_back(std::move(fn));
+    oldest_shared_step_.store(shared_tasks_.begin()->first,
+                              std::memory_order_relaxed);
+  }
+  // Pairs with the check in WorkerLoop() before going to sleep: either the
+  // worker sees the closure, or we see the worker and wake it up.
+  num_queued_.fetch_add(1);
+  if (num_sleeping_.load() > 0) {
+    mutex_lock l(mu_);
+    wake_.notify_one();
+  }
+}
+
+void WorkStealingScheduler::WorkerLoop(int index) {
+  current_worker.scheduler = this;
+  current_worker.index = index;
+  Task task;
+  while (true) {
+    if (TakeTask(index, &task)) {
+      num_queued_.fetch_sub(1);
+      task.fn();
+      task.fn = nullptr;
+      continue;
+    }
+    mutex_lock l(mu_);
+    ++num_sleeping_;
+    if (num_queued_.load() == 0) {
+      if (stopping_) {
+        --num_sleeping_;
+        return;
+      }
+      wake_.wait(l);
+    }
+    --num_sleeping_;
+  }
+}
+
+bool WorkStealingScheduler::TakeTask(int index, Task* task) {
+  // The worker's own closures come first, unless an older step waits in the
+  // shared queue.
+  Worker* worker = workers_[index].get();
+  {
+    mutex_lock l(worker->mu);
+    if (!worker->tasks.empty() &&
+        worker->tasks.front().step <=
+            oldest_shared_step_.load(std::memory_order_relaxed)) {
+      *task = std::move(worker->tasks.front());
+      worker->tasks.pop_front();
+      return true;
+    }
+  }
+  return TakeSharedTask(task) || TakeLocalTask(index, task) ||
+         StealTask(index, task);
+}
+
+bool WorkStealingScheduler::TakeLocalTask(int index, Task* task) {
+  Worker* worker = workers_[index].get();
+  mutex_lock l(worker->mu);
+  if (worker->tasks.empty()) {
+    return false;
+  }
+  *task = std::move(worker->tasks.front());
+  worker->tasks.pop_front();
+  return true;
+}
+
+bool WorkStealingScheduler::TakeSharedTask(Task* task) {
+  if (oldest_shared_step_.load(std::memory_order_relaxed) == kint64max) {
+    return false;
+  }
+  mutex_lock l(mu_);
+  if (shared_tasks_.empty()) {
+    return false;
+  }
+  auto oldest = shared_tasks_.begin();
+  task->step = oldest->first;
+  task->fn = std::move(oldest->second.front());
+  oldest->second.pop_front();
+  if (oldest->second.empty()) {
+    shared_tasks_.erase(oldest);
+  }
+  oldest_shared_step_.store(
+      shared_tasks_.empty() ? kint64max : shared_tasks_.begin()->first,
+      std::memory_order_relaxed);
+  return true;
+}
+
+bool WorkStealingScheduler::StealTask(int index, Task* task) {
+  const int num_workers = workers_.size();
+  for (int i = 1; i < num_workers; ++i) {
+    Worker* victim = workers_[(index + i) % num_workers].get();
+    mutex_lock l(victim->mu);
+    if (!victim->tasks.empty()) {
+      // The back holds the victim's least recently scheduled closure, the one
+      // it would get to last.
+      *task = std::move(victim->tasks.back());
+      victim->tasks.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace tensorflow
@@ -0,0 +1,118 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef THIRD_PARTY_TENSORFLOW_CORE_COMMON_RUNTIME_WORK_STEALING_SCHEDULER_H_
+#define THIRD_PARTY_TENSORFLOW_CORE_COMMON_RUNTIME_WORK_STEALING_SCHEDULER_H_
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+
+// An inter-op scheduler for the closures of concurrent steps. Unlike a plain
+// thread pool, which interleaves the closures of all steps in arrival order,
+// it keeps each step's nodes close together:
+//
+// * Each worker has a deque of its own. A closure scheduled from a worker
+//   (e.g. for a successor of the node it just ran) goes to the front of that
+//   worker's deque, and the worker takes it next, while the node's outputs
+//   are still in its caches.
+//
+// * Closures scheduled from other threads (e.g. for the root nodes of a new
+//   step) go to a shared queue ordered by step: a worker with nothing older
+//   in its own deque takes the closure of the oldest step there.
+//
+// * A worker with nothing to run steals from the back of the other workers'
+//   deques.
+//
+// Steps are ordered by StartStep(), so that the steps admitted first finish
+// first instead of all steps being slowed down alike when several run at
+// once.
+//
+// This class is thread-safe.
+class WorkStealingScheduler {
+ public:
+  WorkStealingScheduler(Env* env, const string& name, int num_threads);
+
+  // Waits for all scheduled closures to run.
+  ~WorkStealingScheduler();
+
+  // Returns the key of a new step, older than the keys returned afterwards.
+  int64 StartStep();
+
+  // Schedules 'fn' on behalf of the step with key 'step'.
+  void Schedule(int64 step, std::function<void()> fn);
+
+  int NumThreads() const { return workers_.size(); }
+
+  // Returns the index of the calling worker in [0, NumThreads()), or -1 if
+  // the caller isn't a worker of this scheduler.
+  int CurrentThreadId() const;
+
+ private:
+  struct Task {
+    int64 step;
+    std::function<void()> fn;
+  };
+
+  struct Worker {
+    mutex mu;
+    // The front is the most recently scheduled closure.
+    std::deque<Task> tasks GUARDED_BY(mu);
+    std::unique_ptr<Thread> thread;
+  };
+
+  void WorkerLoop(int index);
+
+  // Takes the next closure for worker 'index' to run, if any.
+  bool TakeTask(int index, Task* task);
+  bool TakeLocalTask(int index, Task* task);
+  bool TakeSharedTask(Task* task);
+  bool StealTask(int index, Task* task);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  std::atomic<int64> next_step_{0};
+
+  // The number of closures scheduled and not yet taken. Workers sleep only
+  // while it is 0.
+  std::atomic<int64> num_queued_{0};
+  std::atomic<int> num_sleeping_{0};
+
+  // The key of the oldest step with a closure in 'shared_tasks_', or kint64max.
+  std::atomic<int64> oldest_shared_step_;
+
+  mutex mu_;
+  condition_variable wake_;
+  std::map<int64, std::deque<std::function<void()>>> shared_tasks_
+      GUARDED_BY(mu_);
+  bool stopping_ GUARDED_BY(mu_) = false;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(WorkStealingScheduler);
+};
+
+}  // namespace tensorflow
+
+#endif  // THIRD_PARTY_TENSORFLOW_CORE_COMMON_RUNTIME_WORK_STEALING_SCHEDULER_H_
@@ -0,0 +1,100 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/work_stealing_scheduler.h"
+
+#include <atomic>
+#include <vector>
+
+#include "tensorflow/core/lib/core/blocking_counter.h"
+#include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace tensorflow {
+namespace {
+
+TEST(WorkStealingSchedulerTest, RunsAllClosures) {
+  std::atomic<int> num_run(0);
+  {
+    WorkStealingScheduler scheduler(Env::Default(), "test", 4);
+    EXPECT_EQ(4, scheduler.NumThreads());
+    EXPECT_EQ(-1, scheduler.CurrentThreadId());
+    for (int i = 0; i < 100; ++i) {
+      const int64 step = scheduler.StartStep();
+      scheduler.Schedule(step, [&scheduler, &num_run, step]() {
+        EXPECT_GE(scheduler.CurrentThreadId(), 0);
+        // Successors, scheduled from the worker.
+        for (int j = 0; j < 10; ++j) {
+          scheduler.Schedule(step, [&num_run]() { ++num_run; });
+        }
+      });
+    }
+    // The destructor waits for all of them.
+  }
+  EXPECT_EQ(1000, num_run);
+}
+
+TEST(WorkStealingSchedulerTest, RunsOldestStepFirst) {
+  WorkStealingScheduler scheduler(Env::Default(), "test", 1);
+  Notification blocked;
+  Notification unblock;
+  const int64 first_step = scheduler.StartStep();
+  scheduler.Schedule(first_step, [&blocked, &unblock]() {
+    blocked.Notify();
+    unblock.WaitForNotification();
+  });
+  blocked.WaitForNotification();
+
+  // Queued newest first while the only worker is busy.
+  const int64 second_step = scheduler.StartStep();
+  const int64 third_step = scheduler.StartStep();
+  mutex mu;
+  std::vector<int64> order;
+  BlockingCounter done(2);
+  for (const int64 step : {third_step, second_step}) {
+    scheduler.Schedule(step, [&mu, &order, &done, step]() {
+      {
+        mutex_lock l(mu);
+        order.push_back(step);
+      }
+      done.DecrementCount();
+    });
+  }
+  unblock.Notify();
+  done.Wait();
+  EXPECT_EQ(std::vector<int64>({second_step, third_step}), order);
+}
+
+TEST(WorkStealingSchedulerTest, IdleWorkersSteal) {
+  WorkStealingScheduler scheduler(Env::Default(), "test", 2);
+  const int64 step = scheduler.StartStep();
+  // Both closures go to the deque of the worker running the first one, which
+  // blocks until the other worker has stolen and run the second.
+  Notification stolen;
+  Notification done;
+  scheduler.Schedule(step, [&scheduler, &stolen, &done, step]() {
+    const int owner = scheduler.CurrentThreadId();
+    scheduler.Schedule(step, [&scheduler, &stolen, owner]() {
+      EXPECT_NE(owner, scheduler.CurrentThreadId());
+      stolen.Notify();
+    });
+    stolen.WaitForNotification();
+    done.Notify();
+  });
+  done.WaitForNotification();
+}
+
+}  // namespace
+}  // namespace tensorflow
@@ -14,6 +14,8 @@ limitations under the License.
 ==============================================================================*/
 
 #include <algorithm>
+#include <atomic>
+#include <map>
 
 #include "tensorflow/core/common_runtime/device.h"
 #include "tensorflow/core/common_runtime/device_factory.h"
@@ -26,10 +28,12 @@ limitations under the License.
 #include "tensorflow/core/framework/step_stats.pb.h"
 #include "tensorflow/core/framework/versions.pb.h"
 #include "tensorflow/core/graph/graph_constructor.h"
+#include "tensorflow/core/graph/node_builder.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/lib/random/simple_philox.h"
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/profile_utils/cpu_utils.h"
 #include "tensorflow/core/platform/test.h"
 #include "tensorflow/core/platform/test_benchmark.h"
 #include "tensorflow/core/platform/tracing.h"
@@ -71,6 +75,9 @@ class ExecutorTest : public ::testing::Test {
     delete exec_;
     TF_CHECK_OK(NewLocalExecutor(params, graph, &exec_));
     runner_ = [this](std::function<void()> fn) { thread_pool_->Schedule(fn); };
+    if (rendez_ != nullptr) {
+      CHECK(rendez_->Unref());
+    }
     rendez_ = NewLocalRendezvous();
   }
 
@@ -410,4 +417,191 @@ TEST_F(ExecutorTest, RecvInvalidRefDtype) {
   rendez->Unref();
 }
 
+// An identity that claims to be expensive, so the executor dispatches it to
+// the thread pool until it has measured how cheap it is.
+class ClaimsExpensiveOp : public OpKernel {
+ public:
+  explicit ClaimsExpensiveOp(OpKernelConstruction* ctx) : OpKernel(ctx) {}
+  void Compute(OpKernelContext* ctx) override {
+    ctx->set_output(0, ctx->input(0));
+  }
+  bool IsExpensive() override { return true; }
+};
+REGISTER_KERNEL_BUILDER(Name("ClaimsExpensive").Device(DEVICE_CPU),
+                        ClaimsExpensiveOp);
+REGISTER_OP("ClaimsExpensive").Input("x: float").Output("y: float").Doc("");
+
+// An identity that claims to be cheap, so the executor runs it inline until
+// it has measured that it spins for a millisecond.
+class ClaimsCheapOp : public OpKernel {
+ public:
+  explicit ClaimsCheapOp(OpKernelConstruction* ctx) : OpKernel(ctx) {}
+  void Compute(OpKernelContext* ctx) override {
+    const uint64 end_micros = Env::Default()->NowMicros() + 1000;
+    while (Env::Default()->NowMicros() < end_micros) {
+    }
+    ctx->set_output(0, ctx->input(0));
+  }
+  bool IsExpensive() override { return false; }
+};
+REGISTER_KERNEL_BUILDER(Name("ClaimsCheap").Device(DEVICE_CPU), ClaimsCheapOp);
+REGISTER_OP("ClaimsCheap").Input("x: float").Output("y: float").Doc("");
+
+// Builds c = Const, followed by two nodes of op 'op' that both consume c. The
+// executor runs the root nodes in one closure. When c is done, it runs
+// inexpensive successors inline and dispatches all expensive ones but the
+// last.
+void BuildFanOut(const string& op, Graph* g) {
+  auto c = test::graph::Constant(g, V(1.0));
+  test::graph::Unary(g, op, c);
+  test::graph::Unary(g, op, c);
+}
+
+// Kernel costs are measured in cycles.
+bool HasCycleCounter() {
+  const uint64 start_cycles = profile_utils::CpuUtils::GetCurrentClockCycle();
+  Env::Default()->SleepForMicroseconds(1000);
+  return profile_utils::CpuUtils::GetCurrentClockCycle() > start_cycles;
+}
+
+TEST_F(ExecutorTest, InlinesKernelsMeasuredInexpensive) {
+  if (!HasCycleCounter()) return;
+  Graph* g = new Graph(OpRegistry::Global());
+  BuildFanOut("ClaimsExpensive", g);
+  Create(g);
+  std::atomic<int> num_closures(0);
+  runner_ = [this, &num_closures](std::function<void()> fn) {
+    ++num_closures;
+    thread_pool_->Schedule(fn);
+  };
+
+  // Before it has run, each node is as expensive as its kernel claims: one of
+  // the two is dispatched.
+  TF_ASSERT_OK(Run(rendez_));
+  EXPECT_EQ(2, num_closures);
+
+  // Once measured, both run inline. (The estimates start high and decay, and
+  // a preempted run may set them back, so allow for many steps.)
+  bool ran_inline = false;
+  for (int step = 0; step < 1000 && !ran_inline; ++step) {
+    num_closures = 0;
+    TF_ASSERT_OK(Run(rendez_));
+    ran_inline = (num_closures == 1);
+  }
+  EXPECT_TRUE(ran_inline);
+}
+
+TEST_F(ExecutorTest, DispatchesKernelsMeasuredExpensive) {
+  if (!HasCycleCounter()) return;
+  Graph* g = new Graph(OpRegistry::Global());
+  BuildFanOut("ClaimsCheap", g);
+  Create(g);
+  std::atomic<int> num_closures(0);
+  runner_ = [this, &num_closures](std::function<void()> fn) {
+    ++num_closures;
+    thread_pool_->Schedule(fn);
+  };
+
+  // Before it has run, each node is as cheap as its kernel claims: both run
+  // inline, in the closure that ran the root nodes.
+  TF_ASSERT_OK(Run(rendez_));
+  EXPECT_EQ(1, num_closures);
+
+  // A millisecond is far above the dispatch threshold, even after a single
+  // run has been folded into the estimates.
+  num_closures = 0;
+  TF_ASSERT_OK(Run(rendez_));
+  EXPECT_EQ(2, num_closures);
+}
+
+// Builds a graph without control flow in which a dead input, d, reaches
+// several consumers:
+//   d0 = Identity(d), d1 = Identity(d), sum = a + d      (all dead)
+//   twice = a + a                                       (live)
+//   after_trigger = Identity(a), after a ControlTrigger on a and d (live)
+// If 'add_switch' is true, also adds a Switch that nothing consumes, which
+// doesn't change the results but makes the executor take its locked path.
+void BuildDeadFanOut(bool add_switch, Graph* g) {
+  auto a = test::graph::Recv(g, "a", "float", ALICE, 1, BOB);
+  auto d = test::graph::Recv(g, "d", "float", ALICE, 1, BOB);
+  test::graph::Send(g, test::graph::Identity(g, d), "d0", BOB, 1, ALICE);
+  test::graph::Send(g, test::graph::Identity(g, d), "d1", BOB, 1, ALICE);
+  test::graph::Send(g, test::graph::Add(g, a, d), "sum", BOB, 1, ALICE);
+  test::graph::Send(g, test::graph::Add(g, a, a), "twice", BOB, 1, ALICE);
+  Node* trigger;
+  TF_CHECK_OK(
+      NodeBuilder(g->NewName("n"), "ControlTrigger").Finalize(g, &trigger));
+  g->AddControlEdge(a, trigger);
+  g->AddControlEdge(d, trigger);
+  auto after_trigger = test::graph::Identity(g, a);
+  g->AddControlEdge(trigger, after_trigger);
+  test::graph::Send(g, after_trigger, "after_trigger", BOB, 1, ALICE);
+  if (add_switch) {
+    test::graph::Switch(g, test::graph::Constant(g, V(1.0)),
+                        test::graph::Constant(g, VB(true)));
+  }
+}
+
+// The outputs of a BuildDeadFanOut() graph by name: whether each is dead,
+// and if not, its value.
+typedef std::map<string, std::pair<bool, float>> DeadFanOutResults;
+
+TEST_F(ExecutorTest, DeadInputsWithoutControlFlow) {
+  const DeadFanOutResults expected = {{"d0", {true, 0}},
+                                      {"d1", {true, 0}},
+                                      {"sum", {true, 0}},
+                                      {"twice", {false, 2.0}},
+                                      {"after_trigger", {false, 1.0}}};
+  // Runs 'num_steps' steps of the current executor, several at a time, and
+  // returns how many of them gave results other than 'expected'.
+  auto count_mismatches = [this, &expected](int num_steps) {
+    mutex mu;
+    int num_mismatches = 0;
+    {
+      thread::ThreadPool steps(Env::Default(), "steps", 8);
+      for (int i = 0; i < num_steps; ++i) {
+        steps.Schedule([this, &expected, &mu, &num_mismatches]() {
+          Rendezvous* rendez = NewLocalRendezvous();
+          Rendezvous::Args args;
+          TF_CHECK_OK(rendez->Send(Key(ALICE, kIncarnation, BOB, "a"), args,
+                                   V(1.0), false));
+          TF_CHECK_OK(rendez->Send(Key(ALICE, kIncarnation, BOB, "d"), args,
+                                   V(2.0), true /* is_dead */));
+          Executor::Args exec_args;
+          exec_args.rendezvous = rendez;
+          exec_args.runner = runner_;
+          TF_CHECK_OK(exec_->Run(exec_args));
+          DeadFanOutResults results;
+          for (const auto& entry : expected) {
+            Tensor out;
+            bool is_dead = false;
+            TF_CHECK_OK(rendez->Recv(Key(BOB, kIncarnation, ALICE, entry.first),
+                                     args, &out, &is_dead));
+            results[entry.first] = {is_dead, is_dead ? 0 : V(out)};
+          }
+          rendez->Unref();
+          if (results != expected) {
+            mutex_lock l(mu);
+            ++num_mismatches;
+          }
+        });
+      }
+    }
+    return num_mismatches;
+  };
+
+  // The locked path.
+  Graph* g = new Graph(OpRegistry::Global());
+  BuildDeadFanOut(true /* add_switch */, g);
+  Create(g);
+  EXPECT_EQ(0, count_mismatches(100));
+
+  // The lock-free path, where the producers of a node's inputs may finish on
+  // different threads.
+  g = new Graph(OpRegistry::Global());
+  BuildDeadFanOut(false /* add_switch */, g);
+  Create(g);
+  EXPECT_EQ(0, count_mismatches(1000));
+}
+
 }  // namespace tensorflow
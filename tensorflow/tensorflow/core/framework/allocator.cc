@@ -15,10 +15,16 @@ limitations under the License.
 
 #include "tensorflow/core/framework/allocator.h"
 
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
 #include "tensorflow/core/framework/allocator_registry.h"
 #include "tensorflow/core/framework/log_memory.h"
 #include "tensorflow/core/framework/tracking_allocator.h"
 #include "tensorflow/core/lib/strings/stringprintf.h"
+#include "tensorflow/core/platform/cpu_info.h"
 #include "tensorflow/core/platform/mem.h"
 #include "tensorflow/core/platform/mutex.h"
 #include "tensorflow/core/platform/types.h"
@@ -125,6 +131,120 @@ Allocator* cpu_allocator() {
   return cpu_alloc;
 }
 
+namespace {
+
+// Places its memory on one NUMA node, with port::NUMAMalloc(). That maps and
+// binds fresh pages on every call, so this keeps freed blocks for reuse, in
+// free lists by power-of-two size, up to kMaxCachedBytes. Requests below
+// kMinNUMABytes, which span a page or two at most, go to port::AlignedMalloc()
+// instead: placing them is not worth a system call each.
+class NUMAAllocator : public Allocator {
+ public:
+  explicit NUMAAllocator(int numa_node) : numa_node_(numa_node) {}
+
+  ~NUMAAllocator() override {
+    for (auto& entry : free_blocks_) {
+      for (void* block : entry.second) {
+        port::NUMAFree(block);
+      }
+    }
+  }
+
+  string Name() override { return strings::Printf("cpu_numa_%d", numa_node_); }
+
+  void* AllocateRaw(size_t alignment, size_t num_bytes) override {
+    if (num_bytes < kMinNUMABytes) {
+      return port::AlignedMalloc(num_bytes, alignment);
+    }
+    // Cached blocks are only known to be aligned to kAllocatorAlignment.
+    const size_t block_bytes =
+        alignment <= kAllocatorAlignment ? RoundUpToPowerOfTwo(num_bytes) : 0;
+    if (block_bytes > 0) {
+      mutex_lock l(mu_);
+      auto it = free_blocks_.find(block_bytes);
+      if (it != free_blocks_.end() && !it->second.empty()) {
+        void* block = it->second.back();
+        it->second.pop_back();
+        cached_bytes_ -= block_bytes;
+        block_bytes_[block] = block_bytes;
+        return block;
+      }
+    }
+    void* block = port::NUMAMalloc(
+        numa_node_, block_bytes > 0 ? block_bytes : num_bytes,
+        std::max<size_t>(alignment, kAllocatorAlignment));
+    if (block != nullptr) {
+      mutex_lock l(mu_);
+      block_bytes_[block] = block_bytes;
+    }
+    return block;
+  }
+
+  void DeallocateRaw(void* ptr) override {
+    if (ptr == nullptr) return;
+    {
+      mutex_lock l(mu_);
+      auto it = block_bytes_.find(ptr);
+      if (it == block_bytes_.end()) {
+        // A small block, from port::AlignedMalloc().
+        port::AlignedFree(ptr);
+        return;
+      }
+      const size_t block_bytes = it->second;
+      block_bytes_.erase(it);
+      if (block_bytes > 0 && cached_bytes_ + block_bytes <= kMaxCachedBytes) {
+        free_blocks_[block_bytes].push_back(ptr);
+        cached_bytes_ += block_bytes;
+        return;
+      }
+    }
+    port::NUMAFree(ptr);
+  }
+
+ private:
+  static constexpr size_t kMinNUMABytes = 64 << 10;
+  static constexpr size_t kMaxCachedBytes = size_t{256} << 20;
+
+  static size_t RoundUpToPowerOfTwo(size_t num_bytes) {
+    size_t rounded = kMinNUMABytes;
+    while (rounded < num_bytes) rounded <<= 1;
+    return rounded;
+  }
+
+  const int numa_node_;
+
+  mutex mu_;
+  // The size class of each block handed out by NUMAMalloc(), or 0 for a block
+  // with a larger alignment, which is not cached.
+  std::unordered_map<void*, size_t> block_bytes_ GUARDED_BY(mu_);
+  std::map<size_t, std::vector<void*>> free_blocks_ GUARDED_BY(mu_);
+  size_t cached_bytes_ GUARDED_BY(mu_) = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(NUMAAllocator);
+};
+
+constexpr size_t NUMAAllocator::kMinNUMABytes;
+constexpr size_t NUMAAllocator::kMaxCachedBytes;
+
+}  // namespace
+
+Allocator* cpu_allocator(int numa_node) {
+  static const int num_numa_nodes = port::NUMANumNodes();
+  if (numa_node == port::kNUMANoAffinity || num_numa_nodes < 2) {
+    return cpu_allocator();
+  }
+  CHECK_GE(numa_node, 0);
+  CHECK_LT(numa_node, num_numa_nodes);
+  static std::vector<Allocator*>* numa_allocators = [] {
+    auto* allocators = new std::vector<Allocator*>;
+    for (int node = 0; node < num_numa_nodes; ++node) {
+      allocators->push_back(new NUMAAllocator(node));
+    }
+    return allocators;
+  }();
+  return (*numa_allocators)[numa_node];
+}
+
 REGISTER_MEM_ALLOCATOR("DefaultCPUAllocator", 100, CPUAllocator);
 
 }  // namespace tensorflow
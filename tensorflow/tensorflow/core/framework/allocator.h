@@ -43,6 +43,10 @@ struct AllocationAttributes {
   // which Op is performing the allocation, and sets this flag to
   // true.
   bool allocation_will_be_logged = false;
+  // If non-negative, the index of the buffer in the allocator's memory plan
+  // that this allocation is for (see common_runtime/step_memory_planner.h).
+  // Allocators without a memory plan ignore it.
+  int planned_buffer = -1;
 };
 
 // Runtime statistics collected by an allocator.
@@ -372,6 +376,11 @@ struct AllocatorAttributes {
 // default malloc. The returned allocator is a process singleton.
 Allocator* cpu_allocator();
 
+// Returns an allocator whose memory is placed on NUMA node 'numa_node', or
+// cpu_allocator() if 'numa_node' is port::kNUMANoAffinity or the host has a
+// single node. The returned allocators are process singletons.
+Allocator* cpu_allocator(int numa_node);
+
 // If 'enable' is true, the process-wide cpu allocator collects
 // AllocatorStats. By default, it's disabled.
 void EnableCPUAllocatorStats(bool enable);
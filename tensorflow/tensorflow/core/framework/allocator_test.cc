@@ -18,6 +18,7 @@ limitations under the License.
 #include <algorithm>
 #include <vector>
 
+#include "tensorflow/core/platform/cpu_info.h"
 #include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/platform/test.h"
 #include "tensorflow/core/platform/test_benchmark.h"
@@ -147,6 +148,44 @@ TEST(CPUAllocatorTest, Sizes) {
   EXPECT_EQ(false, a->TracksAllocationSizes());
 }
 
+TEST(CPUAllocatorTest, NUMANodes) {
+  EXPECT_EQ(cpu_allocator(), cpu_allocator(port::kNUMANoAffinity));
+  for (int node = 0; node < port::NUMANumNodes(); ++node) {
+    Allocator* a = cpu_allocator(node);
+    EXPECT_EQ(a, cpu_allocator(node));
+    float* values = a->Allocate<float>(1024);
+    ASSERT_NE(nullptr, values);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(values) %
+                     Allocator::kAllocatorAlignment);
+    values[1023] = 1;
+    a->Deallocate(values, 1024);
+  }
+}
+
+TEST(CPUAllocatorTest, NUMANodeReusesLargeBlocks) {
+  for (int node = 0; node < port::NUMANumNodes(); ++node) {
+    Allocator* a = cpu_allocator(node);
+    // Small requests do not go to NUMAMalloc(), but must still be aligned.
+    char* small = a->Allocate<char>(100);
+    ASSERT_NE(nullptr, small);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(small) %
+                     Allocator::kAllocatorAlignment);
+    small[99] = 1;
+
+    const size_t kLarge = 1 << 20;
+    char* large = a->Allocate<char>(kLarge);
+    ASSERT_NE(nullptr, large);
+    large[kLarge - 1] = 1;
+    a->Deallocate(large, kLarge);
+    // A freed block is handed out again for a request of the same size class.
+    char* reused = a->Allocate<char>(kLarge - 1000);
+    EXPECT_EQ(large, reused);
+    reused[kLarge - 1001] = 1;
+    a->Deallocate(reused, kLarge - 1000);
+    a->Deallocate(small, 100);
+  }
+}
+
 namespace {
 
 AllocatorAttributes DeviceAllocatorAttribute() {
@@ -620,7 +620,9 @@ Status OpKernelContext::allocate_output(StringPiece name,
 Status OpKernelContext::allocate_tensor(
     DataType type, const TensorShape& shape, Tensor* out_tensor,
     AllocatorAttributes attr, const AllocationAttributes& allocation_attr) {
-  Allocator* a = get_allocator(attr);
+  Allocator* a = allocation_attr.planned_buffer >= 0
+                     ? params_->planned_output_allocator
+                     : get_allocator(attr);
   AllocationAttributes logged_attr(allocation_attr);
   logged_attr.allocation_will_be_logged = true;
   Tensor new_tensor(a, type, shape, logged_attr);
@@ -649,7 +651,13 @@ Status OpKernelContext::allocate_output(int index, const TensorShape& shape,
   DCHECK(!IsRefType(type));
   DCHECK(mutable_output(index) == nullptr);
   Tensor* output_tensor = new Tensor();
-  Status s = allocate_tensor(type, shape, output_tensor, attr);
+  AllocationAttributes allocation_attr;
+  if (params_->planned_output_allocator != nullptr && attr.value == 0 &&
+      !track_allocations()) {
+    allocation_attr.planned_buffer = params_->planned_output_start + index;
+  }
+  Status s =
+      allocate_tensor(type, shape, output_tensor, attr, allocation_attr);
   if (s.ok()) {
     outputs_[index] = TensorValue(output_tensor);
     *output = outputs_[index].tensor;
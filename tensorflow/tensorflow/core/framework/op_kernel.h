@@ -511,6 +511,12 @@ class OpKernelContext {
     // Array indexed by output number for this node
     const AllocatorAttributes* output_attr_array = nullptr;
 
+    // If set, outputs with default allocator attributes are allocated from
+    // this allocator, as buffer 'planned_output_start' + the output index of
+    // its memory plan. (See common_runtime/step_memory_planner.h.)
+    Allocator* planned_output_allocator = nullptr;
+    int planned_output_start = 0;
+
     // Shared resources accessible by this op kernel invocation.
     ResourceMgr* resource_manager = nullptr;
 
@@ -54,7 +54,6 @@ limitations under the License.
 #include "tensorflow/core/platform/variant_coding.h"
 
 namespace tensorflow {
-std::mutex Tensor::tensor_m;
 
 // Allow Tensors to be stored inside Variants with automatic
 // encoding/decoding when those Variants are themselves being decoded
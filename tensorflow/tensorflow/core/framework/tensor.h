@@ -13,8 +13,6 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
-#include <mutex>
-
 #ifndef TENSORFLOW_CORE_FRAMEWORK_TENSOR_H_
 #define TENSORFLOW_CORE_FRAMEWORK_TENSOR_H_
 
@@ -52,8 +50,6 @@ Status CopyElementToSlice(Tensor element, Tensor* parent, int64 index);
 /// Represents an n-dimensional array of values.
 class Tensor {
  public:
-  //FOR PRINTING
-  static std::mutex tensor_m; 
   /// \brief Creates a 1-dimensional, 0-element float tensor.
   ///
   /// The returned Tensor is not a scalar (shape {}), but is instead
@@ -46,6 +46,11 @@ Tensor DeepCopy(const Tensor& other) {
 }
 
 Status Concat(const gtl::ArraySlice<Tensor>& tensors, Tensor* result) {
+  return Concat(tensors, cpu_allocator(), result);
+}
+
+Status Concat(const gtl::ArraySlice<Tensor>& tensors, Allocator* allocator,
+              Tensor* result) {
   if (tensors.empty()) {
     return errors::InvalidArgument("Cannot concatenate zero tensors");
   }
@@ -67,7 +72,7 @@ Status Concat(const gtl::ArraySlice<Tensor>& tensors, Tensor* result) {
           "Cannot concatenate tensors that have different data types");
     }
   }
-  *result = Tensor(dtype, shape);
+  *result = Tensor(allocator, dtype, shape);
 
   // We use StringPiece as a convenient map over the tensor buffer,
   // but we cast the type to get to the underlying buffer to do the
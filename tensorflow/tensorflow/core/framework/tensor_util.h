@@ -41,6 +41,11 @@ Tensor DeepCopy(const Tensor& other);
 Status Concat(const gtl::ArraySlice<Tensor>& tensors,
               Tensor* result) TF_MUST_USE_RESULT;
 
+// Like Concat() above, but allocates '*result' with 'allocator' (e.g. one that
+// places it on a given NUMA node) rather than cpu_allocator().
+Status Concat(const gtl::ArraySlice<Tensor>& tensors, Allocator* allocator,
+              Tensor* result) TF_MUST_USE_RESULT;
+
 // Splits 'tensor' into 'sizes.size()' individual tensors, along the 0th
 // dimension. The ith output tensor has 0th-dimension size 'sizes[i]'.
 //
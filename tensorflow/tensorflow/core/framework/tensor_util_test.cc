@@ -17,8 +17,10 @@ limitations under the License.
 
 #include <vector>
 #include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
 #include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/cpu_info.h"
 #include "tensorflow/core/platform/test.h"
 
 namespace tensorflow {
@@ -173,6 +175,22 @@ TEST(TensorUtil, Concat) {
   }
 }
 
+TEST(TensorUtil, ConcatWithAllocator) {
+  Tensor first(DT_FLOAT, TensorShape({1, 2}));
+  first.matrix<float>().setConstant(1);
+  Tensor second(DT_FLOAT, TensorShape({2, 2}));
+  second.matrix<float>().setConstant(2);
+
+  // The last NUMA node's allocator, which is cpu_allocator() on hosts with a
+  // single node.
+  Allocator* allocator = cpu_allocator(port::NUMANumNodes() - 1);
+  Tensor concated;
+  TF_ASSERT_OK(tensor::Concat({first, second}, allocator, &concated));
+  test::ExpectTensorEqual<float>(
+      test::AsTensor<float>({1, 1, 2, 2, 2, 2}, TensorShape({3, 2})),
+      concated);
+}
+
 TEST(TensorUtil, Split) {
   Tensor to_split(DT_INT64, TensorShape({10, 2}));
   for (int i = 0; i < 10; ++i) {
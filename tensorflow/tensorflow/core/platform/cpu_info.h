@@ -34,6 +34,23 @@ constexpr bool kLittleEndian = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
 // software can change it dynamically.
 int NumSchedulableCPUs();
 
+// The NUMA node of threads and memory that are not bound to any node.
+constexpr int kNUMANoAffinity = -1;
+
+// Returns the number of NUMA nodes of the host, or 1 if the host is not NUMA
+// or its topology cannot be determined.
+int NUMANumNodes();
+
+// Restricts the calling thread to the CPUs of NUMA node 'node', in
+// [0, NUMANumNodes()), so that the memory it first touches is allocated on
+// that node. kNUMANoAffinity lets the thread run on the CPUs of every node
+// again. A no-op on hosts with a single node.
+void NUMASetThreadNodeAffinity(int node);
+
+// Returns the node the calling thread was last bound to with
+// NUMASetThreadNodeAffinity(), or kNUMANoAffinity.
+int NUMAGetThreadNodeAffinity();
+
 // Mostly ISA related features that we care about
 enum CPUFeature {
   // Do not change numeric assignments.
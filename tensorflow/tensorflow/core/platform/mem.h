@@ -29,6 +29,13 @@ namespace port {
 void* AlignedMalloc(size_t size, int minimum_alignment);
 void AlignedFree(void* aligned_memory);
 
+// Like AlignedMalloc(), but places the memory on NUMA node 'node'. Falls back
+// to AlignedMalloc() if 'node' is kNUMANoAffinity or the host has a single
+// node. Memory must be released with NUMAFree(). Each call maps whole pages,
+// so it is meant for large buffers.
+void* NUMAMalloc(int node, size_t size, int minimum_alignment);
+void NUMAFree(void* ptr);
+
 void* Malloc(size_t size);
 void* Realloc(void* ptr, size_t size);
 void Free(void* ptr);
@@ -33,6 +33,36 @@ TEST(Port, AlignedMalloc) {
   }
 }
 
+TEST(Port, NUMAMalloc) {
+  for (int node = kNUMANoAffinity; node < NUMANumNodes(); ++node) {
+    for (size_t alignment = sizeof(void*); alignment <= 1 << 16;
+         alignment <<= 1) {
+      char* p = static_cast<char*>(NUMAMalloc(node, 100, alignment));
+      ASSERT_TRUE(p != nullptr) << "NUMAMalloc(" << node << ", 100, "
+                                << alignment << ")";
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % alignment, 0);
+      memset(p, 1, 100);
+      NUMAFree(p);
+    }
+  }
+}
+
+TEST(Port, NUMAThreadNodeAffinity) {
+  EXPECT_LE(1, NUMANumNodes());
+  EXPECT_EQ(kNUMANoAffinity, NUMAGetThreadNodeAffinity());
+  // Threads started with a node run bound to it on NUMA hosts.
+  ThreadOptions thread_options;
+  thread_options.numa_node = NUMANumNodes() - 1;
+  int thread_node = kNUMANoAffinity;
+  {
+    std::unique_ptr<Thread> thread(Env::Default()->StartThread(
+        thread_options, "numa_test",
+        [&thread_node] { thread_node = NUMAGetThreadNodeAffinity(); }));
+  }
+  EXPECT_EQ(NUMANumNodes() > 1 ? NUMANumNodes() - 1 : kNUMANoAffinity,
+            thread_node);
+}
+
 TEST(ConditionVariable, WaitForMilliseconds_Timeout) {
   mutex m;
   mutex_lock l(m);
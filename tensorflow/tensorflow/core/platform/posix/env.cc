@@ -40,10 +40,15 @@ namespace {
 
 class StdThread : public Thread {
  public:
-  // name and thread_options are both ignored.
+  // name is ignored, and of thread_options only numa_node is honored.
   StdThread(const ThreadOptions& thread_options, const string& name,
             std::function<void()> fn)
-      : thread_(fn) {}
+      : thread_([thread_options, fn] {
+          if (thread_options.numa_node != port::kNUMANoAffinity) {
+            port::NUMASetThreadNodeAffinity(thread_options.numa_node);
+          }
+          fn();
+        }) {}
   ~StdThread() override { thread_.join(); }
 
  private:
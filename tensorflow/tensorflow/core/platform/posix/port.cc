@@ -29,11 +29,16 @@ limitations under the License.
 
 #if defined(__linux__) && !defined(__ANDROID__)
 #include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #endif
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <algorithm>
+#include <vector>
 #ifdef TF_USE_SNAPPY
 #include "snappy.h"
 #endif
@@ -73,6 +78,107 @@ int NumSchedulableCPUs() {
   return kDefaultCores;
 }
 
+#if defined(__linux__) && !defined(__ANDROID__)
+namespace {
+
+// The CPUs of each NUMA node, read from sysfs once.
+struct NUMATopology {
+  std::vector<cpu_set_t> node_cpus;
+  // The union of 'node_cpus'.
+  cpu_set_t all_cpus;
+};
+
+// Parses a sysfs CPU list such as "0-3,8-11" into 'cpus'.
+bool ParseCPUList(const char* list, cpu_set_t* cpus) {
+  CPU_ZERO(cpus);
+  const char* p = list;
+  while (*p != '\0' && *p != '\n') {
+    char* end;
+    const long first = strtol(p, &end, 10);
+    if (end == p || first < 0) return false;
+    long last = first;
+    p = end;
+    if (*p == '-') {
+      last = strtol(p + 1, &end, 10);
+      if (end == p + 1 || last < first) return false;
+      p = end;
+    }
+    for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+      CPU_SET(cpu, cpus);
+    }
+    if (*p == ',') ++p;
+  }
+  return CPU_COUNT(cpus) > 0;
+}
+
+const NUMATopology& GetNUMATopology() {
+  static const NUMATopology* topology = [] {
+    NUMATopology* topology = new NUMATopology;
+    CPU_ZERO(&topology->all_cpus);
+    for (int node = 0;; ++node) {
+      char path[64];
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+               node);
+      FILE* file = fopen(path, "r");
+      if (file == nullptr) break;
+      char list[4096];
+      const bool read = fgets(list, sizeof(list), file) != nullptr;
+      fclose(file);
+      cpu_set_t cpus;
+      if (!read || !ParseCPUList(list, &cpus)) break;
+      topology->node_cpus.push_back(cpus);
+      CPU_OR(&topology->all_cpus, &topology->all_cpus, &cpus);
+    }
+    return topology;
+  }();
+  return *topology;
+}
+
+thread_local int thread_numa_node = kNUMANoAffinity;
+
+// From <linux/mempolicy.h>, which is not always installed.
+constexpr int kMPOLPreferred = 1;
+
+}  // namespace
+#endif
+
+int NUMANumNodes() {
+#if defined(__linux__) && !defined(__ANDROID__)
+  return std::max<int>(1, GetNUMATopology().node_cpus.size());
+#else
+  return 1;
+#endif
+}
+
+void NUMASetThreadNodeAffinity(int node) {
+#if defined(__linux__) && !defined(__ANDROID__)
+  const NUMATopology& topology = GetNUMATopology();
+  if (topology.node_cpus.size() < 2) return;
+  if (node != kNUMANoAffinity &&
+      (node < 0 || node >= static_cast<int>(topology.node_cpus.size()))) {
+    LOG(ERROR) << "Invalid NUMA node " << node << "; the host has "
+               << topology.node_cpus.size() << " nodes";
+    return;
+  }
+  const cpu_set_t& cpus = node == kNUMANoAffinity ? topology.all_cpus
+                                                  : topology.node_cpus[node];
+  if (sched_setaffinity(0, sizeof(cpu_set_t), &cpus) != 0) {
+    LOG(WARNING) << "sched_setaffinity to NUMA node " << node
+                 << " failed: " << strerror(errno);
+    return;
+  }
+  thread_numa_node = node;
+#endif
+}
+
+int NUMAGetThreadNodeAffinity() {
+#if defined(__linux__) && !defined(__ANDROID__)
+  return thread_numa_node;
+#else
+  return kNUMANoAffinity;
+#endif
+}
+
 void* AlignedMalloc(size_t size, int minimum_alignment) {
 #if defined(__ANDROID__)
   return memalign(minimum_alignment, size);
@@ -98,6 +204,75 @@ void* AlignedMalloc(size_t size, int minimum_alignment) {
 
 void AlignedFree(void* aligned_memory) { Free(aligned_memory); }
 
+#if defined(__linux__) && !defined(__ANDROID__)
+namespace {
+
+// Precedes each block returned by NUMAMalloc().
+struct NUMABlockHeader {
+  // The start of the underlying allocation.
+  void* base;
+  // The length of the mapping at 'base', or 0 if it came from AlignedMalloc().
+  size_t mapped_bytes;
+};
+
+}  // namespace
+
+void* NUMAMalloc(int node, size_t size, int minimum_alignment) {
+  const size_t alignment =
+      std::max<size_t>(minimum_alignment, sizeof(NUMABlockHeader));
+  // Room for the header in front of an aligned block.
+  const size_t total_bytes = sizeof(NUMABlockHeader) + alignment + size;
+  void* base;
+  size_t mapped_bytes = 0;
+  if (node == kNUMANoAffinity || NUMANumNodes() < 2) {
+    base = AlignedMalloc(total_bytes, alignment);
+    if (base == nullptr) return nullptr;
+  } else {
+    const size_t page_size = getpagesize();
+    mapped_bytes = (total_bytes + page_size - 1) / page_size * page_size;
+    base = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return nullptr;
+    // Pages are only placed when first touched, so binding the range before
+    // handing it out puts all of it on 'node'. On failure the memory is still
+    // usable, just not node-local.
+    constexpr int kBitsPerWord = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> node_mask(node / kBitsPerWord + 1, 0);
+    node_mask[node / kBitsPerWord] |= 1UL << (node % kBitsPerWord);
+    if (syscall(SYS_mbind, base, mapped_bytes, kMPOLPreferred,
+                node_mask.data(), node_mask.size() * kBitsPerWord + 1,
+                0) != 0) {
+      VLOG(1) << "mbind to NUMA node " << node << " failed: "
+              << strerror(errno);
+    }
+  }
+  const uintptr_t block =
+      (reinterpret_cast<uintptr_t>(base) + sizeof(NUMABlockHeader) +
+       alignment - 1) &
+      ~(alignment - 1);
+  NUMABlockHeader* header = reinterpret_cast<NUMABlockHeader*>(block) - 1;
+  header->base = base;
+  header->mapped_bytes = mapped_bytes;
+  return reinterpret_cast<void*>(block);
+}
+
+void NUMAFree(void* ptr) {
+  if (ptr == nullptr) return;
+  const NUMABlockHeader* header = static_cast<NUMABlockHeader*>(ptr) - 1;
+  if (header->mapped_bytes == 0) {
+    AlignedFree(header->base);
+  } else {
+    munmap(header->base, header->mapped_bytes);
+  }
+}
+#else
+void* NUMAMalloc(int node, size_t size, int minimum_alignment) {
+  return AlignedMalloc(size, minimum_alignment);
+}
+
+void NUMAFree(void* ptr) { AlignedFree(ptr); }
+#endif
+
 void* Malloc(size_t size) {
 #ifdef TENSORFLOW_USE_JEMALLOC
   return jemalloc_malloc(size);
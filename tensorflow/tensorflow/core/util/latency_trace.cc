@@ -0,0 +1,297 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/util/latency_trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+
+namespace tensorflow {
+namespace latency_trace {
+
+namespace internal {
+std::atomic<bool> enabled(false);
+}  // namespace internal
+
+namespace {
+
+// Number of events each thread can buffer between two flushes. Must be a power
+// of two.
+constexpr uint64 kRingCapacity = 1 << 14;
+
+// A single-producer, single-consumer ring of events. The owning thread is the
+// only producer; the flusher (holding Sink::mu_) is the only consumer.
+class Ring {
+ public:
+  Ring() : head_(0), tail_(0) {}
+
+  void Push(const Event& event) {
+    const uint64 head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= kRingCapacity) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    events_[head & (kRingCapacity - 1)] = event;
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  // Appends the CSV rendering of every buffered event to 'out'.
+  void Drain(string* out) {
+    const uint64 tail = tail_.load(std::memory_order_relaxed);
+    const uint64 head = head_.load(std::memory_order_acquire);
+    for (uint64 i = tail; i < head; ++i) {
+      const Event& event = events_[i & (kRingCapacity - 1)];
+      strings::StrAppend(out, SourceName(event.source), ",",
+                         event.start_micros, ",", event.end_micros, ",");
+      AppendMeasurement(event.queue_micros, out);
+      out->push_back(',');
+      AppendMeasurement(event.compute_micros, out);
+      out->push_back('\n');
+    }
+    tail_.store(head, std::memory_order_release);
+  }
+
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+  int64 dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  // Set once the owning thread has exited; the ring is freed after its last
+  // events are drained. Only accessed under Sink::rings_mu_.
+  bool retired = false;
+
+ private:
+  // Keep the producer and consumer indices on separate cache lines.
+  std::atomic<uint64> head_;
+  char head_padding_[64 - sizeof(std::atomic<uint64>)];
+  std::atomic<uint64> tail_;
+  char tail_padding_[64 - sizeof(std::atomic<uint64>)];
+  std::atomic<int64> dropped_{0};
+  Event events_[kRingCapacity];
+
+  // Writes kNotMeasured as an empty field.
+  static void AppendMeasurement(int64 micros, string* out) {
+    if (micros != kNotMeasured) strings::StrAppend(out, micros);
+  }
+
+  TF_DISALLOW_COPY_AND_ASSIGN(Ring);
+};
+
+// Owns all rings, the output file and the flusher thread.
+class Sink {
+ public:
+  static Sink* Get() {
+    static Sink* sink = new Sink;
+    return sink;
+  }
+
+  // Returns the calling thread's ring, registering it on first use. The ring
+  // is handed back through ReleaseRing() when the thread exits.
+  Ring* ThreadRing() {
+    static thread_local RingHolder holder;
+    if (holder.ring == nullptr) {
+      mutex_lock l(rings_mu_);
+      rings_.emplace_back(new Ring);
+      holder.ring = rings_.back().get();
+    }
+    return holder.ring;
+  }
+
+  Status Start(const string& path, int64 flush_interval_micros) {
+    mutex_lock l(mu_);
+    if (file_ != nullptr) {
+      return errors::AlreadyExists("Latency trace already writing to ", path_);
+    }
+    std::unique_ptr<WritableFile> file;
+    TF_RETURN_IF_ERROR(Env::Default()->NewWritableFile(path, &file));
+    TF_RETURN_IF_ERROR(file->Append(
+        "source,start_micros,end_micros,queue_micros,compute_micros\n"));
+    file_ = std::move(file);
+    path_ = path;
+    flush_interval_micros_ = std::max<int64>(flush_interval_micros, 1000);
+    stop_ = false;
+    flusher_.reset(Env::Default()->StartThread(
+        {}, "latency_trace_flusher", [this]() { FlusherLoop(); }));
+    SetEnabled(true);
+    return Status::OK();
+  }
+
+  void Stop() {
+    SetEnabled(false);
+    std::unique_ptr<Thread> flusher;
+    {
+      mutex_lock l(mu_);
+      if (file_ == nullptr) return;
+      stop_ = true;
+      stop_cv_.notify_all();
+      flusher = std::move(flusher_);
+    }
+    // Joins the flusher, which performs a final drain before exiting.
+    flusher.reset();
+    mutex_lock l(mu_);
+    Status s = file_->Close();
+    if (!s.ok()) {
+      LOG(ERROR) << "Failed to close latency trace " << path_ << ": " << s;
+    }
+    file_.reset();
+  }
+
+  void Flush() {
+    mutex_lock l(mu_);
+    if (file_ != nullptr) FlushLocked();
+  }
+
+  int64 NumDropped() {
+    mutex_lock l(rings_mu_);
+    int64 dropped = retired_dropped_;
+    for (const auto& ring : rings_) {
+      dropped += ring->dropped();
+    }
+    return dropped;
+  }
+
+ private:
+  // Releases the owning thread's ring when the thread exits.
+  struct RingHolder {
+    Ring* ring = nullptr;
+    ~RingHolder() {
+      if (ring != nullptr) Sink::Get()->ReleaseRing(ring);
+    }
+  };
+
+  Sink() = default;
+
+  // Frees 'ring' right away if it holds no events; otherwise leaves it for
+  // the flusher to free once drained.
+  void ReleaseRing(Ring* ring) {
+    mutex_lock l(rings_mu_);
+    ring->retired = true;
+    if (ring->empty()) FreeRetiredRingsLocked();
+  }
+
+  void FreeRetiredRingsLocked() EXCLUSIVE_LOCKS_REQUIRED(rings_mu_) {
+    auto it = rings_.begin();
+    while (it != rings_.end()) {
+      Ring* ring = it->get();
+      if (ring->retired && ring->empty()) {
+        retired_dropped_ += ring->dropped();
+        it = rings_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  void FlusherLoop() {
+    mutex_lock l(mu_);
+    for (;;) {
+      const bool stopping = stop_;
+      FlushLocked();
+      if (stopping) return;
+      stop_cv_.wait_for(l,
+                        std::chrono::microseconds(flush_interval_micros_));
+    }
+  }
+
+  void FlushLocked() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    buffer_.clear();
+    {
+      mutex_lock rings_lock(rings_mu_);
+      for (const auto& ring : rings_) {
+        ring->Drain(&buffer_);
+      }
+      FreeRetiredRingsLocked();
+    }
+    if (buffer_.empty()) return;
+    Status s = file_->Append(buffer_);
+    if (s.ok()) s = file_->Flush();
+    if (!s.ok()) {
+      LOG(ERROR) << "Failed to write latency trace " << path_ << ": " << s;
+    }
+  }
+
+  // Guards the output file and flusher state; also serializes consumers of
+  // the rings.
+  mutex mu_;
+  condition_variable stop_cv_;
+  std::unique_ptr<WritableFile> file_ GUARDED_BY(mu_);
+  string path_ GUARDED_BY(mu_);
+  int64 flush_interval_micros_ GUARDED_BY(mu_) = 0;
+  bool stop_ GUARDED_BY(mu_) = false;
+  std::unique_ptr<Thread> flusher_ GUARDED_BY(mu_);
+  string buffer_ GUARDED_BY(mu_);
+
+  // Guards registration and release of rings. Taken by a thread only the
+  // first time it records an event and when it exits.
+  mutex rings_mu_;
+  std::vector<std::unique_ptr<Ring>> rings_ GUARDED_BY(rings_mu_);
+  // Events dropped by rings that have since been freed.
+  int64 retired_dropped_ GUARDED_BY(rings_mu_) = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(Sink);
+};
+
+}  // namespace
+
+const char* SourceName(Source source) {
+  switch (source) {
+    case Source::kPredict:
+      return "predict";
+    case Source::kBatchingTask:
+      return "batching_task";
+    case Source::kSessionRun:
+      return "session_run";
+  }
+  return "unknown";
+}
+
+void SetEnabled(bool enabled) {
+  internal::enabled.store(enabled, std::memory_order_relaxed);
+}
+
+int64 NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void Record(const Event& event) {
+  if (!IsEnabled()) return;
+  Sink::Get()->ThreadRing()->Push(event);
+}
+
+Status Start(const string& path, int64 flush_interval_micros) {
+  return Sink::Get()->Start(path, flush_interval_micros);
+}
+
+void Flush() { Sink::Get()->Flush(); }
+
+void Stop() { Sink::Get()->Stop(); }
+
+int64 NumDroppedEvents() { return Sink::Get()->NumDropped(); }
+
+}  // namespace latency_trace
+}  // namespace tensorflow
@@ -0,0 +1,131 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// A low-overhead sink for per-request latency measurements.
+//
+// Callers on the request path (e.g. the model server's Predict handler, the
+// batching layer and DirectSession::Run) record fixed-size Events into a
+// ring buffer owned by the calling thread. Recording takes no locks and does
+// no I/O; a single background thread periodically drains every ring and
+// appends the events to a columnar CSV file:
+//
+//   source,start_micros,end_micros,queue_micros,compute_micros
+//
+// Timestamps come from a monotonic clock (see latency_trace::NowMicros()).
+// A field the recording layer cannot measure is left empty. If a ring fills up
+// faster than the flusher drains it, new events are dropped and counted rather
+// than blocking the caller. A thread's ring is freed once the thread exits and
+// its remaining events have been written.
+//
+// Typical usage:
+//
+//   TF_CHECK_OK(latency_trace::Start("/tmp/latency.csv"));
+//   ...
+//   if (latency_trace::IsEnabled()) {
+//     const int64 start = latency_trace::NowMicros();
+//     ... do work ...
+//     latency_trace::Record({latency_trace::Source::kPredict, start,
+//                            latency_trace::NowMicros(),
+//                            latency_trace::kNotMeasured,
+//                            latency_trace::kNotMeasured});
+//   }
+//   ...
+//   latency_trace::Stop();
+
+#ifndef TENSORFLOW_CORE_UTIL_LATENCY_TRACE_H_
+#define TENSORFLOW_CORE_UTIL_LATENCY_TRACE_H_
+
+#include <atomic>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace latency_trace {
+
+// Identifies the layer that recorded an event.
+enum class Source : uint8 {
+  // One RPC as seen by the model server's request handler. The handler cannot
+  // tell queueing from compute, so both are kNotMeasured; join with the
+  // kBatchingTask and kSessionRun events for the breakdown.
+  kPredict = 0,
+  // One task as seen by the batching layer. 'queue_micros' is the time spent
+  // waiting for a batch; 'compute_micros' is the batched Session::Run().
+  kBatchingTask = 1,
+  // One DirectSession::Run() step.
+  kSessionRun = 2,
+};
+
+// Returns the printable name of 'source', as written to the trace file.
+const char* SourceName(Source source);
+
+// Value of Event::queue_micros or Event::compute_micros when the recording
+// layer does not measure it.
+constexpr int64 kNotMeasured = -1;
+
+// A single latency measurement. All values are in microseconds; 'start' and
+// 'end' are taken from NowMicros().
+struct Event {
+  Source source;
+  int64 start_micros;
+  int64 end_micros;
+  int64 queue_micros;
+  int64 compute_micros;
+};
+
+namespace internal {
+extern std::atomic<bool> enabled;
+}  // namespace internal
+
+// Returns true iff events passed to Record() are currently being kept. Cheap
+// enough to guard the timestamp reads on the request path.
+inline bool IsEnabled() {
+  return internal::enabled.load(std::memory_order_relaxed);
+}
+
+// Turns recording on or off without touching the output file. Has no effect
+// on whether the flusher is running; events recorded while no flusher is
+// running stay buffered (up to the ring capacity) until Start() is called.
+void SetEnabled(bool enabled);
+
+// Returns the current time on the monotonic clock used for all events.
+int64 NowMicros();
+
+// Appends 'event' to the calling thread's ring. A no-op if !IsEnabled().
+// Never blocks.
+void Record(const Event& event);
+
+// Opens (truncating) 'path', writes the CSV header, starts the background
+// flusher and enables recording. The flusher drains all rings every
+// 'flush_interval_micros'. Returns an error if the trace is already started or
+// the file cannot be created.
+Status Start(const string& path, int64 flush_interval_micros = 100 * 1000);
+
+// Writes every buffered event to the file now rather than at the next flush
+// interval. A no-op if the trace was not started.
+void Flush();
+
+// Disables recording, drains any buffered events to the file, stops the
+// flusher and closes the file. A no-op if the trace was not started.
+void Stop();
+
+// Returns the number of events dropped because a ring was full, since the
+// process started.
+int64 NumDroppedEvents();
+
+}  // namespace latency_trace
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_CORE_UTIL_LATENCY_TRACE_H_
@@ -0,0 +1,140 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/util/latency_trace.h"
+
+#include <memory>
+#include <vector>
+
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/strings/str_util.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace tensorflow {
+namespace latency_trace {
+namespace {
+
+std::vector<string> ReadLines(const string& path) {
+  string contents;
+  TF_CHECK_OK(ReadFileToString(Env::Default(), path, &contents));
+  return str_util::Split(contents, '\n', str_util::SkipEmpty());
+}
+
+TEST(LatencyTraceTest, DisabledByDefault) {
+  EXPECT_FALSE(IsEnabled());
+}
+
+TEST(LatencyTraceTest, NowMicrosIsMonotonic) {
+  const int64 first = NowMicros();
+  const int64 second = NowMicros();
+  EXPECT_LE(first, second);
+}
+
+TEST(LatencyTraceTest, WritesRecordedEvents) {
+  const string path = io::JoinPath(testing::TmpDir(), "latency_trace.csv");
+  TF_ASSERT_OK(Start(path));
+  EXPECT_TRUE(IsEnabled());
+  EXPECT_FALSE(Start(path).ok());
+
+  Record({Source::kPredict, 100, 250, kNotMeasured, kNotMeasured});
+  Record({Source::kBatchingTask, 110, 240, 30, 100});
+  SetEnabled(false);
+  // Not kept while disabled.
+  Record({Source::kSessionRun, 1, 2, 0, 1});
+  SetEnabled(true);
+  Record({Source::kSessionRun, 140, 240, 0, 100});
+  Stop();
+  EXPECT_FALSE(IsEnabled());
+
+  const std::vector<string> lines = ReadLines(path);
+  ASSERT_EQ(4, lines.size());
+  EXPECT_EQ("source,start_micros,end_micros,queue_micros,compute_micros",
+            lines[0]);
+  EXPECT_EQ("predict,100,250,,", lines[1]);
+  EXPECT_EQ("batching_task,110,240,30,100", lines[2]);
+  EXPECT_EQ("session_run,140,240,0,100", lines[3]);
+}
+
+TEST(LatencyTraceTest, CollectsEventsFromManyThreads) {
+  const string path =
+      io::JoinPath(testing::TmpDir(), "latency_trace_threads.csv");
+  TF_ASSERT_OK(Start(path, 1000 /* flush_interval_micros */));
+  constexpr int kNumThreads = 8;
+  constexpr int kEventsPerThread = 1000;
+  {
+    thread::ThreadPool pool(Env::Default(), "trace_test", kNumThreads);
+    for (int i = 0; i < kNumThreads; ++i) {
+      pool.Schedule([]() {
+        for (int j = 0; j < kEventsPerThread; ++j) {
+          Record({Source::kPredict, j, j + 1, 0, 0});
+        }
+      });
+    }
+  }
+  Stop();
+
+  const std::vector<string> lines = ReadLines(path);
+  EXPECT_EQ(1 + kNumThreads * kEventsPerThread - NumDroppedEvents(),
+            lines.size());
+}
+
+TEST(LatencyTraceTest, WritesEventsOfExitedThreads) {
+  const string path =
+      io::JoinPath(testing::TmpDir(), "latency_trace_exited.csv");
+  // Long enough that the threads below exit before the first flush.
+  TF_ASSERT_OK(Start(path, 60 * 1000 * 1000 /* flush_interval_micros */));
+  constexpr int kNumThreads = 4;
+  for (int i = 0; i < kNumThreads; ++i) {
+    std::unique_ptr<Thread> thread(
+        Env::Default()->StartThread({}, "trace_test", [i]() {
+          Record({Source::kSessionRun, i, i + 1, 0, 1});
+        }));
+  }
+  Flush();
+  const std::vector<string> lines = ReadLines(path);
+  EXPECT_EQ(1 + kNumThreads, lines.size());
+  Stop();
+}
+
+static void BM_Record(int iters) {
+  testing::StopTiming();
+  const string path = io::JoinPath(testing::TmpDir(), "latency_trace_bm.csv");
+  TF_CHECK_OK(Start(path, 60 * 1000 * 1000 /* flush_interval_micros */));
+  const int64 dropped = NumDroppedEvents();
+  testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    const int64 start = NowMicros();
+    Record({Source::kPredict, start, NowMicros(), 0, 0});
+    // Drain well before the ring fills so every iteration measures the
+    // recording path rather than the drop path.
+    if ((i & 1023) == 1023) {
+      testing::StopTiming();
+      Flush();
+      testing::StartTiming();
+    }
+  }
+  testing::StopTiming();
+  Stop();
+  CHECK_EQ(dropped, NumDroppedEvents());
+}
+BENCHMARK(BM_Record);
+
+}  // namespace
+}  // namespace latency_trace
+}  // namespace tensorflow
@@ -0,0 +1,66 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/util/parallelism_limits.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace tensorflow {
+
+namespace {
+
+std::atomic<int32> inter_op_parallelism_override(0);
+std::atomic<int32> intra_op_parallelism_limit(0);
+thread_local int32 scoped_intra_op_parallelism_limit = 0;
+
+}  // namespace
+
+void SetInterOpParallelismOverride(int32 num_threads) {
+  inter_op_parallelism_override.store(std::max(num_threads, 0),
+                                      std::memory_order_relaxed);
+}
+
+int32 GetInterOpParallelismOverride() {
+  return inter_op_parallelism_override.load(std::memory_order_relaxed);
+}
+
+void SetIntraOpParallelismLimit(int32 num_threads) {
+  intra_op_parallelism_limit.store(std::max(num_threads, 0),
+                                   std::memory_order_relaxed);
+}
+
+int32 GetIntraOpParallelismLimit() {
+  return intra_op_parallelism_limit.load(std::memory_order_relaxed);
+}
+
+ScopedIntraOpParallelismLimit::ScopedIntraOpParallelismLimit(int32 num_threads)
+    : previous_limit_(scoped_intra_op_parallelism_limit) {
+  scoped_intra_op_parallelism_limit = std::max(num_threads, 0);
+}
+
+ScopedIntraOpParallelismLimit::~ScopedIntraOpParallelismLimit() {
+  scoped_intra_op_parallelism_limit = previous_limit_;
+}
+
+int32 GetEffectiveIntraOpParallelismLimit() {
+  const int32 global_limit = GetIntraOpParallelismLimit();
+  const int32 scoped_limit = scoped_intra_op_parallelism_limit;
+  if (global_limit == 0) return scoped_limit;
+  if (scoped_limit == 0) return global_limit;
+  return std::min(global_limit, scoped_limit);
+}
+
+}  // namespace tensorflow
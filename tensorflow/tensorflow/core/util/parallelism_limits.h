@@ -0,0 +1,72 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+
+// Process-wide knobs that change the parallelism of running sessions without
+// recreating them. Intended for servers that tune themselves while serving.
+
+#ifndef TENSORFLOW_CORE_UTIL_PARALLELISM_LIMITS_H_
+#define TENSORFLOW_CORE_UTIL_PARALLELISM_LIMITS_H_
+
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+
+// Sets the number of threads in the inter-op thread pool shared by all
+// DirectSessions that use the global pool (i.e. those with neither
+// use_per_session_threads nor session_inter_op_thread_pool set). The pool is
+// replaced at the start of the next Run(); steps already running finish on the
+// old pool, whose threads exit once it is no longer used. 0 restores the size
+// the pool was first created with. Negative values are treated as 0.
+void SetInterOpParallelismOverride(int32 num_threads);
+
+// Returns the value last passed to SetInterOpParallelismOverride(), or 0.
+int32 GetInterOpParallelismOverride();
+
+// Caps the number of threads a single CPU kernel may use for intra-op
+// parallelism (Eigen and Shard()). Takes effect for kernels launched after the
+// call. The cap can only lower parallelism below the size of the intra-op
+// pool, which is fixed when the first CPU device is created. 0 removes the
+// cap. Negative values are treated as 0.
+void SetIntraOpParallelismLimit(int32 num_threads);
+
+// Returns the value last passed to SetIntraOpParallelismLimit(), or 0.
+int32 GetIntraOpParallelismLimit();
+
+// Caps the intra-op parallelism of the CPU kernels run by the calling thread
+// while this object lives, e.g. for one step (see
+// RunOptions.intra_op_parallelism_limit). Applies on top of
+// SetIntraOpParallelismLimit(): the lower of the two wins. Restores the
+// previous cap of the thread on destruction. 0 adds no cap.
+class ScopedIntraOpParallelismLimit {
+ public:
+  explicit ScopedIntraOpParallelismLimit(int32 num_threads);
+  ~ScopedIntraOpParallelismLimit();
+
+ private:
+  const int32 previous_limit_;
+
+  ScopedIntraOpParallelismLimit(const ScopedIntraOpParallelismLimit&) = delete;
+  void operator=(const ScopedIntraOpParallelismLimit&) = delete;
+};
+
+// Returns the intra-op parallelism cap in effect for the calling thread,
+// combining SetIntraOpParallelismLimit() with the innermost
+// ScopedIntraOpParallelismLimit, or 0 if there is none.
+int32 GetEffectiveIntraOpParallelismLimit();
+
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_CORE_UTIL_PARALLELISM_LIMITS_H_
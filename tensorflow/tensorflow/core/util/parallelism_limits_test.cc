@@ -0,0 +1,71 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/util/parallelism_limits.h"
+
+#include <memory>
+
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace tensorflow {
+namespace {
+
+TEST(ParallelismLimitsTest, ScopedLimitsNest) {
+  EXPECT_EQ(0, GetEffectiveIntraOpParallelismLimit());
+  {
+    ScopedIntraOpParallelismLimit outer(4);
+    EXPECT_EQ(4, GetEffectiveIntraOpParallelismLimit());
+    {
+      ScopedIntraOpParallelismLimit inner(2);
+      EXPECT_EQ(2, GetEffectiveIntraOpParallelismLimit());
+    }
+    EXPECT_EQ(4, GetEffectiveIntraOpParallelismLimit());
+    {
+      ScopedIntraOpParallelismLimit none(0);
+      EXPECT_EQ(0, GetEffectiveIntraOpParallelismLimit());
+    }
+  }
+  EXPECT_EQ(0, GetEffectiveIntraOpParallelismLimit());
+}
+
+TEST(ParallelismLimitsTest, LowerOfGlobalAndScopedLimitWins) {
+  SetIntraOpParallelismLimit(3);
+  EXPECT_EQ(3, GetEffectiveIntraOpParallelismLimit());
+  {
+    ScopedIntraOpParallelismLimit limit(2);
+    EXPECT_EQ(2, GetEffectiveIntraOpParallelismLimit());
+  }
+  {
+    ScopedIntraOpParallelismLimit limit(8);
+    EXPECT_EQ(3, GetEffectiveIntraOpParallelismLimit());
+  }
+  SetIntraOpParallelismLimit(0);
+}
+
+TEST(ParallelismLimitsTest, ScopedLimitIsPerThread) {
+  ScopedIntraOpParallelismLimit limit(2);
+  int32 other_thread_limit = -1;
+  std::unique_ptr<Thread> thread(Env::Default()->StartThread(
+      ThreadOptions(), "other", [&other_thread_limit]() {
+        other_thread_limit = GetEffectiveIntraOpParallelismLimit();
+      }));
+  thread.reset();
+  EXPECT_EQ(0, other_thread_limit);
+  EXPECT_EQ(2, GetEffectiveIntraOpParallelismLimit());
+}
+
+}  // namespace
+}  // namespace tensorflow
@@ -16,21 +16,31 @@ limitations under the License.
 #include "tensorflow_serving/batching/batching_session.h"
 
 #include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <map>
 
+#include "tensorflow/core/framework/allocator.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/framework/tensor_util.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/notification.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/gtl/cleanup.h"
 #include "tensorflow/core/lib/strings/str_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/cpu_info.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow/core/platform/types.h"
+#include "tensorflow/core/util/latency_trace.h"
 #include "tensorflow_serving/servables/tensorflow/serving_session.h"
-#include "tensorflow_serving/util/cleanup.h"
 #include "tensorflow_serving/util/hash.h"
 #include "tensorflow_serving/batching/batching_util.h"
-#include "tensorflow_serving/util/optional.h"
 
 namespace tensorflow {
 namespace serving {
@@ -81,18 +91,6 @@ TensorSignature TensorSignatureFromRunArgs(
   return signature;
 }
 
-// Constructs vector of all task inputs from Batch of BatchingSessionTasks.
-// Input for each task is a vector of pairs (tensor_name, tensor_value).
-std::vector<std::vector<std::pair<string, Tensor>>> GetTaskInputsVector(
-    const Batch<BatchingSessionTask>& batch) {
-  std::vector<std::vector<std::pair<string, Tensor>>> all_task_inputs;
-  for (int i = 0; i < batch.num_tasks(); ++i) {
-    const std::vector<std::pair<string, Tensor>>& task_inputs =
-      *batch.task(i).inputs;
-    all_task_inputs.push_back(task_inputs);
-  }
-  return all_task_inputs;
-}
 // Returns true iff all dims of shape1 are equal to dims of shape2 starting with
 // the first (not zeroth) dimension.
 // For example, for shapes [1, 2, 3] and [4, 2, 3] the result is true.
@@ -109,6 +107,267 @@ bool AreShapesEqualExceptZeroDim(const TensorShape& shape1,
   return true;
 }
 
+// The allocator for tensors built on the calling batch thread: local to its
+// NUMA node if the scheduler bound it to one (see
+// SharedBatchScheduler::Options::numa_aware), cpu_allocator() otherwise.
+Allocator* BatchTensorAllocator() {
+  return cpu_allocator(port::NUMAGetThreadNodeAffinity());
+}
+
+// Copies the rows of 'src' into '*dst' starting at row 'dst_row'. The tensors
+// must have the same type, either DT_STRING or one DataTypeCanUseMemcpy()
+// accepts, and shapes that are equal except in the zeroth dimension.
+void CopyRowsAt(const Tensor& src, int64 dst_row, Tensor* dst) {
+  if (src.NumElements() == 0) {
+    return;
+  }
+  // We use StringPiece as a convenient map over the tensor buffers, but cast
+  // the type to get to the underlying buffer to do the copy.
+  StringPiece to_data = dst->tensor_data();
+  if (DataTypeCanUseMemcpy(src.dtype())) {
+    StringPiece from_data = src.tensor_data();
+    const int64 row_bytes = from_data.size() / src.dim_size(0);
+    CHECK_LE(dst_row * row_bytes + from_data.size(), to_data.size());
+    memcpy(const_cast<char*>(to_data.data()) + dst_row * row_bytes,
+           from_data.data(), from_data.size());
+  } else {
+    DCHECK_EQ(DT_STRING, src.dtype());
+    const int64 row_elements = src.NumElements() / src.dim_size(0);
+    string* to_strings =
+        reinterpret_cast<string*>(const_cast<char*>(to_data.data())) +
+        dst_row * row_elements;
+    CHECK_LE(dst_row * row_elements + src.NumElements(), dst->NumElements());
+    // Not flat<string>(), which requires 'src' to be aligned.
+    const string* from_strings =
+        reinterpret_cast<const string*>(src.tensor_data().data());
+    for (int64 i = 0; i < src.NumElements(); ++i) {
+      to_strings[i] = from_strings[i];
+    }
+  }
+}
+
+// Sets '*result' to rows ['start', 'limit') of 'tensor'. The result shares the
+// buffer of 'tensor' (see Tensor::Slice()) unless the rows would start at an
+// address misaligned for Eigen, which tensor accessors such as flat() require;
+// those rows are copied.
+Status SliceRows(const Tensor& tensor, int64 start, int64 limit,
+                 Tensor* result) {
+  const Tensor slice = tensor.Slice(start, limit);
+  if (slice.IsAligned()) {
+    *result = slice;
+    return Status::OK();
+  }
+  if (!DataTypeCanUseMemcpy(tensor.dtype()) && tensor.dtype() != DT_STRING) {
+    return errors::Internal("Unexpected data type");
+  }
+  *result = Tensor(BatchTensorAllocator(), tensor.dtype(), slice.shape());
+  CopyRowsAt(slice, 0, result);
+  return Status::OK();
+}
+
+// Merges 'tensors' along the 0th dimension into '*merged', followed by
+// 'padding_size' repeats of the first row of the last tensor. Each tensor is
+// padded in its other dimensions to the largest size among 'tensors', as it is
+// copied into place (see CopyPaddedRows()).
+Status PadAndMergeTensors(const std::vector<Tensor>& tensors, int padding_size,
+                          Tensor* merged) {
+  TensorShape shape = tensors.front().shape();
+  int64 num_rows = padding_size;
+  for (const Tensor& tensor : tensors) {
+    if (tensor.dims() != shape.dims()) {
+      return errors::FailedPrecondition(
+          "Tensors with the same name from different tasks have different "
+          "ranks: ",
+          tensor.dims(), " and ", shape.dims());
+    }
+    num_rows += tensor.dim_size(0);
+    for (int i = 1; i < shape.dims(); ++i) {
+      shape.set_dim(i, std::max(shape.dim_size(i), tensor.dim_size(i)));
+    }
+  }
+  shape.set_dim(0, num_rows);
+
+  *merged = Tensor(BatchTensorAllocator(), tensors.front().dtype(), shape);
+  int64 row = 0;
+  for (const Tensor& tensor : tensors) {
+    TF_RETURN_IF_ERROR(CopyPaddedRows(tensor, row, merged));
+    row += tensor.dim_size(0);
+  }
+  if (padding_size > 0) {
+    const Tensor padding_row = tensors.back().Slice(0, 1);
+    for (; row < num_rows; ++row) {
+      TF_RETURN_IF_ERROR(CopyPaddedRows(padding_row, row, merged));
+    }
+  }
+  return Status::OK();
+}
+
+// Makes '*batched' hold at least 'num_rows' rows, keeping its first
+// 'num_filled_rows' rows.
+void EnsureBatchedRows(int64 num_filled_rows, int64 num_rows,
+                       Tensor* batched) {
+  if (batched->dim_size(0) >= num_rows) {
+    return;
+  }
+  TensorShape shape = batched->shape();
+  shape.set_dim(0, std::max(num_rows, 2 * batched->dim_size(0)));
+  Tensor grown(BatchTensorAllocator(), batched->dtype(), shape);
+  CopyRowsAt(batched->Slice(0, num_filled_rows), 0, &grown);
+  *batched = grown;
+}
+
+// Copies the inputs of 'task' into the correspondingly-named tensors in
+// '*batched', starting at row 'row'. A batched tensor is created with room for
+// 'capacity' rows when the first task is copied, and grows if the batch
+// outgrows it. Returns false if the task's inputs can't be merged this way,
+// because of an unsupported type or a shape or set of names that differs from
+// the earlier tasks'.
+bool CopyTaskInputsToBatch(const BatchingSessionTask& task, int64 row,
+                           int64 capacity, std::map<string, Tensor>* batched) {
+  for (const auto& entry : *task.inputs) {
+    const string& tensor_name = entry.first;
+    const Tensor& tensor = entry.second;
+    const int64 end_row = row + tensor.dim_size(0);
+    auto batched_entry = batched->find(tensor_name);
+    if (batched_entry == batched->end()) {
+      if (row > 0 || (!DataTypeCanUseMemcpy(tensor.dtype()) &&
+                      tensor.dtype() != DT_STRING)) {
+        return false;
+      }
+      TensorShape shape = tensor.shape();
+      shape.set_dim(0, std::max(capacity, end_row));
+      batched_entry =
+          batched
+              ->emplace(tensor_name,
+                        Tensor(BatchTensorAllocator(), tensor.dtype(), shape))
+              .first;
+    } else {
+      Tensor* batched_tensor = &batched_entry->second;
+      if (tensor.dtype() != batched_tensor->dtype() ||
+          !AreShapesEqualExceptZeroDim(tensor.shape(),
+                                       batched_tensor->shape())) {
+        return false;
+      }
+      EnsureBatchedRows(row, end_row, batched_tensor);
+    }
+    CopyRowsAt(tensor, row, &batched_entry->second);
+  }
+  return task.inputs->size() == batched->size();
+}
+
+// The state shared by the pieces of a task split by SplitInputTask(). The last
+// piece to complete reassembles the original task's outputs from those of the
+// pieces, and completes the original task.
+struct SplitTaskState {
+  explicit SplitTaskState(int num_pieces)
+      : piece_outputs(num_pieces),
+        piece_run_metadata(num_pieces),
+        num_pending_pieces(num_pieces) {}
+
+  // Each piece's outputs and run metadata, in the order of the pieces.
+  std::vector<std::vector<Tensor>> piece_outputs;
+  std::vector<RunMetadata> piece_run_metadata;
+
+  // The original task's result fields.
+  std::vector<Tensor>* outputs;
+  RunMetadata* run_metadata;
+  std::function<void(const Status&)> done;
+
+  mutex mu;
+  int num_pending_pieces GUARDED_BY(mu);
+  // The first error of any piece.
+  Status status GUARDED_BY(mu);
+};
+
+// Records that a piece of a split task has been processed with
+// 'piece_status', and completes the original task once all pieces have been.
+void CompleteSplitTaskPiece(SplitTaskState* state,
+                            const Status& piece_status) {
+  Status status;
+  {
+    mutex_lock l(state->mu);
+    state->status.Update(piece_status);
+    if (--state->num_pending_pieces > 0) {
+      return;
+    }
+    status = state->status;
+  }
+
+  if (status.ok()) {
+    const int num_outputs = state->piece_outputs.front().size();
+    std::vector<Tensor> output_pieces(state->piece_outputs.size());
+    for (int i = 0; status.ok() && i < num_outputs; ++i) {
+      for (int j = 0; j < state->piece_outputs.size(); ++j) {
+        output_pieces[j] = state->piece_outputs[j][i];
+      }
+      state->outputs->emplace_back();
+      status = tensor::Concat(output_pieces, &state->outputs->back());
+    }
+  }
+  if (!status.ok()) {
+    state->outputs->clear();
+  }
+  // The pieces ran in batches of the same signature; any one's metadata is as
+  // representative as the others'.
+  *state->run_metadata = state->piece_run_metadata.front();
+  state->done(status);
+}
+
+// A bounded FIFO queue connecting two stages of the batch processing pipeline
+// (see BatchingSessionOptions::num_pipeline_run_threads). Push() blocks while
+// the queue is full, so that a slow stage throttles the stages before it.
+template <typename T>
+class PipelineQueue {
+ public:
+  explicit PipelineQueue(const int capacity) : capacity_(capacity) {}
+
+  // Appends 'item', waiting for room if the queue is full.
+  void Push(T item) {
+    mutex_lock l(mu_);
+    while (items_.size() >= capacity_) {
+      not_full_.wait(l);
+    }
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+  }
+
+  // Removes the oldest item into 'item', waiting for one if the queue is
+  // empty. Returns false, without waiting, once the queue is both closed and
+  // empty.
+  bool Pop(T* item) {
+    mutex_lock l(mu_);
+    while (items_.empty() && !closed_) {
+      not_empty_.wait(l);
+    }
+    if (items_.empty()) {
+      return false;
+    }
+    *item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  // Wakes up the consumers once the remaining items have been popped. Must not
+  // be followed by Push().
+  void Close() {
+    mutex_lock l(mu_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+ private:
+  const size_t capacity_;
+
+  mutex mu_;
+  condition_variable not_full_;
+  condition_variable not_empty_;
+  std::deque<T> items_ GUARDED_BY(mu_);
+  bool closed_ GUARDED_BY(mu_) = false;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(PipelineQueue);
+};
+
 }  // namespace
 
 TensorSignature TensorSignatureFromSignatureDef(
@@ -149,7 +408,7 @@ class BatchingSession : public ServingSession {
           signatures_with_scheduler_creators,
       std::unique_ptr<BatchingSession>* result);
 
-  ~BatchingSession() override = default;
+  ~BatchingSession() override;
 
   Status Run(const std::vector<std::pair<string, Tensor>>& inputs,
              const std::vector<string>& output_tensor_names,
@@ -159,8 +418,11 @@ class BatchingSession : public ServingSession {
   // RunOptions handling:
   // Since multiple of these Run() calls get backed into a single call to the
   // underlying Session's Run(), we select an arbitrary 'run_options' (typically
-  // they are the same across calls). The exception is the timeout; we take the
-  // largest value (after subtracting time spent in the batching queue).
+  // they are the same across calls). The exceptions are the timeout and the
+  // priority. We take the largest timeout (after subtracting time spent in the
+  // batching queue); calls whose timeout expires while they are queued are
+  // failed without being run. The priority governs which calls are batched
+  // first when calls back up in the batching queue.
   //
   // RunMetadata:
   // We copy the batched call's RunMetadata to each non-batched call's output.
@@ -170,6 +432,16 @@ class BatchingSession : public ServingSession {
              const std::vector<string>& target_node_names,
              std::vector<Tensor>* outputs, RunMetadata* run_metadata) override;
 
+  // Enqueues the call and returns; 'done' is called from a batch thread once
+  // the call's batch has been processed. Calls that don't match a batching
+  // signature run in-line.
+  void RunAsync(const RunOptions& run_options,
+                const std::vector<std::pair<string, Tensor>>& inputs,
+                const std::vector<string>& output_tensor_names,
+                const std::vector<string>& target_node_names,
+                std::vector<Tensor>* outputs, RunMetadata* run_metadata,
+                std::function<void(const Status&)> done) override;
+
   Status ListDevices(std::vector<DeviceAttributes>* response) override;
 
  private:
@@ -196,25 +468,100 @@ class BatchingSession : public ServingSession {
       const TensorSignature& signature, const Batch<BatchingSessionTask>& batch,
       std::vector<std::pair<string, Tensor>>* merged_inputs);
 
+  // Like MergeInputTensors(), but copies each task's inputs into batched
+  // tensors preallocated for the tasks' 'max_batch_size' rows as the task
+  // joins 'batch', rather than once 'batch' has closed. Returns once 'batch'
+  // is closed. Leaves 'merged_inputs' empty if the tasks can't be merged this
+  // way, in which case the caller should fall back to MergeInputTensors().
+  void MergeInputTensorsIncrementally(
+      const TensorSignature& signature,
+      const Batch<BatchingSessionTask>& batch,
+      std::vector<std::pair<string, Tensor>>* merged_inputs);
+
   // Splits the output of a batched call to 'wrapped_->Run()' into individual
-  // task outputs. Assumes the output tensor order matches the signature.
+  // task outputs. Assumes the output tensor order matches the signature. The
+  // task outputs share the batched outputs' buffers where alignment allows, so
+  // that serializing them is the only copy.
   Status SplitOutputTensors(const TensorSignature& signature,
                             const std::vector<Tensor>& combined_outputs,
                             Batch<BatchingSessionTask>* batch);
 
-  // Processes one batch of Run() calls with 'signature'. Called by
-  // 'batch_scheduler_' in a batch thread.
+  // Returns the index of the length bucket of a Run() call with 'inputs' (see
+  // BatchingSessionOptions::length_bucket_boundaries).
+  int GetLengthBucket(
+      const std::vector<std::pair<string, Tensor>>& inputs) const;
+
+  // A batch on its way through the stages of ProcessBatch().
+  struct BatchInProcess {
+    // Points to the key of the batch's signature in 'batch_schedulers_'.
+    const TensorSignature* signature;
+    std::unique_ptr<Batch<BatchingSessionTask>> batch;
+
+    // The outcome so far. Once it is an error, the remaining stages only
+    // propagate it to the tasks.
+    Status status;
+
+    uint64 dequeue_time_micros = 0;
+    // The time spent in the stages so far since the batch was dequeued, not
+    // counting waits between them.
+    uint64 processing_micros = 0;
+    // The latest deadline of the batch's tasks, or kNoDeadlineMicros.
+    uint64 deadline_micros = 0;
+
+    // Monotonic timestamps for the latency trace, if it is enabled.
+    bool trace_latency = false;
+    int64 trace_dequeue_micros = 0;
+    int64 trace_compute_micros = 0;
+
+    RunOptions run_options;
+    std::vector<std::pair<string, Tensor>> merged_inputs;
+    std::vector<Tensor> combined_outputs;
+  };
+
+  // Processes one batch of Run() calls with 'signature', which is a key of
+  // 'batch_schedulers_'. Called by one of the signature's batch schedulers in a
+  // batch thread. Runs the stages below one after the other, or hands the
+  // batch on to the pipeline after the first one.
+  //
+  // Doesn't look at 'batch_schedulers_', whose schedulers are being destroyed
+  // while the destructor drains the remaining batches.
   void ProcessBatch(const TensorSignature& signature,
                     std::unique_ptr<Batch<BatchingSessionTask>> batch);
 
+  // The first stage of processing a batch: waits for 'batch' to close, and
+  // merges its inputs. Returns null if the batch is empty.
+  std::unique_ptr<BatchInProcess> MergeBatch(
+      const TensorSignature& signature,
+      std::unique_ptr<Batch<BatchingSessionTask>> batch);
+
+  // The second stage: runs the wrapped session on the merged inputs.
+  void RunBatch(BatchInProcess* batch_in_process);
+
+  // The last stage: splits the outputs among the tasks, and completes them.
+  void SplitBatch(BatchInProcess* batch_in_process);
+
+  // The loops of the pipeline's run and split threads.
+  void RunStageLoop();
+  void SplitStageLoop();
+
   const BatchingSessionOptions options_;
 
   std::unique_ptr<Session> wrapped_;
-  std::unordered_map<TensorSignature,
-                     std::unique_ptr<BatchScheduler<BatchingSessionTask>>,
-                     HashTensorSignature, EqTensorSignature>
+  // For each signature, one batch scheduler per length bucket.
+  std::unordered_map<
+      TensorSignature,
+      std::vector<std::unique_ptr<BatchScheduler<BatchingSessionTask>>>,
+      HashTensorSignature, EqTensorSignature>
       batch_schedulers_;
 
+  // The queues feeding the pipeline's run and split stages, and their threads.
+  // Only used if 'options_.num_pipeline_run_threads' is positive.
+  std::unique_ptr<PipelineQueue<std::unique_ptr<BatchInProcess>>> run_queue_;
+  std::unique_ptr<PipelineQueue<std::unique_ptr<BatchInProcess>>>
+      split_queue_;
+  std::vector<std::unique_ptr<Thread>> run_threads_;
+  std::vector<std::unique_ptr<Thread>> split_threads_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(BatchingSession);
 };
 
@@ -223,24 +570,83 @@ Status BatchingSession::Create(
     const std::vector<SignatureWithBatchingSessionSchedulerCreator>&
         signatures_with_scheduler_creators,
     std::unique_ptr<BatchingSession>* result) {
+  int last_boundary = 0;
+  for (int boundary : options.length_bucket_boundaries) {
+    if (boundary <= last_boundary) {
+      return errors::InvalidArgument(
+          "length_bucket_boundaries entries must be positive and in "
+          "increasing order");
+    }
+    last_boundary = boundary;
+  }
+  if (options.num_pipeline_run_threads < 0) {
+    return errors::InvalidArgument(
+        "num_pipeline_run_threads must be non-negative; was ",
+        options.num_pipeline_run_threads);
+  }
+  if (options.num_pipeline_run_threads > 0 &&
+      options.pipeline_queue_capacity < 1) {
+    return errors::InvalidArgument(
+        "pipeline_queue_capacity must be positive; was ",
+        options.pipeline_queue_capacity);
+  }
+  if (options.numa_inter_op_thread_pools && options.core_budget != nullptr) {
+    return errors::InvalidArgument(
+        "numa_inter_op_thread_pools can't be combined with core_budget, which "
+        "picks the inter-op pool of each batch itself");
+  }
+  const int num_buckets = options.length_bucket_boundaries.size() + 1;
+
   auto batching_session =
       std::unique_ptr<BatchingSession>(new BatchingSession(options));
   BatchingSession* raw_batching_session = batching_session.get();
   batching_session->wrapped_ = std::move(wrapped);
 
+  if (options.num_pipeline_run_threads > 0) {
+    batching_session->run_queue_.reset(
+        new PipelineQueue<std::unique_ptr<BatchInProcess>>(
+            options.pipeline_queue_capacity));
+    batching_session->split_queue_.reset(
+        new PipelineQueue<std::unique_ptr<BatchInProcess>>(
+            options.pipeline_queue_capacity));
+    for (int i = 0; i < options.num_pipeline_run_threads; ++i) {
+      batching_session->run_threads_.emplace_back(Env::Default()->StartThread(
+          ThreadOptions(), "batching_session_run",
+          [raw_batching_session] { raw_batching_session->RunStageLoop(); }));
+      batching_session->split_threads_.emplace_back(
+          Env::Default()->StartThread(
+              ThreadOptions(), "batching_session_split",
+              [raw_batching_session] {
+                raw_batching_session->SplitStageLoop();
+              }));
+    }
+  }
+
   for (const auto& entry : signatures_with_scheduler_creators) {
     const TensorSignature& signature = entry.signature;
     const BatchingSessionSchedulerCreator& scheduler_creator =
         entry.scheduler_creator;
 
-    std::unique_ptr<BatchScheduler<BatchingSessionTask>> batch_scheduler;
-    TF_RETURN_IF_ERROR(scheduler_creator(
-        [signature, raw_batching_session](
-            std::unique_ptr<Batch<BatchingSessionTask>> batch) {
-          raw_batching_session->ProcessBatch(signature, std::move(batch));
-        },
-        &batch_scheduler));
-    batching_session->batch_schedulers_[signature] = std::move(batch_scheduler);
+    auto entry_it =
+        batching_session->batch_schedulers_
+            .emplace(signature,
+                     std::vector<std::unique_ptr<
+                         BatchScheduler<BatchingSessionTask>>>())
+            .first;
+    // Map keys stay put, and outlive the schedulers and the pipeline.
+    const TensorSignature* signature_key = &entry_it->first;
+    auto& bucket_schedulers = entry_it->second;
+    for (int bucket = 0; bucket < num_buckets; ++bucket) {
+      std::unique_ptr<BatchScheduler<BatchingSessionTask>> batch_scheduler;
+      TF_RETURN_IF_ERROR(scheduler_creator(
+          [signature_key, raw_batching_session](
+              std::unique_ptr<Batch<BatchingSessionTask>> batch) {
+            raw_batching_session->ProcessBatch(*signature_key,
+                                               std::move(batch));
+          },
+          &batch_scheduler));
+      bucket_schedulers.push_back(std::move(batch_scheduler));
+    }
   }
 
   *result = std::move(batching_session);
@@ -263,9 +669,27 @@ Status BatchingSession::Run(
     const std::vector<string>& output_tensor_names,
     const std::vector<string>& target_node_names, std::vector<Tensor>* outputs,
     RunMetadata* run_metadata) {
+  Notification done;
+  Status status;
+  RunAsync(run_options, inputs, output_tensor_names, target_node_names,
+           outputs, run_metadata, [&done, &status](const Status& s) {
+             status = s;
+             done.Notify();
+           });
+  done.WaitForNotification();
+  return status;
+}
+
+void BatchingSession::RunAsync(
+    const RunOptions& run_options,
+    const std::vector<std::pair<string, Tensor>>& inputs,
+    const std::vector<string>& output_tensor_names,
+    const std::vector<string>& target_node_names, std::vector<Tensor>* outputs,
+    RunMetadata* run_metadata, std::function<void(const Status&)> done) {
   if (!target_node_names.empty()) {
-    return errors::PermissionDenied(
-        "BatchingSession does not support target nodes");
+    done(errors::PermissionDenied(
+        "BatchingSession does not support target nodes"));
+    return;
   }
 
   const TensorSignature signature =
@@ -283,30 +707,41 @@ Status BatchingSession::Run(
                    << TensorSignatureDebugString(signature);
       last_log_message_secs = now_secs;
     }
-    return wrapped_->Run(run_options, inputs, output_tensor_names,
-                         target_node_names, outputs, run_metadata);
+    done(wrapped_->Run(run_options, inputs, output_tensor_names,
+                       target_node_names, outputs, run_metadata));
+    return;
   }
   BatchScheduler<BatchingSessionTask>* batch_scheduler =
-      batch_scheduler_it->second.get();
+      batch_scheduler_it->second[GetLengthBucket(inputs)].get();
 
   outputs->clear();
 
-  Notification done;
-  Status status;
   auto task = std::unique_ptr<BatchingSessionTask>(new BatchingSessionTask);
   task->enqueue_time_micros = Env::Default()->NowMicros();
+  // If the caller doesn't populate RunOptions, the timeout is 0 by default.
+  // Interpret that as "no timeout" i.e. infinity.
+  task->timeout_deadline_micros =
+      run_options.timeout_in_ms() <= 0
+          ? kNoDeadlineMicros
+          : task->enqueue_time_micros + run_options.timeout_in_ms() * 1000;
   task->run_options = run_options;
-  TF_RETURN_IF_ERROR(ComputeInputSize(inputs, &task->zeroth_dim_size));
+  task->max_batch_size = batch_scheduler->max_task_size();
+  Status status = ComputeInputSize(inputs, &task->zeroth_dim_size);
+  if (!status.ok()) {
+    done(status);
+    return;
+  }
   task->inputs = &inputs;
   task->output_tensor_names = &output_tensor_names;
-  task->done = &done;
-  task->status = &status;
   task->outputs = outputs;
   task->run_metadata = run_metadata;
+  task->done = std::move(done);
 
-  TF_RETURN_IF_ERROR(batch_scheduler->Schedule(&task));
-  done.WaitForNotification();
-  return status;
+  status = batch_scheduler->Schedule(&task);
+  if (!status.ok()) {
+    // On failure the scheduler leaves the task with us.
+    task->done(status);
+  }
 }
 
 Status BatchingSession::ListDevices(std::vector<DeviceAttributes>* response) {
@@ -316,6 +751,23 @@ Status BatchingSession::ListDevices(std::vector<DeviceAttributes>* response) {
 BatchingSession::BatchingSession(const BatchingSessionOptions& options)
     : options_(options) {}
 
+BatchingSession::~BatchingSession() {
+  // Destroying the batch schedulers processes their remaining batches, which
+  // may feed the pipeline. Their signatures must outlive the pipeline, though.
+  for (auto& entry : batch_schedulers_) {
+    for (auto& batch_scheduler : entry.second) {
+      batch_scheduler.reset();
+    }
+  }
+  // Drain the pipeline one stage at a time.
+  if (run_queue_ != nullptr) {
+    run_queue_->Close();
+    run_threads_.clear();
+    split_queue_->Close();
+    split_threads_.clear();
+  }
+}
+
 Status BatchingSession::ComputeInputSize(
     const std::vector<std::pair<string, Tensor>>& inputs, size_t* size) const {
   if (inputs.size() == 0) {
@@ -348,6 +800,22 @@ Status BatchingSession::ComputeInputSize(
   return Status::OK();
 }
 
+int BatchingSession::GetLengthBucket(
+    const std::vector<std::pair<string, Tensor>>& inputs) const {
+  if (options_.length_bucket_boundaries.empty()) {
+    return 0;
+  }
+  int64 length = 0;
+  for (const auto& entry : inputs) {
+    if (entry.second.dims() > 1) {
+      length = std::max(length, entry.second.dim_size(1));
+    }
+  }
+  return std::lower_bound(options_.length_bucket_boundaries.begin(),
+                          options_.length_bucket_boundaries.end(), length) -
+         options_.length_bucket_boundaries.begin();
+}
+
 int BatchingSession::RoundToLowestAllowedBatchSize(int batch_size) const {
   if (options_.allowed_batch_sizes.empty()) {
     return batch_size;
@@ -376,14 +844,6 @@ Status BatchingSession::MergeInputTensors(
 
   // For each input tensor name, a vector of tensors from the individual tasks.
   std::map<string, std::vector<Tensor>> tensors_to_merge;
-  // For each input tensor name a vector of maximum dimension sizes
-  // among tensors from individual tasks.
-  optional<std::map<string, std::vector<int>>> max_dim_sizes;
-  if (options_.pad_variable_length_inputs) {
-    std::vector<std::vector<std::pair<string, Tensor>>> all_task_inputs =
-      GetTaskInputsVector(batch);
-    max_dim_sizes = CalculateMaxDimSizes(all_task_inputs);
-  }
   // Populate 'tensors_to_merge'.
   for (int i = 0; i < batch.num_tasks(); ++i) {
     const std::vector<std::pair<string, Tensor>>& task_inputs =
@@ -393,17 +853,11 @@ Status BatchingSession::MergeInputTensors(
       const Tensor& tensor = entry.second;
 
       std::vector<Tensor>& tensor_vec = tensors_to_merge[tensor_name];
-      Tensor optionally_padded_tensor;
-      if (options_.pad_variable_length_inputs) {
-        TF_RETURN_IF_ERROR(AddPadding(tensor, (*max_dim_sizes)[tensor_name],
-                                      &optionally_padded_tensor));
-      } else {
-        optionally_padded_tensor = tensor;
+      if (!options_.pad_variable_length_inputs) {
         // Check whether tensors with the same name have equal dims
         // (except zeroth dim) when padding is turned off.
         if (i > 0) {  // added at least one task to tensors_to_merge
-          TensorShape reference_shape =
-            tensors_to_merge[tensor_name][0].shape();
+          TensorShape reference_shape = tensor_vec[0].shape();
           if (!AreShapesEqualExceptZeroDim(tensor.shape(), reference_shape)) {
             return errors::FailedPrecondition(
               "Tensors with name '" + tensor_name + "' from different tasks" +
@@ -414,21 +868,7 @@ Status BatchingSession::MergeInputTensors(
           }
         }
       }
-      tensor_vec.push_back(optionally_padded_tensor);
-      if (i == batch.num_tasks() - 1 && padding_size > 0) {
-        // This is the last task. Insert padding.
-        //
-        // Use the first row of this task's tensor as the padding data. (We know
-        // it represents a valid input tensor row, so it should always be safe
-        // to use for padding.)
-        //
-        // Slice() operates on the 0th dimension, which is the batch dimension.
-        // It avoids a deep copy, which is a nice efficiency bonus.
-        const Tensor padding_tensor = optionally_padded_tensor.Slice(0, 1);
-        for (int i = 0; i < padding_size; ++i) {
-          tensor_vec.push_back(padding_tensor);
-        }
-      }
+      tensor_vec.push_back(tensor);
     }
   }
 
@@ -445,19 +885,98 @@ Status BatchingSession::MergeInputTensors(
       return errors::Internal(
           "One or more tasks does not conform to batch signature");
     }
-    Tensor concated;
-    const Status concat_status = tensor::Concat(tensors->second, &concated);
-    DCHECK(concat_status.ok()) << concat_status.ToString();
-    if (!concat_status.ok()) {
-      return errors::Internal("Tensor concat operation failed: ",
-                              concat_status.ToString());
+    Tensor merged;
+    if (options_.pad_variable_length_inputs) {
+      TF_RETURN_IF_ERROR(
+          PadAndMergeTensors(tensors->second, padding_size, &merged));
+    } else {
+      // Insert padding, using the first row of the last task's tensor as the
+      // padding data. (We know it represents a valid input tensor row, so it
+      // should always be safe to use for padding.)
+      //
+      // Slice() operates on the 0th dimension, which is the batch dimension.
+      // It avoids a deep copy, which is a nice efficiency bonus.
+      const Tensor padding_tensor = tensors->second.back().Slice(0, 1);
+      for (int i = 0; i < padding_size; ++i) {
+        tensors->second.push_back(padding_tensor);
+      }
+      const Status concat_status =
+          tensor::Concat(tensors->second, BatchTensorAllocator(), &merged);
+      DCHECK(concat_status.ok()) << concat_status.ToString();
+      if (!concat_status.ok()) {
+        return errors::Internal("Tensor concat operation failed: ",
+                                concat_status.ToString());
+      }
     }
-    merged_inputs->push_back({tensor_name, concated});
+    merged_inputs->push_back({tensor_name, merged});
   }
 
   return Status::OK();
 }
 
+void BatchingSession::MergeInputTensorsIncrementally(
+    const TensorSignature& signature, const Batch<BatchingSessionTask>& batch,
+    std::vector<std::pair<string, Tensor>>* merged_inputs) {
+  // Set from the first task; a later task the tensors turn out too small for
+  // (after the scheduler's options changed) makes us fall back.
+  int64 capacity = 0;
+
+  // The batched tensors by input name, and the number of their rows filled in
+  // so far.
+  std::map<string, Tensor> batched;
+  int64 num_rows = 0;
+  int num_merged_tasks = 0;
+  for (;;) {
+    const int num_tasks = batch.WaitForMoreTasks(num_merged_tasks);
+    for (; num_merged_tasks < num_tasks; ++num_merged_tasks) {
+      const BatchingSessionTask& task = batch.task(num_merged_tasks);
+      if (num_merged_tasks == 0) {
+        capacity = RoundToLowestAllowedBatchSize(task.max_batch_size);
+      }
+      if (!CopyTaskInputsToBatch(task, num_rows, capacity, &batched)) {
+        batch.WaitUntilClosed();
+        return;
+      }
+      num_rows += task.zeroth_dim_size;
+    }
+    // No tasks can join a closed batch, so once we have seen it closed and
+    // merged all of its tasks we are done.
+    if (batch.IsClosed() && num_merged_tasks == batch.num_tasks()) {
+      break;
+    }
+  }
+  if (num_merged_tasks == 0 ||
+      batched.size() != signature.input_tensors.size()) {
+    return;
+  }
+
+  // Pad with repeats of the first row of the last task, as MergeInputTensors()
+  // does.
+  const int64 padded_num_rows = RoundToLowestAllowedBatchSize(num_rows);
+  const BatchingSessionTask& last_task = batch.task(num_merged_tasks - 1);
+  for (const auto& entry : *last_task.inputs) {
+    Tensor* batched_tensor = &batched[entry.first];
+    if (padded_num_rows > num_rows) {
+      EnsureBatchedRows(num_rows, padded_num_rows, batched_tensor);
+      const Tensor padding_row = entry.second.Slice(0, 1);
+      for (int64 row = num_rows; row < padded_num_rows; ++row) {
+        CopyRowsAt(padding_row, row, batched_tensor);
+      }
+    }
+  }
+
+  for (const string& tensor_name : signature.input_tensors) {
+    auto batched_entry = batched.find(tensor_name);
+    if (batched_entry == batched.end()) {
+      merged_inputs->clear();
+      return;
+    }
+    // Slice() shares the preallocated buffer rather than copying it.
+    merged_inputs->push_back(
+        {tensor_name, batched_entry->second.Slice(0, padded_num_rows)});
+  }
+}
+
 Status BatchingSession::SplitOutputTensors(
     const TensorSignature& signature,
     const std::vector<Tensor>& combined_outputs,
@@ -468,18 +987,11 @@ Status BatchingSession::SplitOutputTensors(
                             batch->num_tasks());
   }
 
-  std::vector<int64> task_sizes_plus_optional_padding;
-  task_sizes_plus_optional_padding.reserve(batch->num_tasks());
-  for (int i = 0; i < batch->num_tasks(); ++i) {
-    task_sizes_plus_optional_padding.push_back(batch->task(i).zeroth_dim_size);
-  }
   const int padding_size =
       RoundToLowestAllowedBatchSize(batch->size()) - batch->size();
-  if (padding_size > 0) {
-    task_sizes_plus_optional_padding.push_back(padding_size);
-  }
 
   // For each output tensor name, a divided-up tensor with one entry per task.
+  // (The padding rows, if any, are left out.)
   std::map<string, std::vector<Tensor>> split_tensors;
 
   // Populate 'split_tensors'.
@@ -503,22 +1015,21 @@ Status BatchingSession::SplitOutputTensors(
           "0th dimension sizes of the input tensors");
     }
 
-    std::vector<Tensor> split_tensor;
-    const Status split_status =
-        tensor::Split(tensor, task_sizes_plus_optional_padding, &split_tensor);
-    DCHECK(split_status.ok()) << split_status.ToString();
-    if (!split_status.ok()) {
-      return errors::Internal("Tensor split operation failed: ",
-                              split_status.ToString());
-    }
-    DCHECK_EQ(split_tensor.size(), task_sizes_plus_optional_padding.size());
-    if (split_tensor.size() != task_sizes_plus_optional_padding.size()) {
-      return errors::Internal(
-          "Tensor split operation did not work as expected; got ",
-          split_tensor.size(), " splits; expected ",
-          task_sizes_plus_optional_padding.size());
+    std::vector<Tensor>& split_tensor = split_tensors[tensor_name];
+    split_tensor.reserve(batch->num_tasks());
+    int64 start = 0;
+    for (int j = 0; j < batch->num_tasks(); ++j) {
+      const int64 limit = start + batch->task(j).zeroth_dim_size;
+      split_tensor.emplace_back();
+      const Status split_status =
+          SliceRows(tensor, start, limit, &split_tensor.back());
+      DCHECK(split_status.ok()) << split_status.ToString();
+      if (!split_status.ok()) {
+        return errors::Internal("Tensor split operation failed: ",
+                                split_status.ToString());
+      }
+      start = limit;
     }
-    split_tensors[tensor_name] = std::move(split_tensor);
   }
 
   for (int i = 0; i < batch->num_tasks(); ++i) {
@@ -532,7 +1043,6 @@ Status BatchingSession::SplitOutputTensors(
       task->outputs->push_back(split_tensor->second[i]);
     }
   }
-  // (Ignore a possible final split_tensors entry containing the padding.)
 
   return Status::OK();
 }
@@ -540,43 +1050,58 @@ Status BatchingSession::SplitOutputTensors(
 void BatchingSession::ProcessBatch(
     const TensorSignature& signature,
     std::unique_ptr<Batch<BatchingSessionTask>> batch) {
-  // As a possible performance optimization, consider overlapping the tensor
-  // concatenation with waiting for the batch to close (i.e. do the
-  // concatenation incrementally as tasks stream into the batch).
-  batch->WaitUntilClosed();
+  std::unique_ptr<BatchInProcess> batch_in_process =
+      MergeBatch(signature, std::move(batch));
+  if (batch_in_process == nullptr) {
+    return;
+  }
+  batch_in_process->processing_micros =
+      Env::Default()->NowMicros() - batch_in_process->dequeue_time_micros;
+  if (run_queue_ != nullptr) {
+    run_queue_->Push(std::move(batch_in_process));
+    return;
+  }
+  RunBatch(batch_in_process.get());
+  SplitBatch(batch_in_process.get());
+}
+
+std::unique_ptr<BatchingSession::BatchInProcess> BatchingSession::MergeBatch(
+    const TensorSignature& signature,
+    std::unique_ptr<Batch<BatchingSessionTask>> batch) {
+  std::unique_ptr<BatchInProcess> batch_in_process(new BatchInProcess);
+  batch_in_process->signature = &signature;
+
+  std::vector<std::pair<string, Tensor>>* merged_inputs =
+      &batch_in_process->merged_inputs;
+  if (options_.merge_inputs_incrementally) {
+    // Overlap the merge with waiting for the batch to close. (Only a scheduler
+    // that hands out open batches gives it anything to overlap with.)
+    MergeInputTensorsIncrementally(signature, *batch, merged_inputs);
+  } else {
+    batch->WaitUntilClosed();
+  }
 
   if (batch->empty()) {
-    return;
+    return nullptr;
   }
+  batch_in_process->batch = std::move(batch);
+  const Batch<BatchingSessionTask>& closed_batch = *batch_in_process->batch;
 
   const uint64 dequeue_time_micros = Env::Default()->NowMicros();
-
-  // Regardless of the outcome, we need to propagate the status to the
-  // individual tasks and signal that they are done. We use MakeCleanup() to
-  // ensure that this happens no matter how we exit the method below.
-  Status status;
-  auto finally = MakeCleanup([&status, &batch] {
-    for (int i = 0; i < batch->num_tasks(); ++i) {
-      *batch->mutable_task(i)->status = status;
-      batch->mutable_task(i)->done->Notify();
-    }
-  });
+  batch_in_process->dequeue_time_micros = dequeue_time_micros;
+  batch_in_process->trace_latency = latency_trace::IsEnabled();
+  if (batch_in_process->trace_latency) {
+    batch_in_process->trace_dequeue_micros = latency_trace::NowMicros();
+  }
 
   // Make sure we have at least one task that hasn't exceeded its timeout from
   // queue time alone, and find the latest task deadline which we'll use for the
-  // overall batch.
+  // overall batch. (The batch scheduler puts tasks that have exceeded their
+  // timeout while queued into batches of their own, which end here.)
   bool all_tasks_timeout_exceeded = true;
   uint64 batch_deadline_micros = 0;
-  for (int i = 0; i < batch->num_tasks(); ++i) {
-    const BatchingSessionTask& task = batch->task(i);
-    // If the caller doesn't populate RunOptions, the timeout is 0 by default.
-    // Interpret that as "no timeout" i.e. infinity.
-    const int64 task_timeout_micros =
-        task.run_options.timeout_in_ms() <= 0
-            ? INT_MAX
-            : task.run_options.timeout_in_ms() * 1000;
-    const uint64 task_deadline_micros =
-        task.enqueue_time_micros + task_timeout_micros;
+  for (int i = 0; i < closed_batch.num_tasks(); ++i) {
+    const uint64 task_deadline_micros = closed_batch.task(i).deadline_micros();
     if (task_deadline_micros > dequeue_time_micros) {
       all_tasks_timeout_exceeded = false;
       if (task_deadline_micros > batch_deadline_micros) {
@@ -585,40 +1110,174 @@ void BatchingSession::ProcessBatch(
     }
   }
   if (all_tasks_timeout_exceeded) {
-    status = Status(error::RESOURCE_EXHAUSTED,
-                    "Run() timeout exceeded while waiting in batching queue");
+    batch_in_process->status =
+        Status(error::RESOURCE_EXHAUSTED,
+               "Run() timeout exceeded while waiting in batching queue");
+    return batch_in_process;
+  }
+  batch_in_process->deadline_micros = batch_deadline_micros;
+  batch_in_process->run_options = closed_batch.task(0).run_options;
+  if (options_.numa_inter_op_thread_pools) {
+    // Run on the node the inputs are merged, and so allocated, on.
+    const int numa_node = port::NUMAGetThreadNodeAffinity();
+    if (numa_node != port::kNUMANoAffinity) {
+      batch_in_process->run_options.set_inter_op_thread_pool(numa_node);
+    }
+  }
+
+  if (merged_inputs->empty()) {
+    batch_in_process->status =
+        MergeInputTensors(signature, closed_batch, merged_inputs);
+  }
+  return batch_in_process;
+}
+
+void BatchingSession::RunBatch(BatchInProcess* batch_in_process) {
+  const uint64 start_time_micros = Env::Default()->NowMicros();
+  auto add_processing_time =
+      gtl::MakeCleanup([batch_in_process, start_time_micros]() {
+        batch_in_process->processing_micros +=
+            Env::Default()->NowMicros() - start_time_micros;
+      });
+  if (!batch_in_process->status.ok()) {
     return;
   }
+  Batch<BatchingSessionTask>* batch = batch_in_process->batch.get();
 
-  RunOptions run_options = batch->task(0).run_options;
-  if (batch_deadline_micros == INT_MAX) {
+  // The timeout is what is left of the batch deadline, which in a pipeline
+  // includes the time spent waiting for a run thread.
+  RunOptions& run_options = batch_in_process->run_options;
+  if (batch_in_process->deadline_micros == kNoDeadlineMicros) {
     run_options.set_timeout_in_ms(0);
   } else {
+    const uint64 now_micros = std::max(batch_in_process->dequeue_time_micros,
+                                       Env::Default()->NowMicros());
+    if (now_micros >= batch_in_process->deadline_micros) {
+      batch_in_process->status =
+          Status(error::RESOURCE_EXHAUSTED,
+                 "Run() timeout exceeded while waiting in batching pipeline");
+      return;
+    }
     run_options.set_timeout_in_ms(
-        (batch_deadline_micros - dequeue_time_micros) / 1000);
+        (batch_in_process->deadline_micros - now_micros) / 1000);
   }
-
-  std::vector<std::pair<string, Tensor>> merged_inputs;
-  status = MergeInputTensors(signature, *batch, &merged_inputs);
-  if (!status.ok()) {
-    return;
+  if (options_.batch_size_per_intra_op_thread > 0) {
+    run_options.set_intra_op_parallelism_limit(
+        (batch->size() + options_.batch_size_per_intra_op_thread - 1) /
+        options_.batch_size_per_intra_op_thread);
   }
 
+  const TensorSignature& signature = *batch_in_process->signature;
   const std::vector<string> output_tensor_names(
       signature.output_tensors.begin(), signature.output_tensors.end());
-  std::vector<Tensor> combined_outputs;
   RunMetadata run_metadata;
-  status = wrapped_->Run(run_options, merged_inputs, output_tensor_names,
-                         {} /* target node names */, &combined_outputs,
-                         &run_metadata);
+  const int64 trace_compute_start_micros =
+      batch_in_process->trace_latency ? latency_trace::NowMicros() : 0;
+  {
+    std::unique_ptr<CoreBudget::Grant> core_grant;
+    if (options_.core_budget != nullptr) {
+      core_grant = options_.core_budget->Acquire();
+      run_options.set_inter_op_thread_pool(core_grant->inter_op_thread_pool());
+      if (run_options.intra_op_parallelism_limit() == 0 ||
+          run_options.intra_op_parallelism_limit() > core_grant->num_cores()) {
+        run_options.set_intra_op_parallelism_limit(core_grant->num_cores());
+      }
+    }
+    batch_in_process->status = wrapped_->Run(
+        run_options, batch_in_process->merged_inputs, output_tensor_names,
+        {} /* target node names */, &batch_in_process->combined_outputs,
+        &run_metadata);
+  }
+  if (batch_in_process->trace_latency) {
+    batch_in_process->trace_compute_micros =
+        latency_trace::NowMicros() - trace_compute_start_micros;
+  }
   for (int i = 0; i < batch->num_tasks(); ++i) {
     *(batch->mutable_task(i)->run_metadata) = run_metadata;
   }
-  if (!status.ok()) {
-    return;
+  // Release the batched inputs before the batch waits for a split thread.
+  batch_in_process->merged_inputs.clear();
+}
+
+void BatchingSession::SplitBatch(BatchInProcess* batch_in_process) {
+  const uint64 start_time_micros = Env::Default()->NowMicros();
+  Batch<BatchingSessionTask>* batch = batch_in_process->batch.get();
+  Status& status = batch_in_process->status;
+  if (status.ok()) {
+    status = SplitOutputTensors(*batch_in_process->signature,
+                                batch_in_process->combined_outputs, batch);
+  }
+
+  // Regardless of the outcome, we need to propagate the status to the
+  // individual tasks and signal that they are done.
+  const bool trace_latency = batch_in_process->trace_latency;
+  const int64 trace_end_micros =
+      trace_latency ? latency_trace::NowMicros() : 0;
+  const uint64 dequeue_time_micros = batch_in_process->dequeue_time_micros;
+  BatchingAutoTuner* const auto_tuner = options_.auto_tuner.get();
+  if (auto_tuner != nullptr) {
+    // Only the stages count as compute; in a pipeline, the waits for a run or
+    // split thread count as queueing.
+    const uint64 now_micros = Env::Default()->NowMicros();
+    const int64 compute_micros =
+        batch_in_process->processing_micros + (now_micros - start_time_micros);
+    const int64 pipeline_wait_micros = std::max<int64>(
+        now_micros - dequeue_time_micros - compute_micros, 0);
+    auto_tuner->RecordBatch(batch->size(), compute_micros);
+    for (int i = 0; i < batch->num_tasks(); ++i) {
+      auto_tuner->RecordTask(
+          dequeue_time_micros - batch->task(i).enqueue_time_micros +
+              pipeline_wait_micros,
+          compute_micros);
+    }
+  }
+  for (int i = 0; i < batch->num_tasks(); ++i) {
+    if (trace_latency) {
+      const int64 queue_micros =
+          dequeue_time_micros - batch->task(i).enqueue_time_micros;
+      latency_trace::Record(
+          {latency_trace::Source::kBatchingTask,
+           batch_in_process->trace_dequeue_micros - queue_micros,
+           trace_end_micros, queue_micros,
+           batch_in_process->trace_compute_micros});
+    }
+    batch->mutable_task(i)->done(status);
+  }
+}
+
+void BatchingSession::RunStageLoop() {
+  std::unique_ptr<BatchInProcess> batch_in_process;
+  while (run_queue_->Pop(&batch_in_process)) {
+    RunBatch(batch_in_process.get());
+    split_queue_->Push(std::move(batch_in_process));
   }
+}
 
-  status = SplitOutputTensors(signature, combined_outputs, batch.get());
+void BatchingSession::SplitStageLoop() {
+  std::unique_ptr<BatchInProcess> batch_in_process;
+  while (split_queue_->Pop(&batch_in_process)) {
+    SplitBatch(batch_in_process.get());
+    batch_in_process.reset();
+  }
+}
+
+void ConfigureSessionForNUMABatching(ConfigProto* config) {
+  const int num_nodes = port::NUMANumNodes();
+  if (num_nodes <= 1) {
+    return;
+  }
+  const int num_threads = config->inter_op_parallelism_threads() > 0
+                              ? config->inter_op_parallelism_threads()
+                              : port::NumSchedulableCPUs();
+  config->clear_session_inter_op_thread_pool();
+  for (int node = 0; node < num_nodes; ++node) {
+    ThreadPoolOptionProto* pool = config->add_session_inter_op_thread_pool();
+    pool->set_num_threads(std::max(1, num_threads / num_nodes));
+    // Global, so that the sessions of all servables share the same pools.
+    pool->set_global_name(strings::StrCat("numa_inter_op_", node));
+    pool->set_bind_to_numa_node(true);
+    pool->set_numa_node(node);
+  }
 }
 
 Status CreateBatchingSession(
@@ -640,6 +1299,11 @@ Status CreateBasicBatchingSession(
     const BatchingSessionOptions& batching_session_options,
     const TensorSignature& signature, std::unique_ptr<Session> session,
     std::unique_ptr<Session>* batching_session) {
+  if (batching_session_options.merge_inputs_incrementally) {
+    return errors::InvalidArgument(
+        "merge_inputs_incrementally needs a scheduler that hands out open "
+        "batches, which BasicBatchScheduler does not");
+  }
   if (!batching_session_options.allowed_batch_sizes.empty()) {
     if (batching_session_options.allowed_batch_sizes.back() !=
         schedule_options.max_batch_size) {
@@ -669,5 +1333,63 @@ Status CreateBasicBatchingSession(
                                std::move(session), batching_session);
 }
 
+Status SplitInputTask(
+    std::unique_ptr<BatchingSessionTask>* input_task,
+    int open_batch_remaining_slot, int max_batch_size,
+    std::vector<std::unique_ptr<BatchingSessionTask>>* output_tasks) {
+  const BatchingSessionTask& task = **input_task;
+
+  std::vector<int64> piece_sizes;
+  int64 piece_size =
+      open_batch_remaining_slot > 0 ? open_batch_remaining_slot : max_batch_size;
+  for (int64 remaining_size = task.zeroth_dim_size; remaining_size > 0;
+       remaining_size -= piece_size) {
+    piece_size = std::min<int64>(piece_size, remaining_size);
+    piece_sizes.push_back(piece_size);
+    piece_size = max_batch_size;
+  }
+  if (piece_sizes.empty()) {
+    return errors::InvalidArgument("Cannot split a task of size 0");
+  }
+
+  auto state = std::make_shared<SplitTaskState>(piece_sizes.size());
+  std::vector<std::unique_ptr<BatchingSessionTask>> pieces;
+  pieces.reserve(piece_sizes.size());
+  int64 start = 0;
+  for (int i = 0; i < piece_sizes.size(); ++i) {
+    const int64 limit = start + piece_sizes[i];
+    auto piece = std::unique_ptr<BatchingSessionTask>(new BatchingSessionTask);
+    piece->enqueue_time_micros = task.enqueue_time_micros;
+    piece->timeout_deadline_micros = task.timeout_deadline_micros;
+    piece->run_options = task.run_options;
+    piece->max_batch_size = task.max_batch_size;
+    piece->zeroth_dim_size = piece_sizes[i];
+    piece->split_inputs.reserve(task.inputs->size());
+    for (const auto& entry : *task.inputs) {
+      Tensor slice;
+      TF_RETURN_IF_ERROR(SliceRows(entry.second, start, limit, &slice));
+      piece->split_inputs.emplace_back(entry.first, std::move(slice));
+    }
+    piece->inputs = &piece->split_inputs;
+    piece->output_tensor_names = task.output_tensor_names;
+    piece->outputs = &state->piece_outputs[i];
+    piece->run_metadata = &state->piece_run_metadata[i];
+    piece->done = [state](const Status& status) {
+      CompleteSplitTaskPiece(state.get(), status);
+    };
+    pieces.push_back(std::move(piece));
+    start = limit;
+  }
+
+  state->outputs = task.outputs;
+  state->run_metadata = task.run_metadata;
+  state->done = std::move((*input_task)->done);
+  input_task->reset();
+  for (auto& piece : pieces) {
+    output_tasks->push_back(std::move(piece));
+  }
+  return Status::OK();
+}
+
 }  // namespace serving
 }  // namespace tensorflow
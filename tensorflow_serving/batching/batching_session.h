@@ -28,6 +28,9 @@ limitations under the License.
 
 #include "tensorflow/contrib/batching/basic_batch_scheduler.h"
 #include "tensorflow/contrib/batching/batch_scheduler.h"
+#include "tensorflow/contrib/batching/batching_auto_tuner.h"
+#include "tensorflow/contrib/batching/core_budget.h"
+#include "tensorflow/core/protobuf/config.pb.h"
 #include "tensorflow/core/protobuf/meta_graph.pb.h"
 #include "tensorflow/core/public/session.h"
 
@@ -130,8 +133,97 @@ struct BatchingSessionOptions {
   // (modulo zeroth dimension) and this option is set to false,
   // then error Status will be returned.
   bool pad_variable_length_inputs = true;
+
+  // If set, Run() calls are grouped into buckets by the length of their inputs
+  // (the largest size of the first dimension after the batch dimension among
+  // the input tensors, or 0 if they have none), and each bucket is batched
+  // separately, with its own batch scheduler. A bucket holds the calls whose
+  // length is at most its entry and greater than the previous entry; calls
+  // longer than the last entry go to one more bucket. Used with
+  // 'pad_variable_length_inputs', this bounds how much a batch is padded: a
+  // long sequence no longer inflates the shape of a batch of short ones.
+  //
+  // Each bucket's scheduler is created by the signature's scheduler creator,
+  // so e.g. a queue capacity set there applies to each bucket on its own.
+  //
+  // IMPORTANT: The entries must be positive and in increasing order.
+  //
+  // If left empty, each signature is batched as a whole.
+  std::vector<int> length_bucket_boundaries;
+
+  // If set to true, each batched input tensor is preallocated at the maximum
+  // batch size (rounded up per 'allowed_batch_sizes'), and the batch thread
+  // copies each task's rows into it as the task joins the batch, instead of
+  // concatenating all tasks' inputs once the batch has closed. This takes the
+  // merge off the critical path between the batch closing and the batched
+  // Run() call.
+  //
+  // IMPORTANT: This needs a scheduler that hands out batches while they are
+  // still open, i.e. StreamingBatchScheduler. SharedBatchScheduler (and hence
+  // BasicBatchScheduler) only hands out closed batches, leaving nothing to
+  // overlap the merge with, so CreateBasicBatchingSession() rejects this
+  // option.
+  //
+  // Batches whose tensors would need padding in dimensions other than the
+  // zeroth, or whose inputs are of a type other than a POD type or DT_STRING,
+  // fall back to concatenation.
+  bool merge_inputs_incrementally = false;
+
+  // If set, every processed batch and each of its tasks is reported to this
+  // tuner, which may in turn adjust the batch scheduler's parameters.
+  std::shared_ptr<BatchingAutoTuner> auto_tuner;
+
+  // If set, each batch holds a grant from this budget while the wrapped
+  // session runs it, and runs on the inter-op pool the grant reserves. The
+  // wrapped session must have been created with a config set up by
+  // CoreBudget::ConfigureSession().
+  std::shared_ptr<CoreBudget> core_budget;
+
+  // If positive, each batch is processed in a pipeline of three stages rather
+  // than start to finish on the batch thread: the batch thread merges the
+  // inputs; one of 'num_pipeline_run_threads' run threads runs the wrapped
+  // session on them; and one of as many split threads splits the outputs
+  // among the tasks and calls their done callbacks (in which RunAsync()
+  // callers typically serialize their responses). Batch N+1 is then merged,
+  // and batch N-1 split, while batch N runs.
+  //
+  // The stages are connected by queues holding at most
+  // 'pipeline_queue_capacity' batches each. A full queue blocks the stage
+  // feeding it, and so ultimately the batch threads, which bounds the number
+  // of batches in flight. Note that the batch scheduler considers a batch
+  // processed once it has been merged.
+  //
+  // If 0, batches are processed on the batch thread.
+  int num_pipeline_run_threads = 0;
+  int pipeline_queue_capacity = 1;
+
+  // If positive, each batch runs with its intra-op parallelism limited to one
+  // thread per this many rows (rounded up), via
+  // RunOptions::intra_op_parallelism_limit. Small batches then leave the
+  // intra-op threads to the batches running alongside them, instead of
+  // splitting work too small to amortize the sharding across all of them.
+  //
+  // If 0, batches run with the wrapped session's limit.
+  int batch_size_per_intra_op_thread = 0;
+
+  // If true, each batch runs on the inter-op pool whose index is the NUMA node
+  // its batch thread is bound to (see SharedBatchScheduler::Options::
+  // numa_aware), so that the ops reading its node-local batched inputs run on
+  // that node too. The wrapped session needs one inter-op pool per node, bound
+  // to it, as set up by ConfigureSessionForNUMABatching(). Batches from unbound
+  // batch threads run on the pool their Run() calls asked for. Can't be
+  // combined with 'core_budget', which picks the pool itself.
+  bool numa_inter_op_thread_pools = false;
 };
 
+// Sets up 'config' for BatchingSessionOptions::numa_inter_op_thread_pools:
+// one global inter-op pool per NUMA node, bound to that node and holding its
+// share of 'config.inter_op_parallelism_threads' (or of the cores, if that is
+// 0). Any existing session_inter_op_thread_pool entries are replaced. Leaves
+// 'config' alone on hosts with a single node, where batch threads are never
+// bound.
+void ConfigureSessionForNUMABatching(ConfigProto* config);
+
 // Wraps a session in a new session that automatically batches Run() calls.
 // Uses one batcher for each distinct Run() signature supported. In addition to
 // a session to wrap, takes a list of signature/BatchingSessionSchedulerCreator
@@ -190,25 +282,59 @@ Status CreateBasicBatchingSession(
     const TensorSignature& signature, std::unique_ptr<Session> session,
     std::unique_ptr<Session>* batching_session);
 
+// Splits 'input_task' along the 0th dimension of its inputs into
+// 'output_tasks': a first one of size 'open_batch_remaining_slot' (if that is
+// positive), followed by ones of at most 'max_batch_size'. Once all of them
+// have been processed, their outputs are concatenated into the outputs of
+// 'input_task', which is then completed. Leaves 'input_task' untouched on
+// error.
+//
+// For use as the 'split_input_task_func' of a batch scheduler with
+// 'enable_large_batch_splitting', so that Run() calls of any size can be
+// batched, filling up each batch:
+//
+// BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+// schedule_options.enable_large_batch_splitting = true;
+// schedule_options.split_input_task_func = SplitInputTask;
+Status SplitInputTask(
+    std::unique_ptr<BatchingSessionTask>* input_task,
+    int open_batch_remaining_slot, int max_batch_size,
+    std::vector<std::unique_ptr<BatchingSessionTask>>* output_tasks);
+
 //////////
 // Implementation details follow. API users need not read.
 
 struct BatchingSessionTask : public BatchTask {
   ~BatchingSessionTask() override = default;
   size_t size() const override { return zeroth_dim_size; }
+  uint64 deadline_micros() const override { return timeout_deadline_micros; }
+  int priority() const override { return run_options.priority(); }
 
   // Fields populated when a task is received.
   uint64 enqueue_time_micros;
+  // The time by which 'run_options.timeout_in_ms' expires, or
+  // kNoDeadlineMicros if it is not set.
+  uint64 timeout_deadline_micros;
   RunOptions run_options;
   size_t zeroth_dim_size;
+  // The scheduler's max_task_size() as of the task's arrival, so that the
+  // batch can be processed without going back to the scheduler.
+  size_t max_batch_size = 0;
   const std::vector<std::pair<string, Tensor>>* inputs;
   const std::vector<string>* output_tensor_names;
 
   // Fields populated when a task is processed (as part of a batch).
-  Notification* done;
-  Status* status;
   std::vector<Tensor>* outputs;
   RunMetadata* run_metadata;
+
+  // Called with the task's outcome once it has been processed. After this
+  // call, 'inputs', 'output_tensor_names', 'outputs' and 'run_metadata' may no
+  // longer be valid.
+  std::function<void(const Status&)> done;
+
+  // For a piece of a task split by SplitInputTask(), the slices of the
+  // original task's inputs, to which 'inputs' points.
+  std::vector<std::pair<string, Tensor>> split_inputs;
 };
 
 }  // namespace serving
@@ -22,13 +22,20 @@ limitations under the License.
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/notification.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/cpu_info.h"
 #include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow/core/platform/types.h"
 #include "tensorflow/core/public/session_options.h"
+#include "tensorflow/core/util/parallelism_limits.h"
+#include "tensorflow_serving/batching/streaming_batch_scheduler.h"
 #include "tensorflow_serving/servables/tensorflow/serving_session.h"
 #include "tensorflow_serving/test_util/test_util.h"
 
@@ -61,8 +68,11 @@ class BatchSizeCapturingSession : public ServingSession {
              const std::vector<string>& target_node_names,
              std::vector<Tensor>* outputs, RunMetadata* run_metadata) override {
     latest_batch_size_ = inputs[0].second.shape().dim_size(0);
-    return wrapped_->Run(run_options, inputs, output_tensor_names,
-                         target_node_names, outputs, run_metadata);
+    const Status status =
+        wrapped_->Run(run_options, inputs, output_tensor_names,
+                      target_node_names, outputs, run_metadata);
+    latest_outputs_ = *outputs;
+    return status;
   }
 
   Status ListDevices(std::vector<DeviceAttributes>* response) override {
@@ -71,15 +81,79 @@ class BatchSizeCapturingSession : public ServingSession {
 
   int latest_batch_size() const { return latest_batch_size_; }
 
+  const std::vector<Tensor>& latest_outputs() const { return latest_outputs_; }
+
  private:
   std::unique_ptr<Session> wrapped_;
 
   // The size of the batch most recently submitted to Run().
   int latest_batch_size_ = -1;
 
+  // The outputs of the most recent Run().
+  std::vector<Tensor> latest_outputs_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(BatchSizeCapturingSession);
 };
 
+// A session that returns its input "x" as its output "y", and records the shape
+// of each batch it is run on, the inter-op pool it was asked to use and its
+// intra-op parallelism limit.
+class ShapeCapturingIdentitySession : public ServingSession {
+ public:
+  ShapeCapturingIdentitySession() = default;
+  ~ShapeCapturingIdentitySession() override = default;
+
+  Status Run(const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs) override {
+    RunMetadata run_metadata;
+    return Run(RunOptions(), inputs, output_tensor_names, target_node_names,
+               outputs, &run_metadata);
+  }
+
+  Status Run(const RunOptions& run_options,
+             const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs, RunMetadata* run_metadata) override {
+    mutex_lock l(mu_);
+    batch_shapes_.push_back(inputs[0].second.shape().DebugString());
+    inter_op_thread_pools_.push_back(run_options.inter_op_thread_pool());
+    intra_op_parallelism_limits_.push_back(
+        run_options.intra_op_parallelism_limit());
+    outputs->push_back(inputs[0].second);
+    return Status::OK();
+  }
+
+  Status ListDevices(std::vector<DeviceAttributes>* response) override {
+    return Status::OK();
+  }
+
+  std::vector<string> batch_shapes() const {
+    mutex_lock l(mu_);
+    return batch_shapes_;
+  }
+
+  std::vector<int> inter_op_thread_pools() const {
+    mutex_lock l(mu_);
+    return inter_op_thread_pools_;
+  }
+
+  std::vector<int> intra_op_parallelism_limits() const {
+    mutex_lock l(mu_);
+    return intra_op_parallelism_limits_;
+  }
+
+ private:
+  mutable mutex mu_;
+  std::vector<string> batch_shapes_ GUARDED_BY(mu_);
+  std::vector<int> inter_op_thread_pools_ GUARDED_BY(mu_);
+  std::vector<int> intra_op_parallelism_limits_ GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ShapeCapturingIdentitySession);
+};
+
 // Creates a (non-batching) session with the half-plus-two model loaded.
 std::unique_ptr<Session> CreateHalfPlusTwoSession() {
   tensorflow::SessionOptions session_options;
@@ -142,6 +216,33 @@ void ExpectError(const string& error_message,
   EXPECT_EQ(error_message, status.error_message());
 }
 
+// Like CreateBasicBatchingSession(), but with a StreamingBatchScheduler, which
+// hands out batches while they are still open.
+Status CreateStreamingBatchingSession(
+    const StreamingBatchScheduler<BatchingSessionTask>::Options&
+        schedule_options,
+    const BatchingSessionOptions& batching_session_options,
+    const TensorSignature& signature, std::unique_ptr<Session> session,
+    std::unique_ptr<Session>* batching_session) {
+  auto scheduler_creator =
+      [schedule_options](
+          std::function<void(std::unique_ptr<Batch<BatchingSessionTask>>)>
+              process_batch_callback,
+          std::unique_ptr<BatchScheduler<BatchingSessionTask>>*
+              batch_scheduler) {
+        std::unique_ptr<StreamingBatchScheduler<BatchingSessionTask>>
+            streaming_batch_scheduler;
+        TF_RETURN_IF_ERROR(StreamingBatchScheduler<BatchingSessionTask>::Create(
+            schedule_options, process_batch_callback,
+            &streaming_batch_scheduler));
+        *batch_scheduler = std::move(streaming_batch_scheduler);
+        return Status::OK();
+      };
+  return CreateBatchingSession(batching_session_options,
+                               {{signature, scheduler_creator}},
+                               std::move(session), batching_session);
+}
+
 // Creates a SignatureDef from a TensorSignature.
 SignatureDef CreateSignatureDef(const TensorSignature& tensor_signature) {
   SignatureDef signature_def;
@@ -232,6 +333,246 @@ TEST(BatchingSessionTest, BatchingWithPadding) {
           }));
 }
 
+TEST(BatchingSessionTest, LengthBuckets) {
+  std::unique_ptr<ShapeCapturingIdentitySession> identity_session(
+      new ShapeCapturingIdentitySession);
+  auto identity_session_raw = identity_session.get();
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 2;
+  schedule_options.batch_timeout_micros = 10 * 1000;
+  schedule_options.num_batch_threads = 1;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.pad_variable_length_inputs = true;
+  batching_session_options.length_bucket_boundaries = {2};
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(identity_session), &batching_session));
+  ServingSession* serving_session =
+      static_cast<ServingSession*>(batching_session.get());
+
+  // The two short requests fill a batch of their own, which is only padded to
+  // the longer of the two; the long request is batched separately.
+  const std::vector<std::vector<std::pair<string, Tensor>>> inputs = {
+      {{"x", test::AsTensor<float>({1}, {1, 1})}},
+      {{"x", test::AsTensor<float>({5, 6, 7, 8}, {1, 4})}},
+      {{"x", test::AsTensor<float>({2, 3}, {1, 2})}}};
+  std::vector<std::vector<Tensor>> outputs(inputs.size());
+  std::vector<RunMetadata> run_metadata(inputs.size());
+  std::vector<Notification> done(inputs.size());
+  for (int i = 0; i < inputs.size(); ++i) {
+    serving_session->RunAsync(RunOptions(), inputs[i], {"y"}, {}, &outputs[i],
+                              &run_metadata[i],
+                              [&done, i](const Status& status) {
+                                TF_EXPECT_OK(status);
+                                done[i].Notify();
+                              });
+  }
+  for (Notification& notification : done) {
+    notification.WaitForNotification();
+  }
+
+  EXPECT_THAT(identity_session_raw->batch_shapes(),
+              UnorderedElementsAre("[2,2]", "[1,4]"));
+  ASSERT_EQ(1, outputs[0].size());
+  test::ExpectTensorEqual<float>(test::AsTensor<float>({1, 1}, {1, 2}),
+                                 outputs[0][0]);
+  ASSERT_EQ(1, outputs[1].size());
+  test::ExpectTensorEqual<float>(inputs[1][0].second, outputs[1][0]);
+}
+
+TEST(BatchingSessionTest, RunsBatchesUnderCoreBudget) {
+  std::unique_ptr<ShapeCapturingIdentitySession> identity_session(
+      new ShapeCapturingIdentitySession);
+  auto identity_session_raw = identity_session.get();
+
+  CoreBudget::Options core_budget_options;
+  core_budget_options.num_cores = 2;
+  core_budget_options.max_concurrent_batches = 2;
+  std::unique_ptr<CoreBudget> core_budget;
+  TF_ASSERT_OK(CoreBudget::Create(core_budget_options, &core_budget));
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 1;
+  schedule_options.num_batch_threads = 2;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.core_budget = std::move(core_budget);
+  const std::shared_ptr<CoreBudget> core_budget_ref =
+      batching_session_options.core_budget;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(identity_session), &batching_session));
+
+  std::vector<Tensor> outputs;
+  TF_ASSERT_OK(batching_session->Run(
+      {{"x", test::AsTensor<float>({1}, {1})}}, {"y"}, {}, &outputs));
+  // A lone batch runs on the first inter-op pool with every core, and returns
+  // its grant.
+  EXPECT_THAT(identity_session_raw->inter_op_thread_pools(),
+              UnorderedElementsAre(0));
+  EXPECT_THAT(identity_session_raw->intra_op_parallelism_limits(),
+              UnorderedElementsAre(2));
+  EXPECT_EQ(0, core_budget_ref->num_batches_in_flight());
+  // The budget leaves the process-wide limit alone.
+  EXPECT_EQ(0, GetIntraOpParallelismLimit());
+}
+
+TEST(BatchingSessionTest, NUMAInterOpThreadPoolsExcludeCoreBudget) {
+  CoreBudget::Options core_budget_options;
+  core_budget_options.num_cores = 1;
+  std::unique_ptr<CoreBudget> core_budget;
+  TF_ASSERT_OK(CoreBudget::Create(core_budget_options, &core_budget));
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.core_budget = std::move(core_budget);
+  batching_session_options.numa_inter_op_thread_pools = true;
+  std::unique_ptr<Session> batching_session;
+  EXPECT_FALSE(CreateBasicBatchingSession(
+                   schedule_options, batching_session_options, {{"x"}, {"y"}},
+                   std::unique_ptr<Session>(new ShapeCapturingIdentitySession),
+                   &batching_session)
+                   .ok());
+}
+
+TEST(BatchingSessionTest, ConfigureSessionForNUMABatching) {
+  ConfigProto config;
+  config.set_inter_op_parallelism_threads(8);
+  config.add_session_inter_op_thread_pool()->set_num_threads(3);
+  ConfigureSessionForNUMABatching(&config);
+  const int num_nodes = port::NUMANumNodes();
+  if (num_nodes == 1) {
+    // Batch threads are never bound, so the config is left alone.
+    ASSERT_EQ(1, config.session_inter_op_thread_pool_size());
+    EXPECT_EQ(3, config.session_inter_op_thread_pool(0).num_threads());
+    return;
+  }
+  ASSERT_EQ(num_nodes, config.session_inter_op_thread_pool_size());
+  for (int node = 0; node < num_nodes; ++node) {
+    const ThreadPoolOptionProto& pool =
+        config.session_inter_op_thread_pool(node);
+    EXPECT_EQ(std::max(1, 8 / num_nodes), pool.num_threads());
+    EXPECT_TRUE(pool.bind_to_numa_node());
+    EXPECT_EQ(node, pool.numa_node());
+  }
+}
+
+TEST(BatchingSessionTest, LimitsIntraOpParallelismByBatchSize) {
+  std::unique_ptr<ShapeCapturingIdentitySession> identity_session(
+      new ShapeCapturingIdentitySession);
+  auto identity_session_raw = identity_session.get();
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 8;
+  schedule_options.num_batch_threads = 1;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.batch_size_per_intra_op_thread = 4;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(identity_session), &batching_session));
+
+  // Run one at a time, so that each is a batch of its own.
+  for (const int batch_size : {1, 4, 5, 8}) {
+    std::vector<Tensor> outputs;
+    TF_ASSERT_OK(batching_session->Run(
+        {{"x", Tensor(DT_FLOAT, TensorShape({batch_size}))}}, {"y"}, {},
+        &outputs));
+  }
+  EXPECT_EQ(std::vector<int>({1, 1, 2, 2}),
+            identity_session_raw->intra_op_parallelism_limits());
+}
+
+TEST(BatchingSessionTest, LengthBucketBoundariesMustIncrease) {
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.length_bucket_boundaries = {4, 4};
+  std::unique_ptr<Session> batching_session;
+  EXPECT_FALSE(CreateBasicBatchingSession(
+                   schedule_options, batching_session_options, {{"x"}, {"y"}},
+                   CreateHalfPlusTwoSession(), &batching_session)
+                   .ok());
+}
+
+TEST(BatchingSessionTest, PipelinedBatchProcessing) {
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 2;  // fits one 2-unit task
+  schedule_options.num_batch_threads = 1;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.num_pipeline_run_threads = 2;
+  batching_session_options.pipeline_queue_capacity = 1;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      CreateHalfPlusTwoSession(), &batching_session));
+
+  // More requests than the pipeline holds at once, so that some of them wait
+  // for room in its queues.
+  std::vector<std::unique_ptr<Thread>> request_threads;
+  for (int i = 0; i < 8; ++i) {
+    request_threads.emplace_back(Env::Default()->StartThread(
+        ThreadOptions(), strings::StrCat("request_thread_", i),
+        [i, &batching_session] {
+          TestSingleRequest(i, 2 * i, batching_session.get());
+        }));
+  }
+}
+
+TEST(BatchingSessionTest, DestructionDrainsIncrementallyMergedBatches) {
+  std::unique_ptr<ShapeCapturingIdentitySession> identity_session(
+      new ShapeCapturingIdentitySession);
+
+  StreamingBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 4;
+  schedule_options.batch_timeout_micros = -1;  // no timeout
+  schedule_options.num_batch_threads = 1;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.merge_inputs_incrementally = true;
+  batching_session_options.num_pipeline_run_threads = 1;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateStreamingBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(identity_session), &batching_session));
+
+  const std::vector<std::pair<string, Tensor>> inputs = {
+      {"x", test::AsTensor<float>({1, 2}, {2})}};
+  std::vector<Tensor> outputs;
+  RunMetadata run_metadata;
+  Notification done;
+  static_cast<ServingSession*>(batching_session.get())
+      ->RunAsync(RunOptions(), inputs, {"y"}, {}, &outputs, &run_metadata,
+                 [&done](const Status& status) {
+                   TF_EXPECT_OK(status);
+                   done.Notify();
+                 });
+  // The batch is still open, and only gets processed while its scheduler is
+  // being destroyed.
+  batching_session.reset();
+  EXPECT_TRUE(done.HasBeenNotified());
+  ASSERT_EQ(1, outputs.size());
+  test::ExpectTensorEqual<float>(inputs[0].second, outputs[0]);
+}
+
+TEST(BatchingSessionTest, PipelineOptionsMustBeValid) {
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.num_pipeline_run_threads = -1;
+  std::unique_ptr<Session> batching_session;
+  EXPECT_FALSE(CreateBasicBatchingSession(
+                   schedule_options, batching_session_options, {{"x"}, {"y"}},
+                   CreateHalfPlusTwoSession(), &batching_session)
+                   .ok());
+
+  batching_session_options.num_pipeline_run_threads = 1;
+  batching_session_options.pipeline_queue_capacity = 0;
+  EXPECT_FALSE(CreateBasicBatchingSession(
+                   schedule_options, batching_session_options, {{"x"}, {"y"}},
+                   CreateHalfPlusTwoSession(), &batching_session)
+                   .ok());
+}
+
 TEST(BatchingSessionTest, UnequalTensorShapesWithPaddingTurnedOff) {
   BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
   schedule_options.max_batch_size = 2;
@@ -279,6 +620,56 @@ TEST(BatchingSessionTest, SingletonBatch) {
   TestSingleRequest(100.0f, 42.0f, batching_session.get());
 }
 
+TEST(BatchingSessionTest, RunAsync) {
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 4;  // fits two 2-unit tasks
+  schedule_options.batch_timeout_micros = 1 * 1000 * 1000;  // won't trigger
+  schedule_options.num_batch_threads = 1;
+  std::unique_ptr<Session> batching_session;
+  BatchingSessionOptions batching_session_options;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      CreateHalfPlusTwoSession(), &batching_session));
+  ServingSession* serving_session =
+      static_cast<ServingSession*>(batching_session.get());
+
+  // Issue two requests from the same thread. Neither call blocks, and together
+  // they fill a batch.
+  const std::vector<std::pair<string, Tensor>> first_inputs = {
+      {"x", test::AsTensor<float>({100.0f, 42.0f}, {2})}};
+  const std::vector<std::pair<string, Tensor>> second_inputs = {
+      {"x", test::AsTensor<float>({71.5f, 18.3f}, {2})}};
+  std::vector<Tensor> first_outputs;
+  std::vector<Tensor> second_outputs;
+  RunMetadata first_run_metadata;
+  RunMetadata second_run_metadata;
+  Notification first_done;
+  Notification second_done;
+  serving_session->RunAsync(RunOptions(), first_inputs, {"y"}, {},
+                            &first_outputs, &first_run_metadata,
+                            [&first_done](const Status& status) {
+                              TF_EXPECT_OK(status);
+                              first_done.Notify();
+                            });
+  EXPECT_FALSE(first_done.HasBeenNotified());
+  serving_session->RunAsync(RunOptions(), second_inputs, {"y"}, {},
+                            &second_outputs, &second_run_metadata,
+                            [&second_done](const Status& status) {
+                              TF_EXPECT_OK(status);
+                              second_done.Notify();
+                            });
+  first_done.WaitForNotification();
+  second_done.WaitForNotification();
+
+  ASSERT_EQ(1, first_outputs.size());
+  test::ExpectTensorEqual<float>(test::AsTensor<float>({52.0f, 23.0f}, {2}),
+                                 first_outputs[0]);
+  ASSERT_EQ(1, second_outputs.size());
+  test::ExpectTensorEqual<float>(
+      test::AsTensor<float>({71.5f / 2 + 2, 18.3f / 2 + 2}, {2}),
+      second_outputs[0]);
+}
+
 TEST(BatchingSessionTest, RequestThatDoesntMatchSignatureGetsRunAnyway) {
   BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
   // Set the batching parameters s.t. if the request is batched the test will
@@ -355,6 +746,156 @@ TEST(BatchingSessionTest, AllowedBatchSizesRequirePadding) {
   EXPECT_EQ(3, batch_size_capturing_session_raw->latest_batch_size());
 }
 
+TEST(BatchingSessionTest, SplitsLargeTasks) {
+  // Arrange to capture the batch size.
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 2;
+  schedule_options.batch_timeout_micros = 0;
+  schedule_options.num_batch_threads = 1;
+  schedule_options.enable_large_batch_splitting = true;
+  schedule_options.split_input_task_func = SplitInputTask;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, BatchingSessionOptions(), {{"x"}, {"y"}},
+      std::move(batch_size_capturing_session), &batching_session));
+
+  // The request is larger than the maximum batch size, and is run in three
+  // batches whose outputs are reassembled in order.
+  Tensor input =
+      test::AsTensor<float>({100.0f, 42.0f, 71.5f, 18.3f, 1.0f}, {5});
+  Tensor expected_output =
+      test::AsTensor<float>({52.0f, 23.0f, 37.75f, 11.15f, 2.5f}, {5});
+  std::vector<Tensor> outputs;
+  TF_ASSERT_OK(batching_session->Run({{"x", input}}, {"y"},
+                                     {} /* target nodes */, &outputs));
+  ASSERT_EQ(1, outputs.size());
+  test::ExpectTensorNear<float>(expected_output, outputs[0], 1e-5);
+  EXPECT_EQ(1, batch_size_capturing_session_raw->latest_batch_size());
+}
+
+TEST(BatchingSessionTest, MergeInputsIncrementally) {
+  StreamingBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 4;  // fits two 2-unit tasks
+  schedule_options.batch_timeout_micros = 1 * 1000 * 1000;  // won't trigger
+  schedule_options.num_batch_threads = 1;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.merge_inputs_incrementally = true;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateStreamingBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      CreateHalfPlusTwoSession(), &batching_session));
+
+  std::unique_ptr<Thread> first_request_thread(Env::Default()->StartThread(
+      ThreadOptions(), "first_request_thread", [&batching_session] {
+        TestSingleRequest(100.0f, 42.0f, batching_session.get());
+      }));
+  std::unique_ptr<Thread> second_request_thread(Env::Default()->StartThread(
+      ThreadOptions(), "second_request_thread", [&batching_session] {
+        TestSingleRequest(71.5f, 18.3f, batching_session.get());
+      }));
+}
+
+TEST(BatchingSessionTest, MergeInputsIncrementallyWithPadding) {
+  // Arrange to capture the batch size.
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+
+  StreamingBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 4;
+  schedule_options.batch_timeout_micros = 1000;
+  schedule_options.num_batch_threads = 1;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.allowed_batch_sizes = {1, 3, 4};
+  batching_session_options.merge_inputs_incrementally = true;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateStreamingBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(batch_size_capturing_session), &batching_session));
+  TestSingleRequest(100.0f, 42.0f, batching_session.get());
+
+  // The batch is preallocated at 4 rows, but only its first 3 are submitted.
+  EXPECT_EQ(3, batch_size_capturing_session_raw->latest_batch_size());
+}
+
+TEST(BatchingSessionTest, MergeInputsIncrementallyFallsBackToPadding) {
+  StreamingBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 2;
+  schedule_options.batch_timeout_micros = 1e6;
+  schedule_options.num_batch_threads = 1;
+  std::unique_ptr<Session> batching_session;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.pad_variable_length_inputs = true;
+  batching_session_options.merge_inputs_incrementally = true;
+  TF_ASSERT_OK(CreateStreamingBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      CreateMatrixHalfPlusTwoSession(), &batching_session));
+  // The two inputs differ beyond the zeroth dimension, so they are merged by
+  // padding and concatenation instead.
+  std::unique_ptr<Thread> first_request_thread(Env::Default()->StartThread(
+      ThreadOptions(), "first_request", [&batching_session] {
+        TestRequestToMatrixHalfPlusTwo(
+            {1, 2, 3, 4}, {1, 2, 2}, {2.5, 3, 2.5, 3.5, 4, 2.5, 2.5, 2.5, 2.5},
+            {1, 3, 3}, batching_session.get());
+      }));
+  std::unique_ptr<Thread> second_request_thread(Env::Default()->StartThread(
+      ThreadOptions(), "second_request", [&batching_session] {
+        TestRequestToMatrixHalfPlusTwo({5, 6, 7, 8, 9, 10, 11, 12, 13},
+                                       {1, 3, 3},
+                                       {4.5, 5, 5.5, 6, 6.5, 7, 7.5, 8, 8.5},
+                                       {1, 3, 3}, batching_session.get());
+      }));
+}
+
+TEST(BatchingSessionTest, MergeInputsIncrementallyNeedsOpenBatches) {
+  // BasicBatchScheduler only hands out closed batches.
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.merge_inputs_incrementally = true;
+  std::unique_ptr<Session> batching_session;
+  const Status status = CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      CreateHalfPlusTwoSession(), &batching_session);
+  EXPECT_EQ(error::INVALID_ARGUMENT, status.code());
+}
+
+TEST(BatchingSessionTest, OutputsShareTheBatchedOutputBuffer) {
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 4;
+  schedule_options.batch_timeout_micros = 0;
+  schedule_options.num_batch_threads = 1;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.allowed_batch_sizes = {1, 3, 4};
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(batch_size_capturing_session), &batching_session));
+
+  std::vector<Tensor> outputs;
+  TF_ASSERT_OK(batching_session->Run(
+      {{"x", test::AsTensor<float>({100.0f, 42.0f}, {2})}}, {"y"},
+      {} /* target nodes */, &outputs));
+  ASSERT_EQ(1, outputs.size());
+  test::ExpectTensorEqual<float>(test::AsTensor<float>({52.0f, 23.0f}, {2}),
+                                 outputs[0]);
+
+  // The padded batch has 3 rows. The task's 2 rows start at the beginning of
+  // the batched output, so they are handed back without a copy.
+  ASSERT_EQ(1, batch_size_capturing_session_raw->latest_outputs().size());
+  const Tensor& batched_output =
+      batch_size_capturing_session_raw->latest_outputs()[0];
+  EXPECT_EQ(3, batched_output.dim_size(0));
+  EXPECT_TRUE(outputs[0].SharesBufferWith(batched_output));
+}
+
 TEST(BatchingSessionTest, UnsortedAllowedBatchSizesRejected) {
   BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
   schedule_options.max_batch_size = 4;
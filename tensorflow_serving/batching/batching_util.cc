@@ -15,12 +15,14 @@ limitations under the License.
 
 #include "tensorflow_serving/batching/batching_util.h"
 
+#include <algorithm>
 #include <string>
 
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/framework/register_types.h"
 #include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/gtl/inlined_vector.h"
 
 
 namespace tensorflow {
@@ -150,6 +152,57 @@ Status PadTensorOfSpecificType(const Tensor& tensor,
   }
 }
 
+// Copies the block of 'src' spanning its dimensions 'dim' and up into the
+// block of 'dst' spanning the same dimensions, which is at least as large in
+// each of them, and fills the rest of the 'dst' block with 'pad_value'.
+// 'src_dims' and 'dst_dims' are the dimension sizes, and 'src_strides' and
+// 'dst_strides' the number of elements one step in each dimension spans.
+template <typename T>
+void CopyPaddedBlock(int dim, const T* src, T* dst,
+                     const gtl::InlinedVector<int64, 4>& src_dims,
+                     const gtl::InlinedVector<int64, 4>& dst_dims,
+                     const gtl::InlinedVector<int64, 4>& src_strides,
+                     const gtl::InlinedVector<int64, 4>& dst_strides,
+                     const T& pad_value) {
+  if (dim == src_dims.size() - 1) {
+    std::copy(src, src + src_dims[dim], dst);
+    std::fill(dst + src_dims[dim], dst + dst_dims[dim], pad_value);
+    return;
+  }
+  for (int64 i = 0; i < src_dims[dim]; ++i) {
+    CopyPaddedBlock(dim + 1, src + i * src_strides[dim],
+                    dst + i * dst_strides[dim], src_dims, dst_dims,
+                    src_strides, dst_strides, pad_value);
+  }
+  std::fill(dst + src_dims[dim] * dst_strides[dim],
+            dst + dst_dims[dim] * dst_strides[dim], pad_value);
+}
+
+template <typename T>
+void CopyPaddedRowsOfSpecificType(const Tensor& tensor, int64 first_row,
+                                  Tensor* batched_tensor) {
+  const int num_dims = tensor.dims();
+  gtl::InlinedVector<int64, 4> src_dims(num_dims), dst_dims(num_dims);
+  gtl::InlinedVector<int64, 4> src_strides(num_dims), dst_strides(num_dims);
+  int64 src_stride = 1, dst_stride = 1;
+  for (int i = num_dims - 1; i >= 0; --i) {
+    src_dims[i] = tensor.dim_size(i);
+    // The rows of 'batched_tensor' that don't belong to 'tensor' are left
+    // alone.
+    dst_dims[i] = i == 0 ? src_dims[i] : batched_tensor->dim_size(i);
+    src_strides[i] = src_stride;
+    dst_strides[i] = dst_stride;
+    src_stride *= src_dims[i];
+    dst_stride *= dst_dims[i];
+  }
+  const T* src = tensor.unaligned_flat<T>().data();
+  T* dst = batched_tensor->unaligned_flat<T>().data() +
+           first_row * dst_strides[0];
+  const T pad_value = tensor.NumElements() > 0 ? src[0] : T();
+  CopyPaddedBlock<T>(0, src, dst, src_dims, dst_dims, src_strides,
+                     dst_strides, pad_value);
+}
+
 std::map<string, std::vector<int>> CalculateMaxDimSizes(
      const std::vector<std::vector<std::pair<string, Tensor>>>& batch) {
   std::map<string, std::vector<int>> max_dim_sizes;
@@ -205,5 +258,57 @@ Status AddPadding(const Tensor& tensor,
 #undef CASE
   return padding_status;
 }
+
+Status CopyPaddedRows(const Tensor& tensor, int64 first_row,
+                      Tensor* batched_tensor) {
+  if (tensor.dtype() != batched_tensor->dtype() ||
+      tensor.dims() != batched_tensor->dims() || tensor.dims() < 1) {
+    return errors::InvalidArgument(
+        "Cannot copy a tensor of type ", DataTypeString(tensor.dtype()),
+        " and shape ", tensor.shape().DebugString(),
+        " into a batched tensor of type ",
+        DataTypeString(batched_tensor->dtype()), " and shape ",
+        batched_tensor->shape().DebugString());
+  }
+  if (first_row < 0 ||
+      first_row + tensor.dim_size(0) > batched_tensor->dim_size(0)) {
+    return errors::InvalidArgument("Rows [", first_row, ", ",
+                                   first_row + tensor.dim_size(0),
+                                   ") are out of the batched tensor's range");
+  }
+  bool needs_padding = false;
+  for (int i = 1; i < tensor.dims(); ++i) {
+    if (tensor.dim_size(i) > batched_tensor->dim_size(i)) {
+      return errors::InvalidArgument(
+          "Cannot copy a tensor of shape ", tensor.shape().DebugString(),
+          " into a smaller batched tensor of shape ",
+          batched_tensor->shape().DebugString());
+    }
+    needs_padding |= tensor.dim_size(i) < batched_tensor->dim_size(i);
+  }
+  if (needs_padding && tensor.dim_size(0) > 0 && tensor.NumElements() < 1) {
+    return errors::InvalidArgument(
+        "Got empty tensor in batch of non-empty tensors.");
+  }
+
+  Status copy_status;
+#define CASE(type)                                                         \
+  case DataTypeToEnum<type>::value: {                                      \
+    CopyPaddedRowsOfSpecificType<type>(tensor, first_row, batched_tensor); \
+    break;                                                                 \
+  }
+  switch (tensor.dtype()) {
+    TF_CALL_ALL_TYPES(CASE);
+    TF_CALL_QUANTIZED_TYPES(CASE);
+    // quantized types macro doesn't include these types
+    TF_CALL_quint16(CASE);
+    TF_CALL_qint16(CASE);
+    default:
+      copy_status = errors::InvalidArgument("Unsupported type");
+  }
+#undef CASE
+  return copy_status;
+}
+
 }  // namespace serving
 }  // namespace tensorflow
@@ -63,6 +63,20 @@ std::map<string, std::vector<int>> CalculateMaxDimSizes(
 
 Status AddPadding(const Tensor& tensor,
     const std::vector<int>& max_dim_sizes, Tensor* padded_tensor);
+
+// Copies 'tensor' into rows ['first_row', 'first_row' + tensor.dim_size(0)) of
+// 'batched_tensor', padding every other dimension up to its size in
+// 'batched_tensor' with the first element of 'tensor'. Produces the same rows
+// as AddPadding() followed by a concatenation into 'batched_tensor', but
+// writes each element once, with no intermediate padded tensor.
+//
+// 'batched_tensor' must have the dtype and rank of 'tensor', and no dimension
+// (other than the zeroth) smaller than that of 'tensor'. If padding is needed,
+// 'tensor' must not be empty.
+//
+// Supports the same datatypes as AddPadding(), at any rank of at least 1.
+Status CopyPaddedRows(const Tensor& tensor, int64 first_row,
+                      Tensor* batched_tensor);
 }  // namespace serving
 }  // namespace tensorflow
 #endif  // TENSORFLOW_SERVING_BATCHING_BATCHING_UTIL_H_
@@ -20,7 +20,9 @@ limitations under the License.
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/platform/types.h"
 
 namespace tensorflow {
@@ -75,6 +77,43 @@ TEST(BatchingUtilTest, AddPadding) {
   }
 }
 
+TEST(BatchingUtilTest, CopyPaddedRows) {
+  const Tensor tensor = test::AsTensor<int32>({1, 2, 3, 4}, {2, 2});
+  Tensor batched(DT_INT32, {4, 3});
+  batched.flat<int32>().setConstant(-1);
+  TF_ASSERT_OK(CopyPaddedRows(tensor, 1, &batched));
+  // Pads with the first element of the tensor, like AddPadding(), and leaves
+  // the other rows alone.
+  test::ExpectTensorEqual<int32>(
+      test::AsTensor<int32>({-1, -1, -1, 1, 2, 1, 3, 4, 1, -1, -1, -1},
+                            {4, 3}),
+      batched);
+}
+
+TEST(BatchingUtilTest, CopyPaddedRowsOfAllTypes) {
+  const std::vector<DataType> types {DT_FLOAT, DT_DOUBLE, DT_INT32, DT_UINT8,
+      DT_INT16, DT_UINT16, DT_INT8, DT_STRING, DT_COMPLEX64, DT_COMPLEX128,
+      DT_INT64, DT_BOOL, DT_QINT8, DT_QUINT8, DT_QINT16,
+      DT_QUINT16, DT_QINT32, DT_HALF, DT_RESOURCE};
+  for (DataType type : types) {
+    const Tensor tensor(type, {10, 20, 3, 2, 1, 1, 3});
+    Tensor batched(type, {25, 40, 3, 4, 1, 2, 3});
+    TF_EXPECT_OK(CopyPaddedRows(tensor, 15, &batched));
+  }
+}
+
+TEST(BatchingUtilTest, CopyPaddedRowsRejectsMismatchedTensors) {
+  const Tensor tensor(DT_FLOAT, {2, 3});
+  Tensor smaller(DT_FLOAT, {4, 2});
+  EXPECT_FALSE(CopyPaddedRows(tensor, 0, &smaller).ok());
+  Tensor too_few_rows(DT_FLOAT, {3, 3});
+  EXPECT_FALSE(CopyPaddedRows(tensor, 2, &too_few_rows).ok());
+  Tensor other_type(DT_INT32, {2, 3});
+  EXPECT_FALSE(CopyPaddedRows(tensor, 0, &other_type).ok());
+  Tensor other_rank(DT_FLOAT, {2, 3, 1});
+  EXPECT_FALSE(CopyPaddedRows(tensor, 0, &other_rank).ok());
+}
+
 TEST(BatchingUtilTest, AddPaddingTensorWithUnsupportedRank) {
   const std::vector<int> max_dim_sizes {20, 100, 200, 300, 400, 500, 600};
   const Tensor tensor(DT_FLOAT, {10, 20, 30, 40, 50, 60, 70});
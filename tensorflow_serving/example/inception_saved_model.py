@@ -36,6 +36,23 @@ tf.app.flags.DEFINE_integer('model_version', 1,
                             """Version number of the model.""")
 tf.app.flags.DEFINE_integer('image_size', 299,
                             """Needs to provide same value as in training.""")
+tf.app.flags.DEFINE_boolean('in_graph_batching', False,
+                            """Batch only the CNN inside the graph, so that """
+                            """JPEG decoding runs per request in parallel. """
+                            """Serve with --in_graph_batching.""")
+tf.app.flags.DEFINE_integer('num_batch_threads', 4,
+                            """Batches processed in parallel by the in-graph """
+                            """batching op.""")
+tf.app.flags.DEFINE_integer('max_batch_size', 32,
+                            """Largest batch formed by the in-graph """
+                            """batching op.""")
+tf.app.flags.DEFINE_integer('batch_timeout_micros', 5000,
+                            """How long the in-graph batching op waits for """
+                            """a batch to fill up.""")
+tf.app.flags.DEFINE_string('allowed_batch_sizes', '',
+                           """Comma-separated batch sizes the in-graph """
+                           """batching op pads batches to. The last one must """
+                           """equal --max_batch_size.""")
 FLAGS = tf.app.flags.FLAGS
 
 NUM_CLASSES = 1000
@@ -74,7 +91,7 @@ def export():
     images = tf.map_fn(preprocess_image, jpegs, dtype=tf.float32)
 
     # Run inference.
-    logits, _ = inception_model.inference(images, NUM_CLASSES + 1)
+    logits = inference(images)
 
     # Transform output to topK result.
     values, indices = tf.nn.top_k(logits, NUM_TOP_CLASSES)
@@ -168,6 +185,33 @@ def export():
       print 'Successfully exported model to %s' % FLAGS.output_dir
 
 
+def inference(images):
+  """Builds the CNN trunk on preprocessed images, and returns its logits.
+
+  With --in_graph_batching, the trunk is wrapped in Batch/Unbatch ops: the
+  images of concurrent requests are gathered into one batch for the trunk only,
+  while parsing and JPEG decoding stay per request and run in parallel.
+  """
+  def trunk(images):
+    logits, _ = inception_model.inference(images, NUM_CLASSES + 1)
+    return logits
+
+  if not FLAGS.in_graph_batching:
+    return trunk(images)
+  # Imported here so that exporting without in-graph batching does not need
+  # the batching ops library.
+  from tensorflow.contrib.batching.python.ops import batch_ops
+  allowed_batch_sizes = [
+      int(size) for size in FLAGS.allowed_batch_sizes.split(',') if size
+  ]
+  batched_trunk = batch_ops.batch_function(
+      num_batch_threads=FLAGS.num_batch_threads,
+      max_batch_size=FLAGS.max_batch_size,
+      batch_timeout_micros=FLAGS.batch_timeout_micros,
+      allowed_batch_sizes=allowed_batch_sizes)(trunk)
+  return batched_trunk(images)
+
+
 def preprocess_image(image_buffer):
   """Preprocess JPEG encoded bytes to 3D float Tensor."""
 
@@ -0,0 +1,328 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// An open-loop load generator for PredictionService.
+//
+// Requests are sent on a fixed schedule of inter-arrival gaps, replayed from a
+// trace or drawn from a synthetic arrival process, whether or not earlier
+// requests have completed. Latency is measured from each request's scheduled
+// send time, so a server (or client) that falls behind is charged for the
+// queueing it causes rather than hiding it.
+//
+// Example:
+//
+//   load_generator --server_port=localhost:9000 --image_file=cat.jpg \
+//       --arrival=poisson --rate=200 --num_requests=10000 --slo_ms=100
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "grpc++/create_channel.h"
+#include "grpc++/security/credentials.h"
+#include "grpc++/support/async_unary_call.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/histogram/histogram.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow/core/util/command_line_flags.h"
+#include "tensorflow_serving/apis/prediction_service.grpc.pb.h"
+#include "tensorflow_serving/util/arrival_schedule.h"
+
+using grpc::ClientContext;
+using grpc::CompletionQueue;
+
+using tensorflow::int64;
+using tensorflow::mutex;
+using tensorflow::mutex_lock;
+using tensorflow::string;
+using tensorflow::serving::PredictRequest;
+using tensorflow::serving::PredictResponse;
+using tensorflow::serving::PredictionService;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+int64 MicrosSince(Clock::time_point start, Clock::time_point end) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+      .count();
+}
+
+// Returns bucket limits, in microseconds, that grow by 1% from 1us to ~30
+// minutes, so that reported percentiles are within 1% of the true value.
+std::vector<double> LatencyBucketLimits() {
+  std::vector<double> limits;
+  for (double limit = 1; limit < 2e9; limit *= 1.01) {
+    limits.push_back(limit);
+  }
+  limits.push_back(DBL_MAX);
+  return limits;
+}
+
+// One request in flight.
+struct Call {
+  Clock::time_point scheduled_time;
+  ClientContext context;
+  PredictResponse response;
+  grpc::Status status;
+  std::unique_ptr<grpc::ClientAsyncResponseReader<PredictResponse>> reader;
+};
+
+// Outcome of a run, updated by the completion thread.
+struct Results {
+  mutex mu;
+  tensorflow::condition_variable all_done;
+  int64 in_flight GUARDED_BY(mu) = 0;
+  int64 num_ok GUARDED_BY(mu) = 0;
+  int64 num_within_slo GUARDED_BY(mu) = 0;
+  int64 num_errors GUARDED_BY(mu) = 0;
+  tensorflow::histogram::Histogram latency_micros GUARDED_BY(mu){
+      LatencyBucketLimits()};
+};
+
+// Drains 'cq' until it is shut down, recording the outcome of every call.
+void CompleteCalls(CompletionQueue* cq, int64 slo_micros, Results* results) {
+  void* tag;
+  bool ok;
+  while (cq->Next(&tag, &ok)) {
+    std::unique_ptr<Call> call(static_cast<Call*>(tag));
+    const int64 latency_micros =
+        MicrosSince(call->scheduled_time, Clock::now());
+    mutex_lock l(results->mu);
+    if (ok && call->status.ok()) {
+      ++results->num_ok;
+      if (slo_micros <= 0 || latency_micros <= slo_micros) {
+        ++results->num_within_slo;
+      }
+      results->latency_micros.Add(latency_micros);
+    } else {
+      ++results->num_errors;
+      if (results->num_errors <= 10) {
+        std::cerr << "Request failed: " << call->status.error_code() << ": "
+                  << call->status.error_message() << std::endl;
+      }
+    }
+    if (--results->in_flight == 0) {
+      results->all_done.notify_all();
+    }
+  }
+}
+
+tensorflow::Status BuildInterArrivals(const string& arrival,
+                                      const string& trace_file, double rate,
+                                      double burst_factor, int burst_size,
+                                      int num_requests, int64 seed,
+                                      std::vector<double>* gaps) {
+  if (arrival == "trace") {
+    if (trace_file.empty()) {
+      return tensorflow::errors::InvalidArgument(
+          "--arrival=trace requires --trace_file");
+    }
+    TF_RETURN_IF_ERROR(
+        tensorflow::serving::ReadInterArrivalTrace(trace_file, gaps));
+    if (gaps->empty()) {
+      return tensorflow::errors::InvalidArgument("Empty trace ", trace_file);
+    }
+    // Cycle through the trace if more requests were asked for.
+    const size_t trace_length = gaps->size();
+    for (int i = trace_length; i < num_requests; ++i) {
+      gaps->push_back((*gaps)[i % trace_length]);
+    }
+    if (num_requests > 0) gaps->resize(num_requests);
+    return tensorflow::Status::OK();
+  }
+  if (rate <= 0 || num_requests <= 0) {
+    return tensorflow::errors::InvalidArgument(
+        "--arrival=", arrival, " requires positive --rate and --num_requests");
+  }
+  if (arrival == "poisson") {
+    *gaps = tensorflow::serving::PoissonInterArrivals(rate, num_requests, seed);
+    return tensorflow::Status::OK();
+  }
+  if (arrival == "bursty") {
+    if (burst_factor < 1 || burst_size < 1) {
+      return tensorflow::errors::InvalidArgument(
+          "--arrival=bursty requires --burst_factor >= 1 and --burst_size "
+          ">= 1");
+    }
+    *gaps = tensorflow::serving::BurstyInterArrivals(
+        rate, burst_factor, burst_size, num_requests, seed);
+    return tensorflow::Status::OK();
+  }
+  return tensorflow::errors::InvalidArgument(
+      "Unknown --arrival ", arrival, "; expected trace, poisson or bursty");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  string server_port = "localhost:9000";
+  string image_file = "";
+  string model_name = "inception";
+  string model_signature_name = "predict_images";
+  string input_name = "images";
+  string arrival = "trace";
+  string trace_file = "";
+  float rate = 0;
+  float burst_factor = 10;
+  tensorflow::int32 burst_size = 10;
+  tensorflow::int32 num_requests = 0;
+  tensorflow::int32 max_in_flight = 10000;
+  tensorflow::int64 deadline_ms = 30000;
+  tensorflow::int64 slo_ms = 0;
+  tensorflow::int64 seed = 1;
+  std::vector<tensorflow::Flag> flag_list = {
+      tensorflow::Flag("server_port", &server_port,
+                       "the IP and port of the server"),
+      tensorflow::Flag("image_file", &image_file,
+                       "the path to the image sent with every request"),
+      tensorflow::Flag("model_name", &model_name, "name of model"),
+      tensorflow::Flag("model_signature_name", &model_signature_name,
+                       "name of model signature"),
+      tensorflow::Flag("input_name", &input_name,
+                       "name of the signature input fed with the image"),
+      tensorflow::Flag("arrival", &arrival,
+                       "arrival process: trace (replay --trace_file), "
+                       "poisson or bursty"),
+      tensorflow::Flag("trace_file", &trace_file,
+                       "inter-arrival gaps in seconds, as a .npy, .jsonl or "
+                       "text file"),
+      tensorflow::Flag("rate", &rate,
+                       "mean requests per second of synthetic arrivals"),
+      tensorflow::Flag("burst_factor", &burst_factor,
+                       "how many times faster than --rate requests arrive "
+                       "within a burst (bursty only)"),
+      tensorflow::Flag("burst_size", &burst_size,
+                       "requests per burst (bursty only)"),
+      tensorflow::Flag("num_requests", &num_requests,
+                       "requests to send; for trace replay, defaults to the "
+                       "trace length and cycles through the trace if larger"),
+      tensorflow::Flag("max_in_flight", &max_in_flight,
+                       "requests due while this many are outstanding are "
+                       "dropped and reported, rather than delayed"),
+      tensorflow::Flag("deadline_ms", &deadline_ms, "per-request deadline"),
+      tensorflow::Flag("slo_ms", &slo_ms,
+                       "if positive, goodput only counts requests that "
+                       "complete within this latency"),
+      tensorflow::Flag("seed", &seed, "seed of synthetic arrivals")};
+
+  string usage = tensorflow::Flags::Usage(argv[0], flag_list);
+  const bool parse_result = tensorflow::Flags::Parse(&argc, argv, flag_list);
+  if (!parse_result || image_file.empty()) {
+    std::cout << usage;
+    return -1;
+  }
+
+  std::vector<double> gaps;
+  const tensorflow::Status gaps_status =
+      BuildInterArrivals(arrival, trace_file, rate, burst_factor, burst_size,
+                         num_requests, seed, &gaps);
+  if (!gaps_status.ok()) {
+    std::cout << gaps_status << std::endl << usage;
+    return -1;
+  }
+
+  string image;
+  const tensorflow::Status read_status =
+      tensorflow::ReadFileToString(tensorflow::Env::Default(), image_file,
+                                   &image);
+  if (!read_status.ok()) {
+    std::cout << "Failed to read " << image_file << ": " << read_status
+              << std::endl;
+    return -1;
+  }
+  PredictRequest request;
+  request.mutable_model_spec()->set_name(model_name);
+  request.mutable_model_spec()->set_signature_name(model_signature_name);
+  tensorflow::TensorProto& proto = (*request.mutable_inputs())[input_name];
+  proto.set_dtype(tensorflow::DataType::DT_STRING);
+  proto.add_string_val(image);
+  proto.mutable_tensor_shape()->add_dim()->set_size(1);
+
+  std::unique_ptr<PredictionService::Stub> stub(PredictionService::NewStub(
+      grpc::CreateChannel(server_port, grpc::InsecureChannelCredentials())));
+  CompletionQueue cq;
+  Results results;
+  std::thread completion_thread(CompleteCalls, &cq, slo_ms * 1000, &results);
+
+  std::cout << "Sending " << gaps.size() << " requests to " << server_port
+            << " (" << arrival << " arrivals) ..." << std::endl;
+  int64 num_dropped = 0;
+  int64 max_send_lag_micros = 0;
+  const Clock::time_point start = Clock::now();
+  Clock::time_point scheduled_time = start;
+  for (const double gap : gaps) {
+    scheduled_time += std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(gap));
+    std::this_thread::sleep_until(scheduled_time);
+    max_send_lag_micros = std::max(
+        max_send_lag_micros, MicrosSince(scheduled_time, Clock::now()));
+    {
+      mutex_lock l(results.mu);
+      if (results.in_flight >= max_in_flight) {
+        ++num_dropped;
+        continue;
+      }
+      ++results.in_flight;
+    }
+    Call* call = new Call;
+    call->scheduled_time = scheduled_time;
+    call->context.set_deadline(std::chrono::system_clock::now() +
+                               std::chrono::milliseconds(deadline_ms));
+    call->reader = stub->AsyncPredict(&call->context, request, &cq);
+    call->reader->Finish(&call->response, &call->status, call);
+  }
+  const int64 send_micros = MicrosSince(start, Clock::now());
+  {
+    mutex_lock l(results.mu);
+    while (results.in_flight > 0) {
+      results.all_done.wait(l);
+    }
+  }
+  const int64 run_micros = MicrosSince(start, Clock::now());
+  cq.Shutdown();
+  completion_thread.join();
+
+  mutex_lock l(results.mu);
+  const double run_seconds = std::max<int64>(run_micros, 1) / 1e6;
+  std::cout << "requests: " << gaps.size() << std::endl
+            << "ok: " << results.num_ok << std::endl
+            << "errors: " << results.num_errors << std::endl
+            << "dropped: " << num_dropped << std::endl
+            << "offered_rps: " << gaps.size() / (send_micros / 1e6 + 1e-9)
+            << std::endl
+            << "throughput_rps: " << results.num_ok / run_seconds << std::endl
+            << "goodput_rps: " << results.num_within_slo / run_seconds
+            << std::endl
+            << "max_send_lag_ms: " << max_send_lag_micros / 1e3 << std::endl;
+  if (results.num_ok > 0) {
+    std::cout << "latency_mean_ms: " << results.latency_micros.Average() / 1e3
+              << std::endl;
+    for (const double percentile : {50.0, 90.0, 99.0, 99.9}) {
+      std::cout << "latency_p" << percentile << "_ms: "
+                << results.latency_micros.Percentile(percentile) / 1e3
+                << std::endl;
+    }
+    std::cout << "latency_max_ms: "
+              << results.latency_micros.Percentile(100) / 1e3 << std::endl;
+  }
+  return results.num_errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/admission_controller.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace tensorflow {
+namespace serving {
+
+Status AdmissionController::ParseMode(const string& name, Mode* mode) {
+  if (name == "passthrough") {
+    *mode = Mode::kPassthrough;
+  } else if (name == "trace-paced") {
+    *mode = Mode::kTracePaced;
+  } else if (name == "token-bucket") {
+    *mode = Mode::kTokenBucket;
+  } else {
+    return errors::InvalidArgument(
+        "Unknown admission mode \"", name,
+        "\"; expected passthrough, trace-paced or token-bucket");
+  }
+  return Status::OK();
+}
+
+Status AdmissionController::Create(
+    const Options& options, std::unique_ptr<AdmissionController>* controller) {
+  switch (options.mode) {
+    case Mode::kPassthrough:
+      break;
+    case Mode::kTracePaced:
+      if (options.inter_arrival_seconds.empty()) {
+        return errors::InvalidArgument(
+            "trace-paced admission requires an inter-arrival trace");
+      }
+      for (const double gap : options.inter_arrival_seconds) {
+        if (!(gap >= 0)) {
+          return errors::InvalidArgument("Negative inter-arrival gap ", gap);
+        }
+      }
+      break;
+    case Mode::kTokenBucket:
+      if (!(options.requests_per_second > 0) || options.burst_size < 1) {
+        return errors::InvalidArgument(
+            "token-bucket admission requires a positive rate and a burst "
+            "size of at least 1");
+      }
+      break;
+  }
+  if (options.max_delay_micros < 0) {
+    return errors::InvalidArgument("max_delay_micros must be non-negative");
+  }
+  controller->reset(new AdmissionController(options));
+  return Status::OK();
+}
+
+AdmissionController::AdmissionController(const Options& options)
+    : options_(options), tokens_(options.burst_size) {
+  if (options_.mode != Mode::kPassthrough) {
+    pacing_thread_.reset(options_.env->StartThread(
+        {}, "admission_pacing", [this]() { PacingLoop(); }));
+  }
+}
+
+AdmissionController::~AdmissionController() {
+  {
+    mutex_lock l(mu_);
+    stop_ = true;
+    held_cv_.notify_all();
+  }
+  // Joins the pacing thread, which fails the requests still held.
+  pacing_thread_.reset();
+}
+
+int64 AdmissionController::NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+Status AdmissionController::Reserve(int64 now_micros, int64* release_micros) {
+  mutex_lock l(mu_);
+  return ReserveLocked(now_micros, release_micros);
+}
+
+Status AdmissionController::ReserveLocked(int64 now_micros,
+                                          int64* release_micros) {
+  switch (options_.mode) {
+    case Mode::kPassthrough:
+      *release_micros = now_micros;
+      return Status::OK();
+
+    case Mode::kTracePaced: {
+      if (!trace_started_) {
+        trace_started_ = true;
+        trace_scheduled_micros_ = now_micros;
+      }
+      // The schedule advances even for rejected requests, so that a backlog
+      // does not shift the rest of the trace.
+      trace_scheduled_micros_ += static_cast<int64>(
+          options_.inter_arrival_seconds[next_gap_] * 1e6);
+      next_gap_ = (next_gap_ + 1) % options_.inter_arrival_seconds.size();
+      *release_micros = std::max(now_micros, trace_scheduled_micros_);
+      break;
+    }
+
+    case Mode::kTokenBucket: {
+      if (last_refill_micros_ >= 0 && now_micros > last_refill_micros_) {
+        tokens_ = std::min<double>(
+            options_.burst_size,
+            tokens_ + (now_micros - last_refill_micros_) *
+                          options_.requests_per_second / 1e6);
+      }
+      last_refill_micros_ = std::max(last_refill_micros_, now_micros);
+      const int64 wait_micros =
+          tokens_ >= 1 ? 0
+                       : static_cast<int64>(std::ceil(
+                             (1 - tokens_) * 1e6 /
+                             options_.requests_per_second));
+      if (options_.max_delay_micros > 0 &&
+          wait_micros > options_.max_delay_micros) {
+        return errors::Unavailable("Request would wait ", wait_micros,
+                                   " us for admission, over the limit of ",
+                                   options_.max_delay_micros, " us");
+      }
+      tokens_ -= 1;
+      *release_micros = now_micros + wait_micros;
+      return Status::OK();
+    }
+  }
+  if (options_.max_delay_micros > 0 &&
+      *release_micros - now_micros > options_.max_delay_micros) {
+    return errors::Unavailable("Request would wait ",
+                               *release_micros - now_micros,
+                               " us for admission, over the limit of ",
+                               options_.max_delay_micros, " us");
+  }
+  return Status::OK();
+}
+
+void AdmissionController::Admit(std::function<void(const Status&)> done) {
+  if (options_.mode == Mode::kPassthrough) {
+    done(Status::OK());
+    return;
+  }
+  const int64 now_micros = NowMicros();
+  Status status;
+  {
+    mutex_lock l(mu_);
+    int64 release_micros;
+    status = ReserveLocked(now_micros, &release_micros);
+    if (status.ok() && release_micros > now_micros) {
+      held_.emplace_back(release_micros, std::move(done));
+      held_cv_.notify_one();
+      return;
+    }
+  }
+  done(status);
+}
+
+void AdmissionController::PacingLoop() {
+  for (;;) {
+    std::function<void(const Status&)> done;
+    bool stopping;
+    {
+      mutex_lock l(mu_);
+      while (!stop_ && held_.empty()) {
+        held_cv_.wait(l);
+      }
+      if (held_.empty()) return;
+      stopping = stop_;
+      if (!stopping) {
+        const int64 wait_micros = held_.front().first - NowMicros();
+        if (wait_micros > 0) {
+          held_cv_.wait_for(l, std::chrono::microseconds(wait_micros));
+          continue;
+        }
+      }
+      done = std::move(held_.front().second);
+      held_.pop_front();
+    }
+    done(stopping ? errors::Unavailable("Admission controller is shutting down")
+                  : Status::OK());
+  }
+}
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,141 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_MODEL_SERVERS_ADMISSION_CONTROLLER_H_
+#define TENSORFLOW_SERVING_MODEL_SERVERS_ADMISSION_CONTROLLER_H_
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Decides when each incoming request may proceed to the predictor.
+//
+// Every request is given a release time on a monotonic clock, computed under a
+// lock in arrival order. Requests whose release time has already passed
+// proceed in-line; the others are held in a FIFO and released by a single
+// pacing thread when their time comes, so no serving thread sleeps. Release
+// times are non-decreasing in arrival order, so the FIFO is also ordered by
+// release time.
+//
+// Thread-safe.
+class AdmissionController {
+ public:
+  enum class Mode {
+    // Every request proceeds immediately.
+    kPassthrough,
+    // Requests are released on the schedule of a replayed inter-arrival trace:
+    // the i-th request is released no earlier than the sum of the first i+1
+    // gaps after the first request arrived. The trace is cycled.
+    kTracePaced,
+    // Requests are released at most at 'requests_per_second', with bursts of
+    // up to 'burst_size'.
+    kTokenBucket,
+  };
+
+  struct Options {
+    Mode mode = Mode::kPassthrough;
+
+    // kTracePaced: gaps between consecutive releases, in seconds.
+    std::vector<double> inter_arrival_seconds;
+
+    // kTokenBucket: the refill rate and capacity of the bucket.
+    double requests_per_second = 0;
+    int64 burst_size = 1;
+
+    // If positive, requests that would be held for longer than this are
+    // rejected with UNAVAILABLE instead.
+    int64 max_delay_micros = 0;
+
+    // The environment used to start the pacing thread.
+    Env* env = Env::Default();
+  };
+
+  // Parses "passthrough", "trace-paced" or "token-bucket".
+  static Status ParseMode(const string& name, Mode* mode);
+
+  static Status Create(const Options& options,
+                       std::unique_ptr<AdmissionController>* controller);
+
+  // Fails any requests still held with UNAVAILABLE.
+  ~AdmissionController();
+
+  // Admits one request. Calls 'done' with OK once the request may proceed, or
+  // with an error if it is rejected. 'done' runs in-line if the request is not
+  // held, and on the pacing thread otherwise; since it delays the release of
+  // later requests, it should hand the request off rather than process it.
+  // Callers must not block waiting for 'done': that holds their thread for as
+  // long as the request is held, which is what the pacing thread avoids.
+  void Admit(std::function<void(const Status&)> done);
+
+  // Computes the release time of a request arriving at 'now_micros' and
+  // accounts for it. Exposed for testing; Admit() calls it with NowMicros().
+  Status Reserve(int64 now_micros, int64* release_micros);
+
+  Mode mode() const { return options_.mode; }
+
+  // The monotonic clock used for release times.
+  static int64 NowMicros();
+
+ private:
+  explicit AdmissionController(const Options& options);
+
+  Status ReserveLocked(int64 now_micros, int64* release_micros)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Releases held requests when their time comes, until 'stop_' is set.
+  void PacingLoop();
+
+  const Options options_;
+
+  mutex mu_;
+
+  // kTracePaced: the scheduled release time of the previous request, and the
+  // index of the gap to the next one. Unset until the first request arrives.
+  bool trace_started_ GUARDED_BY(mu_) = false;
+  int64 trace_scheduled_micros_ GUARDED_BY(mu_) = 0;
+  size_t next_gap_ GUARDED_BY(mu_) = 0;
+
+  // kTokenBucket: the tokens available at 'last_refill_micros_'. Negative
+  // while requests are held waiting for tokens.
+  double tokens_ GUARDED_BY(mu_);
+  int64 last_refill_micros_ GUARDED_BY(mu_) = -1;
+
+  // Held requests, by non-decreasing release time.
+  std::deque<std::pair<int64, std::function<void(const Status&)>>> held_
+      GUARDED_BY(mu_);
+  condition_variable held_cv_;
+  bool stop_ GUARDED_BY(mu_) = false;
+
+  std::unique_ptr<Thread> pacing_thread_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(AdmissionController);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_MODEL_SERVERS_ADMISSION_CONTROLLER_H_
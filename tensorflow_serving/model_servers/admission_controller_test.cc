@@ -0,0 +1,194 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/admission_controller.h"
+
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+using Mode = AdmissionController::Mode;
+
+std::unique_ptr<AdmissionController> CreateController(
+    const AdmissionController::Options& options) {
+  std::unique_ptr<AdmissionController> controller;
+  TF_CHECK_OK(AdmissionController::Create(options, &controller));
+  return controller;
+}
+
+int64 Reserve(AdmissionController* controller, int64 now_micros) {
+  int64 release_micros;
+  TF_CHECK_OK(controller->Reserve(now_micros, &release_micros));
+  return release_micros;
+}
+
+TEST(AdmissionControllerTest, ParseMode) {
+  Mode mode;
+  TF_ASSERT_OK(AdmissionController::ParseMode("passthrough", &mode));
+  EXPECT_EQ(Mode::kPassthrough, mode);
+  TF_ASSERT_OK(AdmissionController::ParseMode("trace-paced", &mode));
+  EXPECT_EQ(Mode::kTracePaced, mode);
+  TF_ASSERT_OK(AdmissionController::ParseMode("token-bucket", &mode));
+  EXPECT_EQ(Mode::kTokenBucket, mode);
+  EXPECT_FALSE(AdmissionController::ParseMode("sleep", &mode).ok());
+}
+
+TEST(AdmissionControllerTest, InvalidOptions) {
+  std::unique_ptr<AdmissionController> controller;
+  AdmissionController::Options options;
+  options.mode = Mode::kTracePaced;
+  EXPECT_FALSE(AdmissionController::Create(options, &controller).ok());
+  options.inter_arrival_seconds = {0.1, -0.1};
+  EXPECT_FALSE(AdmissionController::Create(options, &controller).ok());
+
+  options = AdmissionController::Options();
+  options.mode = Mode::kTokenBucket;
+  EXPECT_FALSE(AdmissionController::Create(options, &controller).ok());
+  options.requests_per_second = 10;
+  options.burst_size = 0;
+  EXPECT_FALSE(AdmissionController::Create(options, &controller).ok());
+}
+
+TEST(AdmissionControllerTest, PassthroughAdmitsInline) {
+  std::unique_ptr<AdmissionController> controller =
+      CreateController(AdmissionController::Options());
+  bool admitted = false;
+  controller->Admit([&admitted](const Status& status) {
+    TF_EXPECT_OK(status);
+    admitted = true;
+  });
+  EXPECT_TRUE(admitted);
+  EXPECT_EQ(42, Reserve(controller.get(), 42));
+}
+
+TEST(AdmissionControllerTest, TracePacedFollowsTheTrace) {
+  AdmissionController::Options options;
+  options.mode = Mode::kTracePaced;
+  options.inter_arrival_seconds = {0.001, 0.002};
+  std::unique_ptr<AdmissionController> controller = CreateController(options);
+
+  // The schedule starts when the first request arrives and cycles through the
+  // trace.
+  EXPECT_EQ(1000 + 1000, Reserve(controller.get(), 1000));
+  EXPECT_EQ(1000 + 3000, Reserve(controller.get(), 1000));
+  EXPECT_EQ(1000 + 4000, Reserve(controller.get(), 1500));
+  EXPECT_EQ(1000 + 6000, Reserve(controller.get(), 1500));
+  // Requests arriving behind the schedule are released immediately, without
+  // shifting the schedule.
+  EXPECT_EQ(20000, Reserve(controller.get(), 20000));
+  EXPECT_EQ(20000, Reserve(controller.get(), 20000));
+  EXPECT_EQ(11000, Reserve(controller.get(), 5000));
+}
+
+TEST(AdmissionControllerTest, TokenBucketLimitsRate) {
+  AdmissionController::Options options;
+  options.mode = Mode::kTokenBucket;
+  options.requests_per_second = 1000;
+  options.burst_size = 2;
+  std::unique_ptr<AdmissionController> controller = CreateController(options);
+
+  // A burst of two goes through, then one request per millisecond.
+  EXPECT_EQ(0, Reserve(controller.get(), 0));
+  EXPECT_EQ(0, Reserve(controller.get(), 0));
+  EXPECT_EQ(1000, Reserve(controller.get(), 0));
+  EXPECT_EQ(2000, Reserve(controller.get(), 0));
+  EXPECT_EQ(3000, Reserve(controller.get(), 500));
+  // After an idle period the bucket is full again, but no fuller.
+  EXPECT_EQ(100000, Reserve(controller.get(), 100000));
+  EXPECT_EQ(100000, Reserve(controller.get(), 100000));
+  EXPECT_EQ(101000, Reserve(controller.get(), 100000));
+}
+
+TEST(AdmissionControllerTest, RejectsRequestsHeldTooLong) {
+  AdmissionController::Options options;
+  options.mode = Mode::kTokenBucket;
+  options.requests_per_second = 1000;
+  options.burst_size = 1;
+  options.max_delay_micros = 1500;
+  std::unique_ptr<AdmissionController> controller = CreateController(options);
+  EXPECT_EQ(0, Reserve(controller.get(), 0));
+  EXPECT_EQ(1000, Reserve(controller.get(), 0));
+  int64 release_micros;
+  const Status status = controller->Reserve(0, &release_micros);
+  EXPECT_EQ(error::UNAVAILABLE, status.code());
+  // The rejected request took no token.
+  EXPECT_EQ(2000, Reserve(controller.get(), 1000));
+
+  options = AdmissionController::Options();
+  options.mode = Mode::kTracePaced;
+  options.inter_arrival_seconds = {0.001};
+  options.max_delay_micros = 1500;
+  controller = CreateController(options);
+  EXPECT_EQ(1000, Reserve(controller.get(), 0));
+  EXPECT_EQ(2000, Reserve(controller.get(), 1000));
+  EXPECT_EQ(error::UNAVAILABLE,
+            controller->Reserve(1000, &release_micros).code());
+}
+
+TEST(AdmissionControllerTest, AdmitHoldsRequestsUntilTheirReleaseTime) {
+  AdmissionController::Options options;
+  options.mode = Mode::kTokenBucket;
+  options.requests_per_second = 20;
+  options.burst_size = 1;
+  std::unique_ptr<AdmissionController> controller = CreateController(options);
+
+  const int64 start_micros = AdmissionController::NowMicros();
+  Notification first_admitted;
+  controller->Admit([&first_admitted](const Status& status) {
+    TF_EXPECT_OK(status);
+    first_admitted.Notify();
+  });
+  EXPECT_TRUE(first_admitted.HasBeenNotified());
+
+  // The second request needs a token that arrives 50ms later; Admit() returns
+  // without waiting for it.
+  Notification second_admitted;
+  int64 second_admitted_micros = 0;
+  controller->Admit([&second_admitted,
+                     &second_admitted_micros](const Status& status) {
+    TF_EXPECT_OK(status);
+    second_admitted_micros = AdmissionController::NowMicros();
+    second_admitted.Notify();
+  });
+  EXPECT_FALSE(second_admitted.HasBeenNotified());
+  second_admitted.WaitForNotification();
+  EXPECT_GE(second_admitted_micros - start_micros, 50 * 1000);
+}
+
+TEST(AdmissionControllerTest, DestructionFailsHeldRequests) {
+  AdmissionController::Options options;
+  options.mode = Mode::kTracePaced;
+  options.inter_arrival_seconds = {3600};
+  std::unique_ptr<AdmissionController> controller = CreateController(options);
+  bool done = false;
+  Status status;
+  controller->Admit([&done, &status](const Status& s) {
+    done = true;
+    status = s;
+  });
+  EXPECT_FALSE(done);
+  controller.reset();
+  EXPECT_TRUE(done);
+  EXPECT_EQ(error::UNAVAILABLE, status.code());
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
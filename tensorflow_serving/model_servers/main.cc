@@ -42,13 +42,23 @@ limitations under the License.
 // To specify port (default 8500): --port=my_port
 // To enable batching (default disabled): --enable_batching
 // To override the default batching parameters: --batching_parameters_file
+// To serve models that batch in-graph with the Batch op: --in_graph_batching
+// To record per-request latencies to a CSV file: --latency_trace_file
+// To let the server tune its batching parameters against a p99 latency
+// target: --auto_tune_latency_target_micros
+//
+// Batching and thread-pool parameters can be changed while the server runs
+// through the ServerTuningService served on the same port.
 
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <memory>
 #include <utility>
 #include <vector>
 #include <fstream>
+#include <functional>
 #include <thread>
 
 #include "google/protobuf/wrappers.pb.h"
@@ -56,29 +66,41 @@ limitations under the License.
 #include "grpc++/server.h"
 #include "grpc++/server_builder.h"
 #include "grpc++/server_context.h"
+#include "grpc++/support/async_unary_call.h"
 #include "grpc++/support/status.h"
 #include "grpc++/support/status_code_enum.h"
 #include "grpc/grpc.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/cpu_info.h"
 #include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/init_main.h"
+#include "tensorflow/core/platform/mutex.h"
 #include "tensorflow/core/platform/protobuf.h"
 #include "tensorflow/core/platform/types.h"
 #include "tensorflow/core/protobuf/config.pb.h"
 #include "tensorflow/core/util/command_line_flags.h"
+#include "tensorflow/core/util/latency_trace.h"
+#include "tensorflow/core/util/parallelism_limits.h"
 #include "tensorflow_serving/apis/prediction_service.grpc.pb.h"
 #include "tensorflow_serving/apis/prediction_service.pb.h"
+#include "tensorflow_serving/apis/server_tuning_service.grpc.pb.h"
+#include "tensorflow_serving/apis/server_tuning_service.pb.h"
 #include "tensorflow_serving/config/model_server_config.pb.h"
 #include "tensorflow_serving/core/availability_preserving_policy.h"
+#include "tensorflow_serving/model_servers/admission_controller.h"
 #include "tensorflow_serving/model_servers/model_platform_types.h"
 #include "tensorflow_serving/model_servers/platform_config_util.h"
 #include "tensorflow_serving/model_servers/server_core.h"
+#include "tensorflow_serving/servables/tensorflow/bundle_factory_util.h"
 #include "tensorflow_serving/servables/tensorflow/classification_service.h"
 #include "tensorflow_serving/servables/tensorflow/get_model_metadata_impl.h"
 #include "tensorflow_serving/servables/tensorflow/multi_inference.h"
 #include "tensorflow_serving/servables/tensorflow/predict_impl.h"
 #include "tensorflow_serving/servables/tensorflow/regression_service.h"
 #include "tensorflow_serving/servables/tensorflow/session_bundle_config.pb.h"
+#include "tensorflow_serving/util/arrival_schedule.h"
 
 namespace grpc
 {
@@ -86,6 +108,7 @@ class ServerCompletionQueue;
 } // namespace grpc
 using tensorflow::string;
 using tensorflow::Tensor;
+using tensorflow::serving::AdmissionController;
 using tensorflow::serving::AspiredVersionPolicy;
 using tensorflow::serving::AspiredVersionsManager;
 using tensorflow::serving::AvailabilityPreservingPolicy;
@@ -94,6 +117,7 @@ using tensorflow::serving::EventBus;
 using tensorflow::serving::FileSystemStoragePathSourceConfig;
 using tensorflow::serving::GetModelMetadataImpl;
 using tensorflow::serving::ModelServerConfig;
+using tensorflow::serving::ModelSpec;
 using tensorflow::serving::ServableState;
 using tensorflow::serving::ServerCore;
 using tensorflow::serving::SessionBundleConfig;
@@ -117,6 +141,9 @@ using tensorflow::serving::PredictRequest;
 using tensorflow::serving::PredictResponse;
 using tensorflow::serving::RegressionRequest;
 using tensorflow::serving::RegressionResponse;
+using tensorflow::serving::ServerTuningService;
+using tensorflow::serving::UpdateServerParametersRequest;
+using tensorflow::serving::UpdateServerParametersResponse;
 
 namespace
 {
@@ -182,6 +209,26 @@ int DeadlineToTimeoutMillis(const gpr_timespec deadline)
                      gpr_now(GPR_CLOCK_MONOTONIC)));
 }
 
+// Sets up the RunOptions of a request from its gRPC deadline and ModelSpec.
+// Fails if the deadline has already passed, rather than letting the resulting
+// non-positive timeout read as "no timeout".
+tensorflow::Status CreateRunOptions(const gpr_timespec deadline,
+                                    const ModelSpec &model_spec,
+                                    tensorflow::RunOptions *run_options)
+{
+    // By default, the deadline is infinite which is the same default as
+    // RunOptions.
+    const int timeout_millis = DeadlineToTimeoutMillis(deadline);
+    if (timeout_millis <= 0)
+    {
+        return tensorflow::errors::DeadlineExceeded(
+            "The deadline of the request passed before it could be run");
+    }
+    run_options->set_timeout_in_ms(timeout_millis);
+    run_options->set_priority(model_spec.priority());
+    return tensorflow::Status::OK();
+}
+
 grpc::Status ToGRPCStatus(const tensorflow::Status &status)
 {
     const int kErrorMessageLimit = 1024;
@@ -202,88 +249,114 @@ grpc::Status ToGRPCStatus(const tensorflow::Status &status)
 class PredictionServiceImpl final : public PredictionService::Service
 {
   public:
-    explicit PredictionServiceImpl(std::unique_ptr<ServerCore> core,
-                                   bool use_saved_model)
+    // Predict requests go through 'admission_controller' before reaching the
+    // predictor. Requests that PredictAsync() held for admission proceed on
+    // 'num_admitted_predict_threads' threads of their own. If 'max_requests'
+    // is positive, 'max_requests_reached' is called once that many Predict
+    // requests have succeeded.
+    PredictionServiceImpl(std::unique_ptr<ServerCore> core,
+                          bool use_saved_model,
+                          std::unique_ptr<AdmissionController> admission_controller,
+                          int num_admitted_predict_threads,
+                          tensorflow::int64 max_requests,
+                          std::function<void()> max_requests_reached)
         : core_(std::move(core)),
           predictor_(new TensorflowPredictor(use_saved_model)),
-          use_saved_model_(use_saved_model)
-    {
-        std::fstream myfile("number_of_request.txt", std::ios_base::in);
-        myfile >> qy_total_request_count;
-        myfile.close();
-        myfile.clear();
-        myfile.open("interarrival_time_generated.txt", std::ios_base::in);
-        double number;
-        while(myfile >> number)
-            interarrival_time_generated.push_back(number);
-        myfile.close();
-    }
-    int qy_request_count = 0; //if this count
-    int qy_income_request_count = 0;
-    int qy_total_request_count;
-    double total_waiting_time=0;
-    std::vector<double>interarrival_time_generated;
+          use_saved_model_(use_saved_model),
+          admission_controller_(std::move(admission_controller)),
+          max_requests_(max_requests),
+          max_requests_reached_(std::move(max_requests_reached))
+    {
+        // Passthrough admission never holds a request, so its callback
+        // always runs in-line.
+        if (num_admitted_predict_threads > 0 &&
+            admission_controller_->mode() !=
+                AdmissionController::Mode::kPassthrough)
+        {
+            admitted_predict_threads_.reset(new tensorflow::thread::ThreadPool(
+                tensorflow::Env::Default(), "admitted_predict",
+                num_admitted_predict_threads));
+        }
+    }
+
     grpc::Status Predict(ServerContext *context, const PredictRequest *request,
                          PredictResponse *response) override
     {
-        total_waiting_time=total_waiting_time+interarrival_time_generated[qy_income_request_count];
-        std::chrono::duration<double> t_time(total_waiting_time);
-        qy_income_request_count++;
-        if (qy_income_request_count>=interarrival_time_generated.size())
+        // Holding a request would block this gRPC thread for the whole delay,
+        // so main() only allows pacing admission with PredictAsync(), and
+        // passthrough admission has nothing to do here.
+        DCHECK(admission_controller_->mode() ==
+               AdmissionController::Mode::kPassthrough);
+        tensorflow::RunOptions run_options = tensorflow::RunOptions();
+        const tensorflow::Status run_options_status = CreateRunOptions(
+            context->raw_deadline(), request->model_spec(), &run_options);
+        if (!run_options_status.ok())
         {
-            qy_income_request_count=qy_income_request_count-interarrival_time_generated.size();
+            return ToGRPCStatus(run_options_status);
         }
-        std::this_thread::sleep_for(t_time);
-        tensorflow::RunOptions run_options = tensorflow::RunOptions();
-        // By default, this is infinite which is the same default as RunOptions.
-        run_options.set_timeout_in_ms(
-            DeadlineToTimeoutMillis(context->raw_deadline()));
-        //run_options.set_timeout_in_ms(900000999);
-        //START
-        int64_t start_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
-        const grpc::Status status = ToGRPCStatus(
-            predictor_->Predict(run_options, core_.get(), *request, response));
-        int64_t end_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
-        Tensor::tensor_m.lock();
-        std::cout << "main.cc," << (end_time - start_time) << "," << qy_request_count << "," << qy_total_request_count << std::endl;
-        Tensor::tensor_m.unlock();
+        const bool trace_latency = tensorflow::latency_trace::IsEnabled();
+        const tensorflow::int64 start_micros =
+            trace_latency ? tensorflow::latency_trace::NowMicros() : 0;
+        return FinishPredict(
+            predictor_->Predict(run_options, core_.get(), *request, response),
+            trace_latency, start_micros);
+    }
 
-        //END
-        if (!status.ok())
+    // Like Predict(), but calls 'done' with the result instead of blocking the
+    // calling thread while the request is held for admission or waits for its
+    // batch. With batching enabled, 'done' runs on a batch thread.
+    void PredictAsync(ServerContext *context, const PredictRequest *request,
+                      PredictResponse *response,
+                      std::function<void(const grpc::Status &)> done)
+    {
         {
-            VLOG(1) << "Predict failed: " << status.error_message();
+            tensorflow::mutex_lock l(pending_mu_);
+            ++num_pending_async_predicts_;
         }
-        else
-        {
-            if (qy_request_count > 0)
+        auto finish = [this, done](const grpc::Status &status) {
+            done(status);
+            tensorflow::mutex_lock l(pending_mu_);
+            if (--num_pending_async_predicts_ == 0)
             {
-                std::ofstream outfile;
-                outfile.open("main.txt", std::ios_base::app);
-                if (outfile.fail())
-                    std::cout << errno;
-                std::cout << end_time - start_time << std::endl;
-                outfile << end_time - start_time << std::endl;
-                outfile.close();
-                outfile.open("main_start.txt", std::ios_base::app);
-                if (outfile.fail())
-                    std::cout << errno;
-                outfile << start_time << std::endl;
-                outfile.close();
-                outfile.open("main_end.txt", std::ios_base::app);
-                if (outfile.fail())
-                    std::cout << errno;
-                outfile << end_time << std::endl;
-                outfile.close();
+                pending_cv_.notify_all();
             }
-
-            qy_request_count++;
-            if (qy_request_count > qy_total_request_count)
+        };
+        admission_controller_->Admit([this, context, request, response,
+                                      finish](
+                                         const tensorflow::Status
+                                             &admission_status) {
+            if (!admission_status.ok())
             {
-                std::cout<<qy_request_count<<" is larger than "<<qy_total_request_count<<std::endl;
-                exit(0);
+                VLOG(1) << "Predict not admitted: "
+                        << admission_status.error_message();
+                finish(ToGRPCStatus(admission_status));
+                return;
             }
+            // A held request is released on the pacing thread, which must not
+            // be kept from releasing the next one by, e.g., a synchronous
+            // Session::Run() of an unbatched model.
+            if (admitted_predict_threads_ != nullptr)
+            {
+                admitted_predict_threads_->Schedule(
+                    [this, context, request, response, finish]() {
+                        StartPredict(context, request, response, finish);
+                    });
+            }
+            else
+            {
+                StartPredict(context, request, response, finish);
+            }
+        });
+    }
+
+    // Blocks until every call to PredictAsync() has called its 'done'.
+    void WaitForPendingPredicts()
+    {
+        tensorflow::mutex_lock l(pending_mu_);
+        while (num_pending_async_predicts_ > 0)
+        {
+            pending_cv_.wait(l);
         }
-        return status;
     }
 
     grpc::Status GetModelMetadata(ServerContext *context,
@@ -311,9 +384,12 @@ class PredictionServiceImpl final : public PredictionService::Service
                           ClassificationResponse *response) override
     {
         tensorflow::RunOptions run_options = tensorflow::RunOptions();
-        // By default, this is infinite which is the same default as RunOptions.
-        run_options.set_timeout_in_ms(
-            DeadlineToTimeoutMillis(context->raw_deadline()));
+        const tensorflow::Status run_options_status = CreateRunOptions(
+            context->raw_deadline(), request->model_spec(), &run_options);
+        if (!run_options_status.ok())
+        {
+            return ToGRPCStatus(run_options_status);
+        }
         const grpc::Status status =
             ToGRPCStatus(TensorflowClassificationServiceImpl::Classify(
                 run_options, core_.get(), *request, response));
@@ -329,9 +405,12 @@ class PredictionServiceImpl final : public PredictionService::Service
                          RegressionResponse *response) override
     {
         tensorflow::RunOptions run_options = tensorflow::RunOptions();
-        // By default, this is infinite which is the same default as RunOptions.
-        run_options.set_timeout_in_ms(
-            DeadlineToTimeoutMillis(context->raw_deadline()));
+        const tensorflow::Status run_options_status = CreateRunOptions(
+            context->raw_deadline(), request->model_spec(), &run_options);
+        if (!run_options_status.ok())
+        {
+            return ToGRPCStatus(run_options_status);
+        }
         const grpc::Status status =
             ToGRPCStatus(TensorflowRegressionServiceImpl::Regress(
                 run_options, core_.get(), *request, response));
@@ -346,10 +425,18 @@ class PredictionServiceImpl final : public PredictionService::Service
                                 const MultiInferenceRequest *request,
                                 MultiInferenceResponse *response) override
     {
+        // The tasks of a request run together, so they share the priority of
+        // the first one.
         tensorflow::RunOptions run_options = tensorflow::RunOptions();
-        // By default, this is infinite which is the same default as RunOptions.
-        run_options.set_timeout_in_ms(
-            DeadlineToTimeoutMillis(context->raw_deadline()));
+        const tensorflow::Status run_options_status = CreateRunOptions(
+            context->raw_deadline(),
+            request->tasks_size() > 0 ? request->tasks(0).model_spec()
+                                      : ModelSpec(),
+            &run_options);
+        if (!run_options_status.ok())
+        {
+            return ToGRPCStatus(run_options_status);
+        }
         const grpc::Status status = ToGRPCStatus(
             RunMultiInference(run_options, core_.get(), *request, response));
         if (!status.ok())
@@ -360,29 +447,368 @@ class PredictionServiceImpl final : public PredictionService::Service
     }
 
   private:
+    // Records and counts a finished Predict request and converts its status.
+    grpc::Status FinishPredict(const tensorflow::Status &predict_status,
+                               bool trace_latency,
+                               tensorflow::int64 start_micros)
+    {
+        const grpc::Status status = ToGRPCStatus(predict_status);
+        if (trace_latency)
+        {
+            tensorflow::latency_trace::Record(
+                {tensorflow::latency_trace::Source::kPredict, start_micros,
+                 tensorflow::latency_trace::NowMicros(),
+                 tensorflow::latency_trace::kNotMeasured,
+                 tensorflow::latency_trace::kNotMeasured});
+        }
+        if (!status.ok())
+        {
+            VLOG(1) << "Predict failed: " << status.error_message();
+        }
+        else if (max_requests_ > 0 &&
+                 num_succeeded_predicts_.fetch_add(1) + 1 == max_requests_)
+        {
+            LOG(INFO) << "Served " << max_requests_ << " Predict requests";
+            max_requests_reached_();
+        }
+        return status;
+    }
+
+    // The part of PredictAsync() after admission.
+    void StartPredict(ServerContext *context, const PredictRequest *request,
+                      PredictResponse *response,
+                      std::function<void(const grpc::Status &)> finish)
+    {
+        tensorflow::RunOptions run_options = tensorflow::RunOptions();
+        const tensorflow::Status run_options_status = CreateRunOptions(
+            context->raw_deadline(), request->model_spec(), &run_options);
+        if (!run_options_status.ok())
+        {
+            finish(ToGRPCStatus(run_options_status));
+            return;
+        }
+        const bool trace_latency = tensorflow::latency_trace::IsEnabled();
+        const tensorflow::int64 start_micros =
+            trace_latency ? tensorflow::latency_trace::NowMicros() : 0;
+        predictor_->PredictAsync(
+            run_options, core_.get(), *request, response,
+            [this, trace_latency, start_micros,
+             finish](const tensorflow::Status &status) {
+                finish(FinishPredict(status, trace_latency, start_micros));
+            });
+    }
+
     std::unique_ptr<ServerCore> core_;
     std::unique_ptr<TensorflowPredictor> predictor_;
     bool use_saved_model_;
+    const std::unique_ptr<AdmissionController> admission_controller_;
+    // Runs the admitted PredictAsync() requests that were held, if any.
+    std::unique_ptr<tensorflow::thread::ThreadPool> admitted_predict_threads_;
+    const tensorflow::int64 max_requests_;
+    const std::function<void()> max_requests_reached_;
+    std::atomic<tensorflow::int64> num_succeeded_predicts_{0};
+
+    tensorflow::mutex pending_mu_;
+    tensorflow::condition_variable pending_cv_;
+    tensorflow::int64 num_pending_async_predicts_ GUARDED_BY(pending_mu_) = 0;
 };
 
+// One pending or in-flight call served through a gRPC completion queue. The
+// call is used as the tag of its completion-queue operations.
+class AsyncCall
+{
+  public:
+    virtual ~AsyncCall() = default;
+
+    // Called on a completion-queue thread when the operation tagged with this
+    // call completes. 'ok' is false if the queue is shutting down.
+    virtual void Proceed(bool ok) = 0;
+};
+
+// A unary call of one PredictionService method. Waits for a call to arrive,
+// hands it to 'handler_fn' and sends the response once the handler calls its
+// 'done' argument, which it may do from any thread.
+template <typename Request, typename Response>
+class AsyncUnaryCall final : public AsyncCall
+{
+  public:
+    using RequestFn = std::function<void(
+        ServerContext *, Request *, grpc::ServerAsyncResponseWriter<Response> *,
+        grpc::ServerCompletionQueue *, void *)>;
+    using HandlerFn = std::function<void(
+        ServerContext *, const Request *, Response *,
+        std::function<void(const grpc::Status &)>)>;
+
+    // Starts waiting for the next call of the method on 'cq'. The call deletes
+    // itself once its response has been sent.
+    static void Start(RequestFn request_fn, HandlerFn handler_fn,
+                      grpc::ServerCompletionQueue *cq)
+    {
+        new AsyncUnaryCall(std::move(request_fn), std::move(handler_fn), cq);
+    }
+
+    void Proceed(bool ok) override
+    {
+        if (!ok || finishing_)
+        {
+            delete this;
+            return;
+        }
+        // Keep accepting calls of this method while this one is handled.
+        Start(request_fn_, handler_fn_, cq_);
+        finishing_ = true;
+        handler_fn_(&context_, &request_, &response_,
+                    [this](const grpc::Status &status) {
+                        responder_.Finish(response_, status, this);
+                    });
+    }
+
+  private:
+    AsyncUnaryCall(RequestFn request_fn, HandlerFn handler_fn,
+                   grpc::ServerCompletionQueue *cq)
+        : request_fn_(std::move(request_fn)),
+          handler_fn_(std::move(handler_fn)),
+          cq_(cq),
+          responder_(&context_)
+    {
+        request_fn_(&context_, &request_, &responder_, cq_, this);
+    }
+
+    const RequestFn request_fn_;
+    const HandlerFn handler_fn_;
+    grpc::ServerCompletionQueue *const cq_;
+    ServerContext context_;
+    Request request_;
+    Response response_;
+    grpc::ServerAsyncResponseWriter<Response> responder_;
+    // Whether the call has been handed to 'handler_fn_', i.e. the next
+    // completion is the one of Finish().
+    bool finishing_ = false;
+};
+
+// Wraps a synchronous PredictionServiceImpl method as an AsyncUnaryCall
+// handler.
+template <typename Request, typename Response>
+typename AsyncUnaryCall<Request, Response>::HandlerFn SyncHandler(
+    grpc::Status (PredictionServiceImpl::*method)(ServerContext *,
+                                                  const Request *, Response *),
+    PredictionServiceImpl *impl)
+{
+    return [method, impl](ServerContext *context, const Request *request,
+                          Response *response,
+                          std::function<void(const grpc::Status &)> done) {
+        done((impl->*method)(context, request, response));
+    };
+}
+
+// Waits for calls of every PredictionService method on 'cq' and processes
+// completion-queue events until the queue is shut down. Predict calls are
+// finished by the batching layer's completion callback; the other methods run
+// synchronously on the calling thread.
+void ServeAsyncPredictionService(PredictionService::AsyncService *service,
+                                 PredictionServiceImpl *impl,
+                                 grpc::ServerCompletionQueue *cq)
+{
+    AsyncUnaryCall<PredictRequest, PredictResponse>::Start(
+        [service](ServerContext *context, PredictRequest *request,
+                  grpc::ServerAsyncResponseWriter<PredictResponse> *responder,
+                  grpc::ServerCompletionQueue *cq, void *tag) {
+            service->RequestPredict(context, request, responder, cq, cq, tag);
+        },
+        [impl](ServerContext *context, const PredictRequest *request,
+               PredictResponse *response,
+               std::function<void(const grpc::Status &)> done) {
+            impl->PredictAsync(context, request, response, std::move(done));
+        },
+        cq);
+    AsyncUnaryCall<GetModelMetadataRequest, GetModelMetadataResponse>::Start(
+        [service](
+            ServerContext *context, GetModelMetadataRequest *request,
+            grpc::ServerAsyncResponseWriter<GetModelMetadataResponse> *responder,
+            grpc::ServerCompletionQueue *cq, void *tag) {
+            service->RequestGetModelMetadata(context, request, responder, cq, cq,
+                                             tag);
+        },
+        SyncHandler(&PredictionServiceImpl::GetModelMetadata, impl), cq);
+    AsyncUnaryCall<ClassificationRequest, ClassificationResponse>::Start(
+        [service](
+            ServerContext *context, ClassificationRequest *request,
+            grpc::ServerAsyncResponseWriter<ClassificationResponse> *responder,
+            grpc::ServerCompletionQueue *cq, void *tag) {
+            service->RequestClassify(context, request, responder, cq, cq, tag);
+        },
+        SyncHandler(&PredictionServiceImpl::Classify, impl), cq);
+    AsyncUnaryCall<RegressionRequest, RegressionResponse>::Start(
+        [service](ServerContext *context, RegressionRequest *request,
+                  grpc::ServerAsyncResponseWriter<RegressionResponse> *responder,
+                  grpc::ServerCompletionQueue *cq, void *tag) {
+            service->RequestRegress(context, request, responder, cq, cq, tag);
+        },
+        SyncHandler(&PredictionServiceImpl::Regress, impl), cq);
+    AsyncUnaryCall<MultiInferenceRequest, MultiInferenceResponse>::Start(
+        [service](
+            ServerContext *context, MultiInferenceRequest *request,
+            grpc::ServerAsyncResponseWriter<MultiInferenceResponse> *responder,
+            grpc::ServerCompletionQueue *cq, void *tag) {
+            service->RequestMultiInference(context, request, responder, cq, cq,
+                                           tag);
+        },
+        SyncHandler(&PredictionServiceImpl::MultiInference, impl), cq);
+
+    void *tag;
+    bool ok;
+    while (cq->Next(&tag, &ok))
+    {
+        static_cast<AsyncCall *>(tag)->Proceed(ok);
+    }
+}
+
+class ServerTuningServiceImpl final : public ServerTuningService::Service
+{
+  public:
+    grpc::Status UpdateServerParameters(
+        ServerContext *context, const UpdateServerParametersRequest *request,
+        UpdateServerParametersResponse *response) override
+    {
+        if (request->has_inter_op_parallelism_threads() &&
+            request->inter_op_parallelism_threads().value() < 0)
+        {
+            return ToGRPCStatus(tensorflow::errors::InvalidArgument(
+                "inter_op_parallelism_threads must be non-negative"));
+        }
+        if (request->has_intra_op_parallelism_threads() &&
+            request->intra_op_parallelism_threads().value() < 0)
+        {
+            return ToGRPCStatus(tensorflow::errors::InvalidArgument(
+                "intra_op_parallelism_threads must be non-negative"));
+        }
+
+        BatchingParameters batching_update;
+        if (request->has_max_batch_size())
+        {
+            *batching_update.mutable_max_batch_size() =
+                request->max_batch_size();
+        }
+        if (request->has_batch_timeout_micros())
+        {
+            *batching_update.mutable_batch_timeout_micros() =
+                request->batch_timeout_micros();
+        }
+        if (request->has_max_enqueued_batches())
+        {
+            *batching_update.mutable_max_enqueued_batches() =
+                request->max_enqueued_batches();
+        }
+        if (request->has_num_batch_threads())
+        {
+            *batching_update.mutable_num_batch_threads() =
+                request->num_batch_threads();
+        }
+        // Apply the batching update first: it is the only part that can be
+        // rejected after validation.
+        const grpc::Status status = ToGRPCStatus(
+            tensorflow::serving::UpdateBatchSchedulers(batching_update));
+        if (!status.ok())
+        {
+            VLOG(1) << "UpdateServerParameters failed: "
+                    << status.error_message();
+            return status;
+        }
+
+        if (request->has_inter_op_parallelism_threads())
+        {
+            tensorflow::SetInterOpParallelismOverride(
+                request->inter_op_parallelism_threads().value());
+        }
+        if (request->has_intra_op_parallelism_threads())
+        {
+            tensorflow::SetIntraOpParallelismLimit(
+                request->intra_op_parallelism_threads().value());
+        }
+        LOG(INFO) << "Updated server parameters: "
+                  << request->ShortDebugString();
+        return status;
+    }
+};
+
+// Serves the model server on 'port'. If 'async_threads' is positive,
+// PredictionService is served through that many gRPC completion-queue threads
+// rather than gRPC's synchronous thread pool. If 'max_requests' is positive,
+// the server shuts down once that many Predict requests have succeeded.
 void RunServer(int port, std::unique_ptr<ServerCore> core,
-               bool use_saved_model)
+               bool use_saved_model, int async_threads,
+               std::unique_ptr<AdmissionController> admission_controller,
+               tensorflow::int64 max_requests)
 {
     // "0.0.0.0" is the way to listen on localhost in gRPC.
 
     const string server_address = "0.0.0.0:" + std::to_string(port);
-    PredictionServiceImpl service(std::move(core), use_saved_model);
+    tensorflow::Notification max_requests_reached;
+    PredictionServiceImpl service(
+        std::move(core), use_saved_model, std::move(admission_controller),
+        async_threads, max_requests, [&max_requests_reached]() {
+            max_requests_reached.Notify();
+        });
+    PredictionService::AsyncService async_service;
+    ServerTuningServiceImpl tuning_service;
     ServerBuilder builder;
     std::shared_ptr<grpc::ServerCredentials> creds = InsecureServerCredentials();
     builder.AddListeningPort(server_address, creds);
-    builder.RegisterService(&service);
+    std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> completion_queues;
+    if (async_threads > 0)
+    {
+        builder.RegisterService(&async_service);
+        for (int i = 0; i < async_threads; ++i)
+        {
+            completion_queues.push_back(builder.AddCompletionQueue());
+        }
+    }
+    else
+    {
+        builder.RegisterService(&service);
+    }
+    builder.RegisterService(&tuning_service);
     builder.SetMaxMessageSize(tensorflow::kint32max);
     std::unique_ptr<Server> server(builder.BuildAndStart());
+    std::vector<std::thread> async_threads_pool;
+    for (const auto &cq : completion_queues)
+    {
+        grpc::ServerCompletionQueue *const queue = cq.get();
+        async_threads_pool.emplace_back([&async_service, &service, queue]() {
+            ServeAsyncPredictionService(&async_service, &service, queue);
+        });
+    }
+    // Shut down from a separate thread: Shutdown() waits for in-flight
+    // requests, including the one that reached the limit.
+    std::unique_ptr<std::thread> shutdown_thread;
+    if (max_requests > 0)
+    {
+        shutdown_thread.reset(
+            new std::thread([&max_requests_reached, &server]() {
+                max_requests_reached.WaitForNotification();
+                server->Shutdown();
+            }));
+    }
     LOG(INFO) << "Running ModelServer at " << server_address << " ...";
     std::ofstream outfile ("flag_server_initilized");
     outfile << "flag_server_initilized" << std::endl;
     outfile.close();
     server->Wait();
+    if (shutdown_thread != nullptr)
+    {
+        shutdown_thread->join();
+    }
+    // Predict calls still in the batching layer finish their RPC on the
+    // completion queues, so they must be done before the queues shut down.
+    service.WaitForPendingPredicts();
+    for (const auto &cq : completion_queues)
+    {
+        cq->Shutdown();
+    }
+    for (std::thread &thread : async_threads_pool)
+    {
+        thread.join();
+    }
 }
 
 // Parses an ascii PlatformConfigMap protobuf from 'file'.
@@ -402,10 +828,18 @@ int main(int argc, char **argv)
     tensorflow::int32 batch_size = 50;
     tensorflow::int32 inter_op = 10;
     tensorflow::int32 intra_op = 10;
+    tensorflow::int32 max_intra_op = 0;
     tensorflow::int32 batch_queue = 10;
     tensorflow::int32 batch_timeout = 1000000;
     tensorflow::int32 batch_threads = 1;
     bool enable_batching = false;
+    bool in_graph_batching = false;
+    bool numa_aware_batching = false;
+    bool speculative_batch_dispatch = false;
+    tensorflow::int32 pipeline_run_threads = 0;
+    tensorflow::int32 batch_size_per_intra_op_thread = 0;
+    bool plan_step_memory = false;
+    bool work_stealing_inter_op = false;
     float per_process_gpu_memory_fraction = 0;
     tensorflow::string batching_parameters_file;
     tensorflow::string model_name = "default";
@@ -417,15 +851,74 @@ int main(int argc, char **argv)
     tensorflow::int64 tensorflow_session_parallelism = 0;
     string platform_config_file = "";
     string model_config_file;
+    string latency_trace_file;
+    tensorflow::int64 auto_tune_latency_target_micros = 0;
+    tensorflow::int64 auto_tune_interval_micros = 1000 * 1000;
+    tensorflow::int32 async_predict_threads = 0;
+    string admission_mode = "passthrough";
+    string admission_trace_file;
+    float admission_rate = 0;
+    tensorflow::int64 admission_burst = 1;
+    tensorflow::int64 admission_max_delay_micros = 0;
+    tensorflow::int64 max_requests = 0;
+    tensorflow::int32 core_budget_cores = 0;
     std::vector<tensorflow::Flag> flag_list = {
         tensorflow::Flag("port", &port, "port to listen on"),
         tensorflow::Flag("batch_size", &batch_size, "Maximum Batch Size"),
         tensorflow::Flag("inter_op", &inter_op, "inter op"),
-        tensorflow::Flag("intra_op", &intra_op, "intra op"),
+        tensorflow::Flag("intra_op", &intra_op,
+                         "Number of threads in the intra-op pool. Only "
+                         "--max_intra_op and --core_budget_cores make the "
+                         "pool larger."),
+        tensorflow::Flag("max_intra_op", &max_intra_op,
+                         "If greater than --intra_op, size the intra-op pool "
+                         "to this many threads (-1 for all cores), so that "
+                         "ServerTuningService can raise "
+                         "intra_op_parallelism_threads up to it. Ops use at "
+                         "most --intra_op threads until then."),
         tensorflow::Flag("batch_queue", &batch_queue, "Max batch queue length"),
         tensorflow::Flag("batch_timeout", &batch_timeout, "Timeout wait for batching in microseconds"),
         tensorflow::Flag("batch_threads", &batch_threads, "Max number of parallel batches"),
         tensorflow::Flag("enable_batching", &enable_batching, "enable batching"),
+        tensorflow::Flag("in_graph_batching", &in_graph_batching,
+                         "If true, serve models whose graph batches with the "
+                         "Batch op without a batching session, even if "
+                         "--enable_batching is set. Models without the Batch "
+                         "op are unaffected."),
+        tensorflow::Flag("numa_aware_batching", &numa_aware_batching,
+                         "If true (and --enable_batching is set), spread the "
+                         "batch threads over the NUMA nodes of the host, "
+                         "allocate the batched tensors of each in its node's "
+                         "memory, and run each batch on an inter-op pool "
+                         "bound to that node. Can't be combined with "
+                         "--core_budget_cores."),
+        tensorflow::Flag("speculative_batch_dispatch",
+                         &speculative_batch_dispatch,
+                         "If true (and --enable_batching is set), dispatch "
+                         "underfull batches before --batch_timeout when the "
+                         "observed request rate predicts they would take "
+                         "longer to fill than to process."),
+        tensorflow::Flag("pipeline_run_threads", &pipeline_run_threads,
+                         "If positive (and --enable_batching is set), run "
+                         "batches on this many threads of their own, so "
+                         "that the batch threads merge the inputs of the "
+                         "next batches while the previous ones run."),
+        tensorflow::Flag("batch_size_per_intra_op_thread",
+                         &batch_size_per_intra_op_thread,
+                         "If positive (and --enable_batching is set), run "
+                         "each batch on at most one intra-op thread per this "
+                         "many rows."),
+        tensorflow::Flag("plan_step_memory", &plan_step_memory,
+                         "If true, plan the memory of each model's CPU "
+                         "outputs once and place them in one arena per "
+                         "step, instead of allocating every output on its "
+                         "own. Graphs with control flow are unaffected."),
+        tensorflow::Flag("work_stealing_inter_op", &work_stealing_inter_op,
+                         "If true, run the ops of all models on one "
+                         "work-stealing scheduler of --inter_op threads, "
+                         "which keeps the successors of an op on its thread "
+                         "and runs the steps that started first ahead of "
+                         "later ones."),
         tensorflow::Flag("batching_parameters_file", &batching_parameters_file,
                          "If non-empty, read an ascii BatchingParameters "
                          "protobuf from the supplied file name and use the "
@@ -458,6 +951,58 @@ int main(int argc, char **argv)
                          "from the supplied file name, and use that platform "
                          "config instead of the Tensorflow platform. (If used, "
                          "--enable_batching is ignored.)"),
+        tensorflow::Flag("latency_trace_file", &latency_trace_file,
+                         "If non-empty, record the start, end, queueing and "
+                         "compute time of every request to this CSV file. "
+                         "Recording is buffered per thread and written by a "
+                         "background thread."),
+        tensorflow::Flag("auto_tune_latency_target_micros",
+                         &auto_tune_latency_target_micros,
+                         "If positive (and --enable_batching is set), adjust "
+                         "max_batch_size, batch_timeout_micros and "
+                         "num_batch_threads while serving to keep the p99 "
+                         "latency of batched requests below this target."),
+        tensorflow::Flag("auto_tune_interval_micros",
+                         &auto_tune_interval_micros,
+                         "How often the batching auto-tuner re-evaluates the "
+                         "batching parameters."),
+        tensorflow::Flag("async_predict_threads", &async_predict_threads,
+                         "If positive, serve PredictionService through the "
+                         "gRPC completion-queue API with this many threads. "
+                         "Predict RPCs are then completed by the batching "
+                         "layer when their batch is done instead of holding a "
+                         "thread while they wait in the batching queue."),
+        tensorflow::Flag("admission_mode", &admission_mode,
+                         "How Predict requests are admitted: passthrough, "
+                         "trace-paced (released on the schedule of "
+                         "--admission_trace_file) or token-bucket (at most "
+                         "--admission_rate per second, in bursts of up to "
+                         "--admission_burst). The last two require "
+                         "--async_predict_threads."),
+        tensorflow::Flag("admission_trace_file", &admission_trace_file,
+                         "Inter-arrival gaps in seconds (.npy, .jsonl or "
+                         "whitespace-separated text, e.g. "
+                         "interarrival_time_generated.txt), for "
+                         "--admission_mode=trace-paced."),
+        tensorflow::Flag("admission_rate", &admission_rate,
+                         "Requests per second for "
+                         "--admission_mode=token-bucket."),
+        tensorflow::Flag("admission_burst", &admission_burst,
+                         "Burst size for --admission_mode=token-bucket."),
+        tensorflow::Flag("admission_max_delay_micros",
+                         &admission_max_delay_micros,
+                         "If positive, reject requests that would be held "
+                         "for admission longer than this."),
+        tensorflow::Flag("max_requests", &max_requests,
+                         "If positive, shut down after this many successful "
+                         "Predict requests."),
+        tensorflow::Flag("core_budget_cores", &core_budget_cores,
+                         "If non-zero (and --enable_batching is set), divide "
+                         "this many cores (-1 for all cores) between the "
+                         "batches processed concurrently: each batch thread "
+                         "gets its own inter-op pool, and the intra-op limit "
+                         "follows the number of batches in flight. Overrides "
+                         "--intra_op and --inter_op for batched requests."),
         tensorflow::Flag(
             "per_process_gpu_memory_fraction", &per_process_gpu_memory_fraction,
             "Fraction that each process occupies of the GPU memory space "
@@ -537,14 +1082,108 @@ int main(int argc, char **argv)
                 << "You supplied --batching_parameters_file without "
                    "--enable_batching";
         }
+        if (numa_aware_batching)
+        {
+            if (!enable_batching)
+            {
+                LOG(FATAL) // Crash ok
+                    << "You supplied --numa_aware_batching without "
+                       "--enable_batching";
+            }
+            session_bundle_config.mutable_batching_parameters()
+                ->set_numa_aware_batch_threads(true);
+        }
+        if (speculative_batch_dispatch)
+        {
+            if (!enable_batching)
+            {
+                LOG(FATAL) // Crash ok
+                    << "You supplied --speculative_batch_dispatch without "
+                       "--enable_batching";
+            }
+            session_bundle_config.mutable_batching_parameters()
+                ->set_enable_speculative_dispatch(true);
+        }
+        if (pipeline_run_threads != 0)
+        {
+            if (!enable_batching)
+            {
+                LOG(FATAL) // Crash ok
+                    << "You supplied --pipeline_run_threads without "
+                       "--enable_batching";
+            }
+            session_bundle_config.mutable_batching_parameters()
+                ->set_num_pipeline_run_threads(pipeline_run_threads);
+        }
+        if (batch_size_per_intra_op_thread != 0)
+        {
+            if (!enable_batching)
+            {
+                LOG(FATAL) // Crash ok
+                    << "You supplied --batch_size_per_intra_op_thread without "
+                       "--enable_batching";
+            }
+            session_bundle_config.mutable_batching_parameters()
+                ->set_batch_size_per_intra_op_thread(
+                    batch_size_per_intra_op_thread);
+        }
+        session_bundle_config.set_in_graph_batching(in_graph_batching);
+        if (auto_tune_latency_target_micros > 0)
+        {
+            if (!enable_batching)
+            {
+                LOG(FATAL) // Crash ok
+                    << "You supplied --auto_tune_latency_target_micros without "
+                       "--enable_batching";
+            }
+            session_bundle_config.mutable_batching_parameters()
+                ->set_auto_tune_latency_target_micros(
+                    auto_tune_latency_target_micros);
+            session_bundle_config.mutable_batching_parameters()
+                ->set_auto_tune_interval_micros(auto_tune_interval_micros);
+        }
 
         //session_bundle_config.mutable_session_config()
         //  ->mutable_gpu_options()
         //->set_per_process_gpu_memory_fraction(per_process_gpu_memory_fraction);
+        // The intra-op pool is fixed at startup, so leave ServerTuningService
+        // room to raise per-op parallelism only if --max_intra_op asks for
+        // it, and cap ops at --intra_op for now.
+        const tensorflow::int32 intra_op_pool_size =
+            max_intra_op < 0 ? tensorflow::port::NumSchedulableCPUs()
+                             : max_intra_op;
         session_bundle_config.mutable_session_config()
-            ->set_intra_op_parallelism_threads(intra_op);
+            ->set_intra_op_parallelism_threads(
+                std::max(intra_op, intra_op_pool_size));
+        if (intra_op_pool_size > intra_op)
+        {
+            tensorflow::SetIntraOpParallelismLimit(intra_op);
+        }
         session_bundle_config.mutable_session_config()
             ->set_inter_op_parallelism_threads(inter_op);
+        session_bundle_config.mutable_session_config()
+            ->mutable_graph_options()
+            ->set_plan_step_memory(plan_step_memory);
+        session_bundle_config.mutable_session_config()
+            ->set_use_work_stealing_inter_op_scheduler(work_stealing_inter_op);
+        if (core_budget_cores != 0)
+        {
+            if (!enable_batching)
+            {
+                LOG(FATAL) // Crash ok
+                    << "You supplied --core_budget_cores without "
+                       "--enable_batching";
+            }
+            if (work_stealing_inter_op)
+            {
+                LOG(FATAL) // Crash ok
+                    << "--work_stealing_inter_op can't be combined with "
+                       "--core_budget_cores, which runs each batch on an "
+                       "inter-op pool of its own";
+            }
+            session_bundle_config.mutable_batching_parameters()
+                ->set_core_budget_cores(core_budget_cores);
+        }
 
         options.platform_config_map = CreateTensorFlowPlatformConfigMap(
             session_bundle_config, use_saved_model);
@@ -560,9 +1199,39 @@ int main(int argc, char **argv)
         std::unique_ptr<AspiredVersionPolicy>(new AvailabilityPreservingPolicy);
     options.file_system_poll_wait_seconds = file_system_poll_wait_seconds;
 
+    if (!latency_trace_file.empty())
+    {
+        TF_CHECK_OK(tensorflow::latency_trace::Start(latency_trace_file));
+    }
+
+    AdmissionController::Options admission_options;
+    TF_CHECK_OK(AdmissionController::ParseMode(admission_mode,
+                                               &admission_options.mode));
+    if (admission_options.mode != AdmissionController::Mode::kPassthrough &&
+        async_predict_threads <= 0)
+    {
+        LOG(FATAL) // Crash ok
+            << "--admission_mode=" << admission_mode
+            << " needs --async_predict_threads, so that held requests don't "
+               "block serving threads";
+    }
+    if (!admission_trace_file.empty())
+    {
+        TF_CHECK_OK(tensorflow::serving::ReadInterArrivalTrace(
+            admission_trace_file, &admission_options.inter_arrival_seconds));
+    }
+    admission_options.requests_per_second = admission_rate;
+    admission_options.burst_size = admission_burst;
+    admission_options.max_delay_micros = admission_max_delay_micros;
+    std::unique_ptr<AdmissionController> admission_controller;
+    TF_CHECK_OK(
+        AdmissionController::Create(admission_options, &admission_controller));
+
     std::unique_ptr<ServerCore> core;
     TF_CHECK_OK(ServerCore::Create(std::move(options), &core));
-    RunServer(port, std::move(core), use_saved_model);
+    RunServer(port, std::move(core), use_saved_model, async_predict_threads,
+              std::move(admission_controller), max_requests);
+    tensorflow::latency_trace::Stop();
 
     return 0;
 }
@@ -15,11 +15,19 @@ limitations under the License.
 
 #include "tensorflow_serving/servables/tensorflow/bundle_factory_util.h"
 
+#include <algorithm>
+#include <utility>
+#include <vector>
+
 #include "google/protobuf/wrappers.pb.h"
 #include "tensorflow/contrib/batching/batch_scheduler.h"
+#include "tensorflow/core/framework/function.pb.h"
+#include "tensorflow/core/framework/node_def.pb.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/cpu_info.h"
 #include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mutex.h"
 #include "tensorflow/core/platform/types.h"
 #include "tensorflow_serving/resources/resource_values.h"
 #include "tensorflow_serving/servables/tensorflow/serving_session.h"
@@ -66,6 +74,202 @@ Status GetAllDescendants(const string& dirname, FileProbingEnv* env,
   return Status::OK();
 }
 
+// Returns an error unless 'max_batch_size' agrees with the last entry of
+// 'batching_config.allowed_batch_sizes' (if any).
+Status ValidateAllowedBatchSizes(const BatchingParameters& batching_config,
+                                 int64 max_batch_size) {
+  if (batching_config.allowed_batch_sizes().empty()) {
+    return Status::OK();
+  }
+  const int last_allowed_size = batching_config.allowed_batch_sizes(
+      batching_config.allowed_batch_sizes().size() - 1);
+  if (last_allowed_size != max_batch_size) {
+    return errors::InvalidArgument(
+        "Last entry in allowed_batch_sizes must match max_batch_size; last "
+        "entry was ",
+        last_allowed_size, "; expected ", max_batch_size);
+  }
+  return Status::OK();
+}
+
+// Returns the queue options requested by 'batching_config', with defaults for
+// any unset fields.
+Batcher::QueueOptions GetQueueOptions(
+    const BatchingParameters& batching_config) {
+  Batcher::QueueOptions queue_options;
+  if (batching_config.has_max_batch_size()) {
+    queue_options.max_batch_size = batching_config.max_batch_size().value();
+  }
+  if (batching_config.has_batch_timeout_micros()) {
+    queue_options.batch_timeout_micros =
+        batching_config.batch_timeout_micros().value();
+  }
+  if (batching_config.has_max_enqueued_batches()) {
+    queue_options.max_enqueued_batches =
+        batching_config.max_enqueued_batches().value();
+  }
+  if (batching_config.enable_large_batch_splitting()) {
+    queue_options.enable_large_batch_splitting = true;
+    queue_options.split_input_task_func = SplitInputTask;
+  }
+  queue_options.enable_speculative_dispatch =
+      batching_config.enable_speculative_dispatch();
+  return queue_options;
+}
+
+// A batch scheduler created by CreateBatchScheduler(), along with the
+// parameters it currently runs with.
+struct RegisteredBatcher {
+  std::weak_ptr<Batcher> batcher;
+  BatchingParameters batching_config;
+};
+
+// Every batch scheduler created by CreateBatchScheduler(), so that
+// UpdateBatchSchedulers() can reach them. Entries for schedulers that have
+// since been destroyed are pruned lazily.
+mutex* GetBatcherRegistryMutex() {
+  static mutex* mu = new mutex;
+  return mu;
+}
+
+std::vector<RegisteredBatcher>* GetBatcherRegistry() {
+  static std::vector<RegisteredBatcher>* registry =
+      new std::vector<RegisteredBatcher>;
+  return registry;
+}
+
+// Serializes UpdateBatchSchedulers(), which applies updates without holding
+// the registry mutex.
+mutex* GetBatcherUpdateMutex() {
+  static mutex* mu = new mutex;
+  return mu;
+}
+
+void RegisterBatcher(const BatchingParameters& batching_config,
+                     std::shared_ptr<Batcher> batcher) {
+  mutex_lock l(*GetBatcherRegistryMutex());
+  std::vector<RegisteredBatcher>* registry = GetBatcherRegistry();
+  registry->erase(std::remove_if(registry->begin(), registry->end(),
+                                 [](const RegisteredBatcher& entry) {
+                                   return entry.batcher.expired();
+                                 }),
+                  registry->end());
+  registry->push_back({batcher, batching_config});
+}
+
+// Returns the batching parameters the auto tuner adjusts, as set in
+// 'batching_config' or else their defaults.
+BatchingKnobs GetBatchingKnobs(const BatchingParameters& batching_config) {
+  BatchingKnobs knobs;
+  knobs.max_batch_size = GetQueueOptions(batching_config).max_batch_size;
+  knobs.batch_timeout_micros =
+      GetQueueOptions(batching_config).batch_timeout_micros;
+  knobs.num_batch_threads = batching_config.has_num_batch_threads()
+                                ? batching_config.num_batch_threads().value()
+                                : Batcher::Options().num_batch_threads;
+  return knobs;
+}
+
+// Applies 'update' to the live scheduler 'only', or to every live scheduler if
+// 'only' is null. See UpdateBatchSchedulers().
+Status UpdateRegisteredBatchers(const BatchingParameters& update,
+                                const Batcher* only) {
+  if (update.has_thread_pool_name() ||
+      !update.allowed_batch_sizes().empty() ||
+      update.pad_variable_length_inputs() ||
+      update.merge_inputs_incrementally() ||
+      update.enable_large_batch_splitting() ||
+      !update.length_bucket_boundaries().empty() ||
+      update.numa_aware_batch_threads() ||
+      update.enable_speculative_dispatch() ||
+      update.num_pipeline_run_threads() != 0 ||
+      update.pipeline_queue_capacity() != 0 ||
+      update.batch_size_per_intra_op_thread() != 0 ||
+      update.core_budget_cores() != 0 ||
+      update.auto_tune_latency_target_micros() != 0 ||
+      update.auto_tune_interval_micros() != 0) {
+    return errors::InvalidArgument(
+        "Only max_batch_size, batch_timeout_micros, max_enqueued_batches and "
+        "num_batch_threads can be changed at runtime");
+  }
+  if (update.has_max_batch_size() && update.max_batch_size().value() <= 0) {
+    return errors::InvalidArgument("max_batch_size must be positive; was ",
+                                   update.max_batch_size().value());
+  }
+  if (update.has_batch_timeout_micros() &&
+      update.batch_timeout_micros().value() < 0) {
+    return errors::InvalidArgument(
+        "batch_timeout_micros must be non-negative; was ",
+        update.batch_timeout_micros().value());
+  }
+  if (update.has_max_enqueued_batches() &&
+      update.max_enqueued_batches().value() < 0) {
+    return errors::InvalidArgument(
+        "max_enqueued_batches must be non-negative; was ",
+        update.max_enqueued_batches().value());
+  }
+  if (update.has_num_batch_threads() &&
+      update.num_batch_threads().value() < 1) {
+    return errors::InvalidArgument("num_batch_threads must be positive; was ",
+                                   update.num_batch_threads().value());
+  }
+
+  // Changing the number of batch threads starts or joins threads, so the
+  // updates are applied outside the registry mutex, which would otherwise
+  // hold up CreateBatchScheduler() and with it model loads.
+  mutex_lock update_lock(*GetBatcherUpdateMutex());
+  // Validate the update against every scheduler it applies to before changing
+  // any of them, so that a rejected update leaves all of them untouched.
+  std::vector<std::pair<std::shared_ptr<Batcher>, BatchingParameters>>
+      batchers;
+  {
+    mutex_lock l(*GetBatcherRegistryMutex());
+    for (const RegisteredBatcher& entry : *GetBatcherRegistry()) {
+      std::shared_ptr<Batcher> batcher = entry.batcher.lock();
+      if (batcher == nullptr) continue;
+      if (only != nullptr && batcher.get() != only) continue;
+      BatchingParameters merged_config = entry.batching_config;
+      merged_config.MergeFrom(update);
+      TF_RETURN_IF_ERROR(ValidateAllowedBatchSizes(
+          merged_config, GetQueueOptions(merged_config).max_batch_size));
+      batchers.emplace_back(std::move(batcher), std::move(merged_config));
+    }
+  }
+  if (only != nullptr && batchers.empty()) {
+    return errors::NotFound("The batch scheduler is no longer alive");
+  }
+
+  Status status;
+  size_t num_updated = 0;
+  for (; num_updated < batchers.size(); ++num_updated) {
+    Batcher* batcher = batchers[num_updated].first.get();
+    const BatchingParameters& merged_config = batchers[num_updated].second;
+    status = batcher->UpdateQueueOptions(GetQueueOptions(merged_config));
+    if (status.ok() && update.has_num_batch_threads()) {
+      status = batcher->SetNumBatchThreads(update.num_batch_threads().value());
+    }
+    if (!status.ok()) break;
+  }
+
+  // Record the parameters of the schedulers that took the update. Updates are
+  // serialized, so no other update has changed them meanwhile.
+  {
+    mutex_lock l(*GetBatcherRegistryMutex());
+    for (size_t i = 0; i < num_updated; ++i) {
+      for (RegisteredBatcher& entry : *GetBatcherRegistry()) {
+        if (entry.batcher.lock() == batchers[i].first) {
+          entry.batching_config = batchers[i].second;
+          break;
+        }
+      }
+    }
+  }
+  TF_RETURN_IF_ERROR(status);
+  LOG(INFO) << "Updated " << batchers.size()
+            << " batch scheduler(s) with: " << update.ShortDebugString();
+  return Status::OK();
+}
+
 }  // namespace
 
 SessionOptions GetSessionOptions(const SessionBundleConfig& config) {
@@ -86,20 +290,8 @@ RunOptions GetRunOptions(const SessionBundleConfig& config) {
 
 Status CreateBatchScheduler(const BatchingParameters& batching_config,
                             std::shared_ptr<Batcher>* batch_scheduler) {
-  if (!batching_config.allowed_batch_sizes().empty()) {
-    // Verify that the last allowed batch size matches the max batch size.
-    const int last_allowed_size = batching_config.allowed_batch_sizes(
-        batching_config.allowed_batch_sizes().size() - 1);
-    const int max_size = batching_config.has_max_batch_size()
-                             ? batching_config.max_batch_size().value()
-                             : Batcher::QueueOptions().max_batch_size;
-    if (last_allowed_size != max_size) {
-      return errors::InvalidArgument(
-          "Last entry in allowed_batch_sizes must match max_batch_size; last "
-          "entry was ",
-          last_allowed_size, "; expected ", max_size);
-    }
-  }
+  TF_RETURN_IF_ERROR(ValidateAllowedBatchSizes(
+      batching_config, GetQueueOptions(batching_config).max_batch_size));
 
   Batcher::Options options;
   if (batching_config.has_num_batch_threads()) {
@@ -108,7 +300,144 @@ Status CreateBatchScheduler(const BatchingParameters& batching_config,
   if (batching_config.has_thread_pool_name()) {
     options.thread_pool_name = batching_config.thread_pool_name().value();
   }
-  return Batcher::Create(options, batch_scheduler);
+  options.numa_aware = batching_config.numa_aware_batch_threads();
+  TF_RETURN_IF_ERROR(Batcher::Create(options, batch_scheduler));
+  RegisterBatcher(batching_config, *batch_scheduler);
+  return Status::OK();
+}
+
+Status UpdateBatchSchedulers(const BatchingParameters& update) {
+  return UpdateRegisteredBatchers(update, nullptr);
+}
+
+Status UpdateBatchScheduler(const Batcher& batch_scheduler,
+                            const BatchingParameters& update) {
+  return UpdateRegisteredBatchers(update, &batch_scheduler);
+}
+
+Status GetBatchSchedulerParameters(const Batcher& batch_scheduler,
+                                   BatchingParameters* batching_config) {
+  mutex_lock l(*GetBatcherRegistryMutex());
+  for (const RegisteredBatcher& entry : *GetBatcherRegistry()) {
+    if (entry.batcher.lock().get() == &batch_scheduler) {
+      *batching_config = entry.batching_config;
+      return Status::OK();
+    }
+  }
+  return errors::NotFound(
+      "The batch scheduler was not created by CreateBatchScheduler()");
+}
+
+Status CreateCoreBudget(const BatchingParameters& batching_config,
+                        ConfigProto* session_config,
+                        std::shared_ptr<CoreBudget>* core_budget) {
+  core_budget->reset();
+  if (batching_config.core_budget_cores() == 0) {
+    return Status::OK();
+  }
+  if (batching_config.numa_aware_batch_threads()) {
+    return errors::InvalidArgument(
+        "core_budget_cores can't be combined with numa_aware_batch_threads: "
+        "both pick the inter-op pool of each batch");
+  }
+  if (session_config->use_work_stealing_inter_op_scheduler()) {
+    return errors::InvalidArgument(
+        "core_budget_cores can't be combined with "
+        "use_work_stealing_inter_op_scheduler: the budget runs each batch on "
+        "an inter-op pool of its own");
+  }
+  CoreBudget::Options options;
+  options.num_cores = std::max<int64>(batching_config.core_budget_cores(), 0);
+  options.max_concurrent_batches = GetBatchingKnobs(batching_config)
+                                       .num_batch_threads;
+  std::unique_ptr<CoreBudget> budget;
+  TF_RETURN_IF_ERROR(CoreBudget::Create(options, &budget));
+  budget->ConfigureSession(session_config);
+  *core_budget = std::move(budget);
+  return Status::OK();
+}
+
+Status CreateBatchingAutoTuner(
+    const BatchingParameters& batching_config,
+    std::shared_ptr<Batcher> batch_scheduler,
+    std::shared_ptr<BatchingAutoTuner>* auto_tuner) {
+  auto_tuner->reset();
+  if (batching_config.auto_tune_latency_target_micros() <= 0) {
+    return Status::OK();
+  }
+  if (batch_scheduler == nullptr) {
+    return errors::InvalidArgument("The auto tuner needs a batch scheduler");
+  }
+  const BatchingKnobs initial_knobs = GetBatchingKnobs(batching_config);
+
+  LatencyTargetTuningPolicy::Options policy_options;
+  policy_options.target_latency_micros =
+      batching_config.auto_tune_latency_target_micros();
+  policy_options.max_max_batch_size = std::max<int64>(
+      policy_options.max_max_batch_size, initial_knobs.max_batch_size);
+  policy_options.max_num_batch_threads = std::max<int64>(
+      port::NumSchedulableCPUs(), initial_knobs.num_batch_threads);
+  if (!batching_config.allowed_batch_sizes().empty()) {
+    // max_batch_size must stay equal to the last allowed batch size.
+    policy_options.min_max_batch_size = initial_knobs.max_batch_size;
+    policy_options.max_max_batch_size = initial_knobs.max_batch_size;
+  }
+
+  BatchingAutoTuner::Options tuner_options;
+  if (batching_config.auto_tune_interval_micros() > 0) {
+    tuner_options.tuning_interval_micros =
+        batching_config.auto_tune_interval_micros();
+  }
+  // The tuner reads and updates only 'batch_scheduler', whose batches it is
+  // fed; it does not keep the scheduler alive.
+  const std::weak_ptr<Batcher> weak_batcher = batch_scheduler;
+  // Starts every step from the parameters in effect, which ServerTuningService
+  // may have changed.
+  tuner_options.read_fn = [weak_batcher](BatchingKnobs* knobs) {
+    std::shared_ptr<Batcher> batcher = weak_batcher.lock();
+    if (batcher == nullptr) {
+      return errors::NotFound("The batch scheduler is no longer alive");
+    }
+    BatchingParameters in_effect;
+    TF_RETURN_IF_ERROR(GetBatchSchedulerParameters(*batcher, &in_effect));
+    *knobs = GetBatchingKnobs(in_effect);
+    return Status::OK();
+  };
+  // Sends only the parameters that change, and leaves max_batch_size alone
+  // where allowed_batch_sizes pins it.
+  auto apply_fn = [weak_batcher](const BatchingKnobs& knobs) {
+    std::shared_ptr<Batcher> batcher = weak_batcher.lock();
+    if (batcher == nullptr) {
+      return errors::NotFound("The batch scheduler is no longer alive");
+    }
+    BatchingParameters in_effect;
+    TF_RETURN_IF_ERROR(GetBatchSchedulerParameters(*batcher, &in_effect));
+    const BatchingKnobs current = GetBatchingKnobs(in_effect);
+    BatchingParameters update;
+    if (knobs.max_batch_size != current.max_batch_size &&
+        in_effect.allowed_batch_sizes().empty()) {
+      update.mutable_max_batch_size()->set_value(knobs.max_batch_size);
+    }
+    if (knobs.batch_timeout_micros != current.batch_timeout_micros) {
+      update.mutable_batch_timeout_micros()->set_value(
+          knobs.batch_timeout_micros);
+    }
+    if (knobs.num_batch_threads != current.num_batch_threads) {
+      update.mutable_num_batch_threads()->set_value(knobs.num_batch_threads);
+    }
+    if (update.ByteSize() == 0) {
+      return Status::OK();
+    }
+    return UpdateBatchScheduler(*batcher, update);
+  };
+  std::unique_ptr<BatchingAutoTuner> tuner;
+  TF_RETURN_IF_ERROR(BatchingAutoTuner::Create(
+      tuner_options, initial_knobs,
+      std::unique_ptr<BatchingTuningPolicy>(
+          new LatencyTargetTuningPolicy(policy_options)),
+      apply_fn, &tuner));
+  *auto_tuner = std::move(tuner);
+  return Status::OK();
 }
 
 Status EstimateResourceFromPath(const string& path,
@@ -150,6 +479,17 @@ Status WrapSessionForBatching(const BatchingParameters& batching_config,
                               std::shared_ptr<Batcher> batch_scheduler,
                               const std::vector<SignatureDef>& signatures,
                               std::unique_ptr<Session>* session) {
+  return WrapSessionForBatching(batching_config, std::move(batch_scheduler),
+                                nullptr /* auto_tuner */,
+                                nullptr /* core_budget */, signatures, session);
+}
+
+Status WrapSessionForBatching(const BatchingParameters& batching_config,
+                              std::shared_ptr<Batcher> batch_scheduler,
+                              std::shared_ptr<BatchingAutoTuner> auto_tuner,
+                              std::shared_ptr<CoreBudget> core_budget,
+                              const std::vector<SignatureDef>& signatures,
+                              std::unique_ptr<Session>* session) {
   LOG(INFO) << "Wrapping session to perform batch processing";
 
   if (batch_scheduler == nullptr) {
@@ -158,26 +498,37 @@ Status WrapSessionForBatching(const BatchingParameters& batching_config,
   if (*session == nullptr) {
     return errors::Internal("session not set");
   }
-
-  Batcher::QueueOptions queue_options;
-  if (batching_config.has_max_batch_size()) {
-    queue_options.max_batch_size = batching_config.max_batch_size().value();
-  }
-  if (batching_config.has_batch_timeout_micros()) {
-    queue_options.batch_timeout_micros =
-        batching_config.batch_timeout_micros().value();
-  }
-  if (batching_config.has_max_enqueued_batches()) {
-    queue_options.max_enqueued_batches =
-        batching_config.max_enqueued_batches().value();
+  if (batching_config.merge_inputs_incrementally()) {
+    return errors::InvalidArgument(
+        "merge_inputs_incrementally is not supported with the shared batch "
+        "scheduler, which only hands out closed batches");
   }
 
+  const Batcher::QueueOptions queue_options = GetQueueOptions(batching_config);
+
   BatchingSessionOptions batching_session_options;
   for (int allowed_batch_size : batching_config.allowed_batch_sizes()) {
     batching_session_options.allowed_batch_sizes.push_back(allowed_batch_size);
   }
 
   batching_session_options.pad_variable_length_inputs = batching_config.pad_variable_length_inputs();
+  batching_session_options.merge_inputs_incrementally =
+      batching_config.merge_inputs_incrementally();
+  for (int64 boundary : batching_config.length_bucket_boundaries()) {
+    batching_session_options.length_bucket_boundaries.push_back(boundary);
+  }
+  batching_session_options.num_pipeline_run_threads =
+      batching_config.num_pipeline_run_threads();
+  if (batching_config.pipeline_queue_capacity() != 0) {
+    batching_session_options.pipeline_queue_capacity =
+        batching_config.pipeline_queue_capacity();
+  }
+  batching_session_options.batch_size_per_intra_op_thread =
+      batching_config.batch_size_per_intra_op_thread();
+  batching_session_options.numa_inter_op_thread_pools =
+      batching_config.numa_aware_batch_threads();
+  batching_session_options.auto_tuner = std::move(auto_tuner);
+  batching_session_options.core_budget = std::move(core_budget);
 
   auto create_queue = [batch_scheduler, queue_options](
       std::function<void(std::unique_ptr<Batch<BatchingSessionTask>>)>
@@ -206,5 +557,21 @@ Status WrapSession(std::unique_ptr<Session>* session) {
   return Status::OK();
 }
 
+bool HasInGraphBatching(const GraphDef& graph_def) {
+  for (const NodeDef& node : graph_def.node()) {
+    if (node.op() == "Batch") {
+      return true;
+    }
+  }
+  for (const FunctionDef& function : graph_def.library().function()) {
+    for (const NodeDef& node : function.node_def()) {
+      if (node.op() == "Batch") {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 }  // namespace serving
 }  // namespace tensorflow
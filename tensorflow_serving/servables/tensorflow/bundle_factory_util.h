@@ -16,7 +16,10 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_BUNDLE_FACTORY_UTIL_H_
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_BUNDLE_FACTORY_UTIL_H_
 
+#include "tensorflow/contrib/batching/batching_auto_tuner.h"
+#include "tensorflow/contrib/batching/core_budget.h"
 #include "tensorflow/contrib/batching/shared_batch_scheduler.h"
+#include "tensorflow/core/framework/graph.pb.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/protobuf/config.pb.h"
 #include "tensorflow/core/public/session.h"
@@ -45,6 +48,49 @@ Status CreateBatchScheduler(
     std::shared_ptr<SharedBatchScheduler<BatchingSessionTask>>*
         batch_scheduler);
 
+// Changes, at runtime, the parameters of every batch scheduler created by
+// CreateBatchScheduler() that is still alive. Only the fields set in 'update'
+// are changed, and only max_batch_size, batch_timeout_micros,
+// max_enqueued_batches and num_batch_threads may be set. Queue options apply to
+// all queues of a scheduler; servables loaded afterwards use the parameters in
+// their own config. Returns an error, and changes nothing, if the update is
+// invalid for any scheduler (e.g. if max_batch_size would no longer match the
+// last entry of its allowed_batch_sizes). Schedulers created from different
+// configs keep their differences in the fields 'update' does not set.
+Status UpdateBatchSchedulers(const BatchingParameters& update);
+
+// Like UpdateBatchSchedulers(), but changes only 'batch_scheduler', which must
+// have been created by CreateBatchScheduler().
+Status UpdateBatchScheduler(
+    const SharedBatchScheduler<BatchingSessionTask>& batch_scheduler,
+    const BatchingParameters& update);
+
+// Sets '*batching_config' to the parameters that 'batch_scheduler' runs with,
+// i.e. the config it was created from by CreateBatchScheduler() with the
+// updates since applied to it. Returns NOT_FOUND if it was not created by
+// CreateBatchScheduler().
+Status GetBatchSchedulerParameters(
+    const SharedBatchScheduler<BatchingSessionTask>& batch_scheduler,
+    BatchingParameters* batching_config);
+
+// Creates the core budget that 'batching_config.core_budget_cores' asks for,
+// to process the batches of the scheduler created from the same config, and
+// sets up 'session_config' for it (see CoreBudget::ConfigureSession()). Sets
+// '*core_budget' to nullptr, and leaves 'session_config' alone, if the config
+// asks for none.
+Status CreateCoreBudget(const BatchingParameters& batching_config,
+                        ConfigProto* session_config,
+                        std::shared_ptr<CoreBudget>* core_budget);
+
+// Creates the tuner that 'batching_config.auto_tune_latency_target_micros'
+// asks for, or sets '*auto_tuner' to nullptr if the config asks for none. The
+// tuner adjusts only 'batch_scheduler', created from the same config, starting
+// from the parameters it runs with.
+Status CreateBatchingAutoTuner(
+    const BatchingParameters& batching_config,
+    std::shared_ptr<SharedBatchScheduler<BatchingSessionTask>> batch_scheduler,
+    std::shared_ptr<BatchingAutoTuner>* auto_tuner);
+
 // Estimates the resources a session bundle or saved model bundle will use once
 // loaded, from its export or saved model path. tensorflow::Env::Default() will
 // be used to access the file system.
@@ -72,9 +118,26 @@ Status WrapSessionForBatching(
     const std::vector<SignatureDef>& signatures,
     std::unique_ptr<Session>* session);
 
+// Like above, but also reports the batches to 'auto_tuner' and processes them
+// under 'core_budget', if non-null. These come from CreateBatchingAutoTuner()
+// and CreateCoreBudget() for the same config, and the session must have been
+// created with the session config set up by the latter.
+Status WrapSessionForBatching(
+    const BatchingParameters& batching_config,
+    std::shared_ptr<SharedBatchScheduler<BatchingSessionTask>> batch_scheduler,
+    std::shared_ptr<BatchingAutoTuner> auto_tuner,
+    std::shared_ptr<CoreBudget> core_budget,
+    const std::vector<SignatureDef>& signatures,
+    std::unique_ptr<Session>* session);
+
 // Wraps a session in a new session that only supports Run() without batching.
 Status WrapSession(std::unique_ptr<Session>* session);
 
+// Returns true if 'graph_def' batches its own inputs with the in-graph Batch op
+// (see tensorflow/contrib/batching/ops/batch_ops.cc), either in the graph
+// itself or in one of its library functions.
+bool HasInGraphBatching(const GraphDef& graph_def);
+
 }  // namespace serving
 }  // namespace tensorflow
 
@@ -25,6 +25,7 @@ limitations under the License.
 #include <gtest/gtest.h>
 #include "tensorflow/contrib/batching/shared_batch_scheduler.h"
 #include "tensorflow/contrib/session_bundle/session_bundle.h"
+#include "tensorflow/core/framework/graph.pb.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/lib/io/path.h"
@@ -95,6 +96,23 @@ TEST_F(BundleFactoryUtilTest, WrapSession) {
   test_util::TestSingleRequest(bundle.session.get());
 }
 
+TEST_F(BundleFactoryUtilTest, HasInGraphBatching) {
+  GraphDef graph_def;
+  graph_def.add_node()->set_op("Placeholder");
+  EXPECT_FALSE(HasInGraphBatching(graph_def));
+
+  GraphDef batching_graph_def = graph_def;
+  batching_graph_def.add_node()->set_op("Batch");
+  EXPECT_TRUE(HasInGraphBatching(batching_graph_def));
+
+  GraphDef batching_function_graph_def = graph_def;
+  batching_function_graph_def.mutable_library()
+      ->add_function()
+      ->add_node_def()
+      ->set_op("Batch");
+  EXPECT_TRUE(HasInGraphBatching(batching_function_graph_def));
+}
+
 TEST_F(BundleFactoryUtilTest, WrapSessionForBatching) {
   // Create a SessionBundle.
   // TODO(b/32248363): use SavedModelBundle instead of SessionBundle when we
@@ -120,6 +138,24 @@ TEST_F(BundleFactoryUtilTest, WrapSessionForBatching) {
   test_util::TestMultipleRequests(10, bundle.session.get());
 }
 
+TEST_F(BundleFactoryUtilTest, WrapSessionForBatchingRejectsIncrementalMerge) {
+  SessionBundle bundle;
+  TF_ASSERT_OK(LoadSessionBundleFromPathUsingRunOptions(
+      SessionOptions(), RunOptions(), export_dir_, &bundle));
+
+  BatchingParameters batching_params;
+  batching_params.mutable_max_batch_size()->set_value(2);
+  batching_params.set_merge_inputs_incrementally(true);
+  std::shared_ptr<Batcher> batcher;
+  TF_ASSERT_OK(CreateBatchScheduler(batching_params, &batcher));
+
+  // The shared batch scheduler only hands out closed batches.
+  const Status status = WrapSessionForBatching(
+      batching_params, batcher, {test_util::GetTestSessionSignature()},
+      &bundle.session);
+  EXPECT_EQ(error::INVALID_ARGUMENT, status.code());
+}
+
 TEST_F(BundleFactoryUtilTest, BatchingConfigError) {
   BatchingParameters batching_params;
   batching_params.mutable_max_batch_size()->set_value(2);
@@ -131,6 +167,140 @@ TEST_F(BundleFactoryUtilTest, BatchingConfigError) {
   EXPECT_FALSE(CreateBatchScheduler(batching_params, &batch_scheduler).ok());
 }
 
+TEST_F(BundleFactoryUtilTest, UpdateBatchSchedulers) {
+  BatchingParameters batching_params;
+  batching_params.mutable_max_batch_size()->set_value(4);
+  batching_params.mutable_num_batch_threads()->set_value(2);
+  batching_params.add_allowed_batch_sizes(2);
+  batching_params.add_allowed_batch_sizes(4);
+  std::shared_ptr<SharedBatchScheduler<BatchingSessionTask>> batcher;
+  TF_ASSERT_OK(CreateBatchScheduler(batching_params, &batcher));
+  EXPECT_EQ(2, batcher->num_batch_threads());
+
+  BatchingParameters update;
+  update.mutable_num_batch_threads()->set_value(3);
+  update.mutable_batch_timeout_micros()->set_value(100);
+  TF_ASSERT_OK(UpdateBatchSchedulers(update));
+  EXPECT_EQ(3, batcher->num_batch_threads());
+  BatchingParameters in_effect;
+  TF_ASSERT_OK(GetBatchSchedulerParameters(*batcher, &in_effect));
+  EXPECT_EQ(4, in_effect.max_batch_size().value());
+  EXPECT_EQ(100, in_effect.batch_timeout_micros().value());
+  EXPECT_EQ(3, in_effect.num_batch_threads().value());
+  EXPECT_EQ(2, in_effect.allowed_batch_sizes_size());
+
+  // max_batch_size must keep matching the last allowed batch size.
+  BatchingParameters bad_max_batch_size;
+  bad_max_batch_size.mutable_max_batch_size()->set_value(8);
+  bad_max_batch_size.mutable_num_batch_threads()->set_value(1);
+  EXPECT_FALSE(UpdateBatchSchedulers(bad_max_batch_size).ok());
+  EXPECT_EQ(3, batcher->num_batch_threads());
+
+  BatchingParameters bad_field;
+  bad_field.mutable_thread_pool_name()->set_value("other_name");
+  EXPECT_FALSE(UpdateBatchSchedulers(bad_field).ok());
+  BatchingParameters bad_numa_field;
+  bad_numa_field.set_numa_aware_batch_threads(true);
+  EXPECT_FALSE(UpdateBatchSchedulers(bad_numa_field).ok());
+  BatchingParameters bad_speculative_field;
+  bad_speculative_field.set_enable_speculative_dispatch(true);
+  EXPECT_FALSE(UpdateBatchSchedulers(bad_speculative_field).ok());
+  BatchingParameters bad_pipeline_field;
+  bad_pipeline_field.set_num_pipeline_run_threads(2);
+  EXPECT_FALSE(UpdateBatchSchedulers(bad_pipeline_field).ok());
+  BatchingParameters bad_intra_op_field;
+  bad_intra_op_field.set_batch_size_per_intra_op_thread(4);
+  EXPECT_FALSE(UpdateBatchSchedulers(bad_intra_op_field).ok());
+  BatchingParameters bad_core_budget_field;
+  bad_core_budget_field.set_core_budget_cores(4);
+  EXPECT_FALSE(UpdateBatchSchedulers(bad_core_budget_field).ok());
+
+  // The update reaches every scheduler; each keeps the fields it does not set.
+  BatchingParameters other_params;
+  other_params.mutable_max_batch_size()->set_value(16);
+  std::shared_ptr<SharedBatchScheduler<BatchingSessionTask>> other_batcher;
+  TF_ASSERT_OK(CreateBatchScheduler(other_params, &other_batcher));
+  update.Clear();
+  update.mutable_batch_timeout_micros()->set_value(200);
+  TF_ASSERT_OK(UpdateBatchSchedulers(update));
+  TF_ASSERT_OK(GetBatchSchedulerParameters(*batcher, &in_effect));
+  EXPECT_EQ(4, in_effect.max_batch_size().value());
+  EXPECT_EQ(200, in_effect.batch_timeout_micros().value());
+  TF_ASSERT_OK(GetBatchSchedulerParameters(*other_batcher, &in_effect));
+  EXPECT_EQ(16, in_effect.max_batch_size().value());
+  EXPECT_EQ(200, in_effect.batch_timeout_micros().value());
+}
+
+TEST_F(BundleFactoryUtilTest, UpdateBatchScheduler) {
+  BatchingParameters batching_params;
+  batching_params.mutable_num_batch_threads()->set_value(2);
+  std::shared_ptr<SharedBatchScheduler<BatchingSessionTask>> batcher;
+  TF_ASSERT_OK(CreateBatchScheduler(batching_params, &batcher));
+  std::shared_ptr<SharedBatchScheduler<BatchingSessionTask>> other_batcher;
+  TF_ASSERT_OK(CreateBatchScheduler(batching_params, &other_batcher));
+
+  BatchingParameters update;
+  update.mutable_num_batch_threads()->set_value(3);
+  TF_ASSERT_OK(UpdateBatchScheduler(*batcher, update));
+  EXPECT_EQ(3, batcher->num_batch_threads());
+  EXPECT_EQ(2, other_batcher->num_batch_threads());
+  BatchingParameters in_effect;
+  TF_ASSERT_OK(GetBatchSchedulerParameters(*batcher, &in_effect));
+  EXPECT_EQ(3, in_effect.num_batch_threads().value());
+  TF_ASSERT_OK(GetBatchSchedulerParameters(*other_batcher, &in_effect));
+  EXPECT_EQ(2, in_effect.num_batch_threads().value());
+
+  // Only schedulers from CreateBatchScheduler() are known.
+  std::shared_ptr<SharedBatchScheduler<BatchingSessionTask>> unknown_batcher;
+  TF_ASSERT_OK(SharedBatchScheduler<BatchingSessionTask>::Create(
+      SharedBatchScheduler<BatchingSessionTask>::Options(), &unknown_batcher));
+  EXPECT_EQ(error::NOT_FOUND,
+            GetBatchSchedulerParameters(*unknown_batcher, &in_effect).code());
+  EXPECT_EQ(error::NOT_FOUND,
+            UpdateBatchScheduler(*unknown_batcher, update).code());
+}
+
+TEST_F(BundleFactoryUtilTest, CreateCoreBudget) {
+  BatchingParameters batching_params;
+  ConfigProto session_config;
+  session_config.set_intra_op_parallelism_threads(1);
+  std::shared_ptr<CoreBudget> core_budget;
+  TF_ASSERT_OK(
+      CreateCoreBudget(batching_params, &session_config, &core_budget));
+  EXPECT_EQ(nullptr, core_budget);
+  EXPECT_EQ(0, session_config.session_inter_op_thread_pool_size());
+
+  batching_params.mutable_num_batch_threads()->set_value(2);
+  batching_params.set_core_budget_cores(4);
+  TF_ASSERT_OK(
+      CreateCoreBudget(batching_params, &session_config, &core_budget));
+  ASSERT_NE(nullptr, core_budget);
+  EXPECT_EQ(4, core_budget->num_cores());
+  EXPECT_EQ(2, core_budget->max_concurrent_batches());
+  EXPECT_EQ(2, session_config.session_inter_op_thread_pool_size());
+  EXPECT_EQ(4, session_config.intra_op_parallelism_threads());
+
+  // The budget needs an inter-op pool per batch.
+  session_config.set_use_work_stealing_inter_op_scheduler(true);
+  EXPECT_FALSE(
+      CreateCoreBudget(batching_params, &session_config, &core_budget).ok());
+}
+
+TEST_F(BundleFactoryUtilTest, CreateBatchingAutoTuner) {
+  BatchingParameters batching_params;
+  std::shared_ptr<SharedBatchScheduler<BatchingSessionTask>> batcher;
+  TF_ASSERT_OK(CreateBatchScheduler(batching_params, &batcher));
+  std::shared_ptr<BatchingAutoTuner> auto_tuner;
+  TF_ASSERT_OK(CreateBatchingAutoTuner(batching_params, batcher, &auto_tuner));
+  EXPECT_EQ(nullptr, auto_tuner);
+
+  batching_params.set_auto_tune_latency_target_micros(10 * 1000);
+  TF_ASSERT_OK(CreateBatchingAutoTuner(batching_params, batcher, &auto_tuner));
+  EXPECT_NE(nullptr, auto_tuner);
+  EXPECT_FALSE(
+      CreateBatchingAutoTuner(batching_params, nullptr, &auto_tuner).ok());
+}
+
 TEST_F(BundleFactoryUtilTest, EstimateResourceFromPathWithBadExport) {
   ResourceAllocation resource_requirement;
   const Status status =
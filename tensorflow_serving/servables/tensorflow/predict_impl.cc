@@ -15,6 +15,7 @@ limitations under the License.
 
 #include "tensorflow_serving/servables/tensorflow/predict_impl.h"
 
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <string>
@@ -27,8 +28,11 @@ limitations under the License.
 #include "tensorflow/contrib/session_bundle/signature.h"
 #include "tensorflow/core/framework/tensor.pb.h"
 #include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/macros.h"
 #include "tensorflow/core/protobuf/named_tensor.pb.h"
 #include "tensorflow_serving/core/servable_handle.h"
+#include "tensorflow_serving/servables/tensorflow/serving_session.h"
 
 namespace tensorflow {
 namespace serving {
@@ -130,103 +134,92 @@ Status SessionBundlePredict(const RunOptions& run_options, ServerCore* core,
   return Status::OK();
 }
 
-// Returns the keys in the map as a comma delimited string. Useful for debugging
-// or when returning error messages.
-// e.g. returns "key1, key2, key3".
-string MapKeysToString(const google::protobuf::Map<string, tensorflow::TensorInfo>& map) {
-  string result = "";
-  for (const auto& i : map) {
-    if (result.empty()) {
-      result += i.first;
-    } else {
-      result += ", " + i.first;
-    }
-  }
-  return result;
-}
+// The arguments and results of the Session::Run() call for a SavedModel
+// Predict request. Asynchronous calls keep it alive until the session is done
+// with it.
+struct PredictCall {
+  PredictCall() = default;
 
-// Validate a SignatureDef to make sure it's compatible with prediction, and
-// if so, populate the input and output tensor names.
-Status PreProcessPrediction(const SignatureDef& signature,
-                            const PredictRequest& request,
-                            std::vector<std::pair<string, Tensor>>* inputs,
-                            std::vector<string>* output_tensor_names,
-                            std::vector<string>* output_tensor_aliases) {
-  if (signature.method_name() != kPredictMethodName &&
-      signature.method_name() != kClassifyMethodName &&
-      signature.method_name() != kRegressMethodName) {
-    return errors::Internal(strings::StrCat(
-        "Expected prediction signature method_name to be one of {",
-        kPredictMethodName, ", ", kClassifyMethodName, ", ", kRegressMethodName,
-        "}. Was: ", signature.method_name()));
-  }
-  if (signature.inputs().empty()) {
-    return errors::Internal(strings::StrCat(
-        "Expected at least one input Tensor in prediction signature."));
-  }
-  if (signature.outputs().empty()) {
-    return errors::Internal(strings::StrCat(
-        "Expected at least one output Tensor in prediction signature."));
-  }
+  // The plan of the requested signature.
+  std::shared_ptr<const PredictSignaturePlan> plan;
+
+  std::vector<std::pair<string, Tensor>> input_tensors;
+
+  // The outputs to fetch. These point into 'plan' unless the request has an
+  // output filter, in which case they point to the 'filtered_' vectors below.
+  const std::vector<string>* output_tensor_names = nullptr;
+  const std::vector<string>* output_tensor_aliases = nullptr;
+  std::vector<string> filtered_output_tensor_names;
+  std::vector<string> filtered_output_tensor_aliases;
+
+  std::vector<string> target_node_names;
+  std::vector<Tensor> outputs;
+  RunMetadata run_metadata;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(PredictCall);
+};
+
+// Validates 'request' against 'call->plan', and if it is valid, populates the
+// inputs and outputs of 'call'.
+Status PreProcessPrediction(const PredictRequest& request, PredictCall* call) {
+  const PredictSignaturePlan& plan = *call->plan;
 
   // Verify and prepare input.
-  if (request.inputs().size() != signature.inputs().size()) {
+  if (request.inputs().size() != plan.input_tensor_names.size()) {
     return tensorflow::Status(tensorflow::error::INVALID_ARGUMENT,
                               "input size does not match signature");
   }
+  call->input_tensors.reserve(request.inputs().size());
   for (auto& input : request.inputs()) {
     const string& alias = input.first;
-    auto iter = signature.inputs().find(alias);
-    if (iter == signature.inputs().end()) {
+    auto iter = plan.input_tensor_names.find(alias);
+    if (iter == plan.input_tensor_names.end()) {
       return tensorflow::Status(
           tensorflow::error::INVALID_ARGUMENT,
           strings::StrCat("input tensor alias not found in signature: ", alias,
                           ". Inputs expected to be in the set {",
-                          MapKeysToString(signature.inputs()), "}."));
+                          plan.input_aliases_string, "}."));
     }
-    Tensor tensor;
-    if (!tensor.FromProto(input.second)) {
+    call->input_tensors.emplace_back(iter->second, Tensor());
+    if (!call->input_tensors.back().second.FromProto(input.second)) {
       return tensorflow::Status(tensorflow::error::INVALID_ARGUMENT,
                                 "tensor parsing error: " + alias);
     }
-    inputs->emplace_back(std::make_pair(iter->second.name(), tensor));
   }
 
-  // Prepare run target.
-  std::set<string> seen_outputs;
-  std::vector<string> output_filter(request.output_filter().begin(),
-                                    request.output_filter().end());
-  for (auto& alias : output_filter) {
-    auto iter = signature.outputs().find(alias);
-    if (iter == signature.outputs().end()) {
+  // Prepare run target. When no output is specified, fetch all output tensors
+  // specified in the signature.
+  if (request.output_filter().empty()) {
+    call->output_tensor_names = &plan.all_output_tensor_names;
+    call->output_tensor_aliases = &plan.all_output_tensor_aliases;
+    return Status::OK();
+  }
+  for (const string& alias : request.output_filter()) {
+    auto iter = plan.output_tensor_names.find(alias);
+    if (iter == plan.output_tensor_names.end()) {
       return tensorflow::Status(
           tensorflow::error::INVALID_ARGUMENT,
           strings::StrCat("output tensor alias not found in signature: ", alias,
                           " Outputs expected to be in the set {",
-                          MapKeysToString(signature.outputs()), "}."));
+                          plan.output_aliases_string, "}."));
     }
-    if (seen_outputs.find(alias) != seen_outputs.end()) {
+    // Output filters are short, so a linear scan is cheaper than a set.
+    if (std::find(call->filtered_output_tensor_aliases.begin(),
+                  call->filtered_output_tensor_aliases.end(),
+                  alias) != call->filtered_output_tensor_aliases.end()) {
       return tensorflow::Status(tensorflow::error::INVALID_ARGUMENT,
                                 "duplicate output tensor alias: " + alias);
     }
-    seen_outputs.insert(alias);
-    output_tensor_names->emplace_back(iter->second.name());
-    output_tensor_aliases->emplace_back(alias);
-  }
-  // When no output is specified, fetch all output tensors specified in
-  // the signature.
-  if (output_tensor_names->empty()) {
-    for (auto& iter : signature.outputs()) {
-      output_tensor_names->emplace_back(iter.second.name());
-      output_tensor_aliases->emplace_back(iter.first);
-    }
+    call->filtered_output_tensor_names.push_back(iter->second);
+    call->filtered_output_tensor_aliases.push_back(alias);
   }
+  call->output_tensor_names = &call->filtered_output_tensor_names;
+  call->output_tensor_aliases = &call->filtered_output_tensor_aliases;
   return Status::OK();
 }
 
 // Validate results and populate a PredictResponse.
 Status PostProcessPredictionResult(
-    const SignatureDef& signature,
     const std::vector<string>& output_tensor_aliases,
     const std::vector<Tensor>& output_tensors, PredictResponse* response) {
   // Validate and return output.
@@ -241,38 +234,82 @@ Status PostProcessPredictionResult(
   return Status::OK();
 }
 
+// Looks up the servable and the plan of its signature for a SavedModel Predict
+// request, and converts the request into Session::Run() arguments.
+Status PrepareSavedModelPredict(PredictSignaturePlanCache* signature_plans,
+                                ServerCore* core, const PredictRequest& request,
+                                ServableHandle<SavedModelBundle>* bundle,
+                                PredictCall* call) {
+  // Validate signatures.
+  TF_RETURN_IF_ERROR(core->GetServableHandle(request.model_spec(), bundle));
+
+  static const string* const kDefaultSignatureName =
+      new string(kDefaultServingSignatureDefKey);
+  const string& signature_name = request.model_spec().signature_name().empty()
+                                     ? *kDefaultSignatureName
+                                     : request.model_spec().signature_name();
+  TF_RETURN_IF_ERROR(signature_plans->Get(bundle->id(), **bundle,
+                                          signature_name, &call->plan));
+
+  return PreProcessPrediction(request, call);
+}
+
 // Implementation of Predict using the SavedModel SignatureDef format.
-Status SavedModelPredict(const RunOptions& run_options, ServerCore* core,
+Status SavedModelPredict(PredictSignaturePlanCache* signature_plans,
+                         const RunOptions& run_options, ServerCore* core,
                          const PredictRequest& request,
                          PredictResponse* response) {
-  // Validate signatures.
   ServableHandle<SavedModelBundle> bundle;
-  TF_RETURN_IF_ERROR(core->GetServableHandle(request.model_spec(), &bundle));
+  PredictCall call;
+  TF_RETURN_IF_ERROR(
+      PrepareSavedModelPredict(signature_plans, core, request, &bundle, &call));
+  TF_RETURN_IF_ERROR(bundle->session->Run(
+      run_options, call.input_tensors, *call.output_tensor_names,
+      call.target_node_names, &call.outputs, &call.run_metadata));
 
-  const string signature_name = request.model_spec().signature_name().empty()
-                                    ? kDefaultServingSignatureDefKey
-                                    : request.model_spec().signature_name();
-  auto iter = bundle->meta_graph_def.signature_def().find(signature_name);
-  if (iter == bundle->meta_graph_def.signature_def().end()) {
-    return errors::FailedPrecondition(strings::StrCat(
-        "Serving signature key \"", signature_name, "\" not found."));
-  }
-  SignatureDef signature = iter->second;
+  return PostProcessPredictionResult(*call.output_tensor_aliases, call.outputs,
+                                     response);
+}
 
-  std::vector<std::pair<string, Tensor>> input_tensors;
-  std::vector<string> output_tensor_names;
-  std::vector<string> output_tensor_aliases;
-  TF_RETURN_IF_ERROR(PreProcessPrediction(signature, request, &input_tensors,
-                                          &output_tensor_names,
-                                          &output_tensor_aliases));
-  std::vector<Tensor> outputs;
-  RunMetadata run_metadata;
-  TF_RETURN_IF_ERROR(bundle->session->Run(run_options, input_tensors,
-                                          output_tensor_names, {}, &outputs,
-                                          &run_metadata));
+void SavedModelPredictAsync(PredictSignaturePlanCache* signature_plans,
+                            const RunOptions& run_options, ServerCore* core,
+                            const PredictRequest& request,
+                            PredictResponse* response,
+                            std::function<void(const Status&)> done) {
+  // The servable handle is only held until the call has been handed to the
+  // session: a ServingSession finishes the calls it has accepted before it is
+  // destroyed, and releasing the last handle from a batch thread could
+  // otherwise make that thread wait for its own batch. The call holds its own
+  // reference to the signature plan.
+  ServableHandle<SavedModelBundle> bundle;
+  std::shared_ptr<PredictCall> call(new PredictCall);
+  const Status status = PrepareSavedModelPredict(signature_plans, core,
+                                                 request, &bundle, call.get());
+  if (!status.ok()) {
+    done(status);
+    return;
+  }
 
-  return PostProcessPredictionResult(signature, output_tensor_aliases, outputs,
-                                     response);
+  auto run_done = [call, response, done](const Status& run_status) {
+    if (!run_status.ok()) {
+      done(run_status);
+      return;
+    }
+    done(PostProcessPredictionResult(*call->output_tensor_aliases,
+                                     call->outputs, response));
+  };
+  ServingSession* serving_session =
+      dynamic_cast<ServingSession*>(bundle->session.get());
+  if (serving_session == nullptr) {
+    run_done(bundle->session->Run(
+        run_options, call->input_tensors, *call->output_tensor_names,
+        call->target_node_names, &call->outputs, &call->run_metadata));
+    return;
+  }
+  serving_session->RunAsync(run_options, call->input_tensors,
+                            *call->output_tensor_names,
+                            call->target_node_names, &call->outputs,
+                            &call->run_metadata, std::move(run_done));
 }
 
 }  // namespace
@@ -286,10 +323,28 @@ Status TensorflowPredictor::Predict(const RunOptions& run_options,
                               "Missing ModelSpec");
   }
   if (use_saved_model_) {
-    return SavedModelPredict(run_options, core, request, response);
+    return SavedModelPredict(&signature_plans_, run_options, core, request,
+                             response);
   }
   return SessionBundlePredict(run_options, core, request, response);
 }
 
+void TensorflowPredictor::PredictAsync(
+    const RunOptions& run_options, ServerCore* core,
+    const PredictRequest& request, PredictResponse* response,
+    std::function<void(const Status&)> done) {
+  if (!request.has_model_spec()) {
+    done(tensorflow::Status(tensorflow::error::INVALID_ARGUMENT,
+                            "Missing ModelSpec"));
+    return;
+  }
+  if (use_saved_model_) {
+    SavedModelPredictAsync(&signature_plans_, run_options, core, request,
+                           response, std::move(done));
+    return;
+  }
+  done(SessionBundlePredict(run_options, core, request, response));
+}
+
 }  // namespace serving
 }  // namespace tensorflow
@@ -16,10 +16,13 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_PREDICT_IMPL_H_
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_PREDICT_IMPL_H_
 
+#include <functional>
+
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/protobuf/config.pb.h"
 #include "tensorflow_serving/apis/predict.pb.h"
 #include "tensorflow_serving/model_servers/server_core.h"
+#include "tensorflow_serving/servables/tensorflow/predict_signature_plan.h"
 
 namespace tensorflow {
 namespace serving {
@@ -33,11 +36,23 @@ class TensorflowPredictor {
   Status Predict(const RunOptions& run_options, ServerCore* core,
                  const PredictRequest& request, PredictResponse* response);
 
+  // Like Predict(), but calls 'done' with the outcome instead of returning it.
+  // With a batching session, 'done' is called from a batch thread once the
+  // request's batch has been processed, so the caller's thread is not blocked
+  // while the request waits in the batching queue. 'request' and 'response'
+  // must stay alive until 'done' is called.
+  void PredictAsync(const RunOptions& run_options, ServerCore* core,
+                    const PredictRequest& request, PredictResponse* response,
+                    std::function<void(const Status&)> done);
+
  private:
   // If use_saved_model_ is true, a SavedModelBundle handle will be retrieved
   // from the ServerCore and the new SavedModel SignatureDef format will be
   // used.
   bool use_saved_model_;
+
+  // The resolved SavedModel signatures of the models served so far.
+  PredictSignaturePlanCache signature_plans_;
 };
 
 }  // namespace serving
@@ -0,0 +1,106 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/tensorflow/predict_signature_plan.h"
+
+#include "tensorflow/cc/saved_model/signature_constants.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+
+namespace tensorflow {
+namespace serving {
+
+constexpr int PredictSignaturePlanCache::kMaxBundles;
+
+Status BuildPredictSignaturePlan(const SignatureDef& signature,
+                                 PredictSignaturePlan* plan) {
+  if (signature.method_name() != kPredictMethodName &&
+      signature.method_name() != kClassifyMethodName &&
+      signature.method_name() != kRegressMethodName) {
+    return errors::Internal(strings::StrCat(
+        "Expected prediction signature method_name to be one of {",
+        kPredictMethodName, ", ", kClassifyMethodName, ", ", kRegressMethodName,
+        "}. Was: ", signature.method_name()));
+  }
+  if (signature.inputs().empty()) {
+    return errors::Internal(strings::StrCat(
+        "Expected at least one input Tensor in prediction signature."));
+  }
+  if (signature.outputs().empty()) {
+    return errors::Internal(strings::StrCat(
+        "Expected at least one output Tensor in prediction signature."));
+  }
+
+  for (const auto& input : signature.inputs()) {
+    plan->input_tensor_names[input.first] = input.second.name();
+    strings::StrAppend(&plan->input_aliases_string,
+                       plan->input_aliases_string.empty() ? "" : ", ",
+                       input.first);
+  }
+  for (const auto& output : signature.outputs()) {
+    plan->output_tensor_names[output.first] = output.second.name();
+    plan->all_output_tensor_names.push_back(output.second.name());
+    plan->all_output_tensor_aliases.push_back(output.first);
+    strings::StrAppend(&plan->output_aliases_string,
+                       plan->output_aliases_string.empty() ? "" : ", ",
+                       output.first);
+  }
+  return Status::OK();
+}
+
+Status PredictSignaturePlanCache::Get(
+    const ServableId& id, const SavedModelBundle& bundle,
+    const string& signature_name,
+    std::shared_ptr<const PredictSignaturePlan>* plan) {
+  {
+    tf_shared_lock l(mu_);
+    auto bundle_plans = bundles_.find(&bundle);
+    if (bundle_plans != bundles_.end() && bundle_plans->second.id == id) {
+      auto bundle_plan = bundle_plans->second.plans.find(signature_name);
+      if (bundle_plan != bundle_plans->second.plans.end()) {
+        *plan = bundle_plan->second;
+        return Status::OK();
+      }
+    }
+  }
+
+  auto iter = bundle.meta_graph_def.signature_def().find(signature_name);
+  if (iter == bundle.meta_graph_def.signature_def().end()) {
+    return errors::FailedPrecondition(strings::StrCat(
+        "Serving signature key \"", signature_name, "\" not found."));
+  }
+  std::shared_ptr<PredictSignaturePlan> new_plan(new PredictSignaturePlan);
+  TF_RETURN_IF_ERROR(BuildPredictSignaturePlan(iter->second, new_plan.get()));
+
+  mutex_lock l(mu_);
+  auto bundle_plans = bundles_.find(&bundle);
+  if (bundle_plans == bundles_.end() || !(bundle_plans->second.id == id)) {
+    if (bundle_plans == bundles_.end() && bundles_.size() >= kMaxBundles) {
+      bundles_.clear();
+    }
+    BundlePlans& fresh_plans = bundles_[&bundle];
+    fresh_plans.id = id;
+    fresh_plans.plans.clear();
+    bundle_plans = bundles_.find(&bundle);
+  }
+  // Another thread may have built the same plan meanwhile; keep the first.
+  auto inserted =
+      bundle_plans->second.plans.emplace(signature_name, std::move(new_plan));
+  *plan = inserted.first->second;
+  return Status::OK();
+}
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,101 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_PREDICT_SIGNATURE_PLAN_H_
+#define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_PREDICT_SIGNATURE_PLAN_H_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tensorflow/cc/saved_model/loader.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/protobuf/meta_graph.pb.h"
+#include "tensorflow_serving/core/servable_id.h"
+
+namespace tensorflow {
+namespace serving {
+
+// A prediction SignatureDef resolved into the form Predict uses on every
+// request, so that requests neither copy nor re-validate the SignatureDef.
+struct PredictSignaturePlan {
+  // Input alias -> tensor name.
+  std::unordered_map<string, string> input_tensor_names;
+
+  // Output alias -> tensor name.
+  std::unordered_map<string, string> output_tensor_names;
+
+  // Every output of the signature, in the order of its output map. Fetched
+  // when a request has no output filter.
+  std::vector<string> all_output_tensor_names;
+  std::vector<string> all_output_tensor_aliases;
+
+  // The input and output aliases as comma-delimited strings, for error
+  // messages.
+  string input_aliases_string;
+  string output_aliases_string;
+};
+
+// Builds the plan for 'signature'. Returns an error if 'signature' is not a
+// predict, classify or regress signature with at least one input and output.
+Status BuildPredictSignaturePlan(const SignatureDef& signature,
+                                 PredictSignaturePlan* plan);
+
+// Caches the PredictSignaturePlans of loaded SavedModels, per model and
+// signature name.
+//
+// Entries are looked up by the address of the SavedModelBundle and checked
+// against its ServableId, so a bundle loaded at the address of an unloaded one
+// does not see stale plans. Since the cache does not learn when bundles are
+// unloaded, it is cleared whenever it reaches 'kMaxBundles' bundles.
+//
+// Thread-safe.
+class PredictSignaturePlanCache {
+ public:
+  PredictSignaturePlanCache() = default;
+  ~PredictSignaturePlanCache() = default;
+
+  // Returns the plan for the signature 'signature_name' of 'bundle', which is
+  // the loaded servable 'id'. The caller must keep 'bundle' loaded during the
+  // call (i.e. hold a ServableHandle to it); '*plan' may outlive it.
+  Status Get(const ServableId& id, const SavedModelBundle& bundle,
+             const string& signature_name,
+             std::shared_ptr<const PredictSignaturePlan>* plan);
+
+  static constexpr int kMaxBundles = 1024;
+
+ private:
+  struct BundlePlans {
+    ServableId id;
+    // Signature name -> plan.
+    std::unordered_map<string, std::shared_ptr<const PredictSignaturePlan>>
+        plans;
+  };
+
+  mutex mu_;
+  std::unordered_map<const SavedModelBundle*, BundlePlans> bundles_
+      GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(PredictSignaturePlanCache);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_PREDICT_SIGNATURE_PLAN_H_
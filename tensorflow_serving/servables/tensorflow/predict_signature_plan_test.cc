@@ -0,0 +1,119 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/tensorflow/predict_signature_plan.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "tensorflow/cc/saved_model/signature_constants.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+using ::testing::AnyOf;
+using ::testing::ElementsAre;
+using ::testing::UnorderedElementsAre;
+
+SignatureDef CreateSignatureDef(const string& method_name,
+                                const std::vector<string>& input_aliases,
+                                const std::vector<string>& output_aliases) {
+  SignatureDef signature_def;
+  signature_def.set_method_name(method_name);
+  for (const string& alias : input_aliases) {
+    (*signature_def.mutable_inputs())[alias].set_name(alias + ":0");
+  }
+  for (const string& alias : output_aliases) {
+    (*signature_def.mutable_outputs())[alias].set_name(alias + ":0");
+  }
+  return signature_def;
+}
+
+TEST(PredictSignaturePlanTest, BuildPlan) {
+  PredictSignaturePlan plan;
+  TF_ASSERT_OK(BuildPredictSignaturePlan(
+      CreateSignatureDef(kPredictMethodName, {"x"}, {"y", "z"}), &plan));
+  EXPECT_THAT(plan.input_tensor_names,
+              UnorderedElementsAre(std::make_pair("x", "x:0")));
+  EXPECT_THAT(plan.output_tensor_names,
+              UnorderedElementsAre(std::make_pair("y", "y:0"),
+                                   std::make_pair("z", "z:0")));
+  ASSERT_EQ(2, plan.all_output_tensor_aliases.size());
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_EQ(plan.all_output_tensor_aliases[i] + ":0",
+              plan.all_output_tensor_names[i]);
+  }
+  EXPECT_EQ("x", plan.input_aliases_string);
+  EXPECT_THAT(plan.output_aliases_string, AnyOf("y, z", "z, y"));
+}
+
+TEST(PredictSignaturePlanTest, RejectsNonPredictionSignatures) {
+  PredictSignaturePlan plan;
+  EXPECT_FALSE(BuildPredictSignaturePlan(
+                   CreateSignatureDef("unknown", {"x"}, {"y"}), &plan)
+                   .ok());
+  EXPECT_FALSE(BuildPredictSignaturePlan(
+                   CreateSignatureDef(kRegressMethodName, {}, {"y"}), &plan)
+                   .ok());
+  EXPECT_FALSE(BuildPredictSignaturePlan(
+                   CreateSignatureDef(kClassifyMethodName, {"x"}, {}), &plan)
+                   .ok());
+}
+
+TEST(PredictSignaturePlanCacheTest, CachesPlansPerBundleAndSignature) {
+  SavedModelBundle bundle;
+  (*bundle.meta_graph_def.mutable_signature_def())["a"] =
+      CreateSignatureDef(kPredictMethodName, {"x"}, {"y"});
+  (*bundle.meta_graph_def.mutable_signature_def())["b"] =
+      CreateSignatureDef(kPredictMethodName, {"x"}, {"z"});
+  const ServableId id = {"model", 1};
+
+  PredictSignaturePlanCache cache;
+  std::shared_ptr<const PredictSignaturePlan> a, b, a_again;
+  TF_ASSERT_OK(cache.Get(id, bundle, "a", &a));
+  TF_ASSERT_OK(cache.Get(id, bundle, "b", &b));
+  TF_ASSERT_OK(cache.Get(id, bundle, "a", &a_again));
+  EXPECT_THAT(a->all_output_tensor_aliases, ElementsAre("y"));
+  EXPECT_THAT(b->all_output_tensor_aliases, ElementsAre("z"));
+  EXPECT_EQ(a.get(), a_again.get());
+
+  std::shared_ptr<const PredictSignaturePlan> missing;
+  EXPECT_EQ(error::FAILED_PRECONDITION,
+            cache.Get(id, bundle, "c", &missing).code());
+}
+
+TEST(PredictSignaturePlanCacheTest, DoesNotServeStalePlans) {
+  SavedModelBundle bundle;
+  (*bundle.meta_graph_def.mutable_signature_def())["a"] =
+      CreateSignatureDef(kPredictMethodName, {"x"}, {"y"});
+
+  PredictSignaturePlanCache cache;
+  std::shared_ptr<const PredictSignaturePlan> first;
+  TF_ASSERT_OK(cache.Get({"model", 1}, bundle, "a", &first));
+
+  // Another version loaded at the same address gets its own plan.
+  (*bundle.meta_graph_def.mutable_signature_def())["a"] =
+      CreateSignatureDef(kPredictMethodName, {"x"}, {"z"});
+  std::shared_ptr<const PredictSignaturePlan> second;
+  TF_ASSERT_OK(cache.Get({"model", 2}, bundle, "a", &second));
+  EXPECT_THAT(second->all_output_tensor_aliases, ElementsAre("z"));
+  // The earlier plan stays valid for the calls still using it.
+  EXPECT_THAT(first->all_output_tensor_aliases, ElementsAre("y"));
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
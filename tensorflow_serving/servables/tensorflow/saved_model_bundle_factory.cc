@@ -24,6 +24,7 @@ limitations under the License.
 #include "tensorflow/core/public/session_options.h"
 #include "tensorflow_serving/servables/tensorflow/bundle_factory_util.h"
 #include "tensorflow_serving/servables/tensorflow/curried_session.h"
+#include "tensorflow_serving/servables/tensorflow/saved_model_warmup.h"
 
 namespace tensorflow {
 namespace serving {
@@ -61,12 +62,25 @@ Status ParseFixedInputTensors(
 Status SavedModelBundleFactory::Create(
     const SessionBundleConfig& config,
     std::unique_ptr<SavedModelBundleFactory>* factory) {
+  SessionBundleConfig factory_config = config;
   std::shared_ptr<Batcher> batcher;
+  std::shared_ptr<BatchingAutoTuner> auto_tuner;
+  std::shared_ptr<CoreBudget> core_budget;
   if (config.has_batching_parameters()) {
     TF_RETURN_IF_ERROR(
         CreateBatchScheduler(config.batching_parameters(), &batcher));
+    TF_RETURN_IF_ERROR(
+        CreateBatchingAutoTuner(config.batching_parameters(), batcher,
+                                &auto_tuner));
+    TF_RETURN_IF_ERROR(
+        CreateCoreBudget(config.batching_parameters(),
+                         factory_config.mutable_session_config(), &core_budget));
+    if (config.batching_parameters().numa_aware_batch_threads()) {
+      ConfigureSessionForNUMABatching(factory_config.mutable_session_config());
+    }
   }
-  factory->reset(new SavedModelBundleFactory(config, batcher));
+  factory->reset(new SavedModelBundleFactory(factory_config, batcher, auto_tuner,
+                                         core_budget));
   return Status::OK();
 }
 
@@ -89,7 +103,36 @@ Status SavedModelBundleFactory::CreateSavedModelBundle(
     (*bundle)->session.reset(
         new CurriedSession(std::move((*bundle)->session), fixed_input_tensors));
   }
-  if (config_.has_batching_parameters()) {
+  const bool has_in_graph_batching =
+      HasInGraphBatching((*bundle)->meta_graph_def.graph_def());
+  const bool wrap_for_batching =
+      config_.has_batching_parameters() &&
+      !(config_.in_graph_batching() && has_in_graph_batching);
+
+  // Warm up the model before it is made available. The warmup runs on the
+  // unwrapped session: a batching session would hold every request smaller
+  // than the largest batch until batch_timeout_micros expires. Instead each
+  // request is padded to every batch size the batching session can form, so
+  // the same shapes are warmed up.
+  std::vector<int64> warmup_batch_sizes;
+  if (wrap_for_batching) {
+    warmup_batch_sizes.assign(
+        config_.batching_parameters().allowed_batch_sizes().begin(),
+        config_.batching_parameters().allowed_batch_sizes().end());
+  }
+  TF_RETURN_IF_ERROR(RunSavedModelWarmup(
+      GetRunOptions(config_), warmup_batch_sizes, path, bundle->get()));
+
+  if (config_.in_graph_batching() && has_in_graph_batching) {
+    LOG(INFO) << "Model batches in-graph; not wrapping session to perform "
+                 "batch processing";
+    TF_RETURN_IF_ERROR(WrapSession(&(*bundle)->session));
+  } else if (wrap_for_batching) {
+    if (has_in_graph_batching) {
+      LOG(WARNING) << "Wrapping session to perform batch processing of a "
+                      "model that already batches in-graph; set "
+                      "in_graph_batching to batch only once";
+    }
     LOG(INFO) << "Wrapping session to perform batch processing";
     if (batch_scheduler_ == nullptr) {
       return errors::Internal("batch_scheduler_ not set");
@@ -98,16 +141,23 @@ Status SavedModelBundleFactory::CreateSavedModelBundle(
     // Note that in the future, the plan is to enable explicit configuration of
     // the one or many SignatureDefs to enable.
     const std::vector<SignatureDef> signatures = GetSignatureDefs(**bundle);
-    return WrapSessionForBatching(config_.batching_parameters(),
-                                  batch_scheduler_, signatures,
-                                  &(*bundle)->session);
+    TF_RETURN_IF_ERROR(WrapSessionForBatching(
+        config_.batching_parameters(), batch_scheduler_, auto_tuner_,
+        core_budget_, signatures, &(*bundle)->session));
+  } else {
+    TF_RETURN_IF_ERROR(WrapSession(&(*bundle)->session));
   }
-  return WrapSession(&(*bundle)->session);
+  return Status::OK();
 }
 
 SavedModelBundleFactory::SavedModelBundleFactory(
-    const SessionBundleConfig& config, std::shared_ptr<Batcher> batch_scheduler)
-    : config_(config), batch_scheduler_(batch_scheduler) {}
+    const SessionBundleConfig& config, std::shared_ptr<Batcher> batch_scheduler,
+    std::shared_ptr<BatchingAutoTuner> auto_tuner,
+    std::shared_ptr<CoreBudget> core_budget)
+    : config_(config),
+      batch_scheduler_(batch_scheduler),
+      auto_tuner_(std::move(auto_tuner)),
+      core_budget_(std::move(core_budget)) {}
 
 }  // namespace serving
 }  // namespace tensorflow
@@ -17,6 +17,8 @@ limitations under the License.
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_SAVED_MODEL_BUNDLE_FACTORY_H_
 
 #include "tensorflow/cc/saved_model/loader.h"
+#include "tensorflow/contrib/batching/batching_auto_tuner.h"
+#include "tensorflow/contrib/batching/core_budget.h"
 #include "tensorflow/contrib/batching/shared_batch_scheduler.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/macros.h"
@@ -79,7 +81,9 @@ class SavedModelBundleFactory {
   using Batcher = SharedBatchScheduler<BatchingSessionTask>;
 
   SavedModelBundleFactory(const SessionBundleConfig& config,
-                          std::shared_ptr<Batcher> batch_scheduler);
+                          std::shared_ptr<Batcher> batch_scheduler,
+                          std::shared_ptr<BatchingAutoTuner> auto_tuner,
+                          std::shared_ptr<CoreBudget> core_budget);
 
   const SessionBundleConfig config_;
 
@@ -87,6 +91,11 @@ class SavedModelBundleFactory {
   // emits. If batching is not configured, this remains null.
   std::shared_ptr<Batcher> batch_scheduler_;
 
+  // The tuner and core budget that 'config_.batching_parameters()' asks for,
+  // shared by the sessions this factory emits. Null if not configured.
+  std::shared_ptr<BatchingAutoTuner> auto_tuner_;
+  std::shared_ptr<CoreBudget> core_budget_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(SavedModelBundleFactory);
 };
 
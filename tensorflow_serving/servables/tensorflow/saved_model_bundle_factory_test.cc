@@ -23,15 +23,21 @@ limitations under the License.
 #include "google/protobuf/wrappers.pb.h"
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include "tensorflow/cc/saved_model/constants.h"
 #include "tensorflow/cc/saved_model/loader.h"
 #include "tensorflow/core/framework/tensor_testutil.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/io/record_writer.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/protobuf/named_tensor.pb.h"
 #include "tensorflow/core/public/session.h"
 #include "tensorflow/core/public/version.h"
+#include "tensorflow_serving/apis/prediction_log.pb.h"
 #include "tensorflow_serving/servables/tensorflow/bundle_factory_test.h"
 #include "tensorflow_serving/servables/tensorflow/bundle_factory_test_util.h"
+#include "tensorflow_serving/servables/tensorflow/saved_model_warmup.h"
 #include "tensorflow_serving/servables/tensorflow/session_bundle_config.pb.h"
 
 namespace tensorflow {
@@ -95,6 +101,49 @@ TEST_F(SavedModelBundleFactoryTest, FixedInputTensors) {
 
 TEST_F(SavedModelBundleFactoryTest, Batching) { TestBatching(); }
 
+TEST_F(SavedModelBundleFactoryTest, WarmupDoesNotWaitForBatchTimeout) {
+  // Copy the test model and add a single-row Predict warmup request to it.
+  const string export_dir = io::JoinPath(testing::TmpDir(), "warmup_model");
+  for (const string& model_file : test_util::GetTestSavedModelFiles()) {
+    const string copy =
+        io::JoinPath(export_dir, model_file.substr(export_dir_.size() + 1));
+    string contents;
+    TF_ASSERT_OK(ReadFileToString(Env::Default(), model_file, &contents));
+    TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(
+        io::Dirname(copy).ToString()));
+    TF_ASSERT_OK(WriteStringToFile(Env::Default(), copy, contents));
+  }
+  const string assets_extra_dir =
+      io::JoinPath(export_dir, kSavedModelAssetsExtraDirectory);
+  TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(assets_extra_dir));
+  PredictionLog log;
+  test::AsTensor<float>({1.0f}, {1, 1}).AsProtoTensorContent(
+      &(*log.mutable_predict_log()->mutable_request()->mutable_inputs())["x"]);
+  std::unique_ptr<WritableFile> file;
+  TF_ASSERT_OK(Env::Default()->NewWritableFile(
+      io::JoinPath(assets_extra_dir, kSavedModelWarmupRequestsFileName),
+      &file));
+  io::RecordWriter writer(file.get());
+  TF_ASSERT_OK(writer.WriteRecord(log.SerializeAsString()));
+  TF_ASSERT_OK(writer.Close());
+  TF_ASSERT_OK(file->Close());
+
+  // Neither batch size below fills a batch, so warming up through the
+  // batching session would wait out the timeout twice.
+  const int64 kBatchTimeoutMicros = 60 * 1000 * 1000;
+  SessionBundleConfig config;
+  BatchingParameters* batching_params = config.mutable_batching_parameters();
+  batching_params->mutable_max_batch_size()->set_value(8);
+  batching_params->mutable_batch_timeout_micros()->set_value(
+      kBatchTimeoutMicros);
+  batching_params->add_allowed_batch_sizes(2);
+  batching_params->add_allowed_batch_sizes(8);
+  const uint64 start_micros = Env::Default()->NowMicros();
+  std::unique_ptr<Session> session;
+  TF_ASSERT_OK(CreateSessionFromPath(config, export_dir, &session));
+  EXPECT_LT(Env::Default()->NowMicros() - start_micros, kBatchTimeoutMicros);
+}
+
 TEST_F(SavedModelBundleFactoryTest, EstimateResourceRequirementWithGoodExport) {
   const double kTotalFileSize =
       test_util::GetTotalFileSize(test_util::GetTestSavedModelFiles());
@@ -0,0 +1,275 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/tensorflow/saved_model_warmup.h"
+
+#include <memory>
+#include <utility>
+
+#include "tensorflow/cc/saved_model/constants.h"
+#include "tensorflow/cc/saved_model/signature_constants.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor.pb.h"
+#include "tensorflow/core/framework/tensor_util.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow_serving/apis/classifier.h"
+#include "tensorflow_serving/apis/prediction_log.pb.h"
+#include "tensorflow_serving/apis/regressor.h"
+#include "tensorflow_serving/servables/tensorflow/classifier.h"
+#include "tensorflow_serving/servables/tensorflow/multi_inference.h"
+#include "tensorflow_serving/servables/tensorflow/predict_signature_plan.h"
+#include "tensorflow_serving/servables/tensorflow/regressor.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+// Runs a Predict request against 'bundle', fetching the outputs named by the
+// request's output filter, or all outputs of the signature if there is none.
+Status RunPredict(const RunOptions& run_options, const PredictRequest& request,
+                  SavedModelBundle* bundle) {
+  const string signature_name = request.model_spec().signature_name().empty()
+                                    ? kDefaultServingSignatureDefKey
+                                    : request.model_spec().signature_name();
+  auto iter = bundle->meta_graph_def.signature_def().find(signature_name);
+  if (iter == bundle->meta_graph_def.signature_def().end()) {
+    return errors::FailedPrecondition(strings::StrCat(
+        "Serving signature key \"", signature_name, "\" not found."));
+  }
+  PredictSignaturePlan plan;
+  TF_RETURN_IF_ERROR(BuildPredictSignaturePlan(iter->second, &plan));
+
+  std::vector<std::pair<string, Tensor>> inputs;
+  for (const auto& input : request.inputs()) {
+    auto name = plan.input_tensor_names.find(input.first);
+    if (name == plan.input_tensor_names.end()) {
+      return errors::InvalidArgument("input tensor alias not found in "
+                                     "signature: ",
+                                     input.first);
+    }
+    Tensor tensor;
+    if (!tensor.FromProto(input.second)) {
+      return errors::InvalidArgument("tensor parsing error: ", input.first);
+    }
+    inputs.emplace_back(name->second, std::move(tensor));
+  }
+  std::vector<string> output_tensor_names;
+  for (const string& alias : request.output_filter()) {
+    auto name = plan.output_tensor_names.find(alias);
+    if (name == plan.output_tensor_names.end()) {
+      return errors::InvalidArgument("output tensor alias not found in "
+                                     "signature: ",
+                                     alias);
+    }
+    output_tensor_names.push_back(name->second);
+  }
+  if (output_tensor_names.empty()) {
+    output_tensor_names = plan.all_output_tensor_names;
+  }
+
+  std::vector<Tensor> outputs;
+  RunMetadata run_metadata;
+  return bundle->session->Run(run_options, inputs, output_tensor_names, {},
+                              &outputs, &run_metadata);
+}
+
+Status RunClassify(const RunOptions& run_options,
+                   const ClassificationRequest& request,
+                   SavedModelBundle* bundle) {
+  SignatureDef signature;
+  TF_RETURN_IF_ERROR(GetClassificationSignatureDef(
+      request.model_spec(), bundle->meta_graph_def, &signature));
+  std::unique_ptr<ClassifierInterface> classifier;
+  TF_RETURN_IF_ERROR(CreateFlyweightTensorFlowClassifier(
+      run_options, bundle->session.get(), &signature, &classifier));
+  ClassificationResponse response;
+  return classifier->Classify(request, response.mutable_result());
+}
+
+Status RunRegress(const RunOptions& run_options,
+                  const RegressionRequest& request, SavedModelBundle* bundle) {
+  SignatureDef signature;
+  TF_RETURN_IF_ERROR(GetRegressionSignatureDef(
+      request.model_spec(), bundle->meta_graph_def, &signature));
+  std::unique_ptr<RegressorInterface> regressor;
+  TF_RETURN_IF_ERROR(CreateFlyweightTensorFlowRegressor(
+      run_options, bundle->session.get(), &signature, &regressor));
+  RegressionResponse response;
+  return regressor->Regress(request, response.mutable_result());
+}
+
+Status RunMultiInferenceOnBundle(const RunOptions& run_options,
+                                 const MultiInferenceRequest& request,
+                                 SavedModelBundle* bundle) {
+  TensorFlowMultiInferenceRunner runner(bundle->session.get(),
+                                        &bundle->meta_graph_def);
+  MultiInferenceResponse response;
+  return runner.Infer(run_options, request, &response);
+}
+
+// Replays the request recorded in 'log' against 'bundle', resized to
+// 'batch_size' rows unless 'batch_size' is 0.
+Status RunWarmupRequest(const RunOptions& run_options, int64 batch_size,
+                        const PredictionLog& log, SavedModelBundle* bundle) {
+  switch (log.log_type_case()) {
+    case PredictionLog::kPredictLog: {
+      PredictRequest request = log.predict_log().request();
+      if (batch_size > 0) {
+        TF_RETURN_IF_ERROR(ResizePredictRequest(batch_size, &request));
+      }
+      return RunPredict(run_options, request, bundle);
+    }
+    case PredictionLog::kClassifyLog: {
+      ClassificationRequest request = log.classify_log().request();
+      if (batch_size > 0) {
+        TF_RETURN_IF_ERROR(ResizeInput(batch_size, request.mutable_input()));
+      }
+      return RunClassify(run_options, request, bundle);
+    }
+    case PredictionLog::kRegressLog: {
+      RegressionRequest request = log.regress_log().request();
+      if (batch_size > 0) {
+        TF_RETURN_IF_ERROR(ResizeInput(batch_size, request.mutable_input()));
+      }
+      return RunRegress(run_options, request, bundle);
+    }
+    case PredictionLog::kMultiInferenceLog: {
+      MultiInferenceRequest request = log.multi_inference_log().request();
+      if (batch_size > 0) {
+        TF_RETURN_IF_ERROR(ResizeInput(batch_size, request.mutable_input()));
+      }
+      return RunMultiInferenceOnBundle(run_options, request, bundle);
+    }
+    default:
+      return errors::Unimplemented("Unsupported log_type for warmup: ",
+                                   log.ShortDebugString());
+  }
+}
+
+// Resizes 'examples' to 'batch_size' elements, cycling through its elements.
+Status ResizeExamples(int64 batch_size,
+                      protobuf::RepeatedPtrField<Example>* examples) {
+  if (examples->empty()) {
+    return errors::InvalidArgument("Cannot resize an input without examples");
+  }
+  protobuf::RepeatedPtrField<Example> original;
+  original.Swap(examples);
+  examples->Reserve(batch_size);
+  for (int64 i = 0; i < batch_size; ++i) {
+    *examples->Add() = original.Get(i % original.size());
+  }
+  return Status::OK();
+}
+
+}  // namespace
+
+Status ResizePredictRequest(const int64 batch_size, PredictRequest* request) {
+  for (auto& input : *request->mutable_inputs()) {
+    Tensor tensor;
+    if (!tensor.FromProto(input.second)) {
+      return errors::InvalidArgument("tensor parsing error: ", input.first);
+    }
+    if (tensor.dims() == 0 || tensor.dim_size(0) == 0) {
+      return errors::InvalidArgument(
+          "Cannot resize input ", input.first,
+          " without a non-empty 0th dimension: ", tensor.shape().DebugString());
+    }
+    const int64 num_rows = tensor.dim_size(0);
+    std::vector<Tensor> rows;
+    rows.reserve(batch_size);
+    for (int64 i = 0; i < batch_size; ++i) {
+      rows.push_back(tensor.Slice(i % num_rows, i % num_rows + 1));
+    }
+    Tensor resized;
+    TF_RETURN_IF_ERROR(tensor::Concat(rows, &resized));
+    input.second.Clear();
+    resized.AsProtoTensorContent(&input.second);
+  }
+  return Status::OK();
+}
+
+Status ResizeInput(const int64 batch_size, Input* input) {
+  switch (input->kind_case()) {
+    case Input::kExampleList:
+      return ResizeExamples(batch_size,
+                            input->mutable_example_list()->mutable_examples());
+    case Input::kExampleListWithContext:
+      return ResizeExamples(
+          batch_size,
+          input->mutable_example_list_with_context()->mutable_examples());
+    default:
+      return errors::InvalidArgument("Input is empty");
+  }
+}
+
+Status RunSavedModelWarmup(const RunOptions& run_options,
+                           const std::vector<int64>& batch_sizes,
+                           const string& export_dir, SavedModelBundle* bundle) {
+  const string warmup_path =
+      io::JoinPath(export_dir, kSavedModelAssetsExtraDirectory,
+                   kSavedModelWarmupRequestsFileName);
+  if (!Env::Default()->FileExists(warmup_path).ok()) {
+    LOG(INFO) << "No warmup data file found at " << warmup_path;
+    return Status::OK();
+  }
+
+  const uint64 start_micros = Env::Default()->NowMicros();
+  std::unique_ptr<RandomAccessFile> file;
+  TF_RETURN_IF_ERROR(Env::Default()->NewRandomAccessFile(warmup_path, &file));
+  io::RecordReader reader(file.get());
+  const std::vector<int64> replay_batch_sizes =
+      batch_sizes.empty() ? std::vector<int64>({0}) : batch_sizes;
+  int num_warmup_records = 0;
+  uint64 offset = 0;
+  string record;
+  Status status = reader.ReadRecord(&offset, &record);
+  while (status.ok()) {
+    if (++num_warmup_records > kMaxNumWarmupRecords) {
+      return errors::InvalidArgument(
+          "Number of warmup records exceeds the maximum (",
+          kMaxNumWarmupRecords, ") at ", warmup_path);
+    }
+    PredictionLog log;
+    if (!log.ParseFromString(record)) {
+      return errors::InvalidArgument("Failed to parse warmup record ",
+                                     num_warmup_records, " from ",
+                                     warmup_path);
+    }
+    for (const int64 batch_size : replay_batch_sizes) {
+      TF_RETURN_IF_ERROR(
+          RunWarmupRequest(run_options, batch_size, log, bundle));
+    }
+    status = reader.ReadRecord(&offset, &record);
+  }
+  // OUT_OF_RANGE means the end of the file was reached.
+  if (!errors::IsOutOfRange(status)) {
+    return status;
+  }
+
+  LOG(INFO) << "Finished replaying " << num_warmup_records
+            << " warmup records from " << warmup_path << " at "
+            << replay_batch_sizes.size() << " batch size(s) in "
+            << Env::Default()->NowMicros() - start_micros << " microseconds";
+  return Status::OK();
+}
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,67 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_SAVED_MODEL_WARMUP_H_
+#define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_SAVED_MODEL_WARMUP_H_
+
+#include <string>
+#include <vector>
+
+#include "tensorflow/cc/saved_model/loader.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/protobuf/config.pb.h"
+#include "tensorflow_serving/apis/input.pb.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+
+namespace tensorflow {
+namespace serving {
+
+// The file in the SavedModel's assets.extra directory that holds the warmup
+// requests, as a TFRecord file of PredictionLog protos.
+constexpr char kSavedModelWarmupRequestsFileName[] =
+    "tf_serving_warmup_requests";
+
+// The maximum number of warmup requests read from the file.
+constexpr int kMaxNumWarmupRecords = 1000;
+
+// Replays the warmup requests stored with the SavedModel at 'export_dir'
+// against 'bundle', so that the executors, allocations and lazily initialized
+// kernels the requests need are in place before the servable serves traffic.
+// The requests go straight to the bundle's session, so callers should warm up
+// before wrapping it in a batching session, which would hold each request until
+// its batch timeout expires.
+//
+// If 'batch_sizes' is non-empty, every request is replayed once per batch size,
+// with its inputs repeated or truncated to that many rows; pass the batch sizes
+// the batching session will form. Otherwise every request is replayed as
+// recorded.
+//
+// Returns OK if the model has no warmup requests, and an error if a request
+// cannot be parsed or fails.
+Status RunSavedModelWarmup(const RunOptions& run_options,
+                           const std::vector<int64>& batch_sizes,
+                           const string& export_dir, SavedModelBundle* bundle);
+
+// Resizes the batch of 'request' to 'batch_size' rows, cycling through the
+// rows of each input tensor. Every input must have a non-empty 0th dimension.
+Status ResizePredictRequest(int64 batch_size, PredictRequest* request);
+
+// Resizes 'input' to 'batch_size' examples, cycling through its examples.
+Status ResizeInput(int64 batch_size, Input* input);
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_SAVED_MODEL_WARMUP_H_
@@ -0,0 +1,216 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/tensorflow/saved_model_warmup.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "tensorflow/cc/saved_model/constants.h"
+#include "tensorflow/cc/saved_model/signature_constants.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/io/record_writer.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow_serving/apis/prediction_log.pb.h"
+#include "tensorflow_serving/core/test_util/mock_session.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+using test_util::MockSession;
+using ::testing::_;
+using ::testing::ElementsAre;
+using ::testing::Invoke;
+using ::testing::Return;
+
+// Creates an export directory under the test's temporary directory, with
+// 'records' as its warmup requests.
+string WriteWarmupRecords(const string& name,
+                          const std::vector<string>& records) {
+  const string export_dir = io::JoinPath(testing::TmpDir(), name);
+  const string assets_extra_dir =
+      io::JoinPath(export_dir, kSavedModelAssetsExtraDirectory);
+  TF_CHECK_OK(Env::Default()->RecursivelyCreateDir(assets_extra_dir));
+  std::unique_ptr<WritableFile> file;
+  TF_CHECK_OK(Env::Default()->NewWritableFile(
+      io::JoinPath(assets_extra_dir, kSavedModelWarmupRequestsFileName),
+      &file));
+  io::RecordWriter writer(file.get());
+  for (const string& record : records) {
+    TF_CHECK_OK(writer.WriteRecord(record));
+  }
+  TF_CHECK_OK(writer.Close());
+  TF_CHECK_OK(file->Close());
+  return export_dir;
+}
+
+PredictionLog CreatePredictLog(const Tensor& x) {
+  PredictionLog log;
+  PredictRequest* request = log.mutable_predict_log()->mutable_request();
+  x.AsProtoTensorContent(&(*request->mutable_inputs())["x"]);
+  return log;
+}
+
+// Sets up 'bundle' with a predict signature "x" -> "y" and a mock session that
+// records the shape of every input it is run on.
+MockSession* SetUpBundle(std::vector<string>* input_shapes,
+                         SavedModelBundle* bundle) {
+  SignatureDef& signature = (*bundle->meta_graph_def.mutable_signature_def())
+      [kDefaultServingSignatureDefKey];
+  signature.set_method_name(kPredictMethodName);
+  (*signature.mutable_inputs())["x"].set_name("x:0");
+  (*signature.mutable_outputs())["y"].set_name("y:0");
+  MockSession* session = new MockSession;
+  bundle->session.reset(session);
+  ON_CALL(*session, Run(_, _, _, _, _, _))
+      .WillByDefault(Invoke(
+          [input_shapes](const RunOptions& run_options,
+                         const std::vector<std::pair<string, Tensor>>& inputs,
+                         const std::vector<string>& output_tensor_names,
+                         const std::vector<string>& target_node_names,
+                         std::vector<Tensor>* outputs,
+                         RunMetadata* run_metadata) {
+            for (const auto& input : inputs) {
+              input_shapes->push_back(input.second.shape().DebugString());
+            }
+            return Status::OK();
+          }));
+  return session;
+}
+
+TEST(SavedModelWarmupTest, ReplaysRequestsPerBatchSize) {
+  const string export_dir = WriteWarmupRecords(
+      "per_batch_size",
+      {CreatePredictLog(test::AsTensor<float>({1, 2}, {2})).SerializeAsString(),
+       CreatePredictLog(test::AsTensor<float>({3}, {1})).SerializeAsString()});
+
+  SavedModelBundle bundle;
+  std::vector<string> input_shapes;
+  MockSession* session = SetUpBundle(&input_shapes, &bundle);
+  EXPECT_CALL(*session, Run(_, _, ElementsAre("y:0"), _, _, _)).Times(4);
+  TF_ASSERT_OK(RunSavedModelWarmup(RunOptions(), {1, 4}, export_dir, &bundle));
+  EXPECT_THAT(input_shapes, ElementsAre("[1]", "[4]", "[1]", "[4]"));
+}
+
+TEST(SavedModelWarmupTest, ReplaysRequestsAsRecordedWithoutBatchSizes) {
+  const string export_dir = WriteWarmupRecords(
+      "as_recorded", {CreatePredictLog(test::AsTensor<float>({1, 2}, {2}))
+                          .SerializeAsString()});
+
+  SavedModelBundle bundle;
+  std::vector<string> input_shapes;
+  MockSession* session = SetUpBundle(&input_shapes, &bundle);
+  EXPECT_CALL(*session, Run(_, _, _, _, _, _)).Times(1);
+  TF_ASSERT_OK(RunSavedModelWarmup(RunOptions(), {}, export_dir, &bundle));
+  EXPECT_THAT(input_shapes, ElementsAre("[2]"));
+}
+
+TEST(SavedModelWarmupTest, NoWarmupRequests) {
+  SavedModelBundle bundle;
+  std::vector<string> input_shapes;
+  MockSession* session = SetUpBundle(&input_shapes, &bundle);
+  EXPECT_CALL(*session, Run(_, _, _, _, _, _)).Times(0);
+  TF_EXPECT_OK(RunSavedModelWarmup(
+      RunOptions(), {1}, io::JoinPath(testing::TmpDir(), "no_warmup"),
+      &bundle));
+}
+
+TEST(SavedModelWarmupTest, FailsOnBadRecordsAndRequests) {
+  SavedModelBundle bundle;
+  std::vector<string> input_shapes;
+  MockSession* session = SetUpBundle(&input_shapes, &bundle);
+
+  EXPECT_FALSE(RunSavedModelWarmup(
+                   RunOptions(), {},
+                   WriteWarmupRecords("unparsable", {"not a prediction log"}),
+                   &bundle)
+                   .ok());
+
+  PredictionLog unknown_signature =
+      CreatePredictLog(test::AsTensor<float>({1}, {1}));
+  unknown_signature.mutable_predict_log()
+      ->mutable_request()
+      ->mutable_model_spec()
+      ->set_signature_name("unknown");
+  EXPECT_FALSE(RunSavedModelWarmup(
+                   RunOptions(), {},
+                   WriteWarmupRecords("unknown_signature",
+                                      {unknown_signature.SerializeAsString()}),
+                   &bundle)
+                   .ok());
+
+  EXPECT_CALL(*session, Run(_, _, _, _, _, _))
+      .WillOnce(Return(errors::Internal("failed")));
+  EXPECT_FALSE(RunSavedModelWarmup(
+                   RunOptions(), {},
+                   WriteWarmupRecords("failing_run",
+                                      {CreatePredictLog(
+                                           test::AsTensor<float>({1}, {1}))
+                                           .SerializeAsString()}),
+                   &bundle)
+                   .ok());
+}
+
+TEST(SavedModelWarmupTest, ResizePredictRequest) {
+  PredictRequest request =
+      CreatePredictLog(test::AsTensor<int64>({1, 2, 3, 4, 5, 6}, {3, 2}))
+          .predict_log()
+          .request();
+  TF_ASSERT_OK(ResizePredictRequest(5, &request));
+  Tensor resized;
+  ASSERT_TRUE(resized.FromProto(request.inputs().at("x")));
+  test::ExpectTensorEqual<int64>(
+      test::AsTensor<int64>({1, 2, 3, 4, 5, 6, 1, 2, 3, 4}, {5, 2}), resized);
+
+  TF_ASSERT_OK(ResizePredictRequest(1, &request));
+  ASSERT_TRUE(resized.FromProto(request.inputs().at("x")));
+  test::ExpectTensorEqual<int64>(test::AsTensor<int64>({1, 2}, {1, 2}),
+                                 resized);
+
+  PredictRequest scalar_request =
+      CreatePredictLog(test::AsScalar<float>(1)).predict_log().request();
+  EXPECT_FALSE(ResizePredictRequest(2, &scalar_request).ok());
+}
+
+TEST(SavedModelWarmupTest, ResizeInput) {
+  Input input;
+  ExampleListWithContext* examples = input.mutable_example_list_with_context();
+  (*examples->add_examples()->mutable_features()->mutable_feature())["a"]
+      .mutable_int64_list()
+      ->add_value(1);
+  (*examples->add_examples()->mutable_features()->mutable_feature())["a"]
+      .mutable_int64_list()
+      ->add_value(2);
+  TF_ASSERT_OK(ResizeInput(3, &input));
+  ASSERT_EQ(3, examples->examples_size());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(i % 2 + 1, examples->examples(i)
+                             .features()
+                             .feature()
+                             .at("a")
+                             .int64_list()
+                             .value(0));
+  }
+
+  Input empty_input;
+  EXPECT_FALSE(ResizeInput(3, &empty_input).ok());
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
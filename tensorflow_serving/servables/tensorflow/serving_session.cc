@@ -34,5 +34,15 @@ Status ServingSession::Close() {
   return errors::PermissionDenied("State changes denied via ServingSession");
 }
 
+void ServingSession::RunAsync(
+    const RunOptions& run_options,
+    const std::vector<std::pair<string, Tensor>>& inputs,
+    const std::vector<string>& output_tensor_names,
+    const std::vector<string>& target_node_names, std::vector<Tensor>* outputs,
+    RunMetadata* run_metadata, std::function<void(const Status&)> done) {
+  done(Run(run_options, inputs, output_tensor_names, target_node_names,
+           outputs, run_metadata));
+}
+
 }  // namespace serving
 }  // namespace tensorflow
@@ -16,6 +16,7 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_SERVING_SESSION_H_
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_SERVING_SESSION_H_
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <utility>
@@ -40,7 +41,23 @@ class ServingSession : public Session {
   Status Extend(const GraphDef& graph) final;
   Status Close() final;
 
-  // (Subclasses just implement Run().)
+  // Like Run(), but calls 'done' with the outcome instead of returning it.
+  // 'inputs', 'output_tensor_names', 'target_node_names', 'outputs' and
+  // 'run_metadata' must stay alive until 'done' is called. 'done' may be called
+  // on the calling thread or on another thread, possibly before RunAsync()
+  // returns.
+  //
+  // The default implementation calls Run() on the calling thread. Subclasses
+  // that can complete a call without blocking the caller (e.g. a batching
+  // session, whose batch threads run the underlying session) override it.
+  virtual void RunAsync(const RunOptions& run_options,
+                        const std::vector<std::pair<string, Tensor>>& inputs,
+                        const std::vector<string>& output_tensor_names,
+                        const std::vector<string>& target_node_names,
+                        std::vector<Tensor>* outputs, RunMetadata* run_metadata,
+                        std::function<void(const Status&)> done);
+
+  // (Subclasses just implement Run(), and optionally RunAsync().)
 };
 
 /// A ServingSession that wraps a given Session, and blocks all calls other than
@@ -59,12 +59,25 @@ Status GetSignatureDefs(const SessionBundle& bundle,
 Status SessionBundleFactory::Create(
     const SessionBundleConfig& config,
     std::unique_ptr<SessionBundleFactory>* factory) {
+  SessionBundleConfig factory_config = config;
   std::shared_ptr<Batcher> batcher;
+  std::shared_ptr<BatchingAutoTuner> auto_tuner;
+  std::shared_ptr<CoreBudget> core_budget;
   if (config.has_batching_parameters()) {
     TF_RETURN_IF_ERROR(
         CreateBatchScheduler(config.batching_parameters(), &batcher));
+    TF_RETURN_IF_ERROR(
+        CreateBatchingAutoTuner(config.batching_parameters(), batcher,
+                                &auto_tuner));
+    TF_RETURN_IF_ERROR(
+        CreateCoreBudget(config.batching_parameters(),
+                         factory_config.mutable_session_config(), &core_budget));
+    if (config.batching_parameters().numa_aware_batch_threads()) {
+      ConfigureSessionForNUMABatching(factory_config.mutable_session_config());
+    }
   }
-  factory->reset(new SessionBundleFactory(config, batcher));
+  factory->reset(new SessionBundleFactory(factory_config, batcher, auto_tuner,
+                                         core_budget));
   return Status::OK();
 }
 
@@ -79,7 +92,19 @@ Status SessionBundleFactory::CreateSessionBundle(
   TF_RETURN_IF_ERROR(LoadSessionBundleFromPathUsingRunOptions(
       GetSessionOptions(config_), GetRunOptions(config_), path, bundle->get()));
 
+  const bool has_in_graph_batching =
+      HasInGraphBatching((*bundle)->meta_graph_def.graph_def());
+  if (config_.in_graph_batching() && has_in_graph_batching) {
+    LOG(INFO) << "Model batches in-graph; not wrapping session to perform "
+                 "batch processing";
+    return WrapSession(&(*bundle)->session);
+  }
   if (config_.has_batching_parameters()) {
+    if (has_in_graph_batching) {
+      LOG(WARNING) << "Wrapping session to perform batch processing of a "
+                      "model that already batches in-graph; set "
+                      "in_graph_batching to batch only once";
+    }
     LOG(INFO) << "Wrapping session to perform batch processing";
     if (batch_scheduler_ == nullptr) {
       return errors::Internal("batch_scheduler_ not set");
@@ -87,15 +112,20 @@ Status SessionBundleFactory::CreateSessionBundle(
     std::vector<SignatureDef> signatures;
     TF_RETURN_IF_ERROR(GetSignatureDefs(**bundle, &signatures));
     return WrapSessionForBatching(config_.batching_parameters(),
-                                  batch_scheduler_, signatures,
-                                  &(*bundle)->session);
+                                  batch_scheduler_, auto_tuner_, core_budget_,
+                                  signatures, &(*bundle)->session);
   }
   return WrapSession(&(*bundle)->session);
 }
 
 SessionBundleFactory::SessionBundleFactory(
-    const SessionBundleConfig& config, std::shared_ptr<Batcher> batch_scheduler)
-    : config_(config), batch_scheduler_(batch_scheduler) {}
+    const SessionBundleConfig& config, std::shared_ptr<Batcher> batch_scheduler,
+    std::shared_ptr<BatchingAutoTuner> auto_tuner,
+    std::shared_ptr<CoreBudget> core_budget)
+    : config_(config),
+      batch_scheduler_(batch_scheduler),
+      auto_tuner_(std::move(auto_tuner)),
+      core_budget_(std::move(core_budget)) {}
 
 }  // namespace serving
 }  // namespace tensorflow
@@ -16,6 +16,8 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_SESSION_BUNDLE_FACTORY_H_
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_SESSION_BUNDLE_FACTORY_H_
 
+#include "tensorflow/contrib/batching/batching_auto_tuner.h"
+#include "tensorflow/contrib/batching/core_budget.h"
 #include "tensorflow/contrib/batching/shared_batch_scheduler.h"
 #include "tensorflow/contrib/session_bundle/session_bundle.h"
 #include "tensorflow/core/lib/core/status.h"
@@ -63,7 +65,9 @@ class SessionBundleFactory {
   using Batcher = SharedBatchScheduler<BatchingSessionTask>;
 
   SessionBundleFactory(const SessionBundleConfig& config,
-                       std::shared_ptr<Batcher> batch_scheduler);
+                       std::shared_ptr<Batcher> batch_scheduler,
+                       std::shared_ptr<BatchingAutoTuner> auto_tuner,
+                       std::shared_ptr<CoreBudget> core_budget);
 
   const SessionBundleConfig config_;
 
@@ -71,6 +75,11 @@ class SessionBundleFactory {
   // emits. If batching is not configured, this remains null.
   std::shared_ptr<Batcher> batch_scheduler_;
 
+  // The tuner and core budget that 'config_.batching_parameters()' asks for,
+  // shared by the sessions this factory emits. Null if not configured.
+  std::shared_ptr<BatchingAutoTuner> auto_tuner_;
+  std::shared_ptr<CoreBudget> core_budget_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(SessionBundleFactory);
 };
 
@@ -0,0 +1,252 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/arrival_schedule.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "google/protobuf/struct.pb.h"
+#include "google/protobuf/util/json_util.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/random/philox_random.h"
+#include "tensorflow/core/lib/random/simple_philox.h"
+#include "tensorflow/core/lib/strings/numbers.h"
+#include "tensorflow/core/lib/strings/str_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/cpu_info.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+constexpr char kNpyMagic[] = "\x93NUMPY";
+constexpr size_t kNpyMagicLength = 6;
+
+// Returns the value of 'key' in the Python dict literal 'header', e.g. "'<f8'"
+// for key "descr", or the empty string if 'key' is not present.
+string NpyHeaderValue(const string& header, const string& key) {
+  const string quoted_key = strings::StrCat("'", key, "':");
+  const size_t key_pos = header.find(quoted_key);
+  if (key_pos == string::npos) return "";
+  StringPiece value = StringPiece(header).substr(key_pos + quoted_key.size());
+  str_util::RemoveLeadingWhitespace(&value);
+  if (value.starts_with("(")) {
+    const size_t end = value.find(')');
+    return value.substr(0, end == StringPiece::npos ? end : end + 1)
+        .ToString();
+  }
+  const size_t end = value.find(',');
+  value = value.substr(0, end);
+  str_util::RemoveTrailingWhitespace(&value);
+  return value.ToString();
+}
+
+Status CheckGaps(const std::vector<double>& gaps) {
+  for (size_t i = 0; i < gaps.size(); ++i) {
+    if (!(gaps[i] >= 0)) {
+      return errors::InvalidArgument("Inter-arrival gap ", i, " is ", gaps[i],
+                                     "; gaps must be non-negative");
+    }
+  }
+  return Status::OK();
+}
+
+// Returns an exponentially distributed value with mean 'mean'.
+double Exponential(double mean, random::SimplePhilox* rng) {
+  return -mean * std::log(1.0 - rng->RandDouble());
+}
+
+}  // namespace
+
+Status ParseNpyInterArrivals(StringPiece contents, std::vector<double>* gaps) {
+  if (!port::kLittleEndian) {
+    return errors::Unimplemented(".npy traces are only read on little-endian "
+                                 "hosts");
+  }
+  if (contents.size() < kNpyMagicLength + 4 ||
+      memcmp(contents.data(), kNpyMagic, kNpyMagicLength) != 0) {
+    return errors::InvalidArgument("Not a .npy file");
+  }
+  const uint8 major_version = contents[kNpyMagicLength];
+  size_t header_length;
+  size_t header_start;
+  if (major_version == 1) {
+    header_length = static_cast<uint8>(contents[8]) |
+                    static_cast<uint8>(contents[9]) << 8;
+    header_start = 10;
+  } else {
+    if (contents.size() < 12) return errors::InvalidArgument("Truncated .npy");
+    header_length = 0;
+    for (int i = 3; i >= 0; --i) {
+      header_length = header_length << 8 | static_cast<uint8>(contents[8 + i]);
+    }
+    header_start = 12;
+  }
+  if (contents.size() < header_start + header_length) {
+    return errors::InvalidArgument("Truncated .npy header");
+  }
+  const string header =
+      contents.substr(header_start, header_length).ToString();
+  const StringPiece data = contents.substr(header_start + header_length);
+
+  if (NpyHeaderValue(header, "fortran_order") == "True") {
+    return errors::Unimplemented("Fortran-ordered .npy arrays are not read");
+  }
+  const string descr = NpyHeaderValue(header, "descr");
+  size_t element_size;
+  if (descr == "'<f8'") {
+    element_size = sizeof(double);
+  } else if (descr == "'<f4'") {
+    element_size = sizeof(float);
+  } else {
+    return errors::Unimplemented("Unsupported .npy dtype ", descr,
+                                 "; expected float32 or float64");
+  }
+
+  // The shape is a tuple such as "(100,)" or "(100, 1)".
+  const string shape = NpyHeaderValue(header, "shape");
+  if (shape.size() < 2) {
+    return errors::InvalidArgument("Missing shape in .npy header: ", header);
+  }
+  std::vector<int64> dims;
+  for (const string& dim :
+       str_util::Split(shape.substr(1, shape.size() - 2), ',',
+                       str_util::SkipWhitespace())) {
+    // Python 2 writes long dimensions with an "L" suffix.
+    StringPiece digits(dim);
+    str_util::RemoveLeadingWhitespace(&digits);
+    str_util::ConsumeSuffix(&digits, "L");
+    int64 size;
+    if (!strings::safe_strto64(digits, &size) || size < 0) {
+      return errors::InvalidArgument("Malformed .npy shape ", shape);
+    }
+    dims.push_back(size);
+  }
+  if (dims.empty() || dims.size() > 2 || (dims.size() == 2 && dims[1] != 1)) {
+    return errors::InvalidArgument("Expected a .npy array of shape [N] or "
+                                   "[N, 1], got ",
+                                   shape);
+  }
+  const size_t num_gaps = dims[0];
+  if (data.size() < num_gaps * element_size) {
+    return errors::InvalidArgument("Truncated .npy data: expected ", num_gaps,
+                                   " values");
+  }
+
+  gaps->clear();
+  gaps->reserve(num_gaps);
+  for (size_t i = 0; i < num_gaps; ++i) {
+    if (element_size == sizeof(double)) {
+      double value;
+      memcpy(&value, data.data() + i * element_size, sizeof(value));
+      gaps->push_back(value);
+    } else {
+      float value;
+      memcpy(&value, data.data() + i * element_size, sizeof(value));
+      gaps->push_back(value);
+    }
+  }
+  return CheckGaps(*gaps);
+}
+
+Status ParseJsonlInterArrivals(StringPiece contents,
+                               std::vector<double>* gaps) {
+  gaps->clear();
+  bool have_previous_arrival = false;
+  double previous_arrival = 0;
+  int line_number = 0;
+  for (const string& line :
+       str_util::Split(contents, '\n', str_util::SkipWhitespace())) {
+    ++line_number;
+    google::protobuf::Struct record;
+    const auto parse_status =
+        google::protobuf::util::JsonStringToMessage(line, &record);
+    if (!parse_status.ok()) {
+      return errors::InvalidArgument("Malformed JSON on line ", line_number,
+                                     ": ", parse_status.ToString());
+    }
+    const auto& fields = record.fields();
+    auto inter_arrival = fields.find("inter_arrival");
+    auto arrival_time = fields.find("arrival_time");
+    if (inter_arrival != fields.end()) {
+      gaps->push_back(inter_arrival->second.number_value());
+    } else if (arrival_time != fields.end()) {
+      const double arrival = arrival_time->second.number_value();
+      gaps->push_back(have_previous_arrival ? arrival - previous_arrival : 0);
+      have_previous_arrival = true;
+      previous_arrival = arrival;
+    }
+  }
+  return CheckGaps(*gaps);
+}
+
+Status ReadInterArrivalTrace(const string& path, std::vector<double>* gaps) {
+  string contents;
+  TF_RETURN_IF_ERROR(ReadFileToString(Env::Default(), path, &contents));
+  if (StringPiece(path).ends_with(".npy")) {
+    return ParseNpyInterArrivals(contents, gaps);
+  }
+  if (StringPiece(path).ends_with(".jsonl")) {
+    return ParseJsonlInterArrivals(contents, gaps);
+  }
+  gaps->clear();
+  for (const string& token : str_util::Split(
+           contents, " \t\r\n", str_util::SkipEmpty())) {
+    double gap;
+    if (!strings::safe_strtod(token.c_str(), &gap)) {
+      return errors::InvalidArgument("Malformed inter-arrival gap \"", token,
+                                     "\" in ", path);
+    }
+    gaps->push_back(gap);
+  }
+  return CheckGaps(*gaps);
+}
+
+std::vector<double> PoissonInterArrivals(double rate, int num_requests,
+                                         uint64 seed) {
+  random::PhiloxRandom philox(seed);
+  random::SimplePhilox rng(&philox);
+  std::vector<double> gaps;
+  gaps.reserve(num_requests);
+  for (int i = 0; i < num_requests; ++i) {
+    gaps.push_back(Exponential(1.0 / rate, &rng));
+  }
+  return gaps;
+}
+
+std::vector<double> BurstyInterArrivals(double rate, double burst_factor,
+                                        int burst_size, int num_requests,
+                                        uint64 seed) {
+  random::PhiloxRandom philox(seed);
+  random::SimplePhilox rng(&philox);
+  // A burst of 'burst_size' requests takes on average burst_size / rate
+  // seconds: burst_size - 1 gaps within the burst, plus the idle gap before
+  // it.
+  const double burst_gap_mean = 1.0 / (rate * burst_factor);
+  const double idle_gap_mean =
+      burst_size / rate - (burst_size - 1) * burst_gap_mean;
+  std::vector<double> gaps;
+  gaps.reserve(num_requests);
+  for (int i = 0; i < num_requests; ++i) {
+    gaps.push_back(Exponential(
+        i % burst_size == 0 ? idle_gap_mean : burst_gap_mean, &rng));
+  }
+  return gaps;
+}
+
+}  // namespace serving
+}  // namespace tensorflow
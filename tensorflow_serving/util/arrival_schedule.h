@@ -0,0 +1,67 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Arrival schedules, for open-loop load generation and for pacing admission in
+// the model server. A schedule is a sequence of inter-arrival gaps, in seconds:
+// request i is sent (or admitted) gaps[0] + ... + gaps[i] seconds after the
+// start of the run, regardless of when earlier requests complete.
+
+#ifndef TENSORFLOW_SERVING_UTIL_ARRIVAL_SCHEDULE_H_
+#define TENSORFLOW_SERVING_UTIL_ARRIVAL_SCHEDULE_H_
+
+#include <vector>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/stringpiece.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Reads the inter-arrival gaps recorded in 'path'. The format is chosen by the
+// file extension:
+//   .npy    A NumPy array of float32 or float64 values, of shape [N] or [N, 1]
+//           (e.g. interarrival_time_generated.npy).
+//   .jsonl  One JSON object per line, holding either an "inter_arrival" gap or
+//           an absolute "arrival_time", both in seconds. Lines without either
+//           field are skipped.
+//   other   Whitespace-separated decimal gaps (e.g.
+//           interarrival_time_generated.txt).
+// Returns an error if the file cannot be read or holds a negative gap.
+Status ReadInterArrivalTrace(const string& path, std::vector<double>* gaps);
+
+// Parses the contents of a .npy file. Exposed for testing.
+Status ParseNpyInterArrivals(StringPiece contents, std::vector<double>* gaps);
+
+// Parses the contents of a .jsonl file. Exposed for testing.
+Status ParseJsonlInterArrivals(StringPiece contents, std::vector<double>* gaps);
+
+// Returns 'num_requests' gaps of a Poisson process with 'rate' requests per
+// second.
+std::vector<double> PoissonInterArrivals(double rate, int num_requests,
+                                         uint64 seed);
+
+// Returns 'num_requests' gaps of an on/off process whose long-run rate is
+// 'rate' requests per second. Requests arrive in bursts of 'burst_size', at
+// 'burst_factor' times the mean rate within a burst; bursts are separated by
+// exponentially distributed idle gaps. REQUIRES: burst_factor >= 1.
+std::vector<double> BurstyInterArrivals(double rate, double burst_factor,
+                                        int burst_size, int num_requests,
+                                        uint64 seed);
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_ARRIVAL_SCHEDULE_H_
@@ -0,0 +1,157 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/arrival_schedule.h"
+
+#include <cmath>
+#include <numeric>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::HasSubstr;
+
+// Returns a version 1.0 .npy file holding 'values' with the given header
+// fields.
+template <typename T>
+string MakeNpy(const string& descr, const string& shape,
+               const std::vector<T>& values) {
+  string header = strings::StrCat("{'descr': '", descr,
+                                  "', 'fortran_order': False, 'shape': ",
+                                  shape, ", }");
+  header.append(15 - (10 + header.size()) % 16, ' ');
+  header.push_back('\n');
+  string npy("\x93NUMPY\x01\x00", 8);
+  npy.push_back(static_cast<char>(header.size() & 0xff));
+  npy.push_back(static_cast<char>(header.size() >> 8));
+  npy += header;
+  npy.append(reinterpret_cast<const char*>(values.data()),
+             values.size() * sizeof(T));
+  return npy;
+}
+
+TEST(ArrivalScheduleTest, ParsesNpyFloat64Column) {
+  std::vector<double> gaps;
+  TF_ASSERT_OK(ParseNpyInterArrivals(
+      MakeNpy<double>("<f8", "(3, 1)", {0.5, 0.0, 0.25}), &gaps));
+  EXPECT_THAT(gaps, ElementsAre(0.5, 0.0, 0.25));
+}
+
+TEST(ArrivalScheduleTest, ParsesNpyFloat32Vector) {
+  std::vector<double> gaps;
+  TF_ASSERT_OK(ParseNpyInterArrivals(
+      MakeNpy<float>("<f4", "(2,)", {0.5f, 0.125f}), &gaps));
+  EXPECT_THAT(gaps, ElementsAre(0.5, 0.125));
+}
+
+TEST(ArrivalScheduleTest, RejectsUnsupportedNpy) {
+  std::vector<double> gaps;
+  EXPECT_THAT(ParseNpyInterArrivals("not a numpy file", &gaps).error_message(),
+              HasSubstr("Not a .npy file"));
+  EXPECT_THAT(ParseNpyInterArrivals(
+                  MakeNpy<int64>("<i8", "(1,)", {1}), &gaps)
+                  .error_message(),
+              HasSubstr("Unsupported .npy dtype"));
+  EXPECT_THAT(ParseNpyInterArrivals(
+                  MakeNpy<double>("<f8", "(1, 2)", {1, 2}), &gaps)
+                  .error_message(),
+              HasSubstr("shape [N] or [N, 1]"));
+  EXPECT_THAT(ParseNpyInterArrivals(
+                  MakeNpy<double>("<f8", "(3,)", {1, 2}), &gaps)
+                  .error_message(),
+              HasSubstr("Truncated"));
+}
+
+TEST(ArrivalScheduleTest, ParsesJsonl) {
+  std::vector<double> gaps;
+  TF_ASSERT_OK(ParseJsonlInterArrivals("{\"inter_arrival\": 0.5}\n"
+                                       "{\"request_id\": \"a\"}\n"
+                                       "\n"
+                                       "{\"inter_arrival\": 0.25}\n",
+                                       &gaps));
+  EXPECT_THAT(gaps, ElementsAre(0.5, 0.25));
+
+  TF_ASSERT_OK(ParseJsonlInterArrivals("{\"arrival_time\": 10.0}\n"
+                                       "{\"arrival_time\": 10.5}\n"
+                                       "{\"arrival_time\": 12.0}\n",
+                                       &gaps));
+  EXPECT_THAT(gaps, ElementsAre(0.0, 0.5, 1.5));
+
+  EXPECT_FALSE(ParseJsonlInterArrivals("{\"arrival_time\": 2.0}\n"
+                                       "{\"arrival_time\": 1.0}\n",
+                                       &gaps)
+                   .ok());
+  EXPECT_FALSE(ParseJsonlInterArrivals("{not json}\n", &gaps).ok());
+}
+
+TEST(ArrivalScheduleTest, ReadsTextTrace) {
+  const string path =
+      io::JoinPath(testing::TmpDir(), "interarrival_time_generated.txt");
+  TF_ASSERT_OK(WriteStringToFile(Env::Default(), path, "0.001\n0.5\n\n0.0\n"));
+  std::vector<double> gaps;
+  TF_ASSERT_OK(ReadInterArrivalTrace(path, &gaps));
+  EXPECT_THAT(gaps, ElementsAre(0.001, 0.5, 0.0));
+
+  TF_ASSERT_OK(WriteStringToFile(Env::Default(), path, "0.1\n-0.5\n"));
+  EXPECT_THAT(ReadInterArrivalTrace(path, &gaps).error_message(),
+              HasSubstr("non-negative"));
+}
+
+double Mean(const std::vector<double>& values) {
+  return std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+}
+
+double CoefficientOfVariation(const std::vector<double>& values) {
+  const double mean = Mean(values);
+  double sum_squares = 0;
+  for (const double value : values) {
+    sum_squares += (value - mean) * (value - mean);
+  }
+  return std::sqrt(sum_squares / values.size()) / mean;
+}
+
+TEST(ArrivalScheduleTest, PoissonArrivals) {
+  const std::vector<double> gaps = PoissonInterArrivals(200, 100000, 1);
+  ASSERT_EQ(100000, gaps.size());
+  EXPECT_NEAR(1.0 / 200, Mean(gaps), 0.02 / 200);
+  EXPECT_NEAR(1.0, CoefficientOfVariation(gaps), 0.02);
+  EXPECT_EQ(gaps, PoissonInterArrivals(200, 100000, 1));
+  EXPECT_NE(gaps, PoissonInterArrivals(200, 100000, 2));
+}
+
+TEST(ArrivalScheduleTest, BurstyArrivals) {
+  const std::vector<double> gaps = BurstyInterArrivals(200, 20, 10, 100000, 1);
+  ASSERT_EQ(100000, gaps.size());
+  // Same long-run rate as a Poisson process, but much burstier.
+  EXPECT_NEAR(1.0 / 200, Mean(gaps), 0.03 / 200);
+  EXPECT_GT(CoefficientOfVariation(gaps), 2.0);
+
+  // With a burst factor of 1 the process is Poisson.
+  EXPECT_NEAR(1.0, CoefficientOfVariation(
+                       BurstyInterArrivals(200, 1, 10, 100000, 1)),
+              0.02);
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -17,13 +17,18 @@ limitations under the License.
 #define TENSORFLOW_SERVING_UTIL_FAST_READ_DYNAMIC_PTR_H_
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/platform/cpu_info.h"
 #include "tensorflow/core/platform/macros.h"
 #include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow/core/platform/types.h"
 
 namespace tensorflow {
@@ -38,8 +43,8 @@ namespace serving {
 // exist to both the old and the new object at the same time (although there can
 // never be more than two objects concurrently). After the update begins, any
 // new calls to get() will point to the new object. The update will then block
-// until all pointers to the old object go out of scope.  This is achieved via a
-// reference counted smart pointer.
+// until all pointers to the old object go out of scope.  This is achieved via
+// reference counted smart pointers.
 //
 // This class is functionally very similar to using a shared_ptr guarded by a
 // mutex, with the important distinction that it provides finer control over
@@ -47,6 +52,13 @@ namespace serving {
 // recycle old objects if desired, and it forces an efficient pattern for
 // updating data (swapping in a pointer rather than in-place modification).
 //
+// Reads take no lock and write no memory shared between CPUs: the readers are
+// spread over shards (one per CPU by default), each holding its own reference
+// counted pointer to the current object, so concurrent get() calls from
+// different threads touch different cache lines. Update() swaps the pointer of
+// every shard and waits for the readers that may still be copying an old one,
+// in the manner of read-copy-update.
+//
 // Example Use:
 //
 //  In initialization code:
@@ -82,9 +94,14 @@ class FastReadDynamicPtr {
   // Used when an object is owned.
   using OwnedPtr = std::unique_ptr<T>;
 
-  // Initially contains a null pointer by default.
+  // Initially contains a null pointer by default. Uses one shard per
+  // schedulable CPU.
   explicit FastReadDynamicPtr(OwnedPtr = nullptr);
 
+  // Same as above, with 'num_shards' shards (at least 1). Fewer shards make
+  // Update() cheaper, at the cost of more contention between readers.
+  FastReadDynamicPtr(int num_shards, OwnedPtr);
+
   // Updates the current object with a new one, returning the old object. This
   // method will block until all ReadPtrs that point to the previous object have
   // been destroyed, guaranteeing that the result is truly unique upon return.
@@ -104,17 +121,39 @@ class FastReadDynamicPtr {
   ReadPtr get() const;
 
  private:
-  // A class that behaves like a shared_ptr, except it is capable of being
-  // released (as a unique_ptr) when it becomes unique.
+  // A class that behaves like a set of shared_ptrs, one per shard, except it is
+  // capable of being released (as a unique_ptr) when none of them is
+  // referenced anymore.
   class ReleasableSharedPtr;
 
-  // The current pointer, and a mutex to guard it. Note that the only operations
-  // performed under lock are swap, during Update(), and incrementing the
-  // reference count, during get().
-  // TODO(b/24973960): Consider implementing userspace RCU instead of this if
-  // performance is ever a concern.
-  mutable mutex mutex_;
-  std::unique_ptr<ReleasableSharedPtr> object_;
+  // The readers of one shard. Padded so that two shards never share a cache
+  // line.
+  struct Shard {
+    // The shard's pointer to the current object, owned by 'object_'.
+    std::atomic<const ReadPtr*> read_ptr{nullptr};
+
+    // The number of get() calls copying 'read_ptr', by the parity of 'epoch_'
+    // they saw.
+    std::atomic<int64> num_readers[2];
+
+    char padding[128];
+  };
+
+  // Returns the shard of the calling thread.
+  Shard* CurrentShard() const;
+
+  const int num_shards_;
+  const std::unique_ptr<Shard[]> shards_;
+
+  // Selects which of the shards' 'num_readers' new readers count on.
+  std::atomic<uint32> epoch_{0};
+
+  // Serializes Update() calls, up to the point where the old object is
+  // released.
+  mutex update_mutex_;
+
+  // The current object, shared by the shards.
+  std::unique_ptr<ReleasableSharedPtr> object_ GUARDED_BY(update_mutex_);
 
   TF_DISALLOW_COPY_AND_ASSIGN(FastReadDynamicPtr);
 };
@@ -123,37 +162,62 @@ class FastReadDynamicPtr {
 // Implementation details follow.
 //
 
+namespace internal {
+
+// Returns a small index that is distinct for each thread, up to the number of
+// threads that called it. Used to spread threads over the shards of
+// FastReadDynamicPtrs.
+inline uint32 FastReadDynamicPtrThreadIndex() {
+  static std::atomic<uint32> next_thread_index{0};
+  static thread_local const uint32 thread_index =
+      next_thread_index.fetch_add(1, std::memory_order_relaxed);
+  return thread_index;
+}
+
+}  // namespace internal
+
 template <typename T>
 class FastReadDynamicPtr<T>::ReleasableSharedPtr {
  public:
-  explicit ReleasableSharedPtr(OwnedPtr object)
+  ReleasableSharedPtr(OwnedPtr object, int num_shards)
       : object_{std::move(object)},
-        read_only_object_{
-            object_.get(),
-            // Use a destructor that will notify 'no_longer_referenced_' rather
-            // than deleting.
-            std::bind(&Notification::Notify, &no_longer_referenced_)} {}
+        num_referenced_shards_{object_ == nullptr ? 0 : num_shards} {
+    shard_references_.reserve(num_shards);
+    for (int i = 0; i < num_shards; ++i) {
+      if (object_ == nullptr) {
+        // A null shared_ptr has no deleter, so there is nothing to wait for.
+        shard_references_.emplace_back();
+      } else {
+        // Each shard gets its own reference count, allocated together with a
+        // ShardReference (which is padded past the cache line) by
+        // make_shared(). The aliasing constructor makes it point to object_.
+        shard_references_.emplace_back(std::make_shared<ShardReference>(this),
+                                       object_.get());
+      }
+    }
+  }
 
   ~ReleasableSharedPtr() {
     // Block destruction until all outstanding references have been cleaned up.
-    // This prevents the last shared_ptr from calling
-    // no_longer_referenced_.set_value() after destruction.
+    // This prevents the last shared_ptr from calling ShardReleased() after
+    // destruction.
     BlockingRelease();
   }
 
-  // Returns a reference to the underlying object, increasing the reference
-  // count by one. May be called concurrently from different threads, but not
-  // concurrently with BlockingRelease().
-  ReadPtr reference() const { return read_only_object_; }
+  // Returns the pointer to the underlying object that readers on 'shard' copy.
+  // Stays valid until BlockingRelease() is called.
+  const ReadPtr* reference(int shard) const {
+    return &shard_references_[shard];
+  }
 
-  // Blocks until outstanding values returned by 'reference' have been
-  // destroyed.  Requires that reference() is not being called concurrently.
+  // Blocks until all copies of the pointers returned by 'reference' have been
+  // destroyed. Requires that those pointers are not being copied concurrently.
   OwnedPtr BlockingRelease() {
-    // Allow the reference count to go to zero.
-    read_only_object_ = nullptr;
+    // Allow the reference counts to go to zero.
+    for (ReadPtr& shard_reference : shard_references_) {
+      shard_reference = nullptr;
+    }
 
-    // shared_ptr doesn't call the destructor if it is null, so do not block for
-    // null pointers.
     if (object_ != nullptr) {
       no_longer_referenced_.WaitForNotification();
     }
@@ -163,37 +227,87 @@ class FastReadDynamicPtr<T>::ReleasableSharedPtr {
   }
 
  private:
+  // Owned by the shared_ptrs of one shard; tells its ReleasableSharedPtr when
+  // the last of them is gone.
+  class ShardReference {
+   public:
+    explicit ShardReference(ReleasableSharedPtr* owner) : owner_(owner) {}
+    ~ShardReference() { owner_->ShardReleased(); }
+
+   private:
+    ReleasableSharedPtr* const owner_;
+    char padding_[128];
+  };
+
+  void ShardReleased() {
+    if (num_referenced_shards_.fetch_sub(1) == 1) {
+      no_longer_referenced_.Notify();
+    }
+  }
+
   // The current object.
   OwnedPtr object_;
 
-  // Notified when read_only_object_'s reference count goes to zero.
+  // Notified when the reference counts of all shards have gone to zero.
   Notification no_longer_referenced_;
 
-  // A shared pointer to object_. Does not actually delete the pointer,
-  // but satisifies 'no_longer_referenced_' upon destruction.
-  ReadPtr read_only_object_;
+  // The number of shards whose reference count has yet to go to zero.
+  std::atomic<int> num_referenced_shards_;
+
+  // Per shard, a shared pointer to object_. Does not actually delete the
+  // pointer, but counts down 'num_referenced_shards_' upon destruction.
+  std::vector<ReadPtr> shard_references_;
 
   TF_DISALLOW_COPY_AND_ASSIGN(ReleasableSharedPtr);
 };
 
 template <typename T>
 FastReadDynamicPtr<T>::FastReadDynamicPtr(OwnedPtr ptr)
-    : object_{new ReleasableSharedPtr{std::move(ptr)}} {}
+    : FastReadDynamicPtr(port::NumSchedulableCPUs(), std::move(ptr)) {}
+
+template <typename T>
+FastReadDynamicPtr<T>::FastReadDynamicPtr(int num_shards, OwnedPtr ptr)
+    : num_shards_(std::max(1, num_shards)),
+      shards_(new Shard[num_shards_]),
+      object_{new ReleasableSharedPtr{std::move(ptr), num_shards_}} {
+  for (int i = 0; i < num_shards_; ++i) {
+    shards_[i].read_ptr = object_->reference(i);
+    shards_[i].num_readers[0] = 0;
+    shards_[i].num_readers[1] = 0;
+  }
+}
 
 template <typename T>
 std::unique_ptr<T> FastReadDynamicPtr<T>::Update(std::unique_ptr<T> object) {
-  // Construct a ReleasableSharedPtr outside of the lock, this performs about
-  // three allocations (the ReleasableSharedPtr, the shared_ptr control block,
-  // and the internal state of std::promise) so we take care to keep it out of
-  // the critical section.
+  // Construct a ReleasableSharedPtr outside of the lock, this performs an
+  // allocation per shard, so we take care to keep it out of the critical
+  // section.
   std::unique_ptr<ReleasableSharedPtr> local_ptr(
-      new ReleasableSharedPtr{std::move(object)});
+      new ReleasableSharedPtr{std::move(object), num_shards_});
 
-  // Swap the new ReleasableSharedPtr under lock.
   {
-    mutex_lock lock(mutex_);
+    mutex_lock lock(update_mutex_);
+    for (int i = 0; i < num_shards_; ++i) {
+      shards_[i].read_ptr.store(local_ptr->reference(i));
+    }
     using std::swap;
     swap(object_, local_ptr);
+
+    // A reader that still copies an old shard pointer incremented one of its
+    // shard's counts before the stores above (readers that increment later
+    // load the new pointers), so once both counts of every shard have dropped
+    // to zero nobody can be copying an old pointer anymore. Flipping the epoch
+    // before waiting for each parity sends new readers to the other count,
+    // which keeps a steady stream of reads from holding up the wait. The wait
+    // is as short as copying a shared_ptr.
+    for (int flip = 0; flip < 2; ++flip) {
+      const uint32 old_parity = epoch_.fetch_add(1) & 1;
+      for (int i = 0; i < num_shards_; ++i) {
+        while (shards_[i].num_readers[old_parity].load() != 0) {
+          std::this_thread::yield();
+        }
+      }
+    }
   }
 
   // Now local_ptr points to the old object, release it to the caller.  This may
@@ -202,10 +316,20 @@ std::unique_ptr<T> FastReadDynamicPtr<T>::Update(std::unique_ptr<T> object) {
   return local_ptr->BlockingRelease();
 }
 
+template <typename T>
+typename FastReadDynamicPtr<T>::Shard* FastReadDynamicPtr<T>::CurrentShard()
+    const {
+  return &shards_[internal::FastReadDynamicPtrThreadIndex() % num_shards_];
+}
+
 template <typename T>
 typename FastReadDynamicPtr<T>::ReadPtr FastReadDynamicPtr<T>::get() const {
-  mutex_lock lock(mutex_);
-  return object_->reference();
+  Shard* const shard = CurrentShard();
+  const uint32 parity = epoch_.load() & 1;
+  shard->num_readers[parity].fetch_add(1);
+  ReadPtr result = *shard->read_ptr.load();
+  shard->num_readers[parity].fetch_sub(1, std::memory_order_release);
+  return result;
 }
 
 }  // namespace serving
@@ -223,7 +223,9 @@ BENCHMARK(BM_Work_NoUpdates_Reads)
     ->Arg(8)
     ->Arg(16)
     ->Arg(32)
-    ->Arg(64);
+    ->Arg(64)
+    ->Arg(128)
+    ->Arg(256);
 
 BENCHMARK(BM_Work_FrequentUpdates_Reads)
     ->Arg(1)
@@ -232,7 +234,9 @@ BENCHMARK(BM_Work_FrequentUpdates_Reads)
     ->Arg(8)
     ->Arg(16)
     ->Arg(32)
-    ->Arg(64);
+    ->Arg(64)
+    ->Arg(128)
+    ->Arg(256);
 
 BENCHMARK(BM_NoWork_NoUpdates_Reads)
     ->Arg(1)
@@ -241,7 +245,9 @@ BENCHMARK(BM_NoWork_NoUpdates_Reads)
     ->Arg(8)
     ->Arg(16)
     ->Arg(32)
-    ->Arg(64);
+    ->Arg(64)
+    ->Arg(128)
+    ->Arg(256);
 
 BENCHMARK(BM_NoWork_FrequentUpdates_Reads)
     ->Arg(1)
@@ -250,7 +256,9 @@ BENCHMARK(BM_NoWork_FrequentUpdates_Reads)
     ->Arg(8)
     ->Arg(16)
     ->Arg(32)
-    ->Arg(64);
+    ->Arg(64)
+    ->Arg(128)
+    ->Arg(256);
 
 }  // namespace serving
 }  // namespace tensorflow
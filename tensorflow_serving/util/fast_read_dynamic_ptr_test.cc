@@ -18,6 +18,7 @@ limitations under the License.
 #include <vector>
 
 #include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/notification.h"
 #include "tensorflow/core/platform/env.h"
 
 namespace tensorflow {
@@ -84,6 +85,47 @@ TEST(FastReadDynamicPtrTest, MultiThreaded) {
   }
 }
 
+TEST(FastReadDynamicPtrTest, UpdateWaitsForReadersOfAllShards) {
+  const int kNumShards = 3;
+  const int kNumReaders = 8;
+
+  FastReadIntPtr fast_read_int(kNumShards, std::unique_ptr<int>(new int(1)));
+
+  // Readers on different threads, and hence on different shards, each hold a
+  // pointer to the first object.
+  std::vector<std::shared_ptr<const int>> pointers(kNumReaders);
+  {
+    std::vector<std::unique_ptr<Thread>> readers;
+    for (int i = 0; i < kNumReaders; ++i) {
+      readers.emplace_back(Env::Default()->StartThread(
+          {}, "Read", [i, &pointers, &fast_read_int]() {
+            pointers[i] = fast_read_int.get();
+          }));
+    }
+  }
+
+  Notification updated;
+  std::unique_ptr<Thread> updater(
+      Env::Default()->StartThread({}, "Update", [&updated, &fast_read_int]() {
+        std::unique_ptr<int> old_value =
+            fast_read_int.Update(std::unique_ptr<int>(new int(2)));
+        EXPECT_EQ(1, *old_value);
+        updated.Notify();
+      }));
+
+  // New readers see the second object right away, while the update waits for
+  // the first one to be released.
+  while (*fast_read_int.get() != 2) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  for (int i = 0; i < kNumReaders; ++i) {
+    EXPECT_FALSE(updated.HasBeenNotified());
+    EXPECT_EQ(1, *pointers[i]);
+    pointers[i].reset();
+  }
+  updated.WaitForNotification();
+}
+
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow